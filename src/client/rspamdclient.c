@@ -160,7 +160,7 @@ rspamd_client_init (struct event_base *ev_base, const gchar *name,
 	conn->ev_base = ev_base;
 	conn->fd = fd;
 	conn->req_sent = FALSE;
-	conn->keys_cache = rspamd_keypair_cache_new (32);
+	conn->keys_cache = rspamd_http_session_cache ();
 	conn->http_conn = rspamd_http_connection_new (rspamd_client_body_handler,
 			rspamd_client_error_handler,
 			rspamd_client_finish_handler,
@@ -180,8 +180,7 @@ rspamd_client_init (struct event_base *ev_base, const gchar *name,
 				RSPAMD_CRYPTOBOX_MODE_25519);
 
 		if (conn->key) {
-			conn->keypair = rspamd_keypair_new (RSPAMD_KEYPAIR_KEX,
-					RSPAMD_CRYPTOBOX_MODE_25519);
+			conn->keypair = rspamd_http_session_keypair ();
 			rspamd_http_connection_set_key (conn->http_conn, conn->keypair);
 		}
 		else {
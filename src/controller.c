@@ -578,7 +578,7 @@ rspamd_controller_handle_auth (struct rspamd_http_connection_entry *conn_ent,
 	struct rspamd_http_message *msg)
 {
 	struct rspamd_controller_session *session = conn_ent->ud;
-	struct rspamd_stat *st;
+	struct rspamd_stat *st, stat_copy;
 	int64_t uptime;
 	gulong data[4];
 	ucl_object_t *obj;
@@ -588,7 +588,8 @@ rspamd_controller_handle_auth (struct rspamd_http_connection_entry *conn_ent,
 	}
 
 	obj = ucl_object_typed_new (UCL_OBJECT);
-	st = session->ctx->srv->stat;
+	rspamd_worker_stat_collect (session->ctx->srv, &stat_copy);
+	st = &stat_copy;
 	data[0] = st->actions_stat[METRIC_ACTION_NOACTION];
 	data[1] = st->actions_stat[METRIC_ACTION_ADD_HEADER] +
 		st->actions_stat[METRIC_ACTION_REWRITE_SUBJECT];
@@ -945,6 +946,7 @@ rspamd_controller_handle_pie_chart (
 {
 	struct rspamd_controller_session *session = conn_ent->ud;
 	struct rspamd_controller_worker_ctx *ctx;
+	struct rspamd_stat stat;
 	gdouble data[5], total;
 	ucl_object_t *top;
 
@@ -955,15 +957,16 @@ rspamd_controller_handle_pie_chart (
 	}
 
 	top = ucl_object_typed_new (UCL_ARRAY);
-	total = ctx->srv->stat->messages_scanned;
+	rspamd_worker_stat_collect (ctx->srv, &stat);
+	total = stat.messages_scanned;
 	if (total != 0) {
 
-		data[0] = ctx->srv->stat->actions_stat[METRIC_ACTION_NOACTION];
-		data[1] = ctx->srv->stat->actions_stat[METRIC_ACTION_SOFT_REJECT];
-		data[2] = (ctx->srv->stat->actions_stat[METRIC_ACTION_ADD_HEADER] +
-			ctx->srv->stat->actions_stat[METRIC_ACTION_REWRITE_SUBJECT]);
-		data[3] = ctx->srv->stat->actions_stat[METRIC_ACTION_GREYLIST];
-		data[4] = ctx->srv->stat->actions_stat[METRIC_ACTION_REJECT];
+		data[0] = stat.actions_stat[METRIC_ACTION_NOACTION];
+		data[1] = stat.actions_stat[METRIC_ACTION_SOFT_REJECT];
+		data[2] = (stat.actions_stat[METRIC_ACTION_ADD_HEADER] +
+			stat.actions_stat[METRIC_ACTION_REWRITE_SUBJECT]);
+		data[3] = stat.actions_stat[METRIC_ACTION_GREYLIST];
+		data[4] = stat.actions_stat[METRIC_ACTION_REJECT];
 	}
 	else {
 		memset (data, 0, sizeof (data));
@@ -1133,7 +1136,7 @@ rspamd_controller_handle_history (struct rspamd_http_connection_entry *conn_ent,
 {
 	struct rspamd_controller_session *session = conn_ent->ud;
 	struct rspamd_controller_worker_ctx *ctx;
-	struct roll_history_row *row, *copied_rows;
+	struct roll_history_row row_copy, *row = &row_copy;
 	guint i, rows_proc, row_num;
 	struct tm *tm;
 	gchar timebuf[32];
@@ -1147,21 +1150,16 @@ rspamd_controller_handle_history (struct rspamd_http_connection_entry *conn_ent,
 
 	top = ucl_object_typed_new (UCL_ARRAY);
 
-	/* Set lock on history */
-	copied_rows = g_slice_alloc (sizeof (*copied_rows) * ctx->srv->history->nrows);
-	memcpy (copied_rows, ctx->srv->history->rows,
-			sizeof (*copied_rows) * ctx->srv->history->nrows);
-
-	/* Go through all rows */
-	row_num = ctx->srv->history->cur_row;
+	/* Go through all rows starting from the oldest one */
+	row_num = g_atomic_int_get (&ctx->srv->history->cur_row) %
+			ctx->srv->history->nrows;
 
 	for (i = 0, rows_proc = 0; i < ctx->srv->history->nrows; i++, row_num++) {
 		if (row_num == ctx->srv->history->nrows) {
 			row_num = 0;
 		}
-		row = &copied_rows[row_num];
 		/* Get only completed rows */
-		if (row->completed) {
+		if (rspamd_roll_history_get_row (ctx->srv->history, row_num, row)) {
 			tm = localtime (&row->tv.tv_sec);
 			strftime (timebuf, sizeof (timebuf) - 1, "%Y-%m-%d %H:%M:%S", tm);
 			obj = ucl_object_typed_new (UCL_OBJECT);
@@ -1212,8 +1210,6 @@ rspamd_controller_handle_history_reset (struct rspamd_http_connection_entry *con
 {
 	struct rspamd_controller_session *session = conn_ent->ud;
 	struct rspamd_controller_worker_ctx *ctx;
-	struct roll_history_row *row;
-	guint start_row, i, t;
 
 	ctx = session->ctx;
 
@@ -1221,26 +1217,7 @@ rspamd_controller_handle_history_reset (struct rspamd_http_connection_entry *con
 		return 0;
 	}
 
-	/* Clean from start to the current row */
-	start_row = g_atomic_int_get (&ctx->srv->history->cur_row);
-
-	for (i = 0; i < start_row; i ++) {
-		t = g_atomic_int_get (&ctx->srv->history->cur_row);
-
-		/* We somehow come to the race condition */
-		if (i >= t) {
-			break;
-		}
-
-		row = &ctx->srv->history->rows[i];
-		memset (row, 0, sizeof (*row));
-	}
-
-	start_row = g_atomic_int_get (&ctx->srv->history->cur_row);
-	/* Optimistically set all bytes to zero (might cause race) */
-	memset (ctx->srv->history->rows,
-			0,
-			sizeof (*row) * (ctx->srv->history->nrows - start_row));
+	rspamd_roll_history_reset (ctx->srv->history);
 
 	msg_info_session ("<%s> reseted history",
 			rspamd_inet_address_to_string (session->from_addr));
@@ -1917,7 +1894,7 @@ rspamd_controller_handle_stat_common (
 	struct rspamd_stat_cbdata *cbdata;
 
 	rspamd_mempool_stat (&mem_st);
-	memcpy (&stat_copy, session->ctx->worker->srv->stat, sizeof (stat_copy));
+	rspamd_worker_stat_collect (session->ctx->worker->srv, &stat_copy);
 	stat = &stat_copy;
 	task = rspamd_task_new (session->ctx->worker, session->cfg);
 
@@ -1956,14 +1933,6 @@ rspamd_controller_handle_stat_common (
 			else {
 				ham += stat->actions_stat[i];
 			}
-			if (do_reset) {
-#ifndef HAVE_ATOMIC_BUILTINS
-				session->ctx->worker->srv->stat->actions_stat[i] = 0;
-#else
-				__atomic_store_n(&session->ctx->worker->srv->stat->actions_stat[i],
-						0, __ATOMIC_RELEASE);
-#endif
-			}
 		}
 		ucl_object_insert_key (top, sub, "actions", 0, false);
 	}
@@ -1997,12 +1966,10 @@ rspamd_controller_handle_stat_common (
 	ucl_object_insert_key (top,
 		ucl_object_fromint (
 			mem_st.oversized_chunks), "chunks_oversized", 0, false);
+	ucl_object_insert_key (top, rspamd_mempool_stat_ucl (), "mempool", 0, false);
 
 	if (do_reset) {
-		session->ctx->srv->stat->messages_scanned = 0;
-		session->ctx->srv->stat->messages_learned = 0;
-		session->ctx->srv->stat->connections_count = 0;
-		session->ctx->srv->stat->control_connections_count = 0;
+		rspamd_worker_stat_reset (session->ctx->srv);
 		rspamd_mempool_stat_reset ();
 	}
 
@@ -2125,7 +2092,8 @@ rspamd_controller_finish_handler (struct rspamd_http_connection_entry *conn_ent)
 {
 	struct rspamd_controller_session *session = conn_ent->ud;
 
-	session->ctx->worker->srv->stat->control_connections_count++;
+	rspamd_atomic_add (
+			&session->ctx->worker->srv->stat->control_connections_count, 1);
 	msg_debug_session ("destroy session %p", session);
 
 	if (session->task != NULL) {
@@ -2181,7 +2149,7 @@ static void
 rspamd_controller_rrd_update (gint fd, short what, void *arg)
 {
 	struct rspamd_controller_worker_ctx *ctx = arg;
-	struct rspamd_stat *stat;
+	struct rspamd_stat *stat, stat_copy;
 	GArray ar;
 	gdouble points[4];
 	GError *err = NULL;
@@ -2189,7 +2157,8 @@ rspamd_controller_rrd_update (gint fd, short what, void *arg)
 	gdouble val;
 
 	g_assert (ctx->rrd != NULL);
-	stat = ctx->srv->stat;
+	rspamd_worker_stat_collect (ctx->srv, &stat_copy);
+	stat = &stat_copy;
 
 	for (i = METRIC_ACTION_REJECT, j = 0;
 		 i <= METRIC_ACTION_NOACTION && j < G_N_ELEMENTS (points);
@@ -2254,8 +2223,7 @@ rspamd_controller_load_saved_stats (struct rspamd_controller_worker_ctx *ctx)
 	obj = ucl_parser_get_object (parser);
 	ucl_parser_free (parser);
 
-	stat = ctx->srv->stat;
-	memcpy (&stat_copy, stat, sizeof (stat_copy));
+	rspamd_worker_stat_collect (ctx->srv, &stat_copy);
 
 	elt = ucl_object_lookup (obj, "scanned");
 
@@ -2294,13 +2262,16 @@ rspamd_controller_load_saved_stats (struct rspamd_controller_worker_ctx *ctx)
 	}
 
 	ucl_object_unref (obj);
+	/* Saved totals replace counters of all processes */
+	rspamd_worker_stat_reset (ctx->srv);
+	stat = ctx->srv->stat;
 	memcpy (stat, &stat_copy, sizeof (stat_copy));
 }
 
 static void
 rspamd_controller_store_saved_stats (struct rspamd_controller_worker_ctx *ctx)
 {
-	struct rspamd_stat *stat;
+	struct rspamd_stat *stat, stat_copy;
 	ucl_object_t *top, *sub;
 	gint i, fd;
 
@@ -2322,7 +2293,8 @@ rspamd_controller_store_saved_stats (struct rspamd_controller_worker_ctx *ctx)
 		return;
 	}
 
-	stat = ctx->srv->stat;
+	rspamd_worker_stat_collect (ctx->srv, &stat_copy);
+	stat = &stat_copy;
 
 	top = ucl_object_typed_new (UCL_OBJECT);
 	ucl_object_insert_key (top, ucl_object_fromint (
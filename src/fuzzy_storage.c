@@ -40,6 +40,8 @@
 /* Resync value in seconds */
 #define DEFAULT_SYNC_TIMEOUT 60.0
 #define DEFAULT_KEYPAIR_CACHE_SIZE 512
+/* Maximum number of datagrams read and decrypted at once */
+#define FUZZY_BATCH_SIZE 32
 
 
 #define INVALID_NODE_TIME (guint64) - 1
@@ -551,8 +553,13 @@ rspamd_fuzzy_command_valid (struct rspamd_fuzzy_cmd *cmd, gint r)
 	return ret;
 }
 
+/*
+ * Checks encrypted header and derives the shared key for a session, actual
+ * decryption is performed in batch by rspamd_fuzzy_process_batch
+ */
 static gboolean
-rspamd_fuzzy_decrypt_command (struct fuzzy_session *s)
+rspamd_fuzzy_prepare_decrypt (struct fuzzy_session *s,
+		struct rspamd_cryptobox_batch_elt *elt)
 {
 	struct rspamd_fuzzy_encrypted_req_hdr *hdr;
 	guchar *payload;
@@ -602,25 +609,22 @@ rspamd_fuzzy_decrypt_command (struct fuzzy_session *s)
 	}
 
 	rspamd_keypair_cache_process (s->ctx->keypair_cache, key->key, rk);
-
-	/* Now decrypt request */
-	if (!rspamd_cryptobox_decrypt_nm_inplace (payload, payload_len, hdr->nonce,
-			rspamd_pubkey_get_nm (rk),
-			hdr->mac, RSPAMD_CRYPTOBOX_MODE_25519)) {
-		msg_err ("decryption failed");
-		rspamd_pubkey_unref (rk);
-
-		return FALSE;
-	}
-
 	memcpy (s->nm, rspamd_pubkey_get_nm (rk), sizeof (s->nm));
 	rspamd_pubkey_unref (rk);
 
+	elt->data = payload;
+	elt->len = payload_len;
+	elt->nonce = hdr->nonce;
+	elt->nm = s->nm;
+	elt->mac = hdr->mac;
+	elt->ok = FALSE;
+
 	return TRUE;
 }
 
 static gboolean
-rspamd_fuzzy_cmd_from_wire (guchar *buf, guint buflen, struct fuzzy_session *s)
+rspamd_fuzzy_cmd_from_wire (guchar *buf, guint buflen, struct fuzzy_session *s,
+		struct rspamd_cryptobox_batch_elt *elt)
 {
 	enum rspamd_fuzzy_epoch epoch;
 
@@ -652,35 +656,17 @@ rspamd_fuzzy_cmd_from_wire (guchar *buf, guint buflen, struct fuzzy_session *s)
 		s->cmd_type = CMD_ENCRYPTED_NORMAL;
 		memcpy (&s->cmd.enc_normal, buf, sizeof (s->cmd.enc_normal));
 
-		if (!rspamd_fuzzy_decrypt_command (s)) {
+		if (!rspamd_fuzzy_prepare_decrypt (s, elt)) {
 			return FALSE;
 		}
-		epoch = rspamd_fuzzy_command_valid (&s->cmd.enc_normal.cmd,
-				sizeof (s->cmd.enc_normal.cmd));
-
-		if (epoch == RSPAMD_FUZZY_EPOCH_MAX) {
-			msg_debug ("invalid fuzzy command of size %d received", buflen);
-			return FALSE;
-		}
-		/* Encrypted is epoch 10 at least */
-		s->epoch = RSPAMD_FUZZY_EPOCH10;
 		break;
 	case sizeof (struct rspamd_fuzzy_encrypted_shingle_cmd):
 		s->cmd_type = CMD_ENCRYPTED_SHINGLE;
 		memcpy (&s->cmd.enc_shingle, buf, sizeof (s->cmd.enc_shingle));
 
-		if (!rspamd_fuzzy_decrypt_command (s)) {
+		if (!rspamd_fuzzy_prepare_decrypt (s, elt)) {
 			return FALSE;
 		}
-		epoch = rspamd_fuzzy_command_valid (&s->cmd.enc_shingle.cmd.basic,
-				sizeof (s->cmd.enc_shingle.cmd));
-
-		if (epoch == RSPAMD_FUZZY_EPOCH_MAX) {
-			msg_debug ("invalid fuzzy command of size %d received", buflen);
-			return FALSE;
-		}
-
-		s->epoch = RSPAMD_FUZZY_EPOCH10;
 		break;
 	default:
 		msg_debug ("invalid fuzzy command of size %d received", buflen);
@@ -690,6 +676,34 @@ rspamd_fuzzy_cmd_from_wire (guchar *buf, guint buflen, struct fuzzy_session *s)
 	return TRUE;
 }
 
+/*
+ * Validates decrypted command
+ */
+static gboolean
+rspamd_fuzzy_cmd_decrypted_valid (struct fuzzy_session *s)
+{
+	enum rspamd_fuzzy_epoch epoch;
+
+	if (s->cmd_type == CMD_ENCRYPTED_NORMAL) {
+		epoch = rspamd_fuzzy_command_valid (&s->cmd.enc_normal.cmd,
+				sizeof (s->cmd.enc_normal.cmd));
+	}
+	else {
+		epoch = rspamd_fuzzy_command_valid (&s->cmd.enc_shingle.cmd.basic,
+				sizeof (s->cmd.enc_shingle.cmd));
+	}
+
+	if (epoch == RSPAMD_FUZZY_EPOCH_MAX) {
+		msg_debug ("invalid encrypted fuzzy command received");
+		return FALSE;
+	}
+
+	/* Encrypted is epoch 10 at least */
+	s->epoch = RSPAMD_FUZZY_EPOCH10;
+
+	return TRUE;
+}
+
 static void
 fuzzy_session_destroy (gpointer d)
 {
@@ -701,6 +715,79 @@ fuzzy_session_destroy (gpointer d)
 	g_slice_free1 (sizeof (*session), session);
 }
 
+static void
+rspamd_fuzzy_session_invalid (struct fuzzy_session *session)
+{
+	guint64 *nerrors;
+
+	/* Discard input */
+	session->ctx->stat.invalid_requests ++;
+	nerrors = rspamd_lru_hash_lookup (session->ctx->errors_ips,
+			session->addr, -1);
+
+	if (nerrors == NULL) {
+		nerrors = g_malloc (sizeof (*nerrors));
+		*nerrors = 1;
+		rspamd_lru_hash_insert (session->ctx->errors_ips,
+				rspamd_inet_address_copy (session->addr),
+				nerrors, -1, -1);
+	}
+	else {
+		*nerrors = *nerrors + 1;
+	}
+}
+
+/*
+ * Decrypts all encrypted sessions of a batch at once and processes commands
+ */
+static void
+rspamd_fuzzy_process_batch (struct fuzzy_session **sessions,
+		struct rspamd_cryptobox_batch_elt *elts, guint nsessions)
+{
+	struct rspamd_cryptobox_batch_elt enc_elts[FUZZY_BATCH_SIZE];
+	struct fuzzy_session *session;
+	guint i, nenc = 0;
+
+	for (i = 0; i < nsessions; i ++) {
+		session = sessions[i];
+
+		if (session->cmd_type == CMD_ENCRYPTED_NORMAL ||
+				session->cmd_type == CMD_ENCRYPTED_SHINGLE) {
+			memcpy (&enc_elts[nenc++], &elts[i], sizeof (enc_elts[0]));
+		}
+	}
+
+	if (nenc > 0) {
+		rspamd_cryptobox_decrypt_nm_batch (enc_elts, nenc,
+				RSPAMD_CRYPTOBOX_MODE_25519);
+	}
+
+	nenc = 0;
+
+	for (i = 0; i < nsessions; i ++) {
+		session = sessions[i];
+
+		if (session->cmd_type == CMD_ENCRYPTED_NORMAL ||
+				session->cmd_type == CMD_ENCRYPTED_SHINGLE) {
+			if (!enc_elts[nenc++].ok) {
+				msg_err ("decryption failed");
+				rspamd_fuzzy_session_invalid (session);
+				REF_RELEASE (session);
+				continue;
+			}
+
+			if (!rspamd_fuzzy_cmd_decrypted_valid (session)) {
+				rspamd_fuzzy_session_invalid (session);
+				REF_RELEASE (session);
+				continue;
+			}
+		}
+
+		rspamd_fuzzy_process_command (session);
+		REF_RELEASE (session);
+	}
+}
+
 /*
  * Accept new connection and construct task
  */
@@ -708,16 +795,22 @@ static void
 accept_fuzzy_socket (gint fd, short what, void *arg)
 {
 	struct rspamd_worker *worker = (struct rspamd_worker *)arg;
-	struct fuzzy_session *session;
+	struct fuzzy_session *session, *sessions[FUZZY_BATCH_SIZE];
+	struct rspamd_cryptobox_batch_elt elts[FUZZY_BATCH_SIZE];
 	rspamd_inet_addr_t *addr;
 	gssize r;
 	guint8 buf[512];
-	guint64 *nerrors;
+	guint nsessions = 0;
 
 	/* Got some data */
 	if (what == EV_READ) {
 
 		for (;;) {
+			if (nsessions == FUZZY_BATCH_SIZE) {
+				rspamd_fuzzy_process_batch (sessions, elts, nsessions);
+				nsessions = 0;
+			}
+
 			worker->nconns++;
 
 			r = rspamd_inet_address_recvfrom (fd,
@@ -727,18 +820,18 @@ accept_fuzzy_socket (gint fd, short what, void *arg)
 					&addr);
 
 			if (r == -1) {
+				worker->nconns--;
+
 				if (errno == EINTR) {
 					continue;
 				}
-				else if (errno == EAGAIN || errno == EWOULDBLOCK) {
-
-					return;
+				else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+					msg_err ("got error while reading from socket: %d, %s",
+							errno,
+							strerror (errno));
 				}
 
-				msg_err ("got error while reading from socket: %d, %s",
-						errno,
-						strerror (errno));
-				return;
+				break;
 			}
 
 			session = g_slice_alloc0 (sizeof (*session));
@@ -749,31 +842,19 @@ accept_fuzzy_socket (gint fd, short what, void *arg)
 			session->time = (guint64) time (NULL);
 			session->addr = addr;
 
-			if (rspamd_fuzzy_cmd_from_wire (buf, r, session)) {
-				/* Check shingles count sanity */
-				rspamd_fuzzy_process_command (session);
+			if (rspamd_fuzzy_cmd_from_wire (buf, r, session,
+					&elts[nsessions])) {
+				sessions[nsessions++] = session;
 			}
 			else {
-				/* Discard input */
-				session->ctx->stat.invalid_requests ++;
 				msg_debug ("invalid fuzzy command of size %z received", r);
-
-				nerrors = rspamd_lru_hash_lookup (session->ctx->errors_ips,
-						addr, -1);
-
-				if (nerrors == NULL) {
-					nerrors = g_malloc (sizeof (*nerrors));
-					*nerrors = 1;
-					rspamd_lru_hash_insert (session->ctx->errors_ips,
-							rspamd_inet_address_copy (addr),
-							nerrors, -1, -1);
-				}
-				else {
-					*nerrors = *nerrors + 1;
-				}
+				rspamd_fuzzy_session_invalid (session);
+				REF_RELEASE (session);
 			}
+		}
 
-			REF_RELEASE (session);
+		if (nsessions > 0) {
+			rspamd_fuzzy_process_batch (sessions, elts, nsessions);
 		}
 	}
 }
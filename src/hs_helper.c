@@ -51,6 +51,7 @@ struct hs_helper_ctx {
 	gboolean loaded;
 	gdouble max_time;
 	gdouble recompile_time;
+	guint max_procs;
 	struct rspamd_config *cfg;
 	struct event recompile_timer;
 	struct event_base *ev_base;
@@ -69,6 +70,11 @@ init_hs_helper (struct rspamd_config *cfg)
 	ctx->hs_dir = RSPAMD_DBDIR "/";
 	ctx->max_time = default_max_time;
 	ctx->recompile_time = default_recompile_time;
+#ifdef HAVE_SC_NPROCESSORS_ONLN
+	ctx->max_procs = sysconf (_SC_NPROCESSORS_ONLN);
+#else
+	ctx->max_procs = 1;
+#endif
 
 	rspamd_rcl_register_worker_option (cfg,
 			type,
@@ -102,15 +108,23 @@ init_hs_helper (struct rspamd_config *cfg)
 			G_STRUCT_OFFSET (struct hs_helper_ctx, max_time),
 			RSPAMD_CL_FLAG_TIME_FLOAT,
 			"Maximum time to wait for compilation of a single expression");
+	rspamd_rcl_register_worker_option (cfg,
+			type,
+			"max_procs",
+			rspamd_rcl_parse_struct_integer,
+			ctx,
+			G_STRUCT_OFFSET (struct hs_helper_ctx, max_procs),
+			RSPAMD_CL_FLAG_UINT,
+			"Maximum number of processes used to compile hyperscan classes");
 
 	return ctx;
 }
 
 /**
- * Clean
+ * Remove hyperscan files that are invalid or do not match the current cache
  */
 static gboolean
-rspamd_hs_helper_cleanup_dir (struct hs_helper_ctx *ctx, gboolean forced)
+rspamd_hs_helper_cleanup_dir (struct hs_helper_ctx *ctx)
 {
 	struct stat st;
 	glob_t globbuf;
@@ -133,9 +147,8 @@ rspamd_hs_helper_cleanup_dir (struct hs_helper_ctx *ctx, gboolean forced)
 
 	if ((rc = glob (pattern, GLOB_DOOFFS, NULL, &globbuf)) == 0) {
 		for (i = 0; i < globbuf.gl_pathc; i++) {
-			if (forced ||
-					!rspamd_re_cache_is_valid_hyperscan_file (ctx->cfg->re_cache,
-						globbuf.gl_pathv[i], TRUE, TRUE)) {
+			if (!rspamd_re_cache_is_valid_hyperscan_file (ctx->cfg->re_cache,
+					globbuf.gl_pathv[i], TRUE, TRUE)) {
 				if (unlink (globbuf.gl_pathv[i]) == -1) {
 					msg_err ("cannot unlink %s: %s", globbuf.gl_pathv[i],
 							strerror (errno));
@@ -163,12 +176,17 @@ rspamd_rs_compile (struct hs_helper_ctx *ctx, struct rspamd_worker *worker,
 	static struct rspamd_srv_command srv_cmd;
 	gint ncompiled;
 
-	if (!rspamd_hs_helper_cleanup_dir (ctx, forced)) {
+	/*
+	 * Files are named by the hash of regexps in a class, so we keep all
+	 * valid files even for forced recompilation and rebuild merely the
+	 * classes that have been changed
+	 */
+	if (!rspamd_hs_helper_cleanup_dir (ctx)) {
 		msg_warn ("cannot cleanup cache dir '%s'", ctx->hs_dir);
 	}
 
 	if ((ncompiled = rspamd_re_cache_compile_hyperscan (ctx->cfg->re_cache,
-			ctx->hs_dir, ctx->max_time, !forced,
+			ctx->hs_dir, ctx->max_time, !forced, ctx->max_procs,
 			&err)) == -1) {
 		msg_err ("failed to compile re cache: %e", err);
 		g_error_free (err);
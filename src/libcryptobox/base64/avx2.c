@@ -0,0 +1,101 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+#include <immintrin.h>
+
+size_t base64_decode_ssse3 (const unsigned char *in, size_t inlen,
+		unsigned char *out, size_t *outlen);
+
+/*
+ * The same algorithm as in ssse3 version working on two lanes, the rest is
+ * decoded by ssse3 code
+ */
+size_t __attribute__((__target__("avx2")))
+base64_decode_avx2 (const unsigned char *in, size_t inlen,
+		unsigned char *out, size_t *outlen)
+{
+	const unsigned char *p = in;
+	unsigned char *o = out;
+	size_t olen = *outlen, tail;
+	__m256i str, hi, lo, mask, bit, shift;
+	const __m256i shift_lut = _mm256_setr_epi8 (
+			0, 0, 19, 4, -65, -65, -71, -71,
+			0, 0, 0, 0, 0, 0, 0, 0,
+			0, 0, 19, 4, -65, -65, -71, -71,
+			0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i mask_lut = _mm256_setr_epi8 (
+			(char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8,
+			(char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+			(char)0xf8, (char)0xf8, (char)0xf0, 0x54,
+			0x50, 0x50, 0x50, 0x54,
+			(char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8,
+			(char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+			(char)0xf8, (char)0xf8, (char)0xf0, 0x54,
+			0x50, 0x50, 0x50, 0x54);
+	const __m256i bitpos_lut = _mm256_setr_epi8 (
+			0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+			0, 0, 0, 0, 0, 0, 0, 0,
+			0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+			0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i nibble = _mm256_set1_epi8 (0x0f);
+	const __m256i slash = _mm256_set1_epi8 ('/');
+	const __m256i slash_shift = _mm256_set1_epi8 (16 - 19);
+	const __m256i pack_ab = _mm256_set1_epi32 (0x01400140);
+	const __m256i pack_abcd = _mm256_set1_epi32 (0x00011000);
+	const __m256i pack_shuf = _mm256_setr_epi8 (
+			2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+			2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i pack_lanes = _mm256_setr_epi32 (0, 1, 2, 4, 5, 6, 7, 7);
+
+	/* We store 32 bytes per 24 decoded ones */
+	while (inlen >= 32 && olen >= 32) {
+		str = _mm256_loadu_si256 ((const __m256i *)p);
+		hi = _mm256_and_si256 (_mm256_srli_epi32 (str, 4), nibble);
+		lo = _mm256_and_si256 (str, nibble);
+		mask = _mm256_shuffle_epi8 (mask_lut, lo);
+		bit = _mm256_shuffle_epi8 (bitpos_lut, hi);
+
+		if (_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (
+				_mm256_and_si256 (mask, bit),
+				_mm256_setzero_si256 ())) != 0) {
+			break;
+		}
+
+		shift = _mm256_add_epi8 (_mm256_shuffle_epi8 (shift_lut, hi),
+				_mm256_and_si256 (_mm256_cmpeq_epi8 (str, slash), slash_shift));
+		str = _mm256_add_epi8 (str, shift);
+
+		str = _mm256_maddubs_epi16 (str, pack_ab);
+		str = _mm256_madd_epi16 (str, pack_abcd);
+		str = _mm256_shuffle_epi8 (str, pack_shuf);
+		/* Move 12 bytes of the higher lane next to the lower ones */
+		str = _mm256_permutevar8x32_epi32 (str, pack_lanes);
+		_mm256_storeu_si256 ((__m256i *)o, str);
+
+		p += 32;
+		inlen -= 32;
+		o += 24;
+		olen -= 24;
+	}
+
+	tail = olen;
+	p += base64_decode_ssse3 (p, inlen, o, &tail);
+	o += tail;
+	*outlen = o - out;
+
+	return p - in;
+}
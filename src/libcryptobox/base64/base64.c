@@ -0,0 +1,192 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "cryptobox.h"
+#include "base64.h"
+#include "platform_config.h"
+#include <stdbool.h>
+
+extern unsigned long cpu_config;
+extern const unsigned char base64_table_dec[256];
+
+typedef struct base64_impl_t {
+	unsigned long cpu_flags;
+	const char *desc;
+
+	/*
+	 * Decode as many characters as possible from the start of `in` stopping
+	 * on the first character outside of base64 alphabet, returns number of
+	 * characters consumed and sets `outlen` to the number of bytes decoded
+	 */
+	size_t (*decode) (const unsigned char *in, size_t inlen,
+			unsigned char *out, size_t *outlen);
+} base64_impl_t;
+
+#define BASE64_DECLARE(ext) \
+	size_t base64_decode_##ext(const unsigned char *in, size_t inlen, unsigned char *out, size_t *outlen);
+
+#define BASE64_IMPL(cpuflags, desc, ext) \
+	{(cpuflags), desc, base64_decode_##ext}
+
+BASE64_DECLARE(ref)
+#define BASE64_GENERIC BASE64_IMPL(0, "generic", ref)
+#if defined(HAVE_SSSE3) && defined(__x86_64__)
+BASE64_DECLARE(ssse3)
+#define BASE64_SSSE3 BASE64_IMPL(CPUID_SSSE3, "ssse3", ssse3)
+#endif
+#if defined(HAVE_AVX2) && defined(HAVE_SSSE3) && defined(__x86_64__)
+BASE64_DECLARE(avx2)
+#define BASE64_AVX2 BASE64_IMPL(CPUID_AVX2, "avx2", avx2)
+#endif
+
+/* list implemenations from most optimized to least, with generic as the last entry */
+static const base64_impl_t base64_list[] = {
+		BASE64_GENERIC,
+#if defined(BASE64_AVX2)
+		BASE64_AVX2,
+#endif
+#if defined(BASE64_SSSE3)
+		BASE64_SSSE3,
+#endif
+};
+
+static const base64_impl_t *base64_opt = &base64_list[0];
+
+static bool
+base64_test_impl (const base64_impl_t *impl)
+{
+	static const char in[] =
+			"TWFuIGlzIGRpc3Rpbmd1aXNoZWQsIG5vdCBvbmx5IGJ5IGhpcyByZWFzb24sIGJ1";
+	static const char expected[] =
+			"Man is distinguished, not only by his reason, bu";
+	unsigned char out[sizeof (in)];
+	size_t outlen = sizeof (out);
+
+	if (impl->decode ((const unsigned char *)in, sizeof (in) - 1,
+			out, &outlen) != sizeof (in) - 1) {
+		return false;
+	}
+
+	return outlen == sizeof (expected) - 1 &&
+			memcmp (out, expected, outlen) == 0;
+}
+
+const char *
+base64_load (void)
+{
+	guint i;
+
+	if (cpu_config != 0) {
+		for (i = 0; i < G_N_ELEMENTS(base64_list); i++) {
+			if (base64_list[i].cpu_flags & cpu_config) {
+				base64_opt = &base64_list[i];
+				g_assert (base64_test_impl (base64_opt));
+				break;
+			}
+		}
+	}
+
+	return base64_opt->desc;
+}
+
+gboolean
+rspamd_cryptobox_base64_decode (const gchar *in, gsize inlen,
+		guchar *out, gsize *outlen)
+{
+	const guchar *p = (const guchar *)in, *end = p + inlen;
+	guchar *o = out, *oend = out + *outlen;
+	guint32 carry = 0;
+	guint n = 0;
+	guchar c;
+	gboolean skipped;
+	size_t consumed, olen;
+
+	while (p < end) {
+		skipped = FALSE;
+
+		if (n == 0) {
+			/* Vectorized decoding stops before a line break */
+			olen = oend - o;
+			consumed = base64_opt->decode (p, end - p, o, &olen);
+			p += consumed;
+			o += olen;
+			/* The rest of line */
+			olen = oend - o;
+			consumed = base64_decode_ref (p, end - p, o, &olen);
+			p += consumed;
+			o += olen;
+		}
+
+		/* Skip line breaks and decode incomplete quantums bytewise */
+		while (p < end) {
+			c = base64_table_dec[*p];
+
+			if (c == 0xff) {
+				if (*p == '=') {
+					/* Padding, ignore everything after it */
+					p = end;
+					break;
+				}
+
+				p ++;
+				skipped = TRUE;
+				continue;
+			}
+
+			if (n == 0 && skipped) {
+				/* Start of the next line */
+				break;
+			}
+
+			carry = carry << 6 | c;
+			p ++;
+
+			if (++n == 4) {
+				if (oend - o < 3) {
+					*outlen = o - out;
+
+					return FALSE;
+				}
+
+				*o++ = carry >> 16;
+				*o++ = carry >> 8;
+				*o++ = carry;
+				carry = 0;
+				n = 0;
+			}
+		}
+	}
+
+	/* Incomplete quantum: 2 sextets give 1 byte and 3 sextets give 2 bytes */
+	if (n > 1) {
+		if ((gsize)(oend - o) < n - 1) {
+			*outlen = o - out;
+
+			return FALSE;
+		}
+
+		carry <<= 6 * (4 - n);
+		*o++ = carry >> 16;
+
+		if (n == 3) {
+			*o++ = carry >> 8;
+		}
+	}
+
+	*outlen = o - out;
+
+	return TRUE;
+}
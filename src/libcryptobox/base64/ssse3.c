@@ -0,0 +1,89 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "config.h"
+#include <tmmintrin.h>
+
+/*
+ * Vectorized decoding of 16 characters per iteration, see
+ * http://0x80.pl/notesen/2016-01-17-sse-base64-decoding.html
+ * Characters are validated by lookups of lower and higher nibbles, so a block
+ * with any character outside of base64 alphabet (including line breaks and
+ * padding) is left for the generic code.
+ */
+size_t __attribute__((__target__("ssse3")))
+base64_decode_ssse3 (const unsigned char *in, size_t inlen,
+		unsigned char *out, size_t *outlen)
+{
+	const unsigned char *p = in;
+	unsigned char *o = out;
+	size_t olen = *outlen;
+	__m128i str, hi, lo, mask, bit, shift;
+	const __m128i shift_lut = _mm_setr_epi8 (
+			0, 0, 19, 4, -65, -65, -71, -71,
+			0, 0, 0, 0, 0, 0, 0, 0);
+	/* Bit n is set if character with higher nibble n is valid */
+	const __m128i mask_lut = _mm_setr_epi8 (
+			(char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8,
+			(char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+			(char)0xf8, (char)0xf8, (char)0xf0, 0x54,
+			0x50, 0x50, 0x50, 0x54);
+	const __m128i bitpos_lut = _mm_setr_epi8 (
+			0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+			0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i nibble = _mm_set1_epi8 (0x0f);
+	const __m128i slash = _mm_set1_epi8 ('/');
+	const __m128i slash_shift = _mm_set1_epi8 (16 - 19);
+	const __m128i pack_ab = _mm_set1_epi32 (0x01400140);
+	const __m128i pack_abcd = _mm_set1_epi32 (0x00011000);
+	const __m128i pack_shuf = _mm_setr_epi8 (
+			2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+			-1, -1, -1, -1);
+
+	/* We store 16 bytes per 12 decoded ones */
+	while (inlen >= 16 && olen >= 16) {
+		str = _mm_loadu_si128 ((const __m128i *)p);
+		hi = _mm_and_si128 (_mm_srli_epi32 (str, 4), nibble);
+		lo = _mm_and_si128 (str, nibble);
+		mask = _mm_shuffle_epi8 (mask_lut, lo);
+		bit = _mm_shuffle_epi8 (bitpos_lut, hi);
+
+		if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_and_si128 (mask, bit),
+				_mm_setzero_si128 ())) != 0) {
+			break;
+		}
+
+		/* '/' shares higher nibble with '+' */
+		shift = _mm_add_epi8 (_mm_shuffle_epi8 (shift_lut, hi),
+				_mm_and_si128 (_mm_cmpeq_epi8 (str, slash), slash_shift));
+		str = _mm_add_epi8 (str, shift);
+
+		/* Merge 4 x 6 bits to 3 bytes in each 32 bit word */
+		str = _mm_maddubs_epi16 (str, pack_ab);
+		str = _mm_madd_epi16 (str, pack_abcd);
+		str = _mm_shuffle_epi8 (str, pack_shuf);
+		_mm_storeu_si128 ((__m128i *)o, str);
+
+		p += 16;
+		inlen -= 16;
+		o += 12;
+		olen -= 12;
+	}
+
+	*outlen = o - out;
+
+	return p - in;
+}
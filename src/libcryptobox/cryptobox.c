@@ -28,6 +28,7 @@
 #include "ed25519/ed25519.h"
 #include "blake2/blake2.h"
 #include "siphash/siphash.h"
+#include "base64/base64.h"
 #include "ottery.h"
 #include "printf.h"
 
@@ -310,6 +311,7 @@ rspamd_cryptobox_init (void)
 	ctx->curve25519_impl = curve25519_load ();
 	ctx->blake2_impl = blake2b_load ();
 	ctx->ed25519_impl = ed25519_load ();
+	ctx->base64_impl = base64_load ();
 #ifdef HAVE_USABLE_OPENSSL
 	ERR_load_ECDSA_strings ();
 	ERR_load_EC_strings ();
@@ -1139,6 +1141,144 @@ rspamd_cryptobox_decrypt_nm_inplace (guchar *data, gsize len,
 	return ret;
 }
 
+/*
+ * Batches are processed in chunks of this size to keep all contexts on stack
+ */
+#define CRYPTOBOX_BATCH_LANES 16
+
+void
+rspamd_cryptobox_encrypt_nm_batch (struct rspamd_cryptobox_batch_elt *elts,
+		gsize cnt,
+		enum rspamd_cryptobox_mode mode)
+{
+	void *enc_ctx[CRYPTOBOX_BATCH_LANES], *auth_ctx[CRYPTOBOX_BATCH_LANES];
+	guchar *enc_mem, *auth_mem;
+	gsize enc_len, auth_len, i, j, nlanes, r;
+	struct rspamd_cryptobox_batch_elt *elt;
+
+	if (mode != RSPAMD_CRYPTOBOX_MODE_25519) {
+		/* OpenSSL contexts cannot be split into passes */
+		for (i = 0; i < cnt; i ++) {
+			elt = &elts[i];
+			rspamd_cryptobox_encrypt_nm_inplace (elt->data, elt->len,
+					elt->nonce, elt->nm, elt->mac, mode);
+			elt->ok = TRUE;
+		}
+
+		return;
+	}
+
+	enc_len = rspamd_cryptobox_encrypt_ctx_len (mode);
+	auth_len = rspamd_cryptobox_auth_ctx_len (mode);
+	enc_mem = g_alloca (enc_len * CRYPTOBOX_BATCH_LANES);
+	auth_mem = g_alloca (auth_len * CRYPTOBOX_BATCH_LANES);
+
+	for (i = 0; i < cnt; i += nlanes) {
+		nlanes = MIN (cnt - i, CRYPTOBOX_BATCH_LANES);
+
+		/* Key setup for all lanes */
+		for (j = 0; j < nlanes; j ++) {
+			elt = &elts[i + j];
+			enc_ctx[j] = rspamd_cryptobox_encrypt_init (enc_mem + enc_len * j,
+					elt->nonce, elt->nm, mode);
+			auth_ctx[j] = rspamd_cryptobox_auth_init (auth_mem + auth_len * j,
+					enc_ctx[j], mode);
+		}
+
+		/* Keystream */
+		for (j = 0; j < nlanes; j ++) {
+			elt = &elts[i + j];
+			rspamd_cryptobox_encrypt_update (enc_ctx[j], elt->data, elt->len,
+					elt->data, &r, mode);
+			rspamd_cryptobox_encrypt_final (enc_ctx[j], elt->data + r,
+					elt->len - r, mode);
+		}
+
+		/* Authentication */
+		for (j = 0; j < nlanes; j ++) {
+			elt = &elts[i + j];
+			rspamd_cryptobox_auth_update (auth_ctx[j], elt->data, elt->len,
+					mode);
+			rspamd_cryptobox_auth_final (auth_ctx[j], elt->mac, mode);
+			rspamd_cryptobox_cleanup (enc_ctx[j], auth_ctx[j], mode);
+			elt->ok = TRUE;
+		}
+	}
+}
+
+guint
+rspamd_cryptobox_decrypt_nm_batch (struct rspamd_cryptobox_batch_elt *elts,
+		gsize cnt,
+		enum rspamd_cryptobox_mode mode)
+{
+	void *enc_ctx[CRYPTOBOX_BATCH_LANES], *auth_ctx[CRYPTOBOX_BATCH_LANES];
+	guchar *enc_mem, *auth_mem;
+	gsize enc_len, auth_len, i, j, nlanes, r;
+	struct rspamd_cryptobox_batch_elt *elt;
+	guint nvalid = 0;
+
+	if (mode != RSPAMD_CRYPTOBOX_MODE_25519) {
+		for (i = 0; i < cnt; i ++) {
+			elt = &elts[i];
+			elt->ok = rspamd_cryptobox_decrypt_nm_inplace (elt->data, elt->len,
+					elt->nonce, elt->nm, elt->mac, mode);
+
+			if (elt->ok) {
+				nvalid ++;
+			}
+		}
+
+		return nvalid;
+	}
+
+	enc_len = rspamd_cryptobox_encrypt_ctx_len (mode);
+	auth_len = rspamd_cryptobox_auth_ctx_len (mode);
+	enc_mem = g_alloca (enc_len * CRYPTOBOX_BATCH_LANES);
+	auth_mem = g_alloca (auth_len * CRYPTOBOX_BATCH_LANES);
+
+	for (i = 0; i < cnt; i += nlanes) {
+		nlanes = MIN (cnt - i, CRYPTOBOX_BATCH_LANES);
+
+		/* Key setup for all lanes */
+		for (j = 0; j < nlanes; j ++) {
+			elt = &elts[i + j];
+			enc_ctx[j] = rspamd_cryptobox_decrypt_init (enc_mem + enc_len * j,
+					elt->nonce, elt->nm, mode);
+			auth_ctx[j] = rspamd_cryptobox_auth_verify_init (
+					auth_mem + auth_len * j, enc_ctx[j], mode);
+		}
+
+		/* Verification */
+		for (j = 0; j < nlanes; j ++) {
+			elt = &elts[i + j];
+			rspamd_cryptobox_auth_verify_update (auth_ctx[j], elt->data,
+					elt->len, mode);
+			elt->ok = rspamd_cryptobox_auth_verify_final (auth_ctx[j], elt->mac,
+					mode);
+		}
+
+		/* Keystream for verified lanes only */
+		for (j = 0; j < nlanes; j ++) {
+			elt = &elts[i + j];
+
+			if (elt->ok) {
+				rspamd_cryptobox_decrypt_update (enc_ctx[j], elt->data, elt->len,
+						elt->data, &r, mode);
+				elt->ok = rspamd_cryptobox_decrypt_final (enc_ctx[j],
+						elt->data + r, elt->len - r, mode);
+			}
+
+			if (elt->ok) {
+				nvalid ++;
+			}
+
+			rspamd_cryptobox_cleanup (enc_ctx[j], auth_ctx[j], mode);
+		}
+	}
+
+	return nvalid;
+}
+
 gboolean
 rspamd_cryptobox_decrypt_inplace (guchar *data, gsize len,
 		const rspamd_nonce_t nonce,
@@ -23,6 +23,18 @@ struct rspamd_cryptobox_segment {
 	gsize len;
 };
 
+/*
+ * Element of a batch of independent messages processed at once
+ */
+struct rspamd_cryptobox_batch_elt {
+	guchar *data;
+	gsize len;
+	const guchar *nonce;
+	const guchar *nm;
+	guchar *mac;
+	gboolean ok;
+};
+
 #define rspamd_cryptobox_MAX_NONCEBYTES 24
 #define rspamd_cryptobox_MAX_PKBYTES 65
 #define rspamd_cryptobox_MAX_SKBYTES 32
@@ -67,6 +79,7 @@ struct rspamd_cryptobox_library_ctx {
 	const gchar *poly1305_impl;
 	const gchar *siphash_impl;
 	const gchar *blake2_impl;
+	const gchar *base64_impl;
 	unsigned long cpu_config;
 };
 
@@ -174,6 +187,29 @@ gboolean rspamd_cryptobox_decrypt_nm_inplace (guchar *data, gsize len,
 		 const rspamd_nm_t nm, const rspamd_mac_t sig,
 		 enum rspamd_cryptobox_mode mode);
 
+/**
+ * Encrypt many independent short messages inplace. Each element has its own
+ * nonce, shared key and mac output. Key setup, keystream generation and
+ * authentication are performed in separate passes over all elements.
+ * @param elts elements to encrypt
+ * @param cnt count of elements
+ */
+void rspamd_cryptobox_encrypt_nm_batch (struct rspamd_cryptobox_batch_elt *elts,
+		gsize cnt,
+		enum rspamd_cryptobox_mode mode);
+
+/**
+ * Verify and decrypt many independent short messages inplace. `ok` field of
+ * each element is set to TRUE if this element has been verified successfully,
+ * data of unverified elements is left untouched
+ * @param elts elements to decrypt
+ * @param cnt count of elements
+ * @return number of elements verified successfully
+ */
+guint rspamd_cryptobox_decrypt_nm_batch (struct rspamd_cryptobox_batch_elt *elts,
+		gsize cnt,
+		enum rspamd_cryptobox_mode mode);
+
 /**
  * Generate shared secret from local sk and remote pk
  * @param nm shared secret
@@ -315,4 +351,18 @@ void rspamd_cryptobox_hash (guchar *out,
 		const guchar *key,
 		gsize keylen);
 
+/**
+ * Decode base64 using the most optimized implementation for this CPU.
+ * Characters outside of base64 alphabet (e.g. line breaks) are skipped,
+ * decoding stops on padding
+ * @param in input
+ * @param inlen length of input
+ * @param out output buffer, may be the same as `in` for in-place decoding
+ * @param outlen in: size of the output buffer, out: number of bytes decoded
+ * @return TRUE if output buffer is large enough, otherwise the output buffer
+ * is filled with the beginning of decoded data
+ */
+gboolean rspamd_cryptobox_base64_decode (const gchar *in, gsize inlen,
+		guchar *out, gsize *outlen);
+
 #endif /* CRYPTOBOX_H_ */
@@ -0,0 +1,499 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "charset.h"
+#include "hash.h"
+#include <iconv.h>
+
+#define UTF8_CHARSET "UTF-8"
+/* Number of converters cached per process */
+#define RSPAMD_CHARSET_CACHE_SIZE 32
+/* Maximum length of UTF-8 sequence for a single byte */
+#define RSPAMD_CHARSET_MAX_SEQ 4
+
+enum rspamd_charset_converter_type {
+	RSPAMD_CHARSET_CONVERTER_TABLE = 0,
+	RSPAMD_CHARSET_CONVERTER_ICONV,
+	RSPAMD_CHARSET_CONVERTER_INVALID
+};
+
+struct rspamd_charset_converter {
+	enum rspamd_charset_converter_type type;
+	gboolean ascii_compatible;
+	iconv_t ic;
+	guint max_len;
+	/* UTF-8 sequences for each input byte, zero length for invalid ones */
+	guint8 lens[256];
+	gchar seqs[256][RSPAMD_CHARSET_MAX_SEQ];
+};
+
+/* Codepoints that are classified by tables */
+#define RSPAMD_TEXT_TABLE_SIZE 0x800
+
+enum rspamd_text_char_class {
+	RSPAMD_TEXT_CHAR_DELIM = 0,
+	RSPAMD_TEXT_CHAR_ALPHA,
+	RSPAMD_TEXT_CHAR_DIGIT,
+	RSPAMD_TEXT_CHAR_NEWLINE
+};
+
+static rspamd_lru_hash_t *converters = NULL;
+/* Classes and scripts for codepoints encoded by one or two utf8 bytes */
+static guint8 text_classes[RSPAMD_TEXT_TABLE_SIZE];
+static guint8 text_scripts[RSPAMD_TEXT_TABLE_SIZE];
+static gboolean text_tables_initialized = FALSE;
+
+static GQuark
+converter_error_quark (void)
+{
+	return g_quark_from_static_string ("conversion error");
+}
+
+gboolean
+rspamd_mime_text_is_ascii (const guchar *p, gsize len)
+{
+	const guchar *end = p + len;
+	guint64 w1, w2, w3, w4;
+	static const guint64 high_bits = 0x8080808080808080ULL;
+
+	/*
+	 * Check 32 bytes per iteration, compilers emit vector instructions for
+	 * this loop where they are available
+	 */
+	while (end - p >= 32) {
+		memcpy (&w1, p, sizeof (w1));
+		memcpy (&w2, p + 8, sizeof (w2));
+		memcpy (&w3, p + 16, sizeof (w3));
+		memcpy (&w4, p + 24, sizeof (w4));
+
+		if ((w1 | w2 | w3 | w4) & high_bits) {
+			return FALSE;
+		}
+
+		p += 32;
+	}
+
+	while (end - p >= 8) {
+		memcpy (&w1, p, sizeof (w1));
+
+		if (w1 & high_bits) {
+			return FALSE;
+		}
+
+		p += 8;
+	}
+
+	while (p < end) {
+		if (*p & 0x80) {
+			return FALSE;
+		}
+
+		p ++;
+	}
+
+	return TRUE;
+}
+
+static guint
+rspamd_text_char_class (gunichar c)
+{
+	if (c == '\n') {
+		return RSPAMD_TEXT_CHAR_NEWLINE;
+	}
+	else if (g_unichar_isalpha (c)) {
+		return RSPAMD_TEXT_CHAR_ALPHA;
+	}
+	else if (g_unichar_isdigit (c)) {
+		return RSPAMD_TEXT_CHAR_DIGIT;
+	}
+
+	return RSPAMD_TEXT_CHAR_DELIM;
+}
+
+static void
+rspamd_text_tables_init (void)
+{
+	gunichar c;
+
+	for (c = 0; c < RSPAMD_TEXT_TABLE_SIZE; c ++) {
+		text_classes[c] = rspamd_text_char_class (c);
+		text_scripts[c] = g_unichar_get_script (c);
+	}
+
+	text_tables_initialized = TRUE;
+}
+
+static inline void
+rspamd_text_stat_char (struct rspamd_mime_text_stat *st, guint cls,
+		GUnicodeScript script, guint *prev_cls, GUnicodeScript *prev_script)
+{
+	switch (cls) {
+	case RSPAMD_TEXT_CHAR_ALPHA:
+		if ((gint)script < RSPAMD_MIME_TEXT_SCRIPTS) {
+			st->scripts[script] ++;
+		}
+
+		if (*prev_cls == RSPAMD_TEXT_CHAR_ALPHA) {
+			st->alpha_pairs ++;
+
+			if (script != *prev_script) {
+				st->script_changes ++;
+			}
+		}
+		else if (*prev_cls != RSPAMD_TEXT_CHAR_DIGIT) {
+			st->nwords ++;
+		}
+
+		*prev_script = script;
+		break;
+	case RSPAMD_TEXT_CHAR_DIGIT:
+		if (*prev_cls != RSPAMD_TEXT_CHAR_ALPHA) {
+			st->nwords ++;
+		}
+		break;
+	case RSPAMD_TEXT_CHAR_NEWLINE:
+		st->nlines ++;
+		break;
+	default:
+		break;
+	}
+
+	*prev_cls = cls;
+}
+
+void
+rspamd_mime_text_stat (const guchar *p, gsize len, gboolean is_utf,
+		struct rspamd_mime_text_stat *st)
+{
+	const guchar *end = p + len;
+	guint cls, prev_cls = RSPAMD_TEXT_CHAR_DELIM, i, max = 0;
+	GUnicodeScript script, prev_script = G_UNICODE_SCRIPT_COMMON;
+	gunichar c;
+
+	if (!text_tables_initialized) {
+		rspamd_text_tables_init ();
+	}
+
+	memset (st, 0, sizeof (*st));
+	st->ascii = rspamd_mime_text_is_ascii (p, len);
+
+	if (st->ascii) {
+		/* Fast path: no decoding required */
+		while (p < end) {
+			rspamd_text_stat_char (st, text_classes[*p], text_scripts[*p],
+					&prev_cls, &prev_script);
+			p ++;
+		}
+	}
+	else if (!is_utf) {
+		while (p < end) {
+			if (*p & 0x80) {
+				rspamd_text_stat_char (st, RSPAMD_TEXT_CHAR_ALPHA,
+						G_UNICODE_SCRIPT_UNKNOWN, &prev_cls, &prev_script);
+			}
+			else {
+				rspamd_text_stat_char (st, text_classes[*p], text_scripts[*p],
+						&prev_cls, &prev_script);
+			}
+
+			p ++;
+		}
+	}
+	else {
+		while (p < end) {
+			if (*p < 0x80) {
+				cls = text_classes[*p];
+				script = text_scripts[*p];
+				p ++;
+			}
+			else if ((*p & 0xE0) == 0xC0 && end - p > 1 &&
+					(p[1] & 0xC0) == 0x80 && *p >= 0xC2) {
+				/* Two bytes sequence, that covers most of alphabetic scripts */
+				c = ((p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+				cls = text_classes[c];
+				script = text_scripts[c];
+				p += 2;
+			}
+			else {
+				c = g_utf8_get_char_validated ((const gchar *)p, end - p);
+
+				if (c == (gunichar) -2 || c == (gunichar) -1) {
+					/* Skip invalid byte and go on */
+					st->invalid_utf = TRUE;
+					cls = RSPAMD_TEXT_CHAR_DELIM;
+					script = G_UNICODE_SCRIPT_UNKNOWN;
+					p ++;
+				}
+				else {
+					cls = rspamd_text_char_class (c);
+					script = g_unichar_get_script (c);
+					p = (const guchar *)g_utf8_next_char (p);
+				}
+			}
+
+			rspamd_text_stat_char (st, cls, script, &prev_cls, &prev_script);
+		}
+	}
+
+	st->script = G_UNICODE_SCRIPT_COMMON;
+
+	for (i = 0; i < RSPAMD_MIME_TEXT_SCRIPTS; i ++) {
+		if (st->scripts[i] > max) {
+			max = st->scripts[i];
+			st->script = i;
+		}
+	}
+}
+
+static void
+rspamd_charset_converter_dtor (gpointer p)
+{
+	struct rspamd_charset_converter *conv = p;
+
+	if (conv->type != RSPAMD_CHARSET_CONVERTER_INVALID) {
+		iconv_close (conv->ic);
+	}
+
+	g_slice_free1 (sizeof (*conv), conv);
+}
+
+/*
+ * Convert each byte separately to find out if a charset is a single byte one
+ * and whether it maps 7 bit characters to themselves
+ */
+static void
+rspamd_charset_converter_probe (struct rspamd_charset_converter *conv)
+{
+	gchar c, out[RSPAMD_CHARSET_MAX_SEQ * 2], *s, *d;
+	gsize slen, dlen, ret, olen;
+	guint i;
+
+	conv->type = RSPAMD_CHARSET_CONVERTER_TABLE;
+	conv->ascii_compatible = TRUE;
+	conv->max_len = 1;
+
+	for (i = 0; i < 256; i ++) {
+		c = (gchar)i;
+		s = &c;
+		slen = 1;
+		d = out;
+		dlen = sizeof (out);
+		/* Reset shift state */
+		iconv (conv->ic, NULL, NULL, NULL, NULL);
+		ret = iconv (conv->ic, &s, &slen, &d, &dlen);
+
+		if (ret == (gsize)-1) {
+			if (errno != EILSEQ) {
+				/* Incomplete multibyte sequence */
+				conv->type = RSPAMD_CHARSET_CONVERTER_ICONV;
+			}
+
+			conv->lens[i] = 0;
+		}
+		else {
+			olen = sizeof (out) - dlen;
+
+			if (olen == 0 || olen > RSPAMD_CHARSET_MAX_SEQ) {
+				/* Shift sequence or something weird */
+				conv->type = RSPAMD_CHARSET_CONVERTER_ICONV;
+				conv->lens[i] = 0;
+			}
+			else {
+				memcpy (conv->seqs[i], out, olen);
+				conv->lens[i] = olen;
+				conv->max_len = MAX (conv->max_len, olen);
+			}
+		}
+
+		if (i > 0 && i < 0x80 &&
+				(conv->lens[i] != 1 || conv->seqs[i][0] != c)) {
+			conv->ascii_compatible = FALSE;
+		}
+	}
+
+	iconv (conv->ic, NULL, NULL, NULL, NULL);
+}
+
+static struct rspamd_charset_converter *
+rspamd_charset_converter_get (const gchar *enc)
+{
+	struct rspamd_charset_converter *conv;
+	gchar *key, *d;
+	const gchar *p;
+
+	if (converters == NULL) {
+		converters = rspamd_lru_hash_new (RSPAMD_CHARSET_CACHE_SIZE, 0,
+				g_free, rspamd_charset_converter_dtor);
+	}
+
+	/* Normalize name: `KOI8-R`, `koi8_r` and `koi8r` are the same charset */
+	key = g_malloc (strlen (enc) + 1);
+
+	for (p = enc, d = key; *p != '\0'; p ++) {
+		if (g_ascii_isalnum (*p)) {
+			*d++ = g_ascii_tolower (*p);
+		}
+	}
+
+	*d = '\0';
+	conv = rspamd_lru_hash_lookup (converters, key, 0);
+
+	if (conv != NULL) {
+		g_free (key);
+	}
+	else {
+		conv = g_slice_alloc0 (sizeof (*conv));
+		conv->ic = iconv_open (UTF8_CHARSET, enc);
+
+		if (conv->ic == (iconv_t)-1) {
+			/* Cache failures as well */
+			conv->type = RSPAMD_CHARSET_CONVERTER_INVALID;
+		}
+		else {
+			rspamd_charset_converter_probe (conv);
+		}
+
+		rspamd_lru_hash_insert (converters, key, conv, 0, 0);
+	}
+
+	if (conv->type == RSPAMD_CHARSET_CONVERTER_INVALID) {
+		return NULL;
+	}
+
+	return conv;
+}
+
+static gchar *
+rspamd_charset_table_convert (struct rspamd_charset_converter *conv,
+		rspamd_mempool_t *pool,
+		const guchar *input, gsize len, gsize *olen)
+{
+	gchar *res, *d;
+	const guchar *p, *end;
+	guint l;
+
+	res = rspamd_mempool_alloc (pool, len * conv->max_len + 1);
+	d = res;
+	p = input;
+	end = input + len;
+
+	while (p < end) {
+		l = conv->lens[*p];
+
+		if (l == 1) {
+			*d++ = conv->seqs[*p][0];
+		}
+		else if (l == 0) {
+			/* Ignore bad characters */
+			*d++ = '?';
+		}
+		else {
+			memcpy (d, conv->seqs[*p], l);
+			d += l;
+		}
+
+		p ++;
+	}
+
+	*d = '\0';
+	*olen = d - res;
+
+	return res;
+}
+
+static gchar *
+rspamd_charset_iconv_convert (struct rspamd_charset_converter *conv,
+		rspamd_mempool_t *pool,
+		gchar *input, gsize len, gsize *olen)
+{
+	gchar *res, *nres, *s, *d;
+	gsize outlen, remain, ret;
+	gint err_code;
+
+	/* For the most of charsets utf8 notation is larger than native one */
+	outlen = len * 2 + 16;
+	res = rspamd_mempool_alloc (pool, outlen);
+	s = input;
+	d = res;
+	/* Reserve space for the trailing zero */
+	remain = outlen - 1;
+	iconv (conv->ic, NULL, NULL, NULL, NULL);
+
+	while (len > 0) {
+		ret = iconv (conv->ic, &s, &len, &d, &remain);
+
+		if (ret == (gsize)-1) {
+			err_code = errno;
+
+			if (err_code == E2BIG || remain == 0) {
+				/* Grow output buffer */
+				nres = rspamd_mempool_alloc (pool, outlen * 2);
+				memcpy (nres, res, d - res);
+				d = nres + (d - res);
+				remain += outlen;
+				outlen *= 2;
+				res = nres;
+			}
+
+			if (err_code == EILSEQ || err_code == EINVAL) {
+				/* Ignore bad characters */
+				*d++ = '?';
+				s ++;
+				len --;
+				remain --;
+			}
+			else if (err_code != E2BIG) {
+				break;
+			}
+		}
+	}
+
+	*d = '\0';
+	*olen = d - res;
+
+	return res;
+}
+
+gchar *
+rspamd_mime_text_to_utf8 (rspamd_mempool_t *pool,
+		gchar *input, gsize len, const gchar *in_enc,
+		gsize *olen, GError **err)
+{
+	struct rspamd_charset_converter *conv;
+
+	conv = rspamd_charset_converter_get (in_enc);
+
+	if (conv == NULL) {
+		g_set_error (err, converter_error_quark(), EINVAL,
+				"cannot open iconv for: %s", in_enc);
+		return NULL;
+	}
+
+	if (conv->ascii_compatible &&
+			rspamd_mime_text_is_ascii ((const guchar *)input, len)) {
+		/* Nothing to convert */
+		*olen = len;
+
+		return input;
+	}
+
+	if (conv->type == RSPAMD_CHARSET_CONVERTER_TABLE) {
+		return rspamd_charset_table_convert (conv, pool,
+				(const guchar *)input, len, olen);
+	}
+
+	return rspamd_charset_iconv_convert (conv, pool, input, len, olen);
+}
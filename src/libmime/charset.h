@@ -0,0 +1,80 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SRC_LIBMIME_CHARSET_H_
+#define SRC_LIBMIME_CHARSET_H_
+
+#include "config.h"
+#include "mem_pool.h"
+
+/*
+ * Charset conversion to UTF-8. Converters are opened once per process and
+ * cached by the normalized charset name. Single byte charsets (koi8-r,
+ * windows-125x, iso-8859-x and so on) are decoded using tables built from
+ * iconv when a converter is opened, other charsets are converted by iconv.
+ */
+
+/* Scripts that are counted separately in text statistics */
+#define RSPAMD_MIME_TEXT_SCRIPTS (G_UNICODE_SCRIPT_NKO + 1)
+
+/*
+ * Characters statistics of a text collected in a single pass
+ */
+struct rspamd_mime_text_stat {
+	guint32 scripts[RSPAMD_MIME_TEXT_SCRIPTS]; /**< alphabetic characters per script */
+	guint32 alpha_pairs;		/**< adjacent alphabetic characters				*/
+	guint32 script_changes;		/**< adjacent alphabetic characters with different scripts */
+	guint32 nwords;				/**< number of alphanumeric sequences			*/
+	guint32 nlines;				/**< number of newline characters				*/
+	GUnicodeScript script;		/**< the most common script of alphabetic characters */
+	gboolean ascii;				/**< text has merely 7 bit characters			*/
+	gboolean invalid_utf;		/**< text has invalid utf8 sequences				*/
+};
+
+/**
+ * Check if text contains merely 7 bit characters
+ * @param p text
+ * @param len length of text
+ * @return TRUE if text is ASCII
+ */
+gboolean rspamd_mime_text_is_ascii (const guchar *p, gsize len);
+
+/**
+ * Collect characters statistics for a text. For non utf8 text all 8 bit
+ * characters are treated as alphabetic characters of an unknown script
+ * @param p text
+ * @param len length of text
+ * @param is_utf whether text is in utf8
+ * @param st statistics output
+ */
+void rspamd_mime_text_stat (const guchar *p, gsize len, gboolean is_utf,
+		struct rspamd_mime_text_stat *st);
+
+/**
+ * Convert text from the specified charset to UTF-8
+ * @param pool pool for output
+ * @param input input text
+ * @param len length of input
+ * @param in_enc charset of input
+ * @param olen output length
+ * @param err error pointer
+ * @return converted text, `input` itself if no conversion is required or
+ * NULL if charset is not supported
+ */
+gchar * rspamd_mime_text_to_utf8 (rspamd_mempool_t *pool,
+		gchar *input, gsize len, const gchar *in_enc,
+		gsize *olen, GError **err);
+
+#endif /* SRC_LIBMIME_CHARSET_H_ */
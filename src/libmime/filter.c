@@ -24,13 +24,26 @@
 
 #define COMMON_PART_FACTOR 95
 
+/* Copy options list to the task's pool, elements are not copied */
+static GList *
+rspamd_task_options_copy (struct rspamd_task *task, GList *opts)
+{
+	GList *res = NULL, *cur;
+
+	for (cur = opts; cur != NULL; cur = g_list_next (cur)) {
+		res = rspamd_mempool_glist_prepend (task->task_pool, res, cur->data);
+	}
+
+	return g_list_reverse (res);
+}
+
 struct metric_result *
 rspamd_create_metric_result (struct rspamd_task *task, const gchar *name)
 {
 	struct metric_result *metric_res;
 	struct metric *metric;
 
-	metric_res = g_hash_table_lookup (task->results, name);
+	metric_res = rspamd_mempool_hash_lookup (task->results, name);
 
 	if (metric_res != NULL) {
 		return metric_res;
@@ -49,15 +62,13 @@ rspamd_create_metric_result (struct rspamd_task *task, const gchar *name)
 	rspamd_mempool_add_destructor (task->task_pool,
 			(rspamd_mempool_destruct_t) g_hash_table_unref,
 			metric_res->symbols);
-	metric_res->sym_groups = g_hash_table_new (g_direct_hash, g_direct_equal);
-	rspamd_mempool_add_destructor (task->task_pool,
-			(rspamd_mempool_destruct_t) g_hash_table_unref,
-			metric_res->sym_groups);
+	metric_res->sym_groups = rspamd_mempool_hash_new (task->task_pool,
+			g_direct_hash, g_direct_equal, 8);
 	metric_res->checked = FALSE;
 	metric_res->metric = metric;
 	metric_res->grow_factor = 0;
 	metric_res->score = 0;
-	g_hash_table_insert (task->results, (gpointer) metric->name,
+	rspamd_mempool_hash_insert (task->results, (gpointer) metric->name,
 			metric_res);
 	metric_res->action = METRIC_ACTION_MAX;
 
@@ -90,12 +101,12 @@ insert_metric_result (struct rspamd_task *task,
 		gr = sdef->gr;
 
 		if (gr != NULL) {
-			gr_score = g_hash_table_lookup (metric_res->sym_groups, gr);
+			gr_score = rspamd_mempool_hash_lookup (metric_res->sym_groups, gr);
 
 			if (gr_score == NULL) {
 				gr_score = rspamd_mempool_alloc (task->task_pool, sizeof (gdouble));
 				*gr_score = 0;
-				g_hash_table_insert (metric_res->sym_groups, gr, gr_score);
+				rspamd_mempool_hash_insert (metric_res->sym_groups, gr, gr_score);
 			}
 		}
 	}
@@ -140,16 +151,11 @@ insert_metric_result (struct rspamd_task *task,
 		}
 		if (s->options && opts && opts != s->options) {
 			/* Append new options */
-			s->options = g_list_concat (s->options, g_list_copy (opts));
-			/*
-			 * Note that there is no need to add new destructor of GList as elements of appended
-			 * GList are used directly, so just free initial GList
-			 */
+			s->options = g_list_concat (s->options,
+					rspamd_task_options_copy (task, opts));
 		}
 		else if (opts) {
-			s->options = g_list_copy (opts);
-			rspamd_mempool_add_destructor (task->task_pool,
-				(rspamd_mempool_destruct_t) g_list_free, s->options);
+			s->options = rspamd_task_options_copy (task, opts);
 		}
 		if (!single) {
 			/* Handle grow factor */
@@ -186,9 +192,7 @@ insert_metric_result (struct rspamd_task *task,
 		metric_res->score += w;
 
 		if (opts) {
-			s->options = g_list_copy (opts);
-			rspamd_mempool_add_destructor (task->task_pool,
-				(rspamd_mempool_destruct_t) g_list_free, s->options);
+			s->options = rspamd_task_options_copy (task, opts);
 		}
 		else {
 			s->options = NULL;
@@ -33,7 +33,7 @@ struct metric_result {
 	double required_score;                          /**< real required score					*/
 	double grow_factor;								/**< current grow factor					*/
 	GHashTable *symbols;                            /**< symbols of metric						*/
-	GHashTable *sym_groups;							/**< groups of symbols						*/
+	rspamd_mempool_hash_t *sym_groups;				/**< groups of symbols						*/
 	gboolean checked;                               /**< whether metric result is consolidated  */
 	enum rspamd_metric_action action;                /**< the current action						*/
 };
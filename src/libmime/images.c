@@ -18,6 +18,10 @@
 #include "rspamd.h"
 #include "message.h"
 #include "html.h"
+#include "cryptobox.h"
+
+/* Enough for dimensions of most of images unless jpeg has huge exif data */
+#define RSPAMD_IMAGE_HEAD_SIZE 16384
 
 static const guint8 png_signature[] = {137, 80, 78, 71, 13, 10, 26, 10};
 static const guint8 jpg_sig1[] = {0xff, 0xd8};
@@ -36,8 +40,9 @@ rspamd_images_process (struct rspamd_task *task)
 
 	for (i = 0; i < task->parts->len; i ++) {
 		part = g_ptr_array_index (task->parts, i);
-		if (g_mime_content_type_is_type (part->type, "image",
-			"*") && part->content->len > 0) {
+		if (g_mime_content_type_is_type (part->type, "image", "*") &&
+				((part->content != NULL && part->content->len > 0) ||
+				(part->content == NULL && part->encoded->len > 0))) {
 			process_image (task, part);
 		}
 	}
@@ -96,7 +101,6 @@ process_png_image (struct rspamd_task *task, GByteArray *data)
 
 	img = rspamd_mempool_alloc0 (task->task_pool, sizeof (struct rspamd_image));
 	img->type = IMAGE_TYPE_PNG;
-	img->data = data;
 
 	p += 4;
 	memcpy (&t, p, sizeof (guint32));
@@ -118,7 +122,6 @@ process_jpg_image (struct rspamd_task *task, GByteArray *data)
 
 	img = rspamd_mempool_alloc0 (task->task_pool, sizeof (struct rspamd_image));
 	img->type = IMAGE_TYPE_JPG;
-	img->data = data;
 
 	p = data->data;
 	remain = data->len;
@@ -152,7 +155,6 @@ process_gif_image (struct rspamd_task *task, GByteArray *data)
 
 	img = rspamd_mempool_alloc0 (task->task_pool, sizeof (struct rspamd_image));
 	img->type = IMAGE_TYPE_GIF;
-	img->data = data;
 
 	p = data->data + 6;
 	memcpy (&t, p,	   sizeof (guint16));
@@ -177,7 +179,6 @@ process_bmp_image (struct rspamd_task *task, GByteArray *data)
 
 	img = rspamd_mempool_alloc0 (task->task_pool, sizeof (struct rspamd_image));
 	img->type = IMAGE_TYPE_BMP;
-	img->data = data;
 	p = data->data + 18;
 	memcpy (&t, p,	   sizeof (gint32));
 	img->width = abs (GINT32_FROM_LE (t));
@@ -187,6 +188,32 @@ process_bmp_image (struct rspamd_task *task, GByteArray *data)
 	return img;
 }
 
+/*
+ * Image parsers need just a few bytes from the beginning of an image, so
+ * we do not decode the whole attachment if it has not been decoded yet
+ */
+static GByteArray *
+rspamd_image_get_head (struct rspamd_task *task, struct mime_part *part,
+		gboolean *partial)
+{
+	GByteArray *head;
+	gsize len = RSPAMD_IMAGE_HEAD_SIZE;
+
+	if (part->content != NULL) {
+		*partial = FALSE;
+
+		return part->content;
+	}
+
+	head = rspamd_mempool_alloc (task->task_pool, sizeof (*head));
+	head->data = rspamd_mempool_alloc (task->task_pool, len);
+	*partial = !rspamd_cryptobox_base64_decode (part->encoded->begin,
+			part->encoded->len, head->data, &len);
+	head->len = len;
+
+	return head;
+}
+
 static void
 process_image (struct rspamd_task *task, struct mime_part *part)
 {
@@ -197,20 +224,30 @@ process_image (struct rspamd_task *task, struct mime_part *part)
 	struct html_image *himg;
 	const gchar *cid, *html_cid;
 	guint cid_len, i, j;
+	GByteArray *head;
+	gboolean partial;
 
-	if ((type = detect_image_type (part->content)) != IMAGE_TYPE_UNKNOWN) {
+	head = rspamd_image_get_head (task, part, &partial);
+
+	if ((type = detect_image_type (head)) != IMAGE_TYPE_UNKNOWN) {
 		switch (type) {
 		case IMAGE_TYPE_PNG:
-			img = process_png_image (task, part->content);
+			img = process_png_image (task, head);
 			break;
 		case IMAGE_TYPE_JPG:
-			img = process_jpg_image (task, part->content);
+			img = process_jpg_image (task, head);
+
+			if (img == NULL && partial) {
+				/* Frame header is too far from the beginning */
+				img = process_jpg_image (task,
+						rspamd_mime_part_get_content (part));
+			}
 			break;
 		case IMAGE_TYPE_GIF:
-			img = process_gif_image (task, part->content);
+			img = process_gif_image (task, head);
 			break;
 		case IMAGE_TYPE_BMP:
-			img = process_bmp_image (task, part->content);
+			img = process_bmp_image (task, head);
 			break;
 		default:
 			img = NULL;
@@ -224,10 +261,13 @@ process_image (struct rspamd_task *task, struct mime_part *part)
 			img->width, img->height,
 			task->message_id);
 		img->filename = part->filename;
-		task->images = g_list_prepend (task->images, img);
+		img->part = part;
+		task->images = rspamd_mempool_glist_prepend (task->task_pool,
+				task->images, img);
 
 		/* Check Content-Id */
-		rh = g_hash_table_lookup (part->raw_headers, "Content-Id");
+		rh = rspamd_mime_headers_lookup_id (part->raw_headers,
+				RSPAMD_HEADER_CONTENT_ID);
 
 		if (rh != NULL) {
 			cid = rh->decoded;
@@ -5,6 +5,7 @@
 #include "rspamd.h"
 
 struct html_image;
+struct mime_part;
 
 enum rspamd_image_type {
 	IMAGE_TYPE_PNG = 0,
@@ -16,7 +17,8 @@ enum rspamd_image_type {
 
 struct rspamd_image {
 	enum rspamd_image_type type;
-	GByteArray *data;
+	struct mime_part *part;		/**< use rspamd_mime_part_get_content to get
+									 image data */
 	guint32 width;
 	guint32 height;
 	const gchar *filename;
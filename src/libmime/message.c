@@ -21,19 +21,20 @@
 #include "libutil/regexp.h"
 #include "html.h"
 #include "images.h"
+#include "charset.h"
+#include "mime_parser.h"
+#include "cryptobox.h"
 #include "utlist.h"
 #include "tokenizers/tokenizers.h"
 
 #ifdef WITH_SNOWBALL
 #include "libstemmer.h"
+#include "xxhash.h"
 #endif
 
 #include "acism.h"
 
-#include <iconv.h>
-
 #define RECURSION_LIMIT 5
-#define UTF8_CHARSET "UTF-8"
 #define GTUBE_SYMBOL "GTUBE"
 
 #define SET_PART_RAW(part) ((part)->flags &= ~RSPAMD_MIME_PART_FLAG_UTF)
@@ -50,56 +51,278 @@ rspamd_message_quark (void)
 	return g_quark_from_static_string ("mime-error");
 }
 
+/* Characters classes used by Received headers parser */
+#define RECV_CHAR_HOST (1 << 0)
+#define RECV_CHAR_IP (1 << 1)
+#define RECV_CHAR_SPACE (1 << 2)
+#define RECV_CHAR_DIGIT (1 << 3)
+
+#define RECV_IS(c, cl) (recv_chars[(guchar)(c)] & (cl))
+
+static guint8 recv_chars[256];
+static gboolean recv_chars_initialized = FALSE;
+
+static const struct rspamd_received_proto {
+	const gchar *name;
+	enum rspamd_received_type type;
+	gint flags;
+} recv_protos[] = {
+	{"smtp", RSPAMD_RECEIVED_SMTP, 0},
+	{"esmtp", RSPAMD_RECEIVED_ESMTP, 0},
+	{"esmtpa", RSPAMD_RECEIVED_ESMTP, RSPAMD_RECEIVED_FLAG_AUTHENTICATED},
+	{"esmtps", RSPAMD_RECEIVED_ESMTP, RSPAMD_RECEIVED_FLAG_SSL},
+	{"esmtpsa", RSPAMD_RECEIVED_ESMTP,
+			RSPAMD_RECEIVED_FLAG_SSL|RSPAMD_RECEIVED_FLAG_AUTHENTICATED},
+	{"lmtp", RSPAMD_RECEIVED_LMTP, 0},
+	{"lmtpa", RSPAMD_RECEIVED_LMTP, RSPAMD_RECEIVED_FLAG_AUTHENTICATED},
+	{"lmtps", RSPAMD_RECEIVED_LMTP, RSPAMD_RECEIVED_FLAG_SSL},
+	{"lmtpsa", RSPAMD_RECEIVED_LMTP,
+			RSPAMD_RECEIVED_FLAG_SSL|RSPAMD_RECEIVED_FLAG_AUTHENTICATED},
+	{"imap", RSPAMD_RECEIVED_IMAP, 0},
+	{"local", RSPAMD_RECEIVED_LOCAL, 0},
+	{"http", RSPAMD_RECEIVED_HTTP, 0},
+	{"https", RSPAMD_RECEIVED_HTTP, RSPAMD_RECEIVED_FLAG_SSL},
+};
+
+static void
+rspamd_recv_chars_init (void)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (recv_chars); i ++) {
+		if (g_ascii_isalnum (i) || i == '.' || i == '-' || i == '_') {
+			recv_chars[i] |= RECV_CHAR_HOST;
+		}
+		if (g_ascii_isxdigit (i) || i == '.' || i == ':') {
+			recv_chars[i] |= RECV_CHAR_IP;
+		}
+		if (g_ascii_isspace (i)) {
+			recv_chars[i] |= RECV_CHAR_SPACE;
+		}
+		if (g_ascii_isdigit (i)) {
+			recv_chars[i] |= RECV_CHAR_DIGIT;
+		}
+	}
+
+	recv_chars_initialized = TRUE;
+}
+
+static inline gchar *
+rspamd_recv_token (rspamd_mempool_t *pool, const gchar *s, const gchar *e)
+{
+	gchar *res;
+
+	res = rspamd_mempool_alloc (pool, e - s + 1);
+	memcpy (res, s, e - s);
+	res[e - s] = '\0';
+
+	return res;
+}
+
+/*
+ * Check whether a word in a comment denotes TLS usage. Protocol versions,
+ * e.g. `TLSv1.2`, are accepted everywhere. Bare `TLS` or `SSL` words need a
+ * context: `using TLS` (Postfix), `version=TLS` (Sendmail) or a comment right
+ * after `with` clause, e.g. `with esmtps (TLS1.2)` (Exim), as otherwise they
+ * can be a part of hostname, e.g. `(SSL-gw.example.com [192.0.2.1])`
+ */
+static gboolean
+parse_recv_tls (const gchar *line, const gchar *p, const gchar *end,
+	gboolean with_comment)
+{
+	const gchar *s;
+	gsize len;
+
+	if (end - p < 4 || (g_ascii_strncasecmp (p, "tls", 3) != 0 &&
+			g_ascii_strncasecmp (p, "ssl", 3) != 0)) {
+		return FALSE;
+	}
+
+	if ((p[3] == 'v' || p[3] == 'V') && end - p > 4 &&
+			RECV_IS (p[4], RECV_CHAR_DIGIT)) {
+		return TRUE;
+	}
+
+	if (g_ascii_isalpha (p[3]) || p[3] == '-' || p[3] == '.') {
+		return FALSE;
+	}
+
+	if (with_comment) {
+		return TRUE;
+	}
+
+	len = sizeof ("version=") - 1;
+
+	if ((gsize)(p - line) >= len &&
+			g_ascii_strncasecmp (p - len, "version=", len) == 0) {
+		return TRUE;
+	}
+
+	/* Check the previous word */
+	s = p;
+
+	while (s > line && RECV_IS (s[-1], RECV_CHAR_SPACE)) {
+		s --;
+	}
+
+	if (s == p) {
+		return FALSE;
+	}
+
+	for (len = 0; s > line && g_ascii_isalpha (s[-1]); len ++) {
+		s --;
+	}
+
+	return (len == 5 && g_ascii_strncasecmp (s, "using", 5) == 0) ||
+			(len == 4 && g_ascii_strncasecmp (s, "with", 4) == 0);
+}
+
+/*
+ * Extract data that does not depend on MTA specific format: protocol from
+ * `with` clause, TLS usage from comments and timestamp after the last `;`
+ */
+static void
+parse_recv_tail (const gchar *line, const gchar *end,
+	struct received_header *r)
+{
+	const gchar *p, *s;
+	gint depth = 0;
+	gboolean with_comment = FALSE;
+	guint i;
+
+	p = end;
+
+	while (p > line && p[-1] != ';') {
+		p --;
+	}
+
+	if (p > line) {
+		/* Date is the rest of NULL terminated header */
+		r->timestamp = g_mime_utils_header_decode_date (p, NULL);
+		end = p - 1;
+	}
+
+	for (p = line; p < end; p ++) {
+		if (*p == '(') {
+			depth ++;
+		}
+		else if (*p == ')') {
+			if (depth > 0) {
+				depth --;
+			}
+			if (depth == 0) {
+				with_comment = FALSE;
+			}
+		}
+		else if (depth > 0) {
+			/* TLS is mentioned in comments, e.g. `(using TLSv1.2 ...)` */
+			if ((p[-1] == '(' || p[-1] == '=' ||
+					RECV_IS (p[-1], RECV_CHAR_SPACE)) &&
+					parse_recv_tls (line, p, end, with_comment)) {
+				r->flags |= RSPAMD_RECEIVED_FLAG_SSL;
+			}
+		}
+		else if ((*p == 'w' || *p == 'W') && p > line &&
+				RECV_IS (p[-1], RECV_CHAR_SPACE) && end - p > 5 &&
+				g_ascii_strncasecmp (p, "with", 4) == 0 &&
+				RECV_IS (p[4], RECV_CHAR_SPACE)) {
+			p += 5;
+
+			while (p < end && RECV_IS (*p, RECV_CHAR_SPACE)) {
+				p ++;
+			}
+
+			s = p;
+
+			while (p < end && RECV_IS (*p, RECV_CHAR_HOST)) {
+				p ++;
+			}
+
+			for (i = 0; i < G_N_ELEMENTS (recv_protos); i ++) {
+				if (strlen (recv_protos[i].name) == (gsize)(p - s) &&
+						g_ascii_strncasecmp (recv_protos[i].name, s, p - s) == 0) {
+					r->type = recv_protos[i].type;
+					r->flags |= recv_protos[i].flags;
+					break;
+				}
+			}
+
+			/* Comment right after protocol can describe TLS */
+			s = p;
+
+			while (s < end && RECV_IS (*s, RECV_CHAR_SPACE)) {
+				s ++;
+			}
+
+			with_comment = (s < end && *s == '(');
+
+			p --;
+		}
+	}
+}
+
 static void
 parse_qmail_recv (rspamd_mempool_t * pool,
-	gchar *line,
+	const gchar *line,
+	const gchar *end,
 	struct received_header *r)
 {
-	gchar *s, *p, t;
+	const gchar *s, *p;
+	goffset pos;
 
 	/* We are interested only with received from network headers */
-	if ((p = strstr (line, "from network")) == NULL) {
+	pos = rspamd_substring_search (line, end - line, "from network",
+			sizeof ("from network") - 1);
+
+	if (pos == -1) {
 		r->is_error = 2;
 		return;
 	}
 
-	p += sizeof ("from network") - 1;
-	while (g_ascii_isspace (*p) || *p == '[') {
+	p = line + pos + sizeof ("from network") - 1;
+
+	while (p < end && (RECV_IS (*p, RECV_CHAR_SPACE) || *p == '[')) {
 		p++;
 	}
 	/* format is ip/host */
 	s = p;
-	if (*p) {
-		while (g_ascii_isdigit (*++p) || *p == '.') ;
-		if (*p != '/') {
+
+	if (p < end) {
+		p ++;
+
+		while (p < end && (RECV_IS (*p, RECV_CHAR_DIGIT) || *p == '.')) {
+			p ++;
+		}
+
+		if (p == end || *p != '/') {
 			r->is_error = 1;
 			return;
 		}
 		else {
-			*p = '\0';
-			r->real_ip = rspamd_mempool_strdup (pool, s);
-			*p = '/';
+			r->real_ip = rspamd_recv_token (pool, s, p);
 			/* Now try to parse hostname */
 			s = ++p;
-			while (g_ascii_isalnum (*p) || *p == '.' || *p == '-' || *p ==
-				'_') {
+
+			while (p < end && RECV_IS (*p, RECV_CHAR_HOST)) {
 				p++;
 			}
-			t = *p;
-			*p = '\0';
-			r->real_hostname = rspamd_mempool_strdup (pool, s);
-			*p = t;
+
+			r->real_hostname = rspamd_recv_token (pool, s, p);
 		}
 	}
 }
 
-static void
-parse_recv_header (rspamd_mempool_t * pool,
+/*
+ * Parse Received header without modifying it, characters are classified by
+ * a lookup table and tokens are copied to the pool only when they are stored
+ */
+void
+rspamd_message_parse_received (rspamd_mempool_t * pool,
 	struct raw_header *rh,
 	struct received_header *r)
 {
-	gchar *p, *s, t, **res = NULL;
-	gchar *line;
+	const gchar *p, *s, *line, *end;
+	gchar **res = NULL;
 	enum {
 		RSPAMD_RECV_STATE_INIT = 0,
 		RSPAMD_RECV_STATE_FROM,
@@ -118,29 +341,38 @@ parse_recv_header (rspamd_mempool_t * pool,
 		return;
 	}
 
-	g_strstrip (line);
+	if (!recv_chars_initialized) {
+		rspamd_recv_chars_init ();
+	}
+
+	end = line + strlen (line);
+
+	while (line < end && RECV_IS (*line, RECV_CHAR_SPACE)) {
+		line ++;
+	}
+	while (end > line && RECV_IS (end[-1], RECV_CHAR_SPACE)) {
+		end --;
+	}
+
+	parse_recv_tail (line, end, r);
 	p = line;
 	s = line;
 
-	while (*p) {
+	while (p < end) {
 		switch (state) {
 		/* Initial state, search for from */
 		case RSPAMD_RECV_STATE_INIT:
-			if (*p == 'f' || *p == 'F') {
-				if (g_ascii_tolower (*++p) == 'r' && g_ascii_tolower (*++p) ==
-					'o' && g_ascii_tolower (*++p) == 'm') {
-					p++;
-					state = RSPAMD_RECV_STATE_SKIP_SPACES;
-					next_state = RSPAMD_RECV_STATE_FROM;
-				}
+			if (end - p >= 4 && g_ascii_strncasecmp (p, "from", 4) == 0) {
+				p += 4;
+				state = RSPAMD_RECV_STATE_SKIP_SPACES;
+				next_state = RSPAMD_RECV_STATE_FROM;
 			}
-			else if (g_ascii_tolower (*p) == 'b' &&
-				g_ascii_tolower (*(p + 1)) == 'y') {
+			else if (end - p >= 2 && g_ascii_strncasecmp (p, "by", 2) == 0) {
 				state = RSPAMD_RECV_STATE_IP_BLOCK;
 			}
 			else {
 				/* This can be qmail header, parse it separately */
-				parse_qmail_recv (pool, line, r);
+				parse_qmail_recv (pool, line, end, r);
 				return;
 			}
 			break;
@@ -153,15 +385,11 @@ parse_recv_header (rspamd_mempool_t * pool,
 				next_state = RSPAMD_RECV_STATE_IP_BLOCK;
 				s = ++p;
 			}
-			else if (g_ascii_isalnum (*p) || *p == '.' || *p == '-' || *p ==
-				'_') {
+			else if (RECV_IS (*p, RECV_CHAR_HOST)) {
 				p++;
 			}
 			else {
-				t = *p;
-				*p = '\0';
-				r->from_hostname = rspamd_mempool_strdup (pool, s);
-				*p = t;
+				r->from_hostname = rspamd_recv_token (pool, s, p);
 				state = RSPAMD_RECV_STATE_SKIP_SPACES;
 				next_state = RSPAMD_RECV_STATE_IP_BLOCK;
 			}
@@ -169,8 +397,7 @@ parse_recv_header (rspamd_mempool_t * pool,
 		/* Try to extract additional info */
 		case RSPAMD_RECV_STATE_IP_BLOCK:
 			/* Try to extract ip or () info or by */
-			if (g_ascii_tolower (*p) == 'b' && g_ascii_tolower (*(p + 1)) ==
-				'y') {
+			if (end - p >= 2 && g_ascii_strncasecmp (p, "by", 2) == 0) {
 				p += 2;
 				/* Skip spaces after by */
 				state = RSPAMD_RECV_STATE_SKIP_SPACES;
@@ -195,8 +422,7 @@ parse_recv_header (rspamd_mempool_t * pool,
 		/* We are in () block. Here can be found real hostname and real ip, this is written by some MTA */
 		case RSPAMD_RECV_STATE_BRACES_BLOCK:
 			/* End of block */
-			if (g_ascii_isalnum (*p) || *p == '.' || *p == '-' ||
-				*p == '_' || *p == ':') {
+			if (RECV_IS (*p, RECV_CHAR_HOST) || *p == ':') {
 				p++;
 			}
 			else if (*p == '[') {
@@ -209,9 +435,11 @@ parse_recv_header (rspamd_mempool_t * pool,
 				if (p > s) {
 					/* Got some real hostname */
 					/* check whether it is helo or p is not space symbol */
-					if (!g_ascii_isspace (*p) || *(p + 1) != '[') {
+					if (!RECV_IS (*p, RECV_CHAR_SPACE) || p + 1 >= end ||
+							p[1] != '[') {
 						/* Exim style ([ip]:port helo=hostname) */
-						if (*s == ':' && (g_ascii_isspace (*p) || *p == ')')) {
+						if (*s == ':' && (RECV_IS (*p, RECV_CHAR_SPACE) ||
+								*p == ')')) {
 							/* Ip ending */
 							is_exim = TRUE;
 							state = RSPAMD_RECV_STATE_SKIP_SPACES;
@@ -225,20 +453,18 @@ parse_recv_header (rspamd_mempool_t * pool,
 								r->real_hostname = r->from_hostname;
 							}
 							s = p;
-							while (*p != ')' && !g_ascii_isspace (*p) && *p !=
-								'\0') {
+							while (p < end && *p != ')' &&
+									!RECV_IS (*p, RECV_CHAR_SPACE)) {
 								p++;
 							}
 							if (p > s) {
-								r->from_hostname = rspamd_mempool_alloc (pool,
-										p - s + 1);
-								rspamd_strlcpy (r->from_hostname, s, p - s + 1);
+								r->from_hostname = rspamd_recv_token (pool, s, p);
 							}
 						}
 						else if (p - s == 4 && memcmp (s, "port=", 5) == 0) {
 							p++;
 							is_exim = TRUE;
-							while (g_ascii_isdigit (*p)) {
+							while (p < end && RECV_IS (*p, RECV_CHAR_DIGIT)) {
 								p++;
 							}
 							state = RSPAMD_RECV_STATE_SKIP_SPACES;
@@ -247,8 +473,8 @@ parse_recv_header (rspamd_mempool_t * pool,
 						else if (*p == '=' && is_exim) {
 							/* Just skip unknown pairs */
 							p++;
-							while (!g_ascii_isspace (*p) && *p != ')' && *p !=
-								'\0') {
+							while (p < end && !RECV_IS (*p, RECV_CHAR_SPACE) &&
+									*p != ')') {
 								p++;
 							}
 							state = RSPAMD_RECV_STATE_SKIP_SPACES;
@@ -256,16 +482,13 @@ parse_recv_header (rspamd_mempool_t * pool,
 						}
 						else {
 							/* skip all  */
-							while (*p++ != ')' && *p != '\0') ;
+							while (p < end && *p++ != ')') ;
 							state = RSPAMD_RECV_STATE_IP_BLOCK;
 						}
 					}
 					else {
 						/* Postfix style (hostname [ip]) */
-						t = *p;
-						*p = '\0';
-						r->real_hostname = rspamd_mempool_strdup (pool, s);
-						*p = t;
+						r->real_hostname = rspamd_recv_token (pool, s, p);
 						/* Now parse ip */
 						p += 2;
 						s = p;
@@ -274,7 +497,7 @@ parse_recv_header (rspamd_mempool_t * pool,
 						next_state = RSPAMD_RECV_STATE_BRACES_BLOCK;
 						continue;
 					}
-					if (*p == ')') {
+					if (p < end && *p == ')') {
 						p++;
 						state = RSPAMD_RECV_STATE_SKIP_SPACES;
 						next_state = RSPAMD_RECV_STATE_IP_BLOCK;
@@ -294,20 +517,16 @@ parse_recv_header (rspamd_mempool_t * pool,
 		/* Got by word */
 		case RSPAMD_RECV_STATE_BY_BLOCK:
 			/* Here can be only hostname */
-			if ((g_ascii_isalnum (*p) || *p == '.' || *p == '-'
-				|| *p == '_') && p[1] != '\0') {
+			if (RECV_IS (*p, RECV_CHAR_HOST) && p + 1 < end) {
 				p++;
 			}
 			else {
 				/* We got something like hostname */
-				if (p[1] != '\0') {
-					t = *p;
-					*p = '\0';
-					r->by_hostname = rspamd_mempool_strdup (pool, s);
-					*p = t;
+				if (p + 1 < end) {
+					r->by_hostname = rspamd_recv_token (pool, s, p);
 				}
 				else {
-					r->by_hostname = rspamd_mempool_strdup (pool, s);
+					r->by_hostname = rspamd_recv_token (pool, s, end);
 				}
 				/* Now end of parsing */
 				if (is_exim) {
@@ -334,26 +553,24 @@ parse_recv_header (rspamd_mempool_t * pool,
 				state = RSPAMD_RECV_STATE_PARSE_IP6;
 			}
 			else {
-				while (g_ascii_isxdigit (*p) || *p == '.' || *p == ':') {
+				while (p < end && RECV_IS (*p, RECV_CHAR_IP)) {
 					p++;
 				}
-				if (*p != ']') {
+				if (p == end || *p != ']') {
 					/* Not an ip in fact */
 					state = RSPAMD_RECV_STATE_SKIP_SPACES;
 					p++;
 				}
 				else {
-					*p = '\0';
-					*res = rspamd_mempool_strdup (pool, s);
-					*p = ']';
+					*res = rspamd_recv_token (pool, s, p);
 					p++;
 					state = RSPAMD_RECV_STATE_SKIP_SPACES;
 				}
 			}
 			break;
 		case RSPAMD_RECV_STATE_PARSE_IP6:
-			if (g_ascii_strncasecmp (p, "IPv6:", sizeof ("IPv6") - 1) == 0) {
-				p += sizeof ("IPv6") - 1;
+			if (end - p > 5 && g_ascii_strncasecmp (p, "IPv6:", 5) == 0) {
+				p += sizeof ("IPv6:") - 1;
 				s = p;
 				state = RSPAMD_RECV_STATE_PARSE_IP;
 			}
@@ -363,7 +580,7 @@ parse_recv_header (rspamd_mempool_t * pool,
 			break;
 		/* Skip spaces */
 		case RSPAMD_RECV_STATE_SKIP_SPACES:
-			if (!g_ascii_isspace (*p)) {
+			if (!RECV_IS (*p, RECV_CHAR_SPACE)) {
 				state = next_state;
 				s = p;
 			}
@@ -384,25 +601,16 @@ parse_recv_header (rspamd_mempool_t * pool,
 
 static void
 append_raw_header (struct rspamd_task *task,
-		GHashTable *target, struct raw_header *rh)
+		struct rspamd_mime_headers *target, struct raw_header *rh)
 {
-	struct raw_header *lp;
-
-	rh->next = NULL;
-	rh->prev = rh;
-	if ((lp =
-			g_hash_table_lookup (target, rh->name)) != NULL) {
-		DL_APPEND (lp, rh);
-	}
-	else {
-		g_hash_table_insert (target, rh->name, rh);
-	}
+	rspamd_mime_headers_append (target, rh);
 	msg_debug_task ("add raw header %s: %s", rh->name, rh->value);
 }
 
 /* Convert raw headers to a list of struct raw_header * */
-static void
-process_raw_headers (struct rspamd_task *task, GHashTable *target,
+void
+rspamd_message_process_headers (struct rspamd_task *task,
+		struct rspamd_mime_headers *target,
 		const gchar *in, gsize len)
 {
 	struct raw_header *new = NULL;
@@ -547,7 +755,13 @@ process_raw_headers (struct rspamd_task *task, GHashTable *target,
 			}
 
 			new->value = tmp;
+			new->value_len = tp - tmp;
 			new->decoded = g_mime_utils_header_decode_text (new->value);
+
+			if (new->decoded) {
+				new->decoded_len = strlen (new->decoded);
+			}
+
 			rspamd_mempool_add_destructor (task->task_pool,
 					(rspamd_mempool_destruct_t)g_free, new->decoded);
 			append_raw_header (task, target, new);
@@ -617,6 +831,25 @@ process_raw_headers (struct rspamd_task *task, GHashTable *target,
 	}
 }
 
+GByteArray *
+rspamd_mime_part_get_content (struct mime_part *part)
+{
+	struct rspamd_mime_part_encoded *enc = part->encoded;
+	GByteArray *ar;
+	gsize len;
+
+	if (part->content == NULL && enc != NULL) {
+		len = enc->len / 4 * 3 + 3;
+		ar = rspamd_mempool_alloc (enc->pool, sizeof (*ar));
+		ar->data = rspamd_mempool_alloc (enc->pool, len);
+		rspamd_cryptobox_base64_decode (enc->begin, enc->len, ar->data, &len);
+		ar->len = len;
+		part->content = ar;
+	}
+
+	return part->content;
+}
+
 static void
 free_byte_array_callback (void *pointer)
 {
@@ -677,74 +910,6 @@ charset_validate (rspamd_mempool_t *pool, const gchar *in, gchar **out)
 	return TRUE;
 }
 
-static GQuark
-converter_error_quark (void)
-{
-	return g_quark_from_static_string ("conversion error");
-}
-
-static gchar *
-rspamd_text_to_utf8 (struct rspamd_task *task,
-		gchar *input, gsize len, const gchar *in_enc,
-		gsize *olen, GError **err)
-{
-	gchar *res, *s, *d;
-	gsize outlen;
-	iconv_t ic;
-	gsize processed, ret;
-
-	ic = iconv_open (UTF8_CHARSET, in_enc);
-
-	if (ic == (iconv_t)-1) {
-		g_set_error (err, converter_error_quark(), EINVAL,
-				"cannot open iconv for: %s", in_enc);
-		return NULL;
-	}
-
-	/* For the most of charsets utf8 notation is larger than native one */
-	outlen = len * 2 + 1;
-
-	res = rspamd_mempool_alloc (task->task_pool, outlen);
-	s = input;
-	d = res;
-	processed = outlen - 1;
-
-	while (len > 0 && processed > 0) {
-		ret = iconv (ic, &s, &len, &d, &processed);
-		if (ret == (gsize)-1) {
-			switch (errno) {
-			case E2BIG:
-				g_set_error (err, converter_error_quark(), EINVAL,
-						"output of size %zd is not enough to handle "
-						"converison of %zd bytes", outlen, len);
-				iconv_close (ic);
-				return NULL;
-			case EILSEQ:
-			case EINVAL:
-				/* Ignore bad characters */
-				if (processed > 0 && len > 0) {
-					*d++ = '?';
-					s++;
-					len --;
-					processed --;
-				}
-				break;
-			}
-		}
-		else if (ret == 0) {
-			break;
-		}
-	}
-
-	*d = '\0';
-	*olen = d - res;
-
-	iconv_close (ic);
-
-	return res;
-}
-
-
 static GByteArray *
 convert_text_to_utf (struct rspamd_task *task,
 	GByteArray * part_content,
@@ -783,7 +948,8 @@ convert_text_to_utf (struct rspamd_task *task,
 	}
 
 	if (rspamd_regexp_match (utf_compatible_re, ocharset, strlen (ocharset), TRUE)) {
-		if (g_utf8_validate (part_content->data, part_content->len, NULL)) {
+		if (rspamd_mime_text_is_ascii (part_content->data, part_content->len) ||
+				g_utf8_validate (part_content->data, part_content->len, NULL)) {
 			SET_PART_UTF (text_part);
 			return part_content;
 		}
@@ -796,7 +962,7 @@ convert_text_to_utf (struct rspamd_task *task,
 		}
 	}
 	else {
-		res_str = rspamd_text_to_utf8 (task, part_content->data,
+		res_str = rspamd_mime_text_to_utf8 (task->task_pool, part_content->data,
 				part_content->len,
 				ocharset,
 				&write_bytes,
@@ -810,6 +976,11 @@ convert_text_to_utf (struct rspamd_task *task,
 			g_error_free (err);
 			return part_content;
 		}
+		else if (res_str == (gchar *)part_content->data) {
+			/* ASCII text is used as is */
+			SET_PART_UTF (text_part);
+			return part_content;
+		}
 	}
 
 	result_array = rspamd_mempool_alloc (task->task_pool, sizeof (GByteArray));
@@ -916,53 +1087,117 @@ detect_text_language (struct mime_text_part *part)
 			{ "nqo", "", G_UNICODE_SCRIPT_NKO }
 	};
 	const struct language_match *lm;
-	const int max_chars = 32;
-
-	if (part != NULL) {
-		if (IS_PART_UTF (part)) {
-			/* Try to detect encoding by several symbols */
-			const gchar *p, *pp;
-			gunichar c;
-			gint32 remain = part->content->len, max = 0, processed = 0;
-			gint32 scripts[G_N_ELEMENTS (language_codes)];
-			GUnicodeScript scc, sel = G_UNICODE_SCRIPT_COMMON;
-
-			p = part->content->data;
-			memset (scripts, 0, sizeof (scripts));
-
-			while (remain > 0 && processed < max_chars) {
-				c = g_utf8_get_char_validated (p, remain);
-				if (c == (gunichar) -2 || c == (gunichar) -1) {
-					break;
-				}
-				if (g_unichar_isalpha (c)) {
-					scc = g_unichar_get_script (c);
-					if (scc < (gint)G_N_ELEMENTS (scripts)) {
-						scripts[scc]++;
-					}
-					processed ++;
-				}
-				pp = g_utf8_next_char (p);
-				remain -= pp - p;
-				p = pp;
-			}
-			for (remain = 0; remain < (gint)G_N_ELEMENTS (scripts); remain++) {
-				if (scripts[remain] > max) {
-					max = scripts[remain];
-					sel = remain;
-				}
-			}
-			part->script = sel;
-			lm = bsearch (&sel, language_codes, G_N_ELEMENTS (language_codes),
-					sizeof (language_codes[0]), &language_elts_cmp);
+	GUnicodeScript sel;
 
-			if (lm != NULL) {
-				part->lang_code = lm->code;
-				part->language = lm->name;
-			}
+	if (part != NULL && IS_PART_UTF (part)) {
+		/* Scripts are counted by rspamd_mime_text_stat */
+		sel = part->text_stat.script;
+		lm = bsearch (&sel, language_codes, G_N_ELEMENTS (language_codes),
+				sizeof (language_codes[0]), &language_elts_cmp);
+
+		if (lm != NULL) {
+			part->lang_code = lm->code;
+			part->language = lm->name;
+		}
+	}
+}
+
+#ifdef WITH_SNOWBALL
+/* Number of entries in the stems memo, must be a power of two */
+#define STEM_MEMO_SIZE 4096
+/* Words and stems that are longer are not memorized */
+#define STEM_MEMO_WORD_LEN 30
+
+struct rspamd_stem_memo_elt {
+	const struct sb_stemmer *stem;
+	guint8 wlen;
+	guint8 slen;
+	gchar word[STEM_MEMO_WORD_LEN];
+	gchar res[STEM_MEMO_WORD_LEN];
+};
+
+/* Stemmers are created once per language per process */
+static GHashTable *stemmers = NULL;
+/* Direct mapped cache of recent stems shared by all stemmers */
+static struct rspamd_stem_memo_elt *stem_memo = NULL;
+
+static struct sb_stemmer *
+rspamd_stemmer_get (struct rspamd_task *task, const gchar *language)
+{
+	struct sb_stemmer *stem;
+
+	if (stemmers == NULL) {
+		stemmers = g_hash_table_new_full (rspamd_str_hash, rspamd_str_equal,
+				g_free, NULL);
+	}
+
+	if (g_hash_table_lookup_extended (stemmers, language, NULL,
+			(gpointer *)&stem)) {
+		return stem;
+	}
+
+	stem = sb_stemmer_new (language, "UTF_8");
+
+	if (stem == NULL) {
+		msg_info_task ("<%s> cannot create lemmatizer for %s language",
+				task->message_id, language);
+	}
+
+	/* Failures are cached as well */
+	g_hash_table_insert (stemmers, g_strdup (language), stem);
+
+	return stem;
+}
+
+/*
+ * Returns stem for a lowercased word, the result is valid till the next call
+ */
+static const gchar *
+rspamd_stemmer_stem (struct sb_stemmer *stem, const gchar *word, gsize len,
+		gsize *rlen)
+{
+	struct rspamd_stem_memo_elt *elt = NULL;
+	const sb_symbol *r;
+	guint64 h;
+	gsize slen;
+
+	if (len < STEM_MEMO_WORD_LEN) {
+		if (stem_memo == NULL) {
+			stem_memo = g_malloc0 (sizeof (*stem_memo) * STEM_MEMO_SIZE);
 		}
+
+		h = XXH64 (word, len, (guint64)GPOINTER_TO_SIZE (stem));
+		elt = &stem_memo[h & (STEM_MEMO_SIZE - 1)];
+
+		if (elt->stem == stem && elt->wlen == len &&
+				memcmp (elt->word, word, len) == 0) {
+			*rlen = elt->slen;
+
+			return elt->res;
+		}
+	}
+
+	r = sb_stemmer_stem (stem, (const sb_symbol *)word, len);
+
+	if (r == NULL) {
+		return NULL;
 	}
+
+	slen = sb_stemmer_length (stem);
+
+	if (elt != NULL && slen < STEM_MEMO_WORD_LEN) {
+		elt->stem = stem;
+		elt->wlen = len;
+		elt->slen = slen;
+		memcpy (elt->word, word, len);
+		memcpy (elt->res, r, slen);
+	}
+
+	*rlen = slen;
+
+	return (const gchar *)r;
 }
+#endif
 
 static void
 rspamd_normalize_text_part (struct rspamd_task *task,
@@ -970,19 +1205,16 @@ rspamd_normalize_text_part (struct rspamd_task *task,
 {
 #ifdef WITH_SNOWBALL
 	struct sb_stemmer *stem = NULL;
+	const gchar *r;
+	gsize nlen;
 #endif
 	rspamd_ftok_t *w;
-	const guchar *r;
 	gchar *temp_word;
-	guint i, nlen;
+	guint i;
 
 #ifdef WITH_SNOWBALL
 	if (part->language && part->language[0] != '\0' && IS_PART_UTF (part)) {
-		stem = sb_stemmer_new (part->language, "UTF_8");
-		if (stem == NULL) {
-			msg_info_task ("<%s> cannot create lemmatizer for %s language",
-				task->message_id, part->language);
-		}
+		stem = rspamd_stemmer_get (task, part->language);
 	}
 #endif
 
@@ -995,43 +1227,38 @@ rspamd_normalize_text_part (struct rspamd_task *task,
 	if (part->normalized_words) {
 		for (i = 0; i < part->normalized_words->len; i ++) {
 			w = &g_array_index (part->normalized_words, rspamd_ftok_t, i);
-			r = NULL;
+
+			if (w->len == 0 || (w->len == 6 && memcmp (w->begin, "!!EX!!", 6) == 0)) {
+				continue;
+			}
+
+			/* Copy and lowercase in a single pass, stems are never longer */
+			temp_word = rspamd_mempool_alloc (task->task_pool, w->len);
+
+			if (IS_PART_UTF (part) &&
+					!rspamd_mime_text_is_ascii ((const guchar *)w->begin, w->len)) {
+				memcpy (temp_word, w->begin, w->len);
+				rspamd_str_lc_utf8 (temp_word, w->len);
+			}
+			else {
+				rspamd_str_copy_lc (w->begin, temp_word, w->len);
+			}
+
+			w->begin = temp_word;
+
 #ifdef WITH_SNOWBALL
 			if (stem) {
-				r = sb_stemmer_stem (stem, w->begin, w->len);
-			}
-#endif
+				r = rspamd_stemmer_stem (stem, temp_word, w->len, &nlen);
 
-			if (w->len > 0 && !(w->len == 6 && memcmp (w->begin, "!!EX!!", 6) == 0)) {
 				if (r != NULL) {
-					nlen = strlen (r);
 					nlen = MIN (nlen, w->len);
-					temp_word = rspamd_mempool_alloc (task->task_pool, nlen);
 					memcpy (temp_word, r, nlen);
-					w->begin = temp_word;
 					w->len = nlen;
 				}
-				else {
-					temp_word = rspamd_mempool_alloc (task->task_pool, w->len);
-					memcpy (temp_word, w->begin, w->len);
-
-					if (IS_PART_UTF (part)) {
-						rspamd_str_lc_utf8 (temp_word, w->len);
-					}
-					else {
-						rspamd_str_lc (temp_word, w->len);
-					}
-
-					w->begin = temp_word;
-				}
 			}
+#endif
 		}
 	}
-#ifdef WITH_SNOWBALL
-	if (stem != NULL) {
-		sb_stemmer_delete (stem);
-	}
-#endif
 }
 
 #define MIN3(a, b, c) ((a) < (b) ? ((a) < (c) ? (a) : (c)) : ((b) < (c) ? (b) : (c)))
@@ -1116,37 +1343,48 @@ rspamd_check_gtube (struct rspamd_task *task, struct mime_text_part *part)
 	return FALSE;
 }
 
+/*
+ * Check Content-Disposition of a part, it works for parts created by both
+ * gmime and native parser
+ */
+static gboolean
+rspamd_mime_part_is_attachment (struct mime_part *mime_part)
+{
+	struct raw_header *rh;
+	const gsize attlen = sizeof ("attachment") - 1;
+
+	rh = rspamd_mime_headers_lookup_id (mime_part->raw_headers,
+			RSPAMD_HEADER_CONTENT_DISPOSITION);
+
+	if (rh == NULL || rh->value == NULL) {
+		return FALSE;
+	}
+
+	if (g_ascii_strncasecmp (rh->value, "attachment", attlen) == 0 &&
+			(rh->value[attlen] == '\0' || rh->value[attlen] == ';' ||
+			g_ascii_isspace (rh->value[attlen]))) {
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
 static void
 process_text_part (struct rspamd_task *task,
 	GByteArray *part_content,
 	GMimeContentType *type,
 	struct mime_part *mime_part,
-	GMimeObject *parent,
+	struct mime_part *parent,
 	gboolean is_empty)
 {
 	struct mime_text_part *text_part;
-	const gchar *cd, *p, *c;
-	guint remain;
 
 	/* Skip attachements */
-#ifndef GMIME24
-	cd = g_mime_part_get_content_disposition (GMIME_PART (mime_part->mime));
-	if (cd &&
-		g_ascii_strcasecmp (cd,
-		"attachment") == 0 && !task->cfg->check_text_attachements) {
-		debug_task ("skip attachments for checking as text parts");
-		return;
-	}
-#else
-	cd = g_mime_object_get_disposition (GMIME_OBJECT (mime_part->mime));
-	if (cd &&
-		g_ascii_strcasecmp (cd,
-		GMIME_DISPOSITION_ATTACHMENT) == 0 &&
-		!task->cfg->check_text_attachements) {
+	if (rspamd_mime_part_is_attachment (mime_part) &&
+			!task->cfg->check_text_attachements) {
 		debug_task ("skip attachments for checking as text parts");
 		return;
 	}
-#endif
 
 	if (g_mime_content_type_is_type (type, "text",
 		"html") || g_mime_content_type_is_type (type, "text", "xhtml")) {
@@ -1159,7 +1397,7 @@ process_text_part (struct rspamd_task *task,
 			text_part->flags |= RSPAMD_MIME_PART_FLAG_EMPTY;
 			text_part->orig = NULL;
 			text_part->content = NULL;
-			g_ptr_array_add (task->text_parts, text_part);
+			rspamd_mempool_ptr_array_add (task->text_parts, text_part);
 			return;
 		}
 		text_part->orig = part_content;
@@ -1188,14 +1426,12 @@ process_text_part (struct rspamd_task *task,
 		/* Handle offsets of this part */
 		if (text_part->urls_offset != NULL) {
 			text_part->urls_offset = g_list_reverse (text_part->urls_offset);
-			rspamd_mempool_add_destructor (task->task_pool,
-					(rspamd_mempool_destruct_t) g_list_free, text_part->urls_offset);
 		}
 
 		rspamd_mempool_add_destructor (task->task_pool,
 			(rspamd_mempool_destruct_t) free_byte_array_callback,
 			text_part->content);
-		g_ptr_array_add (task->text_parts, text_part);
+		rspamd_mempool_ptr_array_add (task->text_parts, text_part);
 	}
 	else if (g_mime_content_type_is_type (type, "text", "*")) {
 
@@ -1209,7 +1445,7 @@ process_text_part (struct rspamd_task *task,
 			text_part->flags |= RSPAMD_MIME_PART_FLAG_EMPTY;
 			text_part->orig = NULL;
 			text_part->content = NULL;
-			g_ptr_array_add (task->text_parts, text_part);
+			rspamd_mempool_ptr_array_add (task->text_parts, text_part);
 			return;
 		}
 
@@ -1219,7 +1455,7 @@ process_text_part (struct rspamd_task *task,
 				text_part);
 		text_part->orig = part_content;
 		rspamd_url_text_extract (task->task_pool, task, text_part, FALSE);
-		g_ptr_array_add (task->text_parts, text_part);
+		rspamd_mempool_ptr_array_add (task->text_parts, text_part);
 	}
 	else {
 		return;
@@ -1243,29 +1479,18 @@ process_text_part (struct rspamd_task *task,
 	}
 
 	/* Post process part */
+	rspamd_mime_text_stat (text_part->content->data, text_part->content->len,
+			IS_PART_UTF (text_part), &text_part->text_stat);
+	text_part->script = text_part->text_stat.script;
+	text_part->nlines = text_part->text_stat.nlines;
 	detect_text_language (text_part);
 	rspamd_normalize_text_part (task, text_part);
-
-	/* Calculate number of lines */
-	p = text_part->content->data;
-	remain = text_part->content->len;
-	c = p;
-
-	while (p != NULL && remain > 0) {
-		p = memchr (c, '\n', remain);
-
-		if (p != NULL) {
-			text_part->nlines ++;
-			remain -= p - c + 1;
-			c = p + 1;
-		}
-	}
 }
 
 struct mime_foreach_data {
 	struct rspamd_task *task;
 	guint parser_recursion;
-	GMimeObject *parent;
+	struct mime_part *parent;
 };
 
 #ifdef GMIME24
@@ -1347,13 +1572,9 @@ mime_foreach_callback (GMimeObject * part, gpointer user_data)
 				sizeof (struct mime_part));
 
 		hdrs = g_mime_object_get_headers (GMIME_OBJECT (part));
-		mime_part->raw_headers = g_hash_table_new (rspamd_strcase_hash,
-				rspamd_strcase_equal);
-		rspamd_mempool_add_destructor (task->task_pool,
-				(rspamd_mempool_destruct_t) g_hash_table_unref,
-				mime_part->raw_headers);
+		mime_part->raw_headers = rspamd_mime_headers_new (task->task_pool);
 		if (hdrs != NULL) {
-			process_raw_headers (task, mime_part->raw_headers,
+			rspamd_message_process_headers (task, mime_part->raw_headers,
 					hdrs, strlen (hdrs));
 			g_free (hdrs);
 		}
@@ -1368,9 +1589,9 @@ mime_foreach_callback (GMimeObject * part, gpointer user_data)
 		debug_task ("found part with content-type: %s/%s",
 				type->type,
 				type->subtype);
-		g_ptr_array_add (task->parts, mime_part);
+		rspamd_mempool_ptr_array_add (task->parts, mime_part);
 
-		md->parent = part;
+		md->parent = mime_part;
 	}
 	else if (GMIME_IS_PART (part)) {
 		/* a normal leaf part, could be text/plain or image/jpeg etc */
@@ -1413,13 +1634,9 @@ mime_foreach_callback (GMimeObject * part, gpointer user_data)
 						sizeof (struct mime_part));
 
 				hdrs = g_mime_object_get_headers (GMIME_OBJECT (part));
-				mime_part->raw_headers = g_hash_table_new (rspamd_strcase_hash,
-						rspamd_strcase_equal);
-				rspamd_mempool_add_destructor (task->task_pool,
-					(rspamd_mempool_destruct_t) g_hash_table_unref,
-					mime_part->raw_headers);
+				mime_part->raw_headers = rspamd_mime_headers_new (task->task_pool);
 				if (hdrs != NULL) {
-					process_raw_headers (task, mime_part->raw_headers,
+					rspamd_message_process_headers (task, mime_part->raw_headers,
 							hdrs, strlen (hdrs));
 					g_free (hdrs);
 				}
@@ -1434,7 +1651,7 @@ mime_foreach_callback (GMimeObject * part, gpointer user_data)
 				debug_task ("found part with content-type: %s/%s",
 					type->type,
 					type->subtype);
-				g_ptr_array_add (task->parts, mime_part);
+				rspamd_mempool_ptr_array_add (task->parts, mime_part);
 				/* Skip empty parts */
 				process_text_part (task,
 					part_content,
@@ -1547,13 +1764,15 @@ rspamd_message_parse (struct rspamd_task *task)
 {
 	GMimeMessage *message;
 	GMimeParser *parser;
-	GMimeStream *stream;
-	GByteArray *tmp;
+	GMimeStream *stream, *hdr_stream = NULL;
+	GByteArray *tmp, *hdr_tmp;
 	GList *first, *cur;
-	GMimeObject *parent;
 	const GMimeContentType *ct;
 	struct raw_header *rh;
 	struct mime_text_part *p1, *p2;
+	struct mime_part *mime_part;
+	GString str;
+	gboolean native = FALSE;
 	struct mime_foreach_data md;
 	struct received_header *recv, *trecv;
 	gchar *url_str;
@@ -1585,11 +1804,32 @@ rspamd_message_parse (struct rspamd_task *task)
 	g_mime_stream_mem_set_owner (GMIME_STREAM_MEM (stream), FALSE);
 
 	if (task->flags & RSPAMD_TASK_FLAG_MIME) {
+		str.str = tmp->data;
+		str.len = tmp->len;
+		hdr_pos = rspamd_string_find_eoh (&str);
 
 		debug_task ("construct mime parser from string length %d",
 				(gint) task->msg.len);
-		/* create a new parser object to parse the stream */
-		parser = g_mime_parser_new_with_stream (stream);
+
+		if (task->cfg->native_mime_parser && hdr_pos > 0 &&
+				hdr_pos < tmp->len) {
+			/*
+			 * Gmime is used merely to parse message headers, the structure
+			 * of the message is parsed by rspamd_mime_parse_task
+			 */
+			native = TRUE;
+			hdr_tmp = rspamd_mempool_alloc (task->task_pool,
+					sizeof (GByteArray));
+			hdr_tmp->data = tmp->data;
+			hdr_tmp->len = hdr_pos;
+			hdr_stream = g_mime_stream_mem_new_with_byte_array (hdr_tmp);
+			g_mime_stream_mem_set_owner (GMIME_STREAM_MEM (hdr_stream), FALSE);
+			parser = g_mime_parser_new_with_stream (hdr_stream);
+		}
+		else {
+			/* create a new parser object to parse the stream */
+			parser = g_mime_parser_new_with_stream (stream);
+		}
 
 		/* parse the message from the stream */
 		message = g_mime_parser_construct_message (parser);
@@ -1604,30 +1844,30 @@ rspamd_message_parse (struct rspamd_task *task)
 						"cannot parse MIME in the message");
 				/* TODO: backport to 0.9 */
 				g_object_unref (parser);
+
+				if (hdr_stream) {
+					g_object_unref (hdr_stream);
+				}
+
 				return FALSE;
 			}
 			else {
 				task->flags &= ~RSPAMD_TASK_FLAG_MIME;
+				native = FALSE;
 				rspamd_message_from_data (task, tmp, stream);
 			}
 		}
 		else {
-			GString str;
-
 			task->message = message;
 			rspamd_mempool_add_destructor (task->task_pool,
 					(rspamd_mempool_destruct_t) destroy_message, task->message);
-			str.str = tmp->data;
-			str.len = tmp->len;
-
-			hdr_pos = rspamd_string_find_eoh (&str);
 
 			if (hdr_pos > 0 && hdr_pos < tmp->len) {
 				task->raw_headers_content.begin = (gchar *) (p);
 				task->raw_headers_content.len = (guint64) (hdr_pos);
 
 				if (task->raw_headers_content.len > 0) {
-					process_raw_headers (task, task->raw_headers,
+					rspamd_message_process_headers (task, task->raw_headers,
 							task->raw_headers_content.begin,
 							task->raw_headers_content.len);
 				}
@@ -1637,6 +1877,10 @@ rspamd_message_parse (struct rspamd_task *task)
 		/* free the parser (and the stream) */
 		g_object_unref (stream);
 		g_object_unref (parser);
+
+		if (hdr_stream) {
+			g_object_unref (hdr_stream);
+		}
 	}
 	else {
 		task->flags &= ~RSPAMD_TASK_FLAG_MIME;
@@ -1653,17 +1897,34 @@ rspamd_message_parse (struct rspamd_task *task)
 
 	memset (&md, 0, sizeof (md));
 	md.task = task;
+
+	if (native) {
+		rspamd_mime_parse_task (task, (const gchar *)tmp->data, tmp->len);
+
+		for (i = 0; i < (gint)task->parts->len; i ++) {
+			mime_part = g_ptr_array_index (task->parts, i);
+
+			/* Attachments decoded on demand are never text parts */
+			if (mime_part->content != NULL &&
+					!g_mime_content_type_is_type (mime_part->type,
+					"multipart", "*")) {
+				process_text_part (task,
+						mime_part->content,
+						mime_part->type,
+						mime_part,
+						mime_part->parent,
+						(mime_part->content->len <= 0));
+			}
+		}
+	}
+	else {
 #ifdef GMIME24
-	g_mime_message_foreach (task->message, mime_foreach_callback, &md);
+		g_mime_message_foreach (task->message, mime_foreach_callback, &md);
 #else
-	/*
-	 * This is rather strange, but gmime 2.2 do NOT pass top-level part to foreach callback
-	 * so we need to set up parent part by hands
-	 */
-	md.parent = g_mime_message_get_mime_part (task->message);
-	g_object_unref (md.parent);
-	g_mime_message_foreach_part (task->message, mime_foreach_callback, &md);
+		/* gmime 2.2 does not pass top-level part to foreach callback */
+		g_mime_message_foreach_part (task->message, mime_foreach_callback, &md);
 #endif
+	}
 
 	debug_task ("found %ud parts in message", task->parts->len);
 	if (task->queue_id == NULL) {
@@ -1680,7 +1941,7 @@ rspamd_message_parse (struct rspamd_task *task)
 		recv =
 				rspamd_mempool_alloc0 (task->task_pool,
 						sizeof (struct received_header));
-		parse_recv_header (task->task_pool, cur->data, recv);
+		rspamd_message_parse_received (task->task_pool, cur->data, recv);
 
 		/*
 		 * For the first header we must ensure that
@@ -1727,7 +1988,7 @@ rspamd_message_parse (struct rspamd_task *task)
 			}
 		}
 
-		g_ptr_array_add (task->received, recv);
+		rspamd_mempool_ptr_array_add (task->received, recv);
 	}
 
 	/* Extract data from received header if we were not given IP */
@@ -1827,11 +2088,7 @@ rspamd_message_parse (struct rspamd_task *task)
 
 					if ((rc == URI_ERRNO_OK) && subject_url->hostlen > 0) {
 						if (subject_url->protocol != PROTOCOL_MAILTO) {
-							if (!g_hash_table_lookup (task->urls, subject_url)) {
-								g_hash_table_insert (task->urls,
-										subject_url,
-										subject_url);
-							}
+							rspamd_url_set_add (task->urls, subject_url);
 						}
 					}
 					else if (rc != URI_ERRNO_OK) {
@@ -1855,8 +2112,7 @@ rspamd_message_parse (struct rspamd_task *task)
 
 		/* First of all check parent object */
 		if (p1->parent && p1->parent == p2->parent) {
-			parent = p1->parent;
-			ct = g_mime_object_get_content_type (parent);
+			ct = p1->parent->type;
 			if (ct == NULL ||
 					!g_mime_content_type_is_type ((GMimeContentType *)ct,
 							"multipart", "alternative")) {
@@ -1922,7 +2178,7 @@ rspamd_message_get_header (struct rspamd_task *task,
 	GList *gret = NULL;
 	struct raw_header *rh;
 
-	rh = g_hash_table_lookup (task->raw_headers, field);
+	rh = rspamd_mime_headers_lookup (task->raw_headers, field);
 
 	if (rh == NULL) {
 		return NULL;
@@ -1931,19 +2187,17 @@ rspamd_message_get_header (struct rspamd_task *task,
 	while (rh) {
 		if (strong) {
 			if (strcmp (rh->name, field) == 0) {
-				gret = g_list_prepend (gret, rh);
+				gret = rspamd_mempool_glist_prepend (task->task_pool, gret, rh);
 			}
 		}
 		else {
-			gret = g_list_prepend (gret, rh);
+			gret = rspamd_mempool_glist_prepend (task->task_pool, gret, rh);
 		}
 		rh = rh->next;
 	}
 
 	if (gret != NULL) {
 		gret = g_list_reverse (gret);
-		rspamd_mempool_add_destructor (task->task_pool,
-			(rspamd_mempool_destruct_t)g_list_free, gret);
 	}
 
 	return gret;
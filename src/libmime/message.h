@@ -8,19 +8,30 @@
 
 #include "config.h"
 #include <gmime/gmime.h>
+#include "charset.h"
+#include "mime_headers.h"
 
 struct rspamd_task;
 struct controller_session;
 struct html_content;
 
+/* Transfer encoded content of a part that is decoded on demand */
+struct rspamd_mime_part_encoded {
+	const gchar *begin;
+	gsize len;
+	rspamd_mempool_t *pool;
+};
+
 struct mime_part {
 	GMimeContentType *type;
-	GByteArray *content;
-	GMimeObject *parent;
-	GMimeObject *mime;
-	GHashTable *raw_headers;
+	GByteArray *content;		/**< use rspamd_mime_part_get_content unless
+									 it is a text part					*/
+	struct mime_part *parent;	/**< enclosing multipart part or NULL		*/
+	GMimeObject *mime;			/**< NULL for parts from the native parser	*/
+	struct rspamd_mime_headers *raw_headers;
 	gchar *checksum;
 	const gchar *filename;
+	struct rspamd_mime_part_encoded *encoded; /**< set if content is NULL	*/
 };
 
 #define RSPAMD_MIME_PART_FLAG_UTF (1 << 0)
@@ -43,19 +54,36 @@ struct mime_text_part {
 	GByteArray *content;
 	struct html_content *html;
 	GList *urls_offset;	/**< list of offsets of urls						*/
-	GMimeObject *parent;
+	struct mime_part *parent;
 	struct mime_part *mime_part;
 	GArray *normalized_words;
+	struct rspamd_mime_text_stat text_stat;	/**< characters statistics		*/
 	guint nlines;
 	guint64 hash;
 };
 
+enum rspamd_received_type {
+	RSPAMD_RECEIVED_UNKNOWN = 0,
+	RSPAMD_RECEIVED_SMTP,
+	RSPAMD_RECEIVED_ESMTP,
+	RSPAMD_RECEIVED_LMTP,
+	RSPAMD_RECEIVED_IMAP,
+	RSPAMD_RECEIVED_LOCAL,
+	RSPAMD_RECEIVED_HTTP
+};
+
+#define RSPAMD_RECEIVED_FLAG_SSL (1 << 0)
+#define RSPAMD_RECEIVED_FLAG_AUTHENTICATED (1 << 1)
+
 struct received_header {
 	gchar *from_hostname;
 	gchar *from_ip;
 	gchar *real_hostname;
 	gchar *real_ip;
 	gchar *by_hostname;
+	time_t timestamp;					/**< time after `;`, 0 if not parsed	*/
+	enum rspamd_received_type type;		/**< protocol from `with` clause		*/
+	gint flags;							/**< RSPAMD_RECEIVED_FLAG_*				*/
 	gint is_error;
 };
 
@@ -66,6 +94,8 @@ struct raw_header {
 	gboolean empty_separator;
 	gchar *separator;
 	gchar *decoded;
+	gsize value_len;
+	gsize decoded_len;
 	struct raw_header *prev, *next;
 };
 
@@ -76,6 +106,35 @@ struct raw_header {
  */
 gboolean rspamd_message_parse (struct rspamd_task *task);
 
+/**
+ * Parse block of raw headers and append them to `target`
+ * @param task worker task structure
+ * @param target headers storage
+ * @param in headers block
+ * @param len length of block
+ */
+void rspamd_message_process_headers (struct rspamd_task *task,
+		struct rspamd_mime_headers *target,
+		const gchar *in, gsize len);
+
+/**
+ * Parse decoded value of Received header
+ * @param pool memory pool for tokens
+ * @param rh raw header
+ * @param r output structure
+ */
+void rspamd_message_parse_received (rspamd_mempool_t *pool,
+		struct raw_header *rh,
+		struct received_header *r);
+
+/**
+ * Get decoded content of a part, base64 attachments from the native parser
+ * are decoded on the first call
+ * @param part
+ * @return decoded content
+ */
+GByteArray * rspamd_mime_part_get_content (struct mime_part *part);
+
 /*
  * Get a list of header's values with specified header's name using raw headers
  * @param task worker task structure
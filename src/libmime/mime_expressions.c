@@ -1372,7 +1372,7 @@ rspamd_has_fake_html (struct rspamd_task * task, GArray * args, void *unused)
 	for (i = 0; i < task->text_parts->len; i ++) {
 		p = g_ptr_array_index (task->text_parts, i);
 
-		if (!IS_PART_EMPTY (p) && IS_PART_HTML (p) && p->html->html_tags == NULL) {
+		if (!IS_PART_EMPTY (p) && IS_PART_HTML (p) && p->html->ntags == 0) {
 			res = TRUE;
 		}
 
@@ -1400,7 +1400,7 @@ rspamd_raw_header_exists (struct rspamd_task *task, GArray * args, void *unused)
 		return FALSE;
 	}
 
-	return g_hash_table_lookup (task->raw_headers, arg->data) != NULL;
+	return rspamd_mime_headers_lookup (task->raw_headers, arg->data) != NULL;
 }
 
 static gboolean
@@ -1554,7 +1554,6 @@ rspamd_content_type_compare_param (struct rspamd_task * task,
 	const gchar *param_data;
 	rspamd_regexp_t *re;
 	struct expression_argument *arg, *arg1, *arg_pattern;
-	GMimeObject *part;
 	GMimeContentType *ct;
 	gint r;
 	guint i;
@@ -1573,8 +1572,7 @@ rspamd_content_type_compare_param (struct rspamd_task * task,
 
 	for (i = 0; i < task->parts->len; i ++) {
 		cur_part = g_ptr_array_index (task->parts, i);
-		part = cur_part->mime;
-		ct = (GMimeContentType *)g_mime_object_get_content_type (part);
+		ct = cur_part->type;
 
 		if (args->len >= 3) {
 			arg1 = &g_array_index (args, struct expression_argument, 2);
@@ -1592,9 +1590,6 @@ rspamd_content_type_compare_param (struct rspamd_task * task,
 				recursive = TRUE;
 			}
 		}
-#ifndef GMIME24
-		g_object_unref (part);
-#endif
 
 		if ((param_data =
 				g_mime_content_type_get_parameter ((GMimeContentType *)ct,
@@ -1632,7 +1627,6 @@ rspamd_content_type_has_param (struct rspamd_task * task,
 	gchar *param_name;
 	const gchar *param_data;
 	struct expression_argument *arg, *arg1;
-	GMimeObject *part;
 	GMimeContentType *ct;
 	gboolean recursive = FALSE, result = FALSE;
 	guint i;
@@ -1649,8 +1643,7 @@ rspamd_content_type_has_param (struct rspamd_task * task,
 
 	for (i = 0; i < task->parts->len; i ++) {
 		cur_part = g_ptr_array_index (task->parts, i);
-		part = cur_part->mime;
-		ct = (GMimeContentType *)g_mime_object_get_content_type (part);
+		ct = cur_part->type;
 
 		if (args->len >= 2) {
 			arg1 = &g_array_index (args, struct expression_argument, 2);
@@ -1669,9 +1662,6 @@ rspamd_content_type_has_param (struct rspamd_task * task,
 			}
 		}
 
-#ifndef GMIME24
-		g_object_unref (part);
-#endif
 		if ((param_data =
 				g_mime_content_type_get_parameter ((GMimeContentType *)ct,
 						param_name)) != NULL) {
@@ -1694,7 +1684,6 @@ rspamd_content_type_check (struct rspamd_task *task,
 	const gchar *param_data;
 	rspamd_regexp_t *re;
 	struct expression_argument *arg1, *arg_pattern;
-	GMimeObject *part;
 	GMimeContentType *ct;
 	gint r;
 	guint i;
@@ -1710,8 +1699,7 @@ rspamd_content_type_check (struct rspamd_task *task,
 
 	for (i = 0; i < task->parts->len; i ++) {
 		cur_part = g_ptr_array_index (task->parts, i);
-		part = cur_part->mime;
-		ct = (GMimeContentType *)g_mime_object_get_content_type (part);
+		ct = cur_part->type;
 
 		if (args->len >= 2) {
 			arg1 = &g_array_index (args, struct expression_argument, 1);
@@ -1730,9 +1718,6 @@ rspamd_content_type_check (struct rspamd_task *task,
 			}
 		}
 
-#ifndef GMIME24
-		g_object_unref (part);
-#endif
 		if (check_subtype) {
 			param_data = ct->subtype;
 		}
@@ -1810,18 +1795,22 @@ compare_subtype (struct rspamd_task *task, GMimeContentType * ct,
 static gboolean
 compare_len (struct mime_part *part, guint min, guint max)
 {
+	GByteArray *content;
+
 	if (min == 0 && max == 0) {
 		return TRUE;
 	}
 
+	content = rspamd_mime_part_get_content (part);
+
 	if (min == 0) {
-		return part->content->len <= max;
+		return content->len <= max;
 	}
 	else if (max == 0) {
-		return part->content->len >= min;
+		return content->len >= min;
 	}
 	else {
-		return part->content->len >= min && part->content->len <= max;
+		return content->len >= min && content->len <= max;
 	}
 }
 
@@ -0,0 +1,196 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "mime_headers.h"
+#include "message.h"
+#include "str_util.h"
+#include "utlist.h"
+
+/* Must be a power of two and much larger than number of known headers */
+#define RSPAMD_HEADER_NAMES_SIZE 256
+
+struct rspamd_header_name {
+	const gchar *name;
+	gint id;
+};
+
+static const struct rspamd_header_name known_headers[] = {
+	{"Received", RSPAMD_HEADER_RECEIVED},
+	{"From", RSPAMD_HEADER_FROM},
+	{"To", RSPAMD_HEADER_TO},
+	{"Cc", RSPAMD_HEADER_CC},
+	{"Bcc", RSPAMD_HEADER_BCC},
+	{"Subject", RSPAMD_HEADER_SUBJECT},
+	{"Date", RSPAMD_HEADER_DATE},
+	{"Message-Id", RSPAMD_HEADER_MESSAGE_ID},
+	{"Reply-To", RSPAMD_HEADER_REPLY_TO},
+	{"Sender", RSPAMD_HEADER_SENDER},
+	{"Return-Path", RSPAMD_HEADER_RETURN_PATH},
+	{"Delivered-To", RSPAMD_HEADER_DELIVERED_TO},
+	{"In-Reply-To", RSPAMD_HEADER_IN_REPLY_TO},
+	{"References", RSPAMD_HEADER_REFERENCES},
+	{"MIME-Version", RSPAMD_HEADER_MIME_VERSION},
+	{"Content-Type", RSPAMD_HEADER_CONTENT_TYPE},
+	{"Content-Transfer-Encoding", RSPAMD_HEADER_CONTENT_TRANSFER_ENCODING},
+	{"Content-Disposition", RSPAMD_HEADER_CONTENT_DISPOSITION},
+	{"Content-Id", RSPAMD_HEADER_CONTENT_ID},
+	{"DKIM-Signature", RSPAMD_HEADER_DKIM_SIGNATURE},
+	{"DomainKey-Signature", RSPAMD_HEADER_DOMAINKEY_SIGNATURE},
+	{"Authentication-Results", RSPAMD_HEADER_AUTHENTICATION_RESULTS},
+	{"Received-SPF", RSPAMD_HEADER_RECEIVED_SPF},
+	{"List-Id", RSPAMD_HEADER_LIST_ID},
+	{"List-Unsubscribe", RSPAMD_HEADER_LIST_UNSUBSCRIBE},
+	{"Precedence", RSPAMD_HEADER_PRECEDENCE},
+	{"Organization", RSPAMD_HEADER_ORGANIZATION},
+	{"User-Agent", RSPAMD_HEADER_USER_AGENT},
+	{"X-Mailer", RSPAMD_HEADER_X_MAILER},
+	{"X-Priority", RSPAMD_HEADER_X_PRIORITY},
+	{"X-MSMail-Priority", RSPAMD_HEADER_X_MSMAIL_PRIORITY},
+	{"X-MimeOLE", RSPAMD_HEADER_X_MIMEOLE},
+	{"X-Originating-IP", RSPAMD_HEADER_X_ORIGINATING_IP},
+	{"X-Mailing-List", RSPAMD_HEADER_X_MAILING_LIST},
+	{"Thread-Index", RSPAMD_HEADER_THREAD_INDEX},
+};
+
+struct rspamd_header_name_slot {
+	const gchar *name;
+	guint len;
+	gint id;
+};
+
+static struct rspamd_header_name_slot header_names[RSPAMD_HEADER_NAMES_SIZE];
+static gboolean header_names_initialized = FALSE;
+
+static inline guint
+rspamd_header_name_hash (const gchar *name, gsize len)
+{
+	guint h = len;
+	gsize i;
+
+	for (i = 0; i < len; i ++) {
+		h = h * 33 + g_ascii_tolower (name[i]);
+	}
+
+	return h;
+}
+
+static void
+rspamd_header_names_init (void)
+{
+	guint i, pos;
+
+	G_STATIC_ASSERT (G_N_ELEMENTS (known_headers) == RSPAMD_HEADER_MAX);
+	G_STATIC_ASSERT (RSPAMD_HEADER_MAX < RSPAMD_HEADER_NAMES_SIZE / 4);
+
+	for (i = 0; i < G_N_ELEMENTS (known_headers); i ++) {
+		g_assert (known_headers[i].id == (gint)i);
+		pos = rspamd_header_name_hash (known_headers[i].name,
+				strlen (known_headers[i].name)) &
+				(RSPAMD_HEADER_NAMES_SIZE - 1);
+
+		while (header_names[pos].name != NULL) {
+			pos = (pos + 1) & (RSPAMD_HEADER_NAMES_SIZE - 1);
+		}
+
+		header_names[pos].name = known_headers[i].name;
+		header_names[pos].len = strlen (known_headers[i].name);
+		header_names[pos].id = known_headers[i].id;
+	}
+
+	header_names_initialized = TRUE;
+}
+
+gint
+rspamd_mime_header_id (const gchar *name, gsize len)
+{
+	guint pos;
+
+	if (!header_names_initialized) {
+		rspamd_header_names_init ();
+	}
+
+	pos = rspamd_header_name_hash (name, len) & (RSPAMD_HEADER_NAMES_SIZE - 1);
+
+	while (header_names[pos].name != NULL) {
+		if (header_names[pos].len == len &&
+				rspamd_lc_cmp (header_names[pos].name, name, len) == 0) {
+			return header_names[pos].id;
+		}
+
+		pos = (pos + 1) & (RSPAMD_HEADER_NAMES_SIZE - 1);
+	}
+
+	return RSPAMD_HEADER_UNKNOWN;
+}
+
+struct rspamd_mime_headers *
+rspamd_mime_headers_new (rspamd_mempool_t *pool)
+{
+	struct rspamd_mime_headers *hdrs;
+
+	hdrs = rspamd_mempool_alloc0 (pool, sizeof (*hdrs));
+	hdrs->other = g_hash_table_new (rspamd_strcase_hash,
+			rspamd_strcase_equal);
+	rspamd_mempool_add_destructor (pool,
+			(rspamd_mempool_destruct_t) g_hash_table_unref,
+			hdrs->other);
+
+	return hdrs;
+}
+
+void
+rspamd_mime_headers_append (struct rspamd_mime_headers *hdrs,
+		struct raw_header *rh)
+{
+	struct raw_header *lp;
+	gint id;
+
+	rh->next = NULL;
+	rh->prev = rh;
+	id = rspamd_mime_header_id (rh->name, strlen (rh->name));
+
+	if (id != RSPAMD_HEADER_UNKNOWN) {
+		lp = hdrs->known[id];
+
+		if (lp != NULL) {
+			DL_APPEND (lp, rh);
+		}
+		else {
+			hdrs->known[id] = rh;
+		}
+	}
+	else if ((lp = g_hash_table_lookup (hdrs->other, rh->name)) != NULL) {
+		DL_APPEND (lp, rh);
+	}
+	else {
+		g_hash_table_insert (hdrs->other, rh->name, rh);
+	}
+}
+
+struct raw_header *
+rspamd_mime_headers_lookup (struct rspamd_mime_headers *hdrs,
+		const gchar *name)
+{
+	gint id;
+
+	id = rspamd_mime_header_id (name, strlen (name));
+
+	if (id != RSPAMD_HEADER_UNKNOWN) {
+		return hdrs->known[id];
+	}
+
+	return g_hash_table_lookup (hdrs->other, name);
+}
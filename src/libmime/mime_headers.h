@@ -0,0 +1,113 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SRC_LIBMIME_MIME_HEADERS_H_
+#define SRC_LIBMIME_MIME_HEADERS_H_
+
+#include "config.h"
+#include "mem_pool.h"
+
+/*
+ * Raw headers storage. Well known header names are interned to small
+ * integer ids once per process, headers with such names are stored in a flat
+ * array indexed by id, other ones are stored in a hash table.
+ */
+
+enum rspamd_header_id {
+	RSPAMD_HEADER_UNKNOWN = -1,
+	RSPAMD_HEADER_RECEIVED = 0,
+	RSPAMD_HEADER_FROM,
+	RSPAMD_HEADER_TO,
+	RSPAMD_HEADER_CC,
+	RSPAMD_HEADER_BCC,
+	RSPAMD_HEADER_SUBJECT,
+	RSPAMD_HEADER_DATE,
+	RSPAMD_HEADER_MESSAGE_ID,
+	RSPAMD_HEADER_REPLY_TO,
+	RSPAMD_HEADER_SENDER,
+	RSPAMD_HEADER_RETURN_PATH,
+	RSPAMD_HEADER_DELIVERED_TO,
+	RSPAMD_HEADER_IN_REPLY_TO,
+	RSPAMD_HEADER_REFERENCES,
+	RSPAMD_HEADER_MIME_VERSION,
+	RSPAMD_HEADER_CONTENT_TYPE,
+	RSPAMD_HEADER_CONTENT_TRANSFER_ENCODING,
+	RSPAMD_HEADER_CONTENT_DISPOSITION,
+	RSPAMD_HEADER_CONTENT_ID,
+	RSPAMD_HEADER_DKIM_SIGNATURE,
+	RSPAMD_HEADER_DOMAINKEY_SIGNATURE,
+	RSPAMD_HEADER_AUTHENTICATION_RESULTS,
+	RSPAMD_HEADER_RECEIVED_SPF,
+	RSPAMD_HEADER_LIST_ID,
+	RSPAMD_HEADER_LIST_UNSUBSCRIBE,
+	RSPAMD_HEADER_PRECEDENCE,
+	RSPAMD_HEADER_ORGANIZATION,
+	RSPAMD_HEADER_USER_AGENT,
+	RSPAMD_HEADER_X_MAILER,
+	RSPAMD_HEADER_X_PRIORITY,
+	RSPAMD_HEADER_X_MSMAIL_PRIORITY,
+	RSPAMD_HEADER_X_MIMEOLE,
+	RSPAMD_HEADER_X_ORIGINATING_IP,
+	RSPAMD_HEADER_X_MAILING_LIST,
+	RSPAMD_HEADER_THREAD_INDEX,
+	RSPAMD_HEADER_MAX
+};
+
+struct raw_header;
+
+struct rspamd_mime_headers {
+	struct raw_header *known[RSPAMD_HEADER_MAX];
+	GHashTable *other;
+};
+
+/**
+ * Get id of a header name (case insensitive)
+ * @param name header name
+ * @param len length of name
+ * @return id or RSPAMD_HEADER_UNKNOWN
+ */
+gint rspamd_mime_header_id (const gchar *name, gsize len);
+
+/**
+ * Create new headers storage, it is freed with the pool
+ * @param pool
+ * @return
+ */
+struct rspamd_mime_headers * rspamd_mime_headers_new (rspamd_mempool_t *pool);
+
+/**
+ * Append raw header to the list of headers with the same name
+ * @param hdrs
+ * @param rh
+ */
+void rspamd_mime_headers_append (struct rspamd_mime_headers *hdrs,
+		struct raw_header *rh);
+
+/**
+ * Find list of headers with the specified name (case insensitive)
+ * @param hdrs
+ * @param name
+ * @return the first header in list or NULL
+ */
+struct raw_header * rspamd_mime_headers_lookup (
+		struct rspamd_mime_headers *hdrs,
+		const gchar *name);
+
+/**
+ * Find list of headers by id
+ */
+#define rspamd_mime_headers_lookup_id(hdrs, id) ((hdrs)->known[(id)])
+
+#endif /* SRC_LIBMIME_MIME_HEADERS_H_ */
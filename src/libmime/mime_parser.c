@@ -0,0 +1,395 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "config.h"
+#include "rspamd.h"
+#include "message.h"
+#include "mime_parser.h"
+#include "cryptobox.h"
+
+struct rspamd_mime_parser_ctx {
+	struct rspamd_task *task;
+	guint nparts;
+	gboolean overflow;
+};
+
+static void rspamd_mime_parse_entity (struct rspamd_mime_parser_ctx *ctx,
+		struct mime_part *parent, const gchar *start, gsize len, guint depth);
+
+static GByteArray *
+rspamd_mime_parser_array (struct rspamd_task *task, const gchar *data,
+		gsize len)
+{
+	GByteArray *ar;
+
+	/* Read-only array that is never freed by glib */
+	ar = rspamd_mempool_alloc (task->task_pool, sizeof (GByteArray));
+	ar->data = (guint8 *)data;
+	ar->len = len;
+
+	return ar;
+}
+
+static GMimeContentType *
+rspamd_mime_parser_content_type (struct rspamd_task *task,
+		struct mime_part *part)
+{
+	struct raw_header *rh;
+	GMimeContentType *ct = NULL;
+
+	rh = rspamd_mime_headers_lookup_id (part->raw_headers,
+			RSPAMD_HEADER_CONTENT_TYPE);
+
+	if (rh != NULL && rh->value != NULL) {
+		ct = g_mime_content_type_new_from_string (rh->value);
+	}
+
+	if (ct == NULL) {
+		/* RFC 2045: default is text/plain */
+		ct = g_mime_content_type_new ("text", "plain");
+	}
+
+#ifdef GMIME24
+	rspamd_mempool_add_destructor (task->task_pool,
+			(rspamd_mempool_destruct_t) g_object_unref, ct);
+#else
+	rspamd_mempool_add_destructor (task->task_pool,
+			(rspamd_mempool_destruct_t) g_mime_content_type_destroy, ct);
+#endif
+
+	return ct;
+}
+
+/*
+ * Extract parameter from a header value, e.g. filename from
+ * `attachment; filename="file.txt"`
+ */
+static const gchar *
+rspamd_mime_parser_header_param (struct rspamd_task *task,
+		const gchar *value, const gchar *name)
+{
+	const gchar *p, *c, *e, *end;
+	gchar *res;
+	gsize nlen;
+	goffset pos;
+
+	nlen = strlen (name);
+	p = value;
+	end = value + strlen (value);
+
+	while ((pos = rspamd_substring_search_caseless (p, end - p,
+			name, nlen)) != -1) {
+		p += pos;
+		c = p + nlen;
+
+		if (p == value || p[-1] == ';' || g_ascii_isspace (p[-1])) {
+			while (c < end && g_ascii_isspace (*c)) {
+				c ++;
+			}
+
+			if (c < end && *c == '=') {
+				c ++;
+
+				while (c < end && g_ascii_isspace (*c)) {
+					c ++;
+				}
+
+				if (c < end && *c == '"') {
+					c ++;
+					e = memchr (c, '"', end - c);
+
+					if (e == NULL) {
+						e = end;
+					}
+				}
+				else {
+					e = c;
+
+					while (e < end && *e != ';' && !g_ascii_isspace (*e)) {
+						e ++;
+					}
+				}
+
+				res = rspamd_mempool_alloc (task->task_pool, e - c + 1);
+				rspamd_strlcpy (res, c, e - c + 1);
+
+				return res;
+			}
+		}
+
+		p += nlen;
+	}
+
+	return NULL;
+}
+
+static const gchar *
+rspamd_mime_parser_filename (struct rspamd_task *task, struct mime_part *part)
+{
+	struct raw_header *rh;
+	const gchar *fname = NULL;
+
+	rh = rspamd_mime_headers_lookup_id (part->raw_headers,
+			RSPAMD_HEADER_CONTENT_DISPOSITION);
+
+	if (rh != NULL && rh->value != NULL) {
+		fname = rspamd_mime_parser_header_param (task, rh->value, "filename");
+	}
+
+	if (fname == NULL) {
+		fname = g_mime_content_type_get_parameter (part->type, "name");
+	}
+
+	return fname;
+}
+
+static GByteArray *
+rspamd_mime_parser_decode (struct rspamd_task *task, struct mime_part *part,
+		const gchar *data, gsize len)
+{
+	struct raw_header *rh;
+	struct rspamd_mime_part_encoded *enc;
+	guchar *out;
+	gssize olen;
+	gsize dlen;
+
+	rh = rspamd_mime_headers_lookup_id (part->raw_headers,
+			RSPAMD_HEADER_CONTENT_TRANSFER_ENCODING);
+
+	if (rh != NULL && rh->value != NULL) {
+		if (g_ascii_strncasecmp (rh->value, "base64",
+				sizeof ("base64") - 1) == 0) {
+			if (!g_mime_content_type_is_type (part->type, "text", "*")) {
+				/*
+				 * Attachments are decoded only if their content is requested,
+				 * see rspamd_mime_part_get_content
+				 */
+				enc = rspamd_mempool_alloc (task->task_pool, sizeof (*enc));
+				enc->begin = data;
+				enc->len = len;
+				enc->pool = task->task_pool;
+				part->encoded = enc;
+
+				return NULL;
+			}
+
+			dlen = len / 4 * 3 + 3;
+			out = rspamd_mempool_alloc (task->task_pool, dlen);
+
+			if (rspamd_cryptobox_base64_decode (data, len, out, &dlen)) {
+				return rspamd_mime_parser_array (task, (const gchar *)out, dlen);
+			}
+		}
+		else if (g_ascii_strncasecmp (rh->value, "quoted-printable",
+				sizeof ("quoted-printable") - 1) == 0) {
+			out = rspamd_mempool_alloc (task->task_pool, len);
+			olen = rspamd_decode_qp_buf (data, len, (gchar *)out, len);
+
+			if (olen >= 0) {
+				return rspamd_mime_parser_array (task, (const gchar *)out, olen);
+			}
+		}
+	}
+
+	if (g_mime_content_type_is_type (part->type, "text", "html") ||
+			g_mime_content_type_is_type (part->type, "text", "xhtml")) {
+		/* HTML parser decodes entities in place, so it needs its own copy */
+		out = rspamd_mempool_alloc (task->task_pool, len);
+		memcpy (out, data, len);
+
+		return rspamd_mime_parser_array (task, (const gchar *)out, len);
+	}
+
+	return rspamd_mime_parser_array (task, data, len);
+}
+
+/*
+ * Find the next line that starts with `--boundary`, lines are found by
+ * memchr, which is vectorized by libc. The boundary must be followed by
+ * `--`, a line end, whitespace or the end of input, so that a boundary
+ * which is a prefix of a nested boundary is not matched
+ */
+static const gchar *
+rspamd_mime_parser_find_boundary (const gchar *start, const gchar *p,
+		const gchar *end, const gchar *boundary, gsize blen)
+{
+	const gchar *t;
+
+	while (p < end && (p = memchr (p, '-', end - p)) != NULL) {
+		if ((gsize)(end - p) >= blen + 2 && p[1] == '-' &&
+				(p == start || p[-1] == '\n') &&
+				memcmp (p + 2, boundary, blen) == 0) {
+			t = p + blen + 2;
+
+			if (t == end || *t == '-' || *t == '\r' || *t == '\n' ||
+					*t == ' ' || *t == '\t') {
+				return p;
+			}
+		}
+
+		p ++;
+	}
+
+	return NULL;
+}
+
+static void
+rspamd_mime_parse_multipart (struct rspamd_mime_parser_ctx *ctx,
+		struct mime_part *part, const gchar *start, gsize len, guint depth)
+{
+	const gchar *boundary, *end, *pos, *next, *p, *pend;
+	gsize blen;
+
+	boundary = g_mime_content_type_get_parameter (part->type, "boundary");
+	g_assert (boundary != NULL);
+	blen = strlen (boundary);
+	end = start + len;
+	pos = rspamd_mime_parser_find_boundary (start, start, end, boundary, blen);
+
+	while (pos != NULL) {
+		p = pos + blen + 2;
+
+		if (end - p >= 2 && p[0] == '-' && p[1] == '-') {
+			/* Closing delimiter, the rest is epilogue */
+			break;
+		}
+
+		p = memchr (p, '\n', end - p);
+
+		if (p == NULL) {
+			break;
+		}
+
+		p ++;
+		next = rspamd_mime_parser_find_boundary (start, p, end, boundary, blen);
+
+		if (next != NULL) {
+			/* Line break before delimiter belongs to the delimiter */
+			pend = next;
+
+			if (pend > p && pend[-1] == '\n') {
+				pend --;
+			}
+			if (pend > p && pend[-1] == '\r') {
+				pend --;
+			}
+		}
+		else {
+			pend = end;
+		}
+
+		rspamd_mime_parse_entity (ctx, part, p, pend - p, depth + 1);
+		pos = next;
+	}
+}
+
+static void
+rspamd_mime_parse_entity (struct rspamd_mime_parser_ctx *ctx,
+		struct mime_part *parent, const gchar *start, gsize len, guint depth)
+{
+	struct rspamd_task *task = ctx->task;
+	struct mime_part *part;
+	const gchar *body, *end;
+	goffset hdr_pos;
+	GString str;
+
+	if (depth > RSPAMD_MIME_MAX_DEPTH) {
+		msg_err_task ("too deep mime nesting detected: %d", depth);
+		return;
+	}
+
+	if (ctx->nparts >= RSPAMD_MIME_MAX_PARTS) {
+		if (!ctx->overflow) {
+			msg_err_task ("too many mime parts, skip the rest: %d",
+					ctx->nparts);
+			ctx->overflow = TRUE;
+		}
+
+		return;
+	}
+
+	part = rspamd_mempool_alloc0 (task->task_pool, sizeof (*part));
+	part->raw_headers = rspamd_mime_headers_new (task->task_pool);
+	part->parent = parent;
+	end = start + len;
+	body = start;
+
+	if (len > 0 && (start[0] == '\n' ||
+			(len > 1 && start[0] == '\r' && start[1] == '\n'))) {
+		/* Part without headers starts with an empty line (RFC 2046) */
+		hdr_pos = 0;
+	}
+	else {
+		str.str = (gchar *)start;
+		str.len = len;
+		hdr_pos = rspamd_string_find_eoh (&str);
+	}
+
+	if (hdr_pos > 0 && hdr_pos < (goffset)len) {
+		rspamd_message_process_headers (task, part->raw_headers, start,
+				hdr_pos);
+		body = start + hdr_pos;
+	}
+
+	/* Skip empty line between headers and body */
+	if (body < end && *body == '\r') {
+		body ++;
+	}
+	if (body < end && *body == '\n') {
+		body ++;
+	}
+
+	part->type = rspamd_mime_parser_content_type (task, part);
+
+	if (g_mime_content_type_is_type (part->type, "message", "rfc822")) {
+		/* Like gmime parser, we do not add the container itself */
+		rspamd_mime_parse_entity (ctx, parent, body, end - body, depth + 1);
+		return;
+	}
+
+	ctx->nparts ++;
+
+	if (g_mime_content_type_is_type (part->type, "multipart", "*") &&
+			g_mime_content_type_get_parameter (part->type, "boundary") != NULL) {
+		part->content = rspamd_mime_parser_array (task, body, 0);
+		rspamd_mempool_ptr_array_add (task->parts, part);
+		debug_task ("found multipart part with content-type: %s/%s",
+				part->type->type,
+				part->type->subtype);
+		rspamd_mime_parse_multipart (ctx, part, body, end - body, depth);
+	}
+	else {
+		part->content = rspamd_mime_parser_decode (task, part, body,
+				end - body);
+		part->filename = rspamd_mime_parser_filename (task, part);
+		rspamd_mempool_ptr_array_add (task->parts, part);
+		debug_task ("found part with content-type: %s/%s",
+				part->type->type,
+				part->type->subtype);
+	}
+}
+
+guint
+rspamd_mime_parse_task (struct rspamd_task *task, const gchar *start,
+		gsize len)
+{
+	struct rspamd_mime_parser_ctx ctx;
+
+	memset (&ctx, 0, sizeof (ctx));
+	ctx.task = task;
+	rspamd_mime_parse_entity (&ctx, NULL, start, len, 0);
+
+	return ctx.nparts;
+}
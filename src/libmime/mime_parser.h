@@ -0,0 +1,47 @@
+/*-
+ * Copyright 2016 Vsevolod Stakhov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SRC_LIBMIME_MIME_PARSER_H_
+#define SRC_LIBMIME_MIME_PARSER_H_
+
+#include "config.h"
+
+/* Maximum nesting of multipart and message/rfc822 parts */
+#define RSPAMD_MIME_MAX_DEPTH 16
+/* Maximum number of parts in a single message */
+#define RSPAMD_MIME_MAX_PARTS 1024
+
+struct rspamd_task;
+
+/*
+ * Native MIME parser. It works on the message buffer by offsets: parts with
+ * identity transfer encodings refer to the message itself, base64 and
+ * quoted-printable parts are decoded to the task's pool. Content of parts is
+ * thus read-only. Base64 encoded attachments are not decoded until their
+ * content is requested.
+ */
+
+/**
+ * Parse MIME structure of a message and append all parts found to
+ * `task->parts`, parts are ordered as they appear in the message
+ * @param task
+ * @param start message start
+ * @param len message length
+ * @return number of parts found
+ */
+guint rspamd_mime_parse_task (struct rspamd_task *task,
+		const gchar *start, gsize len);
+
+#endif /* SRC_LIBMIME_MIME_PARSER_H_ */
@@ -263,7 +263,7 @@ write_smtp_reply (struct smtp_session *session)
 				session->task->user);
 	}
 
-	g_hash_table_foreach (session->task->results, smtp_metric_callback, &cd);
+	rspamd_mempool_hash_foreach (session->task->results, smtp_metric_callback, &cd);
 
 	msg_info ("%s", logbuf);
 
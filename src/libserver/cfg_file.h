@@ -8,6 +8,7 @@
 
 #include "config.h"
 #include "mem_pool.h"
+#include "fstring.h"
 #include "upstream.h"
 #include "symbols_cache.h"
 #include "cfg_rcl.h"
@@ -28,6 +29,7 @@ struct rspamd_stat_classifier;
 struct module_s;
 struct worker_s;
 struct rspamd_external_libs_ctx;
+struct rspamd_composites_index;
 
 enum { VAL_UNDEF=0, VAL_TRUE, VAL_FALSE };
 
@@ -99,6 +101,7 @@ struct rspamd_symbols_group {
 struct rspamd_symbol_def {
 	gchar *name;
 	gchar *description;
+	rspamd_ftok_t legacy_reply; /**< pre-serialized "Symbol: name(" fragment */
 	gdouble *weight_ptr;
 	gdouble score;
 	guint priority;
@@ -276,8 +279,10 @@ struct rspamd_config {
 	gboolean check_all_filters;                     /**< check all filters									*/
 	gboolean allow_raw_input;                       /**< scan messages with invalid mime					*/
 	gboolean disable_hyperscan;                     /**< disable hyperscan usage							*/
+	gboolean eager_regexp_classes;                  /**< evaluate whole regexp class on the first use		*/
 	gboolean enable_shutdown_workaround;            /**< enable workaround for legacy SA clients (exim)		*/
 	gboolean ignore_received;                       /**< Ignore data from the first received header			*/
+	gboolean native_mime_parser;                    /**< parse mime structure without gmime					*/
 
 	gsize max_diff;                                 /**< maximum diff size for text parts					*/
 	gsize max_cores_size;                           /**< maximum size occupied by rspamd core files			*/
@@ -323,6 +328,7 @@ struct rspamd_config {
 	GHashTable * metrics_symbols;                   /**< hash table of metrics indexed by symbol			*/
 	GHashTable * c_modules;                         /**< hash of c modules indexed by module name			*/
 	GHashTable * composite_symbols;                 /**< hash of composite symbols indexed by its name		*/
+	struct rspamd_composites_index *composites_idx; /**< composites indexed by symbols they depend on		*/
 	GList *classifiers;                             /**< list of all classifiers defined                    */
 	GList *statfiles;                               /**< list of all statfiles in config file order         */
 	GHashTable *classifiers_symbols;                /**< hashtable indexed by symbol name of classifiers    */
@@ -371,6 +377,7 @@ struct rspamd_config {
 	guint min_word_len;								/**< minimum length of the word to be considered		*/
 	guint max_word_len;								/**< maximum length of the word to be considered		*/
 	guint words_decay;								/**< limit for words for starting adaptive ignoring		*/
+	guint mempool_profile_rate;                     /**< sample rate for memory pool allocations			*/
 	guint history_rows;								/**< number of history rows stored						*/
 
 	GList *classify_headers;						/**< list of headers using for statistics				*/
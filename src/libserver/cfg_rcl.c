@@ -1355,6 +1355,7 @@ rspamd_rcl_composite_handler (rspamd_mempool_t *pool,
 	composite =
 		rspamd_mempool_alloc (cfg->cfg_pool, sizeof (struct rspamd_composite));
 	composite->expr = expr;
+	composite->sym = composite_name;
 	composite->id = g_hash_table_size (cfg->composite_symbols);
 	g_hash_table_insert (cfg->composite_symbols,
 		(gpointer)composite_name,
@@ -1677,6 +1678,12 @@ rspamd_rcl_config_init (struct rspamd_config *cfg)
 			G_STRUCT_OFFSET (struct rspamd_config, check_text_attachements),
 			0,
 			"Treat text attachements as normal text parts");
+	rspamd_rcl_add_default_handler (sub,
+			"native_mime_parser",
+			rspamd_rcl_parse_struct_boolean,
+			G_STRUCT_OFFSET (struct rspamd_config, native_mime_parser),
+			0,
+			"Parse MIME structure of messages without gmime");
 	rspamd_rcl_add_default_handler (sub,
 			"tempdir",
 			rspamd_rcl_parse_struct_string,
@@ -1785,12 +1792,24 @@ rspamd_rcl_config_init (struct rspamd_config *cfg)
 			G_STRUCT_OFFSET (struct rspamd_config, history_rows),
 			RSPAMD_CL_FLAG_UINT,
 			"Number of records in the history file");
+	rspamd_rcl_add_default_handler (sub,
+			"mempool_profile_rate",
+			rspamd_rcl_parse_struct_integer,
+			G_STRUCT_OFFSET (struct rspamd_config, mempool_profile_rate),
+			RSPAMD_CL_FLAG_UINT,
+			"Sample each N-th memory pool allocation to find allocation sites (0 to disable)");
 	rspamd_rcl_add_default_handler (sub,
 			"disable_hyperscan",
 			rspamd_rcl_parse_struct_boolean,
 			G_STRUCT_OFFSET (struct rspamd_config, disable_hyperscan),
 			0,
 			"Disable hyperscan optimizations for regular expressions");
+	rspamd_rcl_add_default_handler (sub,
+			"eager_regexp_classes",
+			rspamd_rcl_parse_struct_boolean,
+			G_STRUCT_OFFSET (struct rspamd_config, eager_regexp_classes),
+			0,
+			"Evaluate all regular expressions of a class in a single pass when it is used for the first time");
 	rspamd_rcl_add_default_handler (sub,
 			"cores_dir",
 			rspamd_rcl_parse_struct_string,
@@ -630,6 +630,7 @@ rspamd_config_post_load (struct rspamd_config *cfg, gboolean validate_cache)
 #endif
 
 	rspamd_regexp_library_init ();
+	rspamd_mempool_set_profile_rate (cfg->mempool_profile_rate);
 
 	if ((def_metric =
 		g_hash_table_lookup (cfg->metrics, DEFAULT_METRIC)) == NULL) {
@@ -1325,6 +1326,8 @@ rspamd_config_new_metric_symbol (struct rspamd_config *cfg,
 	struct rspamd_symbol_def *sym_def;
 	GList *metric_list;
 	gdouble *score_ptr;
+	gchar *legacy;
+	gsize legacy_len;
 
 	sym_def =
 		rspamd_mempool_alloc0 (cfg->cfg_pool, sizeof (struct rspamd_symbol_def));
@@ -1334,6 +1337,12 @@ rspamd_config_new_metric_symbol (struct rspamd_config *cfg,
 	sym_def->score = score;
 	sym_def->weight_ptr = score_ptr;
 	sym_def->name = rspamd_mempool_strdup (cfg->cfg_pool, symbol);
+	/* Legacy protocol line is immutable, so serialize it once */
+	legacy_len = sizeof ("Symbol: (") + strlen (symbol);
+	legacy = rspamd_mempool_alloc (cfg->cfg_pool, legacy_len);
+	sym_def->legacy_reply.len = rspamd_snprintf (legacy, legacy_len,
+			"Symbol: %s(", symbol);
+	sym_def->legacy_reply.begin = legacy;
 	sym_def->priority = priority;
 	sym_def->flags = flags;
 
@@ -25,15 +25,30 @@ struct composites_data {
 	struct rspamd_task *task;
 	struct rspamd_composite *composite;
 	struct metric_result *metric_res;
-	GTree *symbols_to_remove;
+	GHashTable *symbols_to_remove;
 	guint8 *checked;
+	guint ncomposites;
 };
 
 struct symbol_remove_data {
 	struct symbol *ms;
 	gboolean remove_weight;
 	gboolean remove_symbol;
-	GList *comp;
+	guint8 *comp;
+};
+
+struct rspamd_composites_index {
+	GHashTable *by_symbol; /* symbol -> GPtrArray of composites */
+	GPtrArray *composites; /* composites indexed by id */
+	guint8 *always; /* composites that could match with no symbols */
+	guint ncomposites;
+};
+
+struct composites_index_cbdata {
+	struct rspamd_config *cfg;
+	struct rspamd_composites_index *idx;
+	struct rspamd_composite *root;
+	guint8 *visited;
 };
 
 static rspamd_expression_atom_t * rspamd_composite_expr_parse (const gchar *line, gsize len,
@@ -139,6 +154,11 @@ rspamd_composite_expr_process (gpointer input, rspamd_expression_atom_t *atom)
 	gint rc = 0;
 	gchar t = '\0';
 
+	if (cd->task == NULL) {
+		/* Evaluation with no symbols inserted used when building index */
+		return 0;
+	}
+
 	if (isset (cd->checked, cd->composite->id * 2)) {
 		/* We have already checked this composite, so just return its value */
 		rc = isset (cd->checked, cd->composite->id * 2 + 1);
@@ -178,9 +198,11 @@ rspamd_composite_expr_process (gpointer input, rspamd_expression_atom_t *atom)
 		 * that depends on the later decisions when the complete expression is
 		 * evaluated.
 		 */
-		if ((rd = g_tree_lookup (cd->symbols_to_remove, ms->name)) == NULL) {
+		if ((rd = g_hash_table_lookup (cd->symbols_to_remove, ms->name)) == NULL) {
 			rd = rspamd_mempool_alloc (cd->task->task_pool, sizeof (*rd));
 			rd->ms = ms;
+			rd->comp = rspamd_mempool_alloc0 (cd->task->task_pool,
+					NBYTES (cd->ncomposites));
 
 			if (G_UNLIKELY (t == '~')) {
 				rd->remove_weight = FALSE;
@@ -195,18 +217,15 @@ rspamd_composite_expr_process (gpointer input, rspamd_expression_atom_t *atom)
 				rd->remove_weight = TRUE;
 			}
 
-			rd->comp = g_list_prepend (NULL, cd->composite);
-			g_tree_insert (cd->symbols_to_remove,
+			g_hash_table_insert (cd->symbols_to_remove,
 					(gpointer)ms->name,
 					rd);
 		}
-		else {
-			/*
-			 * XXX: what if we have different preferences regarding
-			 * weight and symbol removal in different composites?
-			 */
-			rd->comp = g_list_prepend (rd->comp, cd->composite);
-		}
+		/*
+		 * XXX: what if we have different preferences regarding
+		 * weight and symbol removal in different composites?
+		 */
+		setbit (rd->comp, cd->composite->id);
 	}
 
 	return rc;
@@ -227,14 +246,6 @@ rspamd_composite_expr_destroy (rspamd_expression_atom_t *atom)
 	/* Composite atoms are destroyed just with the pool */
 }
 
-static gint
-remove_compare_data (gconstpointer a, gconstpointer b)
-{
-	const gchar *ca = a, *cb = b;
-
-	return strcmp (ca, cb);
-}
-
 static void
 composites_foreach_callback (gpointer key, gpointer value, void *data)
 {
@@ -259,36 +270,33 @@ composites_foreach_callback (gpointer key, gpointer value, void *data)
 	}
 }
 
-
-static gboolean
+static void
 composites_remove_symbols (gpointer key, gpointer value, gpointer data)
 {
 	struct composites_data *cd = data;
 	struct symbol_remove_data *rd = value;
-	GList *cur;
-	struct rspamd_composite *comp;
 	gboolean matched = FALSE;
-
-	cur = rd->comp;
+	guint i, id;
 
 	/*
 	 * XXX: actually, this is a weak assumption as we are unaware here about
 	 * negate operation and so on. We need to parse AST directly and remove
 	 * only those symbols that could be removed.
 	 */
-	while (cur) {
-		comp = cur->data;
-
-		if (isset (cd->checked, comp->id * 2 + 1)) {
-			matched = TRUE;
-			break;
+	for (i = 0; i < NBYTES (cd->ncomposites) && !matched; i ++) {
+		if (rd->comp[i] == 0) {
+			continue;
 		}
 
-		cur = g_list_next (cur);
+		for (id = i * NBBY; id < (i + 1) * NBBY && id < cd->ncomposites;
+				id ++) {
+			if (isset (rd->comp, id) && isset (cd->checked, id * 2 + 1)) {
+				matched = TRUE;
+				break;
+			}
+		}
 	}
 
-	g_list_free (rd->comp);
-
 	if (matched) {
 		if (rd->remove_symbol) {
 			g_hash_table_remove (cd->metric_res->symbols, key);
@@ -297,38 +305,242 @@ composites_remove_symbols (gpointer key, gpointer value, gpointer data)
 			cd->metric_res->score -= rd->ms->score;
 		}
 	}
+}
 
-	return FALSE;
+static void
+composites_index_symbol (struct composites_index_cbdata *cbd,
+		const gchar *sym)
+{
+	GPtrArray *comps;
+
+	comps = g_hash_table_lookup (cbd->idx->by_symbol, sym);
+
+	if (comps == NULL) {
+		comps = g_ptr_array_new ();
+		g_hash_table_insert (cbd->idx->by_symbol,
+				rspamd_mempool_strdup (cbd->cfg->cfg_pool, sym), comps);
+	}
+
+	/* Composites are indexed one by one, so we need to check the last one */
+	if (comps->len == 0 ||
+			g_ptr_array_index (comps, comps->len - 1) != cbd->root) {
+		g_ptr_array_add (comps, cbd->root);
+	}
+}
+
+static void composites_index_atom (const rspamd_ftok_t *atom, gpointer ud);
+
+static void
+composites_index_name (struct composites_index_cbdata *cbd, const gchar *sym)
+{
+	struct rspamd_composite *comp;
+
+	composites_index_symbol (cbd, sym);
+
+	comp = g_hash_table_lookup (cbd->cfg->composite_symbols, sym);
+
+	if (comp != NULL && isclr (cbd->visited, comp->id)) {
+		/* Nested composite: depend on everything it depends on */
+		setbit (cbd->visited, comp->id);
+
+		if (isset (cbd->idx->always, comp->id)) {
+			setbit (cbd->idx->always, cbd->root->id);
+		}
+
+		rspamd_expression_atom_foreach (comp->expr, composites_index_atom, cbd);
+	}
+}
+
+static void
+composites_index_atom (const rspamd_ftok_t *atom, gpointer ud)
+{
+	struct composites_index_cbdata *cbd = ud;
+	struct metric *metric;
+	struct rspamd_symbols_group *gr;
+	struct rspamd_symbol_def *sdef;
+	GHashTableIter it;
+	gpointer k, v;
+	gchar *sym;
+	gsize len = atom->len;
+	const gchar *p = atom->begin;
+
+	if (len > 0 && (*p == '~' || *p == '-')) {
+		p ++;
+		len --;
+	}
+
+	sym = g_malloc (len + 1);
+	rspamd_strlcpy (sym, p, len + 1);
+
+	if (strncmp (sym, "g:", 2) == 0) {
+		metric = g_hash_table_lookup (cbd->cfg->metrics, DEFAULT_METRIC);
+
+		if (metric != NULL &&
+				(gr = g_hash_table_lookup (metric->groups, sym + 2)) != NULL) {
+			g_hash_table_iter_init (&it, gr->symbols);
+
+			while (g_hash_table_iter_next (&it, &k, &v)) {
+				sdef = v;
+				composites_index_name (cbd, sdef->name);
+			}
+		}
+	}
+	else {
+		composites_index_name (cbd, sym);
+	}
+
+	g_free (sym);
+}
+
+static void
+composites_index_destroy (gpointer p)
+{
+	struct rspamd_composites_index *idx = p;
+
+	g_hash_table_unref (idx->by_symbol);
+	g_ptr_array_free (idx->composites, TRUE);
+	g_free (idx->always);
+	g_free (idx);
+}
+
+void
+rspamd_composites_build_index (struct rspamd_config *cfg)
+{
+	struct rspamd_composites_index *idx;
+	struct rspamd_composite *comp;
+	struct composites_index_cbdata cbd;
+	struct composites_data cd;
+	GHashTableIter it;
+	gpointer k, v;
+	guint i;
+
+	if (cfg->composites_idx != NULL) {
+		return;
+	}
+
+	idx = g_malloc0 (sizeof (*idx));
+	idx->by_symbol = g_hash_table_new_full (rspamd_str_hash, rspamd_str_equal,
+			NULL, rspamd_ptr_array_free_hard);
+	idx->composites = g_ptr_array_new ();
+
+	/* Redefined composites might leave holes in ids */
+	g_hash_table_iter_init (&it, cfg->composite_symbols);
+
+	while (g_hash_table_iter_next (&it, &k, &v)) {
+		comp = v;
+
+		if ((guint)comp->id >= idx->ncomposites) {
+			idx->ncomposites = comp->id + 1;
+		}
+	}
+
+	g_ptr_array_set_size (idx->composites, idx->ncomposites);
+	idx->always = g_malloc0 (NBYTES (idx->ncomposites));
+
+	/*
+	 * Composites that match when no symbols are inserted (e.g. `!A`) must
+	 * always be evaluated
+	 */
+	memset (&cd, 0, sizeof (cd));
+	g_hash_table_iter_init (&it, cfg->composite_symbols);
+
+	while (g_hash_table_iter_next (&it, &k, &v)) {
+		comp = v;
+		g_ptr_array_index (idx->composites, comp->id) = comp;
+		cd.composite = comp;
+
+		if (rspamd_process_expression (comp->expr,
+				RSPAMD_EXPRESSION_FLAG_NOOPT, &cd)) {
+			setbit (idx->always, comp->id);
+		}
+	}
+
+	cbd.cfg = cfg;
+	cbd.idx = idx;
+	cbd.visited = g_malloc (NBYTES (idx->ncomposites));
+
+	for (i = 0; i < idx->ncomposites; i ++) {
+		comp = g_ptr_array_index (idx->composites, i);
+
+		if (comp == NULL) {
+			continue;
+		}
+
+		memset (cbd.visited, 0, NBYTES (idx->ncomposites));
+		setbit (cbd.visited, comp->id);
+		cbd.root = comp;
+		rspamd_expression_atom_foreach (comp->expr, composites_index_atom,
+				&cbd);
+	}
+
+	g_free (cbd.visited);
+	cfg->composites_idx = idx;
+	rspamd_mempool_add_destructor (cfg->cfg_pool,
+			(rspamd_mempool_destruct_t)composites_index_destroy, idx);
+
+	msg_debug_config ("indexed %d composites by %d symbols",
+			idx->ncomposites, g_hash_table_size (idx->by_symbol));
 }
 
 static void
 composites_metric_callback (gpointer key, gpointer value, gpointer data)
 {
 	struct rspamd_task *task = (struct rspamd_task *)data;
+	struct rspamd_composites_index *idx = task->cfg->composites_idx;
 	struct composites_data *cd =
 		rspamd_mempool_alloc (task->task_pool, sizeof (struct composites_data));
 	struct metric_result *metric_res = (struct metric_result *)value;
+	struct rspamd_composite *comp;
+	GPtrArray *comps;
+	GHashTableIter it;
+	gpointer k, v;
+	guint8 *pending;
+	guint i;
 
 	cd->task = task;
 	cd->metric_res = (struct metric_result *)metric_res;
-	cd->symbols_to_remove = g_tree_new (remove_compare_data);
+	cd->symbols_to_remove = g_hash_table_new (rspamd_str_hash,
+			rspamd_str_equal);
+	cd->ncomposites = idx->ncomposites;
 	cd->checked =
 		rspamd_mempool_alloc0 (task->task_pool,
-			NBYTES (g_hash_table_size (task->cfg->composite_symbols) * 2));
+			NBYTES (idx->ncomposites * 2));
+	pending = rspamd_mempool_alloc (task->task_pool,
+			NBYTES (idx->ncomposites));
+	memcpy (pending, idx->always, NBYTES (idx->ncomposites));
+
+	/* Select composites that depend on the inserted symbols */
+	g_hash_table_iter_init (&it, metric_res->symbols);
+
+	while (g_hash_table_iter_next (&it, &k, &v)) {
+		comps = g_hash_table_lookup (idx->by_symbol, k);
+
+		if (comps != NULL) {
+			for (i = 0; i < comps->len; i ++) {
+				comp = g_ptr_array_index (comps, i);
+				setbit (pending, comp->id);
+			}
+		}
+	}
 
-	/* Process hash table */
-	g_hash_table_foreach (task->cfg->composite_symbols,
-		composites_foreach_callback,
-		cd);
+	for (i = 0; i < idx->ncomposites; i ++) {
+		if (isset (pending, i)) {
+			comp = g_ptr_array_index (idx->composites, i);
+			composites_foreach_callback ((gpointer)comp->sym, comp, cd);
+		}
+	}
 
 	/* Remove symbols that are in composites */
-	g_tree_foreach (cd->symbols_to_remove, composites_remove_symbols, cd);
-	/* Free list */
-	g_tree_destroy (cd->symbols_to_remove);
+	g_hash_table_foreach (cd->symbols_to_remove, composites_remove_symbols, cd);
+	g_hash_table_unref (cd->symbols_to_remove);
 }
 
 void
 rspamd_make_composites (struct rspamd_task *task)
 {
-	g_hash_table_foreach (task->results, composites_metric_callback, task);
+	if (task->cfg->composites_idx == NULL) {
+		rspamd_composites_build_index (task->cfg);
+	}
+
+	rspamd_mempool_hash_foreach (task->results, composites_metric_callback, task);
 }
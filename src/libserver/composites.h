@@ -19,6 +19,7 @@
 #include "config.h"
 
 struct rspamd_task;
+struct rspamd_config;
 
 /**
  * Subr for composite expressions
@@ -29,9 +30,18 @@ extern const struct rspamd_atom_subr composite_expr_subr;
  */
 struct rspamd_composite {
 	struct rspamd_expression *expr;
+	const gchar *sym;
 	gint id;
 };
 
+/**
+ * Build index of composites by symbols they depend on, so only composites
+ * that might match are evaluated for a task. Index is built on the first call
+ * of `rspamd_make_composites` if this function has not been called explicitly
+ * @param cfg config with all composites defined
+ */
+void rspamd_composites_build_index (struct rspamd_config *cfg);
+
 /**
  * Process all results and form composite metrics from existent metrics as it is defined in config
  * @param task worker's task that present message from user
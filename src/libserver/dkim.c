@@ -17,6 +17,7 @@
 #include "rspamd.h"
 #include "message.h"
 #include "dkim.h"
+#include "cryptobox.h"
 #include "dns.h"
 #include "utlist.h"
 
@@ -129,15 +130,8 @@ rspamd_dkim_parse_signature (rspamd_dkim_context_t * ctx,
 {
 	ctx->b = rspamd_mempool_alloc (ctx->pool, len + 1);
 	rspamd_strlcpy (ctx->b, param, len + 1);
-#if ((GLIB_MAJOR_VERSION == 2) && (GLIB_MINOR_VERSION < 20))
-	gchar *tmp;
-	gsize tmp_len = len;
-	tmp = g_base64_decode (ctx->b, &tmp_len);
-	rspamd_strlcpy (ctx->b, tmp, tmp_len + 1);
-	g_free (tmp);
-#else
-	g_base64_decode_inplace (ctx->b, &len);
-#endif
+	rspamd_cryptobox_base64_decode ((const gchar *)ctx->b, len,
+			(guchar *)ctx->b, &len);
 	ctx->blen = len;
 	return TRUE;
 }
@@ -436,15 +430,8 @@ rspamd_dkim_parse_bodyhash (rspamd_dkim_context_t * ctx,
 {
 	ctx->bh = rspamd_mempool_alloc (ctx->pool, len + 1);
 	rspamd_strlcpy (ctx->bh, param, len + 1);
-#if ((GLIB_MAJOR_VERSION == 2) && (GLIB_MINOR_VERSION < 20))
-	gchar *tmp;
-	gsize tmp_len = len;
-	tmp = g_base64_decode (ctx->bh, &tmp_len);
-	rspamd_strlcpy (ctx->bh, tmp, tmp_len + 1);
-	g_free (tmp);
-#else
-	g_base64_decode_inplace (ctx->bh, &len);
-#endif
+	rspamd_cryptobox_base64_decode ((const gchar *)ctx->bh, len,
+			(guchar *)ctx->bh, &len);
 	ctx->bhlen = len;
 	return TRUE;
 }
@@ -845,17 +832,9 @@ rspamd_dkim_make_key (rspamd_dkim_context_t *ctx, const gchar *keydata,
 	key->keydata = g_slice_alloc (keylen + 1);
 	rspamd_strlcpy (key->keydata, keydata, keylen + 1);
 	key->keylen = keylen + 1;
-	key->decoded_len = keylen + 1;
-#if ((GLIB_MAJOR_VERSION == 2) && (GLIB_MINOR_VERSION < 20))
-	gchar *tmp;
-	gsize tmp_len = keylen;
-	tmp = g_base64_decode (key->keydata, &tmp_len);
-	rspamd_strlcpy (key->keydata, tmp, tmp_len + 1);
-	g_free (tmp);
-	key->decoded_len = tmp_len;
-#else
-	g_base64_decode_inplace (key->keydata, &key->decoded_len);
-#endif
+	key->decoded_len = keylen;
+	rspamd_cryptobox_base64_decode ((const gchar *)key->keydata, keylen,
+			(guchar *)key->keydata, &key->decoded_len);
 	REF_INIT_RETAIN (key, rspamd_dkim_key_free);
 
 #ifdef HAVE_OPENSSL
@@ -1557,7 +1536,7 @@ rspamd_dkim_canonize_header (rspamd_dkim_context_t *ctx,
 				   is_sig);
 	}
 	else {
-		rh = g_hash_table_lookup (task->raw_headers, header_name);
+		rh = rspamd_mime_headers_lookup (task->raw_headers, header_name);
 		if (rh) {
 			if (!is_sig) {
 				rh_iter = rh;
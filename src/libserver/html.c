@@ -21,7 +21,7 @@
 #include "html_tags.h"
 #include "url.h"
 
-static sig_atomic_t tags_sorted = 0;
+static sig_atomic_t tables_initialized = 0;
 
 struct html_tag_def {
 	gint id;
@@ -155,7 +155,6 @@ static struct html_tag_def tag_defs[] = {
 	{Tag_WBR, "wbr", (CM_INLINE | CM_EMPTY)},
 };
 
-static sig_atomic_t entities_sorted = 0;
 struct _entity;
 typedef struct _entity entity;
 
@@ -440,22 +439,23 @@ static entity entities_defs[] = {
 static entity entities_defs_num[ (G_N_ELEMENTS (entities_defs)) ];
 static struct html_tag_def tag_defs_num[ (G_N_ELEMENTS (tag_defs)) ];
 
-static gint
-tag_cmp (const void *m1, const void *m2)
-{
-	const struct html_tag_def *p1 = m1;
-	const struct html_tag_def *p2 = m2;
-	gsize l1, l2;
+/*
+ * Open addressing tables for case insensitive lookup of tags and entities
+ * names, they are filled once per process
+ */
+#define HTML_NAMES_TABLE_SIZE 1024
 
-	l1 = strlen (p1->name);
-	l2 = strlen (p2->name);
+struct html_name_slot {
+	const gchar *name;
+	guint len;
+	gpointer data;
+};
 
-	if (l1 == l2) {
-		return g_ascii_strcasecmp (p1->name, p2->name);
-	}
+static struct html_name_slot tag_names[HTML_NAMES_TABLE_SIZE];
+static struct html_name_slot entity_names[HTML_NAMES_TABLE_SIZE];
 
-	return l1 - l2;
-}
+/* Characters that stop text copying: tags, entities and spaces */
+static guint8 html_text_stops[256];
 
 static gint
 tag_cmp_id (const void *m1, const void *m2)
@@ -476,55 +476,126 @@ tag_find_id (const void *skey, const void *elt)
 }
 
 static gint
-tag_find (const void *skey, const void *elt)
+entity_cmp_num (const void *m1, const void *m2)
 {
-	const struct html_tag *tag = skey;
-	const struct html_tag_def *d = elt;
-	gsize tlen;
+	const entity *p1 = m1;
+	const entity *p2 = m2;
 
-	tlen = strlen (d->name);
+	return p1->code - p2->code;
+}
+
+static guint
+rspamd_html_name_hash (const gchar *name, guint len)
+{
+	guint h = len, i;
 
-	if (tlen == tag->name.len) {
-		return g_ascii_strncasecmp (tag->name.start, d->name, tag->name.len);
+	for (i = 0; i < len; i ++) {
+		h = h * 31 + g_ascii_tolower (name[i]);
 	}
 
-	return tag->name.len - tlen;
+	return h;
 }
 
-static gint
-entity_cmp (const void *m1, const void *m2)
+static void
+rspamd_html_names_insert (struct html_name_slot *tbl, const gchar *name,
+		gpointer data)
 {
-	const entity *p1 = m1;
-	const entity *p2 = m2;
+	guint len, i;
+
+	len = strlen (name);
+	i = rspamd_html_name_hash (name, len) & (HTML_NAMES_TABLE_SIZE - 1);
+
+	while (tbl[i].name != NULL) {
+		i = (i + 1) & (HTML_NAMES_TABLE_SIZE - 1);
+	}
 
-	return g_ascii_strcasecmp (p1->name, p2->name);
+	tbl[i].name = name;
+	tbl[i].len = len;
+	tbl[i].data = data;
 }
 
-static gint
-entity_cmp_num (const void *m1, const void *m2)
+/*
+ * Exact match is preferred, otherwise the first case insensitive match is
+ * returned (e.g. for `&Dagger;` and `&dagger;`)
+ */
+static gpointer
+rspamd_html_names_find (const struct html_name_slot *tbl, const gchar *name,
+		guint len)
 {
-	const entity *p1 = m1;
-	const entity *p2 = m2;
+	guint i;
+	gpointer res = NULL;
 
-	return p1->code - p2->code;
+	i = rspamd_html_name_hash (name, len) & (HTML_NAMES_TABLE_SIZE - 1);
+
+	while (tbl[i].name != NULL) {
+		if (tbl[i].len == len) {
+			if (memcmp (tbl[i].name, name, len) == 0) {
+				return tbl[i].data;
+			}
+			else if (res == NULL &&
+					g_ascii_strncasecmp (tbl[i].name, name, len) == 0) {
+				res = tbl[i].data;
+			}
+		}
+
+		i = (i + 1) & (HTML_NAMES_TABLE_SIZE - 1);
+	}
+
+	return res;
+}
+
+static void
+rspamd_html_init_tables (void)
+{
+	guint i;
+
+	G_STATIC_ASSERT (G_N_ELEMENTS (tag_defs) < HTML_NAMES_TABLE_SIZE / 2);
+	G_STATIC_ASSERT (G_N_ELEMENTS (entities_defs) < HTML_NAMES_TABLE_SIZE / 2);
+
+	if (tables_initialized) {
+		return;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (tag_defs); i ++) {
+		rspamd_html_names_insert (tag_names, tag_defs[i].name, &tag_defs[i]);
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (entities_defs); i ++) {
+		rspamd_html_names_insert (entity_names, entities_defs[i].name,
+				&entities_defs[i]);
+	}
+
+	memcpy (tag_defs_num, tag_defs, sizeof (tag_defs));
+	qsort (tag_defs_num, G_N_ELEMENTS (tag_defs_num),
+			sizeof (struct html_tag_def), tag_cmp_id);
+	memcpy (entities_defs_num, entities_defs, sizeof (entities_defs));
+	qsort (entities_defs_num, G_N_ELEMENTS (
+			entities_defs), sizeof (entity), entity_cmp_num);
+
+	html_text_stops['<'] = 1;
+	html_text_stops['&'] = 1;
+
+	for (i = 0; i < 256; i ++) {
+		if (g_ascii_isspace (i)) {
+			html_text_stops[i] = 1;
+		}
+	}
+
+	tables_initialized = 1;
 }
 
 static gboolean
-rspamd_html_check_balance (GNode * node, GNode ** cur_level)
+rspamd_html_check_balance (struct html_tag *tag, struct html_tag **cur_level)
 {
-	struct html_tag *arg = node->data, *tmp;
-	GNode *cur;
+	struct html_tag *cur;
 
-	if (arg->flags & FL_CLOSING) {
+	if (tag->flags & FL_CLOSING) {
 		/* First of all check whether this tag is closing tag for parent node */
-		cur = node->parent;
-		while (cur && cur->data) {
-			tmp = cur->data;
-			if (tmp->id == arg->id &&
-				(tmp->flags & FL_CLOSED) == 0) {
-				tmp->flags |= FL_CLOSED;
-				/* Destroy current node as we find corresponding parent node */
-				g_node_destroy (node);
+		cur = *cur_level;
+		while (cur) {
+			if (cur->id == tag->id &&
+				(cur->flags & FL_CLOSED) == 0) {
+				cur->flags |= FL_CLOSED;
 				/* Change level */
 				*cur_level = cur->parent;
 				return TRUE;
@@ -542,17 +613,13 @@ rspamd_html_check_balance (GNode * node, GNode ** cur_level)
 gboolean
 rspamd_html_tag_seen (struct html_content *hc, const gchar *tagname)
 {
-	struct html_tag tag;
 	struct html_tag_def *found;
 
 	g_assert (hc != NULL);
 	g_assert (hc->tags_seen != NULL);
 
-	tag.name.start = tagname;
-	tag.name.len = strlen (tagname);
-
-	found = bsearch (&tag, tag_defs, G_N_ELEMENTS (tag_defs),
-			sizeof (tag_defs[0]), tag_find);
+	rspamd_html_init_tables ();
+	found = rspamd_html_names_find (tag_names, tagname, strlen (tagname));
 
 	if (found) {
 		return isset (hc->tags_seen, found->id);
@@ -567,6 +634,7 @@ rspamd_html_tag_by_id (gint id)
 	struct html_tag tag;
 	struct html_tag_def *found;
 
+	rspamd_html_init_tables ();
 	tag.id = id;
 	/* Should work as IDs monotonically increase */
 	found = bsearch (&tag, tag_defs_num, G_N_ELEMENTS (tag_defs_num),
@@ -616,12 +684,10 @@ rspamd_html_decode_entitles_inplace (gchar *s, guint len)
 				/* Determine base */
 				/* First find in entities table */
 
-				key.name = e + 1;
 				*h = '\0';
 				if (*(e + 1) != '#' &&
-					(found =
-					bsearch (&key, entities_defs, G_N_ELEMENTS (entities_defs),
-					sizeof (entity), entity_cmp)) != NULL) {
+					(found = rspamd_html_names_find (entity_names, e + 1,
+							h - e - 1)) != NULL) {
 					if (found->replacement) {
 						rep_len = strlen (found->replacement);
 						memcpy (t, found->replacement, rep_len);
@@ -717,36 +783,17 @@ rspamd_html_url_is_phished (rspamd_mempool_t *pool,
 
 static gboolean
 rspamd_html_process_tag (rspamd_mempool_t *pool, struct html_content *hc,
-		struct html_tag *tag, GNode **cur_level, gboolean *balanced)
+		struct html_tag *tag, struct html_tag **cur_level, gboolean *balanced)
 {
-	GNode *nnode;
 	struct html_tag *parent;
 
-	if (hc->html_tags == NULL) {
-		nnode = g_node_new (NULL);
-		*cur_level = nnode;
-		hc->html_tags = nnode;
-		rspamd_mempool_add_destructor (pool,
-				(rspamd_mempool_destruct_t) g_node_destroy,
-				nnode);
-	}
-
+	hc->ntags ++;
 	tag->parent = *cur_level;
 
 	if (!(tag->flags & CM_INLINE)) {
 		/* Block tag */
-		nnode = g_node_new (tag);
-
 		if (tag->flags & FL_CLOSING) {
-			if (!*cur_level) {
-				msg_debug_pool ("bad parent node");
-				g_node_destroy (nnode);
-				return FALSE;
-			}
-
-			g_node_append (*cur_level, nnode);
-
-			if (!rspamd_html_check_balance (nnode, cur_level)) {
+			if (!rspamd_html_check_balance (tag, cur_level)) {
 				msg_debug_pool (
 						"mark part as unbalanced as it has not pairable closing tags");
 				hc->flags |= RSPAMD_HTML_FLAG_UNBALANCED;
@@ -757,17 +804,15 @@ rspamd_html_process_tag (rspamd_mempool_t *pool, struct html_content *hc,
 			}
 		}
 		else {
-			parent = (*cur_level)->data;
+			parent = *cur_level;
 
 			if (parent && (parent->flags & FL_IGNORE)) {
 				/* Propagate ignore flag */
 				tag->flags |= FL_IGNORE;
 			}
 
-			g_node_append (*cur_level, nnode);
-
 			if ((tag->flags & FL_CLOSED) == 0) {
-				*cur_level = nnode;
+				*cur_level = tag;
 			}
 
 			if (tag->flags & (CM_HEAD|CM_UNKNOWN|FL_BROKEN|FL_IGNORE)) {
@@ -780,7 +825,7 @@ rspamd_html_process_tag (rspamd_mempool_t *pool, struct html_content *hc,
 	}
 	else {
 		/* Inline tag */
-		parent = (*cur_level)->data;
+		parent = *cur_level;
 
 		if (parent && (parent->flags & (CM_HEAD|CM_UNKNOWN|FL_BROKEN|FL_IGNORE))) {
 			tag->flags |= FL_IGNORE;
@@ -911,8 +956,8 @@ rspamd_html_parse_tag_content (rspamd_mempool_t *pool,
 						(gchar *)tag->name.start,
 						tag->name.len);
 
-				found = bsearch (tag, tag_defs, G_N_ELEMENTS (tag_defs),
-					sizeof (tag_defs[0]), tag_find);
+				found = rspamd_html_names_find (tag_names,
+						tag->name.start, tag->name.len);
 				if (found == NULL) {
 					hc->flags |= RSPAMD_HTML_FLAG_UNKNOWN_ELEMENTS;
 					tag->id = -1;
@@ -1215,7 +1260,7 @@ rspamd_html_process_url_tag (rspamd_mempool_t *pool, struct html_tag *tag)
 
 static void
 rspamd_process_html_url (rspamd_mempool_t *pool, struct rspamd_url *url,
-		GHashTable *target)
+		struct rspamd_url_set *target)
 {
 	gint nstate = 0;
 	struct rspamd_url *query_url;
@@ -1239,12 +1284,7 @@ rspamd_process_html_url (rspamd_mempool_t *pool, struct rspamd_url *url,
 				msg_debug_pool ("found url %s in query of url"
 						" %*s", url_str, url->querylen, url->query);
 
-				if (!g_hash_table_lookup (target,
-						query_url)) {
-					g_hash_table_insert (target,
-							query_url,
-							query_url);
-				}
+				rspamd_url_set_add (target, query_url);
 			}
 		}
 	}
@@ -1510,16 +1550,17 @@ rspamd_html_process_block_tag (rspamd_mempool_t *pool, struct html_tag *tag,
 
 GByteArray*
 rspamd_html_process_part_full (rspamd_mempool_t *pool, struct html_content *hc,
-		GByteArray *in, GList **exceptions, GHashTable *urls,  GHashTable *emails)
+		GByteArray *in, GList **exceptions, struct rspamd_url_set *urls,
+		struct rspamd_url_set *emails)
 {
 	const guchar *p, *c, *end, *savep = NULL;
 	guchar t;
 	gboolean closing = FALSE, need_decode = FALSE, save_space = FALSE,
 			balanced, url_text;
 	GByteArray *dest;
-	GHashTable *target_tbl;
+	struct rspamd_url_set *target_tbl;
 	guint obrace = 0, ebrace = 0;
-	GNode *cur_level = NULL;
+	struct html_tag *cur_level = NULL;
 	gint substate = 0, len, href_offset = -1;
 	struct html_tag *cur_tag = NULL;
 	struct rspamd_url *url = NULL, *turl;
@@ -1545,22 +1586,7 @@ rspamd_html_process_part_full (rspamd_mempool_t *pool, struct html_content *hc,
 	g_assert (hc != NULL);
 	g_assert (pool != NULL);
 
-	if (!tags_sorted) {
-		qsort (tag_defs, G_N_ELEMENTS (
-				tag_defs), sizeof (struct html_tag_def), tag_cmp);
-		memcpy (tag_defs_num, tag_defs, sizeof (tag_defs));
-		qsort (tag_defs_num, G_N_ELEMENTS (tag_defs_num),
-				sizeof (struct html_tag_def), tag_cmp_id);
-		tags_sorted = 1;
-	}
-	if (!entities_sorted) {
-		qsort (entities_defs, G_N_ELEMENTS (
-				entities_defs), sizeof (entity), entity_cmp);
-		memcpy (entities_defs_num, entities_defs, sizeof (entities_defs));
-		qsort (entities_defs_num, G_N_ELEMENTS (
-				entities_defs), sizeof (entity), entity_cmp_num);
-		entities_sorted = 1;
-	}
+	rspamd_html_init_tables ();
 
 	hc->tags_seen = rspamd_mempool_alloc0 (pool, NBYTES (G_N_ELEMENTS (tag_defs)));
 
@@ -1705,7 +1731,12 @@ rspamd_html_process_part_full (rspamd_mempool_t *pool, struct html_content *hc,
 
 		case content_ignore:
 			if (t != '<') {
-				p ++;
+				/* Skip to the next tag at once */
+				p = memchr (p, '<', end - p);
+
+				if (p == NULL) {
+					p = end;
+				}
 			}
 			else {
 				state = tag_begin;
@@ -1745,6 +1776,15 @@ rspamd_html_process_part_full (rspamd_mempool_t *pool, struct html_content *hc,
 						}
 						save_space = FALSE;
 					}
+
+					/* Skip plain text up to the next special character */
+					p ++;
+
+					while (p < end && !html_text_stops[*p]) {
+						p ++;
+					}
+
+					continue;
 				}
 			}
 			else {
@@ -1859,13 +1899,10 @@ rspamd_html_process_part_full (rspamd_mempool_t *pool, struct html_content *hc,
 							}
 
 							if (target_tbl != NULL) {
-								turl = g_hash_table_lookup (target_tbl, url);
+								turl = rspamd_url_set_lookup (target_tbl, url);
 
-								if (turl != NULL && turl->phished_url == NULL) {
-									g_hash_table_insert (target_tbl, url, url);
-								}
-								else if (turl == NULL) {
-									g_hash_table_insert (target_tbl, url, url);
+								if (turl == NULL || turl->phished_url == NULL) {
+									rspamd_url_set_replace (target_tbl, url);
 								}
 								else {
 									url = NULL;
@@ -1894,7 +1931,8 @@ rspamd_html_process_part_full (rspamd_mempool_t *pool, struct html_content *hc,
 								ex->pos = href_offset;
 								ex->len = dest->len - href_offset;
 
-								*exceptions = g_list_prepend (*exceptions, ex);
+								*exceptions = rspamd_mempool_glist_prepend (pool,
+										*exceptions, ex);
 							}
 						}
 
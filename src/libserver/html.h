@@ -83,14 +83,15 @@ struct html_tag {
 	struct html_tag_component name;
 	GQueue *params;
 	gpointer extra; /** Additional data associated with tag (e.g. image) */
-	GNode *parent;
+	struct html_tag *parent; /** Enclosing block tag or NULL */
 };
 
 /* Forwarded declaration */
 struct rspamd_task;
+struct rspamd_url_set;
 
 struct html_content {
-	GNode *html_tags;
+	guint ntags;
 	gint flags;
 	guchar *tags_seen;
 	GPtrArray *images;
@@ -108,7 +109,8 @@ GByteArray* rspamd_html_process_part (rspamd_mempool_t *pool,
 
 GByteArray* rspamd_html_process_part_full (rspamd_mempool_t *pool,
 		struct html_content *hc,
-		GByteArray *in, GList **exceptions, GHashTable *urls, GHashTable *emails);
+		GByteArray *in, GList **exceptions, struct rspamd_url_set *urls,
+		struct rspamd_url_set *emails);
 
 /*
  * Returns true if a specified tag has been seen in a part
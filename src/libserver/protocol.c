@@ -615,10 +615,8 @@ struct tree_cb_data {
  * Callback for writing urls
  */
 static void
-urls_protocol_cb (gpointer key, gpointer value, gpointer ud)
+urls_protocol_cb (struct rspamd_url *url, struct tree_cb_data *cb)
 {
-	struct tree_cb_data *cb = ud;
-	struct rspamd_url *url = value;
 	ucl_object_t *obj, *elt;
 	struct rspamd_task *task = cb->task;
 	const gchar *user_field = "unknown";
@@ -675,25 +673,26 @@ urls_protocol_cb (gpointer key, gpointer value, gpointer ud)
 }
 
 static ucl_object_t *
-rspamd_urls_tree_ucl (GHashTable *input, struct rspamd_task *task)
+rspamd_urls_tree_ucl (struct rspamd_url_set *input, struct rspamd_task *task)
 {
 	struct tree_cb_data cb;
 	ucl_object_t *obj;
+	guint i;
 
 	obj = ucl_object_typed_new (UCL_ARRAY);
 	cb.top = obj;
 	cb.task = task;
 
-	g_hash_table_foreach (input, urls_protocol_cb, &cb);
+	for (i = 0; i < rspamd_url_set_size (input); i ++) {
+		urls_protocol_cb (rspamd_url_set_index (input, i), &cb);
+	}
 
 	return obj;
 }
 
 static void
-emails_protocol_cb (gpointer key, gpointer value, gpointer ud)
+emails_protocol_cb (struct rspamd_url *url, struct tree_cb_data *cb)
 {
-	struct tree_cb_data *cb = ud;
-	struct rspamd_url *url = value;
 	ucl_object_t *obj;
 
 	if (url->userlen > 0 && url->hostlen > 0 &&
@@ -705,16 +704,19 @@ emails_protocol_cb (gpointer key, gpointer value, gpointer ud)
 }
 
 static ucl_object_t *
-rspamd_emails_tree_ucl (GHashTable *input, struct rspamd_task *task)
+rspamd_emails_tree_ucl (struct rspamd_url_set *input, struct rspamd_task *task)
 {
 	struct tree_cb_data cb;
 	ucl_object_t *obj;
+	guint i;
 
 	obj = ucl_object_typed_new (UCL_ARRAY);
 	cb.top = obj;
 	cb.task = task;
 
-	g_hash_table_foreach (input, emails_protocol_cb, &cb);
+	for (i = 0; i < rspamd_url_set_size (input); i ++) {
+		emails_protocol_cb (rspamd_url_set_index (input, i), &cb);
+	}
 
 	return obj;
 }
@@ -853,90 +855,154 @@ rspamd_metric_result_ucl (struct rspamd_task *task,
 	return obj;
 }
 
+/*
+ * Immutable fragments of legacy replies
+ */
+static const rspamd_ftok_t legacy_action_lines[METRIC_ACTION_MAX] = {
+	[METRIC_ACTION_REJECT] = {
+		.begin = "Action: reject" CRLF,
+		.len = sizeof ("Action: reject" CRLF) - 1
+	},
+	[METRIC_ACTION_SOFT_REJECT] = {
+		.begin = "Action: soft reject" CRLF,
+		.len = sizeof ("Action: soft reject" CRLF) - 1
+	},
+	[METRIC_ACTION_REWRITE_SUBJECT] = {
+		.begin = "Action: rewrite subject" CRLF,
+		.len = sizeof ("Action: rewrite subject" CRLF) - 1
+	},
+	[METRIC_ACTION_ADD_HEADER] = {
+		.begin = "Action: add header" CRLF,
+		.len = sizeof ("Action: add header" CRLF) - 1
+	},
+	[METRIC_ACTION_GREYLIST] = {
+		.begin = "Action: greylist" CRLF,
+		.len = sizeof ("Action: greylist" CRLF) - 1
+	},
+	[METRIC_ACTION_NOACTION] = {
+		.begin = "Action: no action" CRLF,
+		.len = sizeof ("Action: no action" CRLF) - 1
+	},
+};
+
+/*
+ * Calculates actions for all metrics as the ucl output does
+ */
 static void
-rspamd_ucl_torspamc_output (struct rspamd_task *task,
-	ucl_object_t *top,
+rspamd_protocol_check_actions (struct rspamd_task *task)
+{
+	struct metric_result *mres;
+	rspamd_mempool_hash_iter_t hiter;
+	gpointer h, v;
+
+	rspamd_mempool_hash_iter_init (&hiter, task->results);
+
+	while (rspamd_mempool_hash_iter_next (&hiter, &h, &v)) {
+		mres = (struct metric_result *)v;
+		mres->action = rspamd_check_action_metric (task, mres->score,
+				&mres->required_score, mres->metric);
+	}
+}
+
+/*
+ * Legacy replies are assembled directly from the metric result using
+ * fragments serialized at config load, so only numbers are printed per task
+ */
+static void
+rspamd_torspamc_output (struct rspamd_task *task,
 	rspamd_fstring_t **out)
 {
-	const ucl_object_t *metric, *score,
-	*required_score, *is_spam, *elt, *cur;
-	ucl_object_iter_t iter = NULL;
-
-	metric = ucl_object_lookup (top, DEFAULT_METRIC);
-	if (metric != NULL) {
-		score = ucl_object_lookup (metric, "score");
-		required_score = ucl_object_lookup (metric, "required_score");
-		is_spam = ucl_object_lookup (metric, "is_spam");
+	struct metric_result *mres;
+	struct symbol *sym;
+	GHashTableIter hiter;
+	gpointer h, v;
+	GList *cur;
+	const gchar *name;
+
+	mres = rspamd_mempool_hash_lookup (task->results, DEFAULT_METRIC);
+
+	if (mres != NULL) {
 		rspamd_printf_fstring (out,
 			"Metric: default; %s; %.2f / %.2f / 0.0\r\n",
-			ucl_object_toboolean (is_spam) ? "True" : "False",
-			ucl_object_todouble (score),
-			ucl_object_todouble (required_score));
-		elt = ucl_object_lookup (metric, "action");
-		if (elt != NULL) {
-			rspamd_printf_fstring (out, "Action: %s\r\n",
-				ucl_object_tostring (elt));
+			mres->action < METRIC_ACTION_GREYLIST ? "True" : "False",
+			mres->score,
+			mres->required_score);
+
+		if (mres->action < METRIC_ACTION_MAX) {
+			*out = rspamd_fstring_append (*out,
+					legacy_action_lines[mres->action].begin,
+					legacy_action_lines[mres->action].len);
 		}
 
-		iter = NULL;
-		while ((elt = ucl_object_iterate (metric, &iter, true)) != NULL) {
-			if (elt->type == UCL_OBJECT) {
-				const ucl_object_t *sym_score;
-				sym_score = ucl_object_lookup (elt, "score");
-				rspamd_printf_fstring (out, "Symbol: %s(%.2f)\r\n",
-					ucl_object_key (elt),
-					ucl_object_todouble (sym_score));
+		g_hash_table_iter_init (&hiter, mres->symbols);
+
+		while (g_hash_table_iter_next (&hiter, &h, &v)) {
+			sym = (struct symbol *)v;
+
+			if (sym->def != NULL) {
+				*out = rspamd_fstring_append (*out, sym->def->legacy_reply.begin,
+						sym->def->legacy_reply.len);
+				rspamd_printf_fstring (out, "%.2f)\r\n", sym->score);
+			}
+			else {
+				name = h;
+				rspamd_printf_fstring (out, "Symbol: %s(%.2f)\r\n", name,
+						sym->score);
 			}
 		}
 
-		elt = ucl_object_lookup (metric, "subject");
-		if (elt != NULL) {
+		if (mres->action == METRIC_ACTION_REWRITE_SUBJECT) {
 			rspamd_printf_fstring (out, "Subject: %s\r\n",
-				ucl_object_tostring (elt));
+				make_rewritten_subject (mres->metric, task));
 		}
 	}
 
-	elt = ucl_object_lookup (top, "messages");
-	if (elt != NULL) {
-		iter = NULL;
-		while ((cur = ucl_object_iterate (elt, &iter, true)) != NULL) {
-			if (cur->type == UCL_STRING) {
-				rspamd_printf_fstring (out, "Message: %s\r\n",
-						ucl_object_tostring (cur));
-			}
-		}
+	for (cur = task->messages; cur != NULL; cur = g_list_next (cur)) {
+		rspamd_printf_fstring (out, "Message: %s\r\n", (const gchar *)cur->data);
 	}
 
 	rspamd_printf_fstring (out, "Message-ID: %s\r\n", task->message_id);
 }
 
 static void
-rspamd_ucl_tospamc_output (struct rspamd_task *task,
-	ucl_object_t *top,
+rspamd_tospamc_output (struct rspamd_task *task,
 	rspamd_fstring_t **out)
 {
-	const ucl_object_t *metric, *score,
-		*required_score, *is_spam, *elt;
-	ucl_object_iter_t iter = NULL;
+	struct metric_result *mres;
+	struct symbol *sym;
+	GHashTableIter hiter;
+	gpointer h, v;
 	rspamd_fstring_t *f;
+	const gchar *name;
+
+	mres = rspamd_mempool_hash_lookup (task->results, DEFAULT_METRIC);
 
-	metric = ucl_object_lookup (top, DEFAULT_METRIC);
-	if (metric != NULL) {
-		score = ucl_object_lookup (metric, "score");
-		required_score = ucl_object_lookup (metric, "required_score");
-		is_spam = ucl_object_lookup (metric, "is_spam");
+	if (mres != NULL) {
 		rspamd_printf_fstring (out,
 			"Spam: %s ; %.2f / %.2f\r\n\r\n",
-			ucl_object_toboolean (is_spam) ? "True" : "False",
-			ucl_object_todouble (score),
-			ucl_object_todouble (required_score));
-
-		while ((elt = ucl_object_iterate (metric, &iter, true)) != NULL) {
-			if (elt->type == UCL_OBJECT) {
-				rspamd_printf_fstring (out, "%s,",
-					ucl_object_key (elt));
+			mres->action < METRIC_ACTION_GREYLIST ? "True" : "False",
+			mres->score,
+			mres->required_score);
+
+		g_hash_table_iter_init (&hiter, mres->symbols);
+
+		while (g_hash_table_iter_next (&hiter, &h, &v)) {
+			sym = (struct symbol *)v;
+
+			if (sym->def != NULL) {
+				/* Skip "Symbol: " prefix and trailing "(" */
+				*out = rspamd_fstring_append (*out,
+						sym->def->legacy_reply.begin + sizeof ("Symbol: ") - 1,
+						sym->def->legacy_reply.len - (sizeof ("Symbol: (") - 1));
 			}
+			else {
+				name = h;
+				*out = rspamd_fstring_append (*out, name, strlen (name));
+			}
+
+			*out = rspamd_fstring_append (*out, ",", 1);
 		}
+
 		/* Ugly hack, but the whole spamc is ugly */
 		f = *out;
 		if (f->str[f->len - 1] == ',') {
@@ -952,13 +1018,13 @@ rspamd_protocol_write_ucl (struct rspamd_task *task)
 {
 	struct metric_result *metric_res;
 	ucl_object_t *top = NULL, *obj;
-	GHashTableIter hiter;
+	rspamd_mempool_hash_iter_t hiter;
 	gpointer h, v;
 
-	g_hash_table_iter_init (&hiter, task->results);
+	rspamd_mempool_hash_iter_init (&hiter, task->results);
 	top = ucl_object_typed_new (UCL_OBJECT);
 	/* Convert results to an ucl object */
-	while (g_hash_table_iter_next (&hiter, &h, &v)) {
+	while (rspamd_mempool_hash_iter_next (&hiter, &h, &v)) {
 		metric_res = (struct metric_result *)v;
 		obj = rspamd_metric_result_ucl (task, metric_res);
 		ucl_object_insert_key (top, obj, h, 0, false);
@@ -970,11 +1036,11 @@ rspamd_protocol_write_ucl (struct rspamd_task *task)
 	}
 
 	if (task->cfg->log_urls || (task->flags & RSPAMD_TASK_FLAG_EXT_URLS)) {
-		if (g_hash_table_size (task->urls) > 0) {
+		if (rspamd_url_set_size (task->urls) > 0) {
 			ucl_object_insert_key (top, rspamd_urls_tree_ucl (task->urls,
 					task), "urls", 0, false);
 		}
-		if (g_hash_table_size (task->emails) > 0) {
+		if (rspamd_url_set_size (task->emails) > 0) {
 			ucl_object_insert_key (top, rspamd_emails_tree_ucl (task->emails, task),
 					"emails", 0, false);
 		}
@@ -1006,7 +1072,13 @@ rspamd_protocol_http_reply (struct rspamd_http_message *msg,
 		rspamd_http_message_add_header (msg, hn->begin, hv->begin);
 	}
 
-	top = rspamd_protocol_write_ucl (task);
+	if (msg->method < HTTP_SYMBOLS && !RSPAMD_TASK_IS_SPAMC (task)) {
+		top = rspamd_protocol_write_ucl (task);
+	}
+	else {
+		/* Legacy replies do not need ucl representation */
+		rspamd_protocol_check_actions (task);
+	}
 
 	if (!(task->flags & RSPAMD_TASK_FLAG_NO_LOG)) {
 		rspamd_roll_history_update (task->worker->srv->history, task);
@@ -1033,38 +1105,31 @@ rspamd_protocol_http_reply (struct rspamd_http_message *msg,
 	}
 	else {
 		if (RSPAMD_TASK_IS_SPAMC (task)) {
-			rspamd_ucl_tospamc_output (task, top, &msg->body);
+			rspamd_tospamc_output (task, &msg->body);
 		}
 		else {
-			rspamd_ucl_torspamc_output (task, top, &msg->body);
+			rspamd_torspamc_output (task, &msg->body);
 		}
 	}
 
-	ucl_object_unref (top);
+	if (top != NULL) {
+		ucl_object_unref (top);
+	}
 
 	if (!(task->flags & RSPAMD_TASK_FLAG_NO_STAT)) {
 		/* Update stat for default metric */
-		metric_res = g_hash_table_lookup (task->results, DEFAULT_METRIC);
+		metric_res = rspamd_mempool_hash_lookup (task->results, DEFAULT_METRIC);
 		if (metric_res != NULL) {
 			action = rspamd_check_action_metric (task, metric_res->score, &required_score,
 					metric_res->metric);
 			if (action <= METRIC_ACTION_NOACTION) {
-#ifndef HAVE_ATOMIC_BUILTINS
-				task->worker->srv->stat->actions_stat[action]++;
-#else
-				__atomic_add_fetch (&task->worker->srv->stat->actions_stat[action],
-						1, __ATOMIC_RELEASE);
-#endif
+				rspamd_atomic_add (&task->worker->srv->stat->actions_stat[action],
+						1);
 			}
 		}
 
 		/* Increase counters */
-#ifndef HAVE_ATOMIC_BUILTINS
-		task->worker->srv->stat->messages_scanned++;
-#else
-		__atomic_add_fetch (&task->worker->srv->stat->messages_scanned,
-				1, __ATOMIC_RELEASE);
-#endif
+		rspamd_atomic_add (&task->worker->srv->stat->messages_scanned, 1);
 	}
 }
 
@@ -23,10 +23,7 @@
 #include "libserver/cfg_file.h"
 #include "libutil/util.h"
 #include "libutil/regexp.h"
-#ifdef WITH_HYPERSCAN
-#include "hs.h"
-#include "unix-std.h"
-#include <signal.h>
+#include "acism.h"
 
 #ifndef WITH_PCRE2
 #include <pcre.h>
@@ -34,6 +31,11 @@
 #include <pcre2.h>
 #endif
 
+#ifdef WITH_HYPERSCAN
+#include "hs.h"
+#include "unix-std.h"
+#include <signal.h>
+
 #ifdef HAVE_SYS_WAIT_H
 #include <sys/wait.h>
 #endif
@@ -57,9 +59,12 @@
         G_STRFUNC, \
         __VA_ARGS__)
 
+/* Shorter literals are too common to be useful for prefiltering */
+#define RSPAMD_RE_CACHE_MIN_LITERAL 3
+
 #ifdef WITH_HYPERSCAN
 #define RSPAMD_HS_MAGIC_LEN (sizeof (rspamd_hs_magic))
-static const guchar rspamd_hs_magic[] = {'r', 's', 'h', 's', 'r', 'e', '1', '1'};
+static const guchar rspamd_hs_magic[] = {'r', 's', 'h', 's', 'r', 'e', '1', '2'};
 #endif
 
 struct rspamd_re_class {
@@ -68,13 +73,18 @@ struct rspamd_re_class {
 	gpointer type_data;
 	gsize type_len;
 	GHashTable *re;
+	GArray *re_ids; /* global ids of regexps ordered as in cache */
 	gchar hash[rspamd_cryptobox_HASHBYTES + 1];
 	rspamd_cryptobox_hash_state_t *st;
+	guint idx;
+	ac_trie_t *lit_trie;
+	GPtrArray *lit_res; /* GArray of regexp ids for each literal in trie */
 #ifdef WITH_HYPERSCAN
 	hs_database_t *hs_db;
 	hs_scratch_t *hs_scratch;
 	gint *hs_ids;
 	guint nhs;
+	gboolean hs_vectored;
 #endif
 };
 
@@ -87,6 +97,7 @@ enum rspamd_re_cache_elt_match_type {
 struct rspamd_re_cache_elt {
 	rspamd_regexp_t *re;
 	enum rspamd_re_cache_elt_match_type match_type;
+	gboolean has_literal;
 };
 
 struct rspamd_re_cache {
@@ -94,7 +105,9 @@ struct rspamd_re_cache {
 	GPtrArray *re;
 	ref_entry_t ref;
 	guint nre;
+	guint nclasses;
 	guint max_re_data;
+	gboolean eager_classes;
 	gchar hash[rspamd_cryptobox_HASHBYTES + 1];
 #ifdef WITH_HYPERSCAN
 	gboolean hyperscan_loaded;
@@ -106,6 +119,9 @@ struct rspamd_re_cache {
 struct rspamd_re_runtime {
 	guchar *checked;
 	guchar *results;
+	guint *vec_elts; /* last element confirmed per regexp in vectored scans */
+	guchar *lit_found; /* regexps whose required literal has been found */
+	guchar *lit_classes; /* classes that have been scanned for literals */
 	struct rspamd_re_cache *cache;
 	struct rspamd_re_cache_stat stat;
 };
@@ -147,6 +163,16 @@ rspamd_re_cache_destroy (struct rspamd_re_cache *cache)
 		re_class = v;
 		g_hash_table_iter_steal (&it);
 		g_hash_table_unref (re_class->re);
+
+		if (re_class->re_ids) {
+			g_array_free (re_class->re_ids, TRUE);
+		}
+		if (re_class->lit_trie) {
+			acism_destroy (re_class->lit_trie);
+		}
+		if (re_class->lit_res) {
+			g_ptr_array_free (re_class->lit_res, TRUE);
+		}
 #ifdef WITH_HYPERSCAN
 		if (re_class->hs_db) {
 			hs_free_database (re_class->hs_db);
@@ -183,6 +209,9 @@ rspamd_re_cache_new (void)
 	cache = g_slice_alloc (sizeof (*cache));
 	cache->re_classes = g_hash_table_new (g_int64_hash, g_int64_equal);
 	cache->nre = 0;
+	cache->nclasses = 0;
+	cache->max_re_data = 0;
+	cache->eager_classes = FALSE;
 	cache->re = g_ptr_array_new_full (256, rspamd_re_cache_elt_dtor);
 #ifdef WITH_HYPERSCAN
 	cache->hyperscan_loaded = FALSE;
@@ -305,10 +334,268 @@ rspamd_re_cache_sort_func (gconstpointer a, gconstpointer b)
 			rspamd_regexp_get_id ((*re2)->re));
 }
 
+static void
+rspamd_re_cache_flush_literal (GString *cur, GString **best)
+{
+	if (*best == NULL || cur->len > (*best)->len) {
+		if (*best == NULL) {
+			*best = g_string_sized_new (cur->len);
+		}
+
+		g_string_assign (*best, cur->str);
+	}
+
+	g_string_truncate (cur, 0);
+}
+
+gchar *
+rspamd_re_cache_extract_literal (const gchar *pat, gint pcre_flags,
+		gsize *outlen)
+{
+	const gchar *p = pat, *t;
+	GString *cur, *best = NULL;
+	gint depth = 0;
+	gboolean in_class = FALSE;
+	gchar c, *ret = NULL;
+
+	if (pcre_flags & PCRE_FLAG(EXTENDED)) {
+		return NULL;
+	}
+
+	cur = g_string_sized_new (32);
+
+	while (*p) {
+		c = *p;
+
+		if (in_class) {
+			if (c == '\\' && p[1] != '\0') {
+				p ++;
+			}
+			else if (c == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+				/* POSIX class, e.g. [:digit:], is a single token */
+				for (t = p + 2; *t != '\0'; t ++) {
+					if (t[0] == p[1] && t[1] == ']') {
+						break;
+					}
+				}
+
+				if (*t == '\0') {
+					goto fail;
+				}
+
+				p = t + 2;
+				continue;
+			}
+			else if (c == ']') {
+				in_class = FALSE;
+			}
+
+			p ++;
+			continue;
+		}
+
+		if (c == '\\') {
+			c = p[1];
+
+			if (c == '\0') {
+				break;
+			}
+			else if (strchr ("xpPcoNgkQE0123456789", c) != NULL) {
+				/* Escapes with arguments, give up */
+				goto fail;
+			}
+			else if (g_ascii_isalnum (c)) {
+				/* Character types and assertions */
+				rspamd_re_cache_flush_literal (cur, &best);
+				p += 2;
+				continue;
+			}
+
+			/* Escaped punctuation is a literal character */
+			p += 2;
+		}
+		else if (c == '[') {
+			rspamd_re_cache_flush_literal (cur, &best);
+			in_class = TRUE;
+			p ++;
+
+			if (*p == '^') {
+				p ++;
+			}
+			if (*p == ']') {
+				p ++;
+			}
+
+			continue;
+		}
+		else if (c == '(') {
+			if (p[1] == '?') {
+				/* Check inline options for extended mode */
+				for (t = p + 2; g_ascii_isalpha (*t) || *t == '-'; t ++) {
+					if (*t == 'x') {
+						goto fail;
+					}
+				}
+			}
+
+			rspamd_re_cache_flush_literal (cur, &best);
+			depth ++;
+			p ++;
+			continue;
+		}
+		else if (c == ')') {
+			rspamd_re_cache_flush_literal (cur, &best);
+			depth --;
+			p ++;
+			continue;
+		}
+		else if (c == '|') {
+			if (depth <= 0) {
+				/* Top level alternation */
+				goto fail;
+			}
+
+			p ++;
+			continue;
+		}
+		else if (strchr (".^$*+?{", c) != NULL || (guchar)c >= 0x80) {
+			rspamd_re_cache_flush_literal (cur, &best);
+
+			if (c == '{') {
+				while (*p && *p != '}') {
+					p ++;
+				}
+			}
+
+			if (*p) {
+				p ++;
+			}
+
+			continue;
+		}
+		else {
+			p ++;
+		}
+
+		/* We have a literal character c */
+		if (depth > 0) {
+			continue;
+		}
+
+		if (*p == '?' || *p == '*' || *p == '{') {
+			/* Optional character */
+			rspamd_re_cache_flush_literal (cur, &best);
+		}
+		else {
+			g_string_append_c (cur, g_ascii_tolower (c));
+
+			if (*p == '+') {
+				rspamd_re_cache_flush_literal (cur, &best);
+			}
+		}
+	}
+
+	rspamd_re_cache_flush_literal (cur, &best);
+
+	if (best && best->len >= RSPAMD_RE_CACHE_MIN_LITERAL) {
+		*outlen = best->len;
+		ret = g_string_free (best, FALSE);
+		best = NULL;
+	}
+
+fail:
+	g_string_free (cur, TRUE);
+
+	if (best) {
+		g_string_free (best, TRUE);
+	}
+
+	return ret;
+}
+
+static void
+rspamd_re_cache_lit_res_dtor (gpointer p)
+{
+	g_array_free ((GArray *)p, TRUE);
+}
+
+/*
+ * Builds aho-corasick trie of required literals for all regexps in a class
+ */
+static void
+rspamd_re_cache_build_literals (struct rspamd_re_cache *cache,
+		struct rspamd_re_class *re_class)
+{
+	GHashTableIter it;
+	gpointer k, v;
+	GHashTable *seen;
+	GArray *pats, *ids;
+	ac_trie_pat_t pat;
+	rspamd_regexp_t *re;
+	struct rspamd_re_cache_elt *elt;
+	guint64 re_id;
+	gchar *lit;
+	gsize litlen;
+	guint i;
+
+	pats = g_array_new (FALSE, FALSE, sizeof (ac_trie_pat_t));
+	seen = g_hash_table_new (g_str_hash, g_str_equal);
+	re_class->lit_res = g_ptr_array_new_full (8, rspamd_re_cache_lit_res_dtor);
+	g_hash_table_iter_init (&it, re_class->re);
+
+	while (g_hash_table_iter_next (&it, &k, &v)) {
+		re = v;
+		re_id = rspamd_regexp_get_cache_id (re);
+		elt = g_ptr_array_index (cache->re, re_id);
+		elt->has_literal = FALSE;
+		lit = rspamd_re_cache_extract_literal (rspamd_regexp_get_pattern (re),
+				rspamd_regexp_get_pcre_flags (re), &litlen);
+
+		if (lit == NULL) {
+			continue;
+		}
+
+		if ((v = g_hash_table_lookup (seen, lit)) != NULL) {
+			/* Index of the literal + 1 */
+			i = GPOINTER_TO_UINT (v) - 1;
+			g_free (lit);
+		}
+		else {
+			pat.ptr = lit;
+			pat.len = litlen;
+			g_array_append_val (pats, pat);
+			i = pats->len - 1;
+			g_hash_table_insert (seen, lit, GUINT_TO_POINTER (i + 1));
+			g_ptr_array_add (re_class->lit_res,
+					g_array_new (FALSE, FALSE, sizeof (guint64)));
+		}
+
+		ids = g_ptr_array_index (re_class->lit_res, i);
+		g_array_append_val (ids, re_id);
+		elt->has_literal = TRUE;
+	}
+
+	if (pats->len > 0) {
+		re_class->lit_trie = acism_create ((ac_trie_pat_t *)pats->data,
+				pats->len);
+		msg_debug_re_cache ("extracted %d literals for class %s",
+				pats->len, rspamd_re_cache_type_to_string (re_class->type));
+	}
+
+	/* Trie does not reference patterns after creation */
+	for (i = 0; i < pats->len; i ++) {
+		g_free ((gchar *)g_array_index (pats, ac_trie_pat_t, i).ptr);
+	}
+
+	g_array_free (pats, TRUE);
+	g_hash_table_unref (seen);
+}
+
 void
 rspamd_re_cache_init (struct rspamd_re_cache *cache, struct rspamd_config *cfg)
 {
 	guint i, fl;
+	guint64 re_id;
 	GHashTableIter it;
 	gpointer k, v;
 	struct rspamd_re_class *re_class;
@@ -333,8 +620,13 @@ rspamd_re_cache_init (struct rspamd_re_cache *cache, struct rspamd_config *cfg)
 		if (re_class->st == NULL) {
 			re_class->st = g_slice_alloc (sizeof (*re_class->st));
 			rspamd_cryptobox_hash_init (re_class->st, NULL, 0);
+			re_class->re_ids = g_array_new (FALSE, FALSE, sizeof (guint64));
 		}
 
+		/* Local id of regexp in class is its position in this array */
+		re_id = i;
+		g_array_append_val (re_class->re_ids, re_id);
+
 		/* Update hashes */
 		rspamd_cryptobox_hash_update (re_class->st, (gpointer) &re_class->id,
 				sizeof (re_class->id));
@@ -364,6 +656,7 @@ rspamd_re_cache_init (struct rspamd_re_cache *cache, struct rspamd_config *cfg)
 	rspamd_cryptobox_hash_final (&st_global, hash_out);
 	rspamd_snprintf (cache->hash, sizeof (cache->hash), "%*xs",
 			(gint) rspamd_cryptobox_HASHBYTES, hash_out);
+	cache->eager_classes = cfg->eager_regexp_classes;
 
 	/* Now finalize all classes */
 	g_hash_table_iter_init (&it, cache->re_classes);
@@ -373,19 +666,19 @@ rspamd_re_cache_init (struct rspamd_re_cache *cache, struct rspamd_config *cfg)
 
 		if (re_class->st) {
 			/*
-			 * We finally update all classes with the number of expressions
-			 * in the cache to ensure that if even a single re has been changed
-			 * we won't be broken due to id mismatch
+			 * Hyperscan databases use ids local to the class, so the hash
+			 * depends merely on the set of regexps in this class and
+			 * compiled databases could be reused when other classes change
 			 */
-			rspamd_cryptobox_hash_update (re_class->st,
-					(gpointer)&cache->re->len,
-					sizeof (cache->re->len));
 			rspamd_cryptobox_hash_final (re_class->st, hash_out);
 			rspamd_snprintf (re_class->hash, sizeof (re_class->hash), "%*xs",
 					(gint) rspamd_cryptobox_HASHBYTES, hash_out);
 			g_slice_free1 (sizeof (*re_class->st), re_class->st);
 			re_class->st = NULL;
 		}
+
+		re_class->idx = cache->nclasses ++;
+		rspamd_re_cache_build_literals (cache, re_class);
 	}
 
 #ifdef WITH_HYPERSCAN
@@ -438,6 +731,8 @@ rspamd_re_cache_runtime_new (struct rspamd_re_cache *cache)
 	REF_RETAIN (cache);
 	rt->checked = g_slice_alloc0 (NBYTES (cache->nre));
 	rt->results = g_slice_alloc0 (cache->nre);
+	rt->lit_found = g_slice_alloc0 (NBYTES (cache->nre));
+	rt->lit_classes = g_slice_alloc0 (NBYTES (cache->nclasses));
 
 	return rt;
 }
@@ -512,12 +807,24 @@ rspamd_re_cache_process_pcre (struct rspamd_re_runtime *rt,
 #ifdef WITH_HYPERSCAN
 struct rspamd_re_hyperscan_cbdata {
 	struct rspamd_re_runtime *rt;
+	struct rspamd_re_class *re_class;
 	const guchar *in;
 	gsize len;
 	rspamd_regexp_t *re;
 	rspamd_mempool_t *pool;
 };
 
+struct rspamd_re_hyperscan_vector_cbdata {
+	struct rspamd_re_runtime *rt;
+	struct rspamd_re_class *re_class;
+	const guchar **in;
+	guint *lens;
+	gsize *ends;
+	guint count;
+	gboolean is_raw;
+	rspamd_mempool_t *pool;
+};
+
 static gint
 rspamd_re_cache_hyperscan_cb (unsigned int id,
 		unsigned long long from,
@@ -531,6 +838,8 @@ rspamd_re_cache_hyperscan_cb (unsigned int id,
 	guint ret, maxhits;
 
 	rt = cbdata->rt;
+	/* Hyperscan reports ids local to the class */
+	id = g_array_index (cbdata->re_class->re_ids, guint64, id);
 	pcre_elt = g_ptr_array_index (rt->cache->re, id);
 	maxhits = rspamd_regexp_get_maxhits (pcre_elt->re);
 
@@ -558,66 +867,326 @@ rspamd_re_cache_hyperscan_cb (unsigned int id,
 
 	return 0;
 }
+
+/*
+ * Vectored scan treats all elements as a single block of data, so a match
+ * reported by hyperscan might span several elements. We use it merely as a
+ * prefilter and confirm each candidate by pcre within the element where
+ * the match ends.
+ */
+static gint
+rspamd_re_cache_hyperscan_vector_cb (unsigned int id,
+		unsigned long long from,
+		unsigned long long to,
+		unsigned int flags,
+		void *ud)
+{
+	struct rspamd_re_hyperscan_vector_cbdata *cbdata = ud;
+	struct rspamd_re_runtime *rt;
+	struct rspamd_re_cache_elt *pcre_elt;
+	guint maxhits, lo, hi, mid, i;
+
+	rt = cbdata->rt;
+	id = g_array_index (cbdata->re_class->re_ids, guint64, id);
+	pcre_elt = g_ptr_array_index (rt->cache->re, id);
+	maxhits = rspamd_regexp_get_maxhits (pcre_elt->re);
+	setbit (rt->checked, id);
+
+	if (maxhits > 0 && rt->results[id] >= maxhits) {
+		return 0;
+	}
+
+	/* Find the first element that ends after the match */
+	lo = 0;
+	hi = cbdata->count - 1;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+
+		if (cbdata->ends[mid] < to) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+
+	if (rt->vec_elts[id] > lo) {
+		/* Element has been already checked */
+		return 0;
+	}
+
+	if (maxhits == 1) {
+		/*
+		 * Single match regexps are reported only once, so if the first match
+		 * has not been confirmed we need to check the subsequent elements
+		 */
+		for (i = lo; i < cbdata->count && rt->results[id] == 0; i ++) {
+			rt->results[id] = rspamd_re_cache_process_pcre (rt,
+					pcre_elt->re,
+					cbdata->pool,
+					cbdata->in[i],
+					cbdata->lens[i],
+					cbdata->is_raw);
+		}
+
+		rt->vec_elts[id] = cbdata->count;
+	}
+	else {
+		rt->results[id] = rspamd_re_cache_process_pcre (rt,
+				pcre_elt->re,
+				cbdata->pool,
+				cbdata->in[lo],
+				cbdata->lens[lo],
+				cbdata->is_raw);
+		rt->vec_elts[id] = lo + 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Anchors and word boundaries have different meaning when elements are
+ * concatenated, so we cannot use vectored scan for such regexps
+ */
+static gboolean
+rspamd_re_cache_is_vector_safe (const gchar *pat)
+{
+	const gchar *p = pat;
+	gboolean in_class = FALSE;
+
+	while (*p) {
+		if (*p == '\\') {
+			p ++;
+
+			if (*p == '\0') {
+				break;
+			}
+
+			if (!in_class && strchr ("AzZGbB", *p) != NULL) {
+				return FALSE;
+			}
+		}
+		else if (in_class) {
+			if (*p == ']') {
+				in_class = FALSE;
+			}
+		}
+		else if (*p == '[') {
+			in_class = TRUE;
+
+			/* Skip negation and literal ']' at the beginning of class */
+			if (p[1] == '^') {
+				p ++;
+			}
+			if (p[1] == ']') {
+				p ++;
+			}
+		}
+		else if (*p == '^' || *p == '$') {
+			return FALSE;
+		}
+
+		p ++;
+	}
+
+	return TRUE;
+}
 #endif
 
+struct rspamd_re_literal_cbdata {
+	struct rspamd_re_runtime *rt;
+	struct rspamd_re_class *re_class;
+};
+
+static gint
+rspamd_re_cache_literal_cb (gint strnum, gint textpos, void *context)
+{
+	struct rspamd_re_literal_cbdata *cbdata = context;
+	GArray *ids;
+	guint i;
+
+	ids = g_ptr_array_index (cbdata->re_class->lit_res, strnum);
+
+	for (i = 0; i < ids->len; i ++) {
+		setbit (cbdata->rt->lit_found, g_array_index (ids, guint64, i));
+	}
+
+	return 0;
+}
+
+/*
+ * Returns FALSE if a regexp cannot match the input as its required literal
+ * is absent. All literals of a class are searched in a single pass.
+ */
+static gboolean
+rspamd_re_cache_check_literal (struct rspamd_re_runtime *rt,
+		struct rspamd_re_class *re_class,
+		struct rspamd_re_cache_elt *elt,
+		guint64 re_id,
+		const guchar **in, guint *lens,
+		guint count)
+{
+	struct rspamd_re_literal_cbdata cbdata;
+	guint i;
+	gsize len;
+	gint state;
+
+	if (!elt->has_literal || re_class->lit_trie == NULL) {
+		return TRUE;
+	}
+
+	if (!isset (rt->lit_classes, re_class->idx)) {
+		cbdata.rt = rt;
+		cbdata.re_class = re_class;
+
+		for (i = 0; i < count; i ++) {
+			len = lens[i];
+
+			if (rt->cache->max_re_data > 0 && len > rt->cache->max_re_data) {
+				len = rt->cache->max_re_data;
+			}
+
+			state = 0;
+			acism_lookup (re_class->lit_trie, (const gchar *)in[i], len,
+					rspamd_re_cache_literal_cb, &cbdata, &state, TRUE);
+		}
+
+		setbit (rt->lit_classes, re_class->idx);
+	}
+
+	return isset (rt->lit_found, re_id);
+}
+
 static guint
 rspamd_re_cache_process_regexp_data (struct rspamd_re_runtime *rt,
 		rspamd_regexp_t *re, rspamd_mempool_t *pool,
-		const guchar *in, gsize len,
+		const guchar **in, guint *lens,
+		guint count,
 		gboolean is_raw)
 {
 
 	guint64 re_id;
-	guint ret = 0;
+	guint ret = 0, i;
 
 	re_id = rspamd_regexp_get_cache_id (re);
 
-	if (len == 0 || in == NULL) {
+	if (count == 0 || in == NULL) {
 		/* We assume this as absence of the specified data */
 		setbit (rt->checked, re_id);
 		rt->results[re_id] = ret;
 		return ret;
 	}
 
-#ifndef WITH_HYPERSCAN
-	ret = rspamd_re_cache_process_pcre (rt, re, pool, in, len, is_raw);
-	setbit (rt->checked, re_id);
-	rt->results[re_id] = ret;
-#else
 	struct rspamd_re_cache_elt *elt;
 	struct rspamd_re_class *re_class;
-	struct rspamd_re_hyperscan_cbdata cbdata;
 
 	elt = g_ptr_array_index (rt->cache->re, re_id);
 	re_class = rspamd_regexp_get_class (re);
 
-	if (rt->cache->disable_hyperscan || elt->match_type == RSPAMD_RE_CACHE_PCRE) {
-		ret = rspamd_re_cache_process_pcre (rt, re, pool, in, len, is_raw);
-		setbit (rt->checked, re_id);
+#ifndef WITH_HYPERSCAN
+	if (!rspamd_re_cache_check_literal (rt, re_class, elt, re_id, in, lens,
+			count)) {
+		/* Skip pcre */
+		count = 0;
+	}
+
+	for (i = 0; i < count; i ++) {
+		ret = rspamd_re_cache_process_pcre (rt, re, pool, in[i], lens[i],
+				is_raw);
 		rt->results[re_id] = ret;
 	}
-	else {
-		if (rt->cache->max_re_data > 0 && len > rt->cache->max_re_data) {
-			len = rt->cache->max_re_data;
+
+	setbit (rt->checked, re_id);
+#else
+	struct rspamd_re_hyperscan_cbdata cbdata;
+	struct rspamd_re_hyperscan_vector_cbdata vcbdata;
+	gsize total = 0;
+
+	if (rt->cache->disable_hyperscan || elt->match_type == RSPAMD_RE_CACHE_PCRE) {
+		if (!rspamd_re_cache_check_literal (rt, re_class, elt, re_id, in, lens,
+				count)) {
+			/* Skip pcre */
+			count = 0;
 		}
 
+		for (i = 0; i < count; i ++) {
+			ret = rspamd_re_cache_process_pcre (rt, re, pool, in[i], lens[i],
+					is_raw);
+			rt->results[re_id] = ret;
+		}
+
+		setbit (rt->checked, re_id);
+	}
+	else {
 		g_assert (re_class->hs_scratch != NULL);
 		g_assert (re_class->hs_db != NULL);
 
-		/* Go through hyperscan API */
-		cbdata.in = in;
-		cbdata.re = re;
-		cbdata.rt = rt;
-		cbdata.len = len;
-		cbdata.pool = pool;
-		rt->stat.bytes_scanned += len;
+		if (count > 1 && re_class->hs_vectored) {
+			/* Scan all elements at once */
+			vcbdata.rt = rt;
+			vcbdata.re_class = re_class;
+			vcbdata.in = in;
+			vcbdata.lens = lens;
+			vcbdata.count = count;
+			vcbdata.is_raw = is_raw;
+			vcbdata.pool = pool;
+			vcbdata.ends = g_malloc (count * sizeof (*vcbdata.ends));
+
+			for (i = 0; i < count; i ++) {
+				if (rt->cache->max_re_data > 0 &&
+						lens[i] > rt->cache->max_re_data) {
+					lens[i] = rt->cache->max_re_data;
+				}
+
+				total += lens[i];
+				vcbdata.ends[i] = total;
+			}
+
+			if (rt->vec_elts == NULL) {
+				rt->vec_elts = g_malloc0 (rt->cache->nre *
+						sizeof (*rt->vec_elts));
+			}
 
-		if ((hs_scan (re_class->hs_db, in, len, 0, re_class->hs_scratch,
-				rspamd_re_cache_hyperscan_cb, &cbdata)) != HS_SUCCESS) {
-			ret = 0;
+			rt->stat.bytes_scanned += total;
+
+			if ((hs_scan_vector (re_class->hs_db, (const char **)in, lens,
+					count, 0, re_class->hs_scratch,
+					rspamd_re_cache_hyperscan_vector_cb, &vcbdata))
+					!= HS_SUCCESS) {
+				ret = 0;
+			}
+			else {
+				ret = rt->results[re_id];
+			}
+
+			g_free (vcbdata.ends);
 		}
 		else {
-			ret = rt->results[re_id];
+			for (i = 0; i < count; i ++) {
+				if (rt->cache->max_re_data > 0 &&
+						lens[i] > rt->cache->max_re_data) {
+					lens[i] = rt->cache->max_re_data;
+				}
+
+				/* Go through hyperscan API */
+				cbdata.in = in[i];
+				cbdata.re = re;
+				cbdata.rt = rt;
+				cbdata.re_class = re_class;
+				cbdata.len = lens[i];
+				cbdata.pool = pool;
+				rt->stat.bytes_scanned += lens[i];
+
+				if ((hs_scan (re_class->hs_db, in[i], lens[i], 0,
+						re_class->hs_scratch,
+						rspamd_re_cache_hyperscan_cb, &cbdata)) != HS_SUCCESS) {
+					ret = 0;
+				}
+				else {
+					ret = rt->results[re_id];
+				}
+			}
 		}
 	}
 #endif
@@ -646,6 +1215,37 @@ rspamd_re_cache_finish_class (struct rspamd_re_runtime *rt,
 #endif
 }
 
+/*
+ * Evaluates all regexps of the class that have not been checked yet using
+ * the data that has been already collected for this class
+ */
+static void
+rspamd_re_cache_exec_class (struct rspamd_re_runtime *rt,
+		struct rspamd_re_class *re_class,
+		rspamd_mempool_t *pool,
+		const guchar **in, guint *lens,
+		guint count,
+		gboolean is_raw)
+{
+	GHashTableIter it;
+	gpointer k, v;
+	rspamd_regexp_t *re;
+	guint64 re_id;
+
+	g_hash_table_iter_init (&it, re_class->re);
+
+	while (g_hash_table_iter_next (&it, &k, &v)) {
+		re = v;
+		re_id = rspamd_regexp_get_cache_id (re);
+
+		if (!isset (rt->checked, re_id)) {
+			rspamd_re_cache_process_regexp_data (rt, re, pool, in, lens,
+					count, is_raw);
+			setbit (rt->checked, re_id);
+		}
+	}
+}
+
 /*
  * Calculates the specified regexp for the specified class if it's not calculated
  */
@@ -656,16 +1256,15 @@ rspamd_re_cache_exec_re (struct rspamd_task *task,
 		struct rspamd_re_class *re_class,
 		gboolean is_strong)
 {
-	guint ret = 0, i, re_id;
+	guint ret = 0, i, re_id, cnt = 0, slen;
 	GList *cur, *headerlist;
-	GHashTableIter it;
 	struct raw_header *rh;
-	const gchar *in;
-	gboolean raw = FALSE;
+	const gchar *in, **scvec = NULL;
+	guint *lenvec = NULL;
+	gboolean raw = FALSE, allocated = FALSE;
 	struct mime_text_part *part;
 	struct rspamd_url *url;
 	struct rspamd_re_cache *cache = rt->cache;
-	gpointer k, v;
 	gsize len;
 
 	msg_debug_re_cache ("get to the slow path for re type: %s: %s",
@@ -673,6 +1272,7 @@ rspamd_re_cache_exec_re (struct rspamd_task *task,
 			rspamd_regexp_get_pattern (re));
 	re_id = rspamd_regexp_get_cache_id (re);
 
+	/* Collect all data for the class */
 	switch (re_class->type) {
 	case RSPAMD_RE_HEADER:
 	case RSPAMD_RE_RAWHEADER:
@@ -682,47 +1282,52 @@ rspamd_re_cache_exec_re (struct rspamd_task *task,
 				is_strong);
 
 		if (headerlist) {
-			cur = headerlist;
-
-			while (cur) {
+			cnt = g_list_length (headerlist);
+			/* Number of headers is not limited, so do not use stack */
+			scvec = g_malloc (sizeof (*scvec) * cnt);
+			lenvec = g_malloc (sizeof (*lenvec) * cnt);
+			allocated = TRUE;
+			cnt = 0;
+
+			for (cur = headerlist; cur != NULL; cur = g_list_next (cur)) {
 				rh = cur->data;
+
 				if (re_class->type == RSPAMD_RE_RAWHEADER) {
 					in = rh->value;
+					len = rh->value_len;
 					raw = TRUE;
 				}
 				else {
 					in = rh->decoded;
+					len = rh->decoded_len;
+
 					/* Validate input */
-					if (!in || !g_utf8_validate (in, -1, NULL)) {
-						cur = g_list_next (cur);
+					if (!in || !g_utf8_validate (in, len, NULL)) {
 						continue;
 					}
 				}
 
-				/* Match re */
-				if (in) {
-					ret = rspamd_re_cache_process_regexp_data (rt, re,
-							task->task_pool, in, strlen (in), raw);
-					debug_task ("checking header %s regexp: %s -> %d",
-							re_class->type_data,
-							rspamd_regexp_get_pattern (re), ret);
+				if (in && len > 0) {
+					scvec[cnt] = in;
+					lenvec[cnt++] = len;
 				}
-
-				cur = g_list_next (cur);
 			}
 		}
 		break;
 	case RSPAMD_RE_ALLHEADER:
 		raw = TRUE;
 		in = task->raw_headers_content.begin;
-		len = task->raw_headers_content.len;
-		ret = rspamd_re_cache_process_regexp_data (rt, re,
-				task->task_pool, in, len, raw);
-		debug_task ("checking allheader regexp: %s -> %d",
-				rspamd_regexp_get_pattern (re), ret);
+		slen = task->raw_headers_content.len;
+		scvec = &in;
+		lenvec = &slen;
+		cnt = slen > 0 ? 1 : 0;
 		break;
 	case RSPAMD_RE_MIME:
 	case RSPAMD_RE_RAWMIME:
+		scvec = g_malloc (sizeof (*scvec) * (task->text_parts->len + 1));
+		lenvec = g_malloc (sizeof (*lenvec) * (task->text_parts->len + 1));
+		allocated = TRUE;
+
 		/* Iterate throught text parts */
 		for (i = 0; i < task->text_parts->len; i++) {
 			part = g_ptr_array_index (task->text_parts, i);
@@ -748,50 +1353,44 @@ rspamd_re_cache_exec_re (struct rspamd_task *task,
 			}
 
 			if (len > 0) {
-				ret = rspamd_re_cache_process_regexp_data (rt, re,
-						task->task_pool, in, len, raw);
-				debug_task ("checking mime regexp: %s -> %d",
-						rspamd_regexp_get_pattern (re), ret);
+				scvec[cnt] = in;
+				lenvec[cnt++] = len;
 			}
 		}
 		break;
 	case RSPAMD_RE_URL:
-		g_hash_table_iter_init (&it, task->urls);
-
-		while (g_hash_table_iter_next (&it, &k, &v)) {
-			url = v;
-			in = url->string;
-			len = url->urllen;
-			raw = FALSE;
-
-			ret = rspamd_re_cache_process_regexp_data (rt, re,
-					task->task_pool, in, len, raw);
+		cnt = rspamd_url_set_size (task->urls) +
+				rspamd_url_set_size (task->emails);
+		scvec = g_malloc (sizeof (*scvec) * (cnt + 1));
+		lenvec = g_malloc (sizeof (*lenvec) * (cnt + 1));
+		allocated = TRUE;
+		cnt = 0;
+
+		for (i = 0; i < rspamd_url_set_size (task->urls); i ++) {
+			url = rspamd_url_set_index (task->urls, i);
+
+			if (url->urllen > 0) {
+				scvec[cnt] = url->string;
+				lenvec[cnt++] = url->urllen;
+			}
 		}
 
-		g_hash_table_iter_init (&it, task->emails);
-
-		while (g_hash_table_iter_next (&it, &k, &v)) {
-			url = v;
-			in = url->string;
-			len = url->urllen;
-			raw = FALSE;
+		for (i = 0; i < rspamd_url_set_size (task->emails); i ++) {
+			url = rspamd_url_set_index (task->emails, i);
 
-			ret = rspamd_re_cache_process_regexp_data (rt, re,
-					task->task_pool, in, len, raw);
+			if (url->urllen > 0) {
+				scvec[cnt] = url->string;
+				lenvec[cnt++] = url->urllen;
+			}
 		}
-
-		debug_task ("checking url regexp: %s -> %d",
-				rspamd_regexp_get_pattern (re), ret);
 		break;
 	case RSPAMD_RE_BODY:
 		raw = TRUE;
 		in = task->msg.begin;
-		len = task->msg.len;
-
-		ret = rspamd_re_cache_process_regexp_data (rt, re, task->task_pool, in,
-				len, raw);
-		debug_task ("checking rawbody regexp: %s -> %d",
-				rspamd_regexp_get_pattern (re), ret);
+		slen = task->msg.len;
+		scvec = &in;
+		lenvec = &slen;
+		cnt = slen > 0 ? 1 : 0;
 		break;
 	case RSPAMD_RE_MAX:
 		msg_err_task ("regexp of class invalid has been called: %s",
@@ -799,6 +1398,12 @@ rspamd_re_cache_exec_re (struct rspamd_task *task,
 		break;
 	}
 
+	ret = rspamd_re_cache_process_regexp_data (rt, re, task->task_pool,
+			(const guchar **)scvec, lenvec, cnt, raw);
+	debug_task ("checking %s regexp: %s -> %d",
+			rspamd_re_cache_type_to_string (re_class->type),
+			rspamd_regexp_get_pattern (re), ret);
+
 #if WITH_HYPERSCAN
 	if (!rt->cache->disable_hyperscan) {
 		rspamd_re_cache_finish_class (rt, re_class);
@@ -807,6 +1412,16 @@ rspamd_re_cache_exec_re (struct rspamd_task *task,
 
 	setbit (rt->checked, re_id);
 
+	if (cache->eager_classes) {
+		rspamd_re_cache_exec_class (rt, re_class, task->task_pool,
+				(const guchar **)scvec, lenvec, cnt, raw);
+	}
+
+	if (allocated) {
+		g_free (scvec);
+		g_free (lenvec);
+	}
+
 	return rt->results[re_id];
 }
 
@@ -864,6 +1479,13 @@ rspamd_re_cache_runtime_destroy (struct rspamd_re_runtime *rt)
 
 	g_slice_free1 (NBYTES (rt->cache->nre), rt->checked);
 	g_slice_free1 (rt->cache->nre, rt->results);
+	g_slice_free1 (NBYTES (rt->cache->nre), rt->lit_found);
+	g_slice_free1 (NBYTES (rt->cache->nclasses), rt->lit_classes);
+
+	if (rt->vec_elts) {
+		g_free (rt->vec_elts);
+	}
+
 	REF_RELEASE (rt->cache);
 	g_slice_free1 (sizeof (*rt), rt);
 }
@@ -1037,10 +1659,263 @@ rspamd_re_cache_is_finite (struct rspamd_re_cache *cache,
 }
 #endif
 
+#ifdef WITH_HYPERSCAN
+/*
+ * Returns number of regexps in a valid hyperscan file
+ */
+static gint
+rspamd_re_cache_hyperscan_file_count (struct rspamd_re_cache *cache,
+		const gchar *path)
+{
+	gint fd, n = 0;
+
+	fd = open (path, O_RDONLY);
+
+	if (fd != -1) {
+		lseek (fd, RSPAMD_HS_MAGIC_LEN + sizeof (cache->plt), SEEK_SET);
+
+		if (read (fd, &n, sizeof (n)) != sizeof (n)) {
+			n = 0;
+		}
+
+		close (fd);
+	}
+
+	return n;
+}
+
+/*
+ * Compiles a single class to the hyperscan database and saves it to the
+ * specified path. Returns number of compiled regexps or -1 on error.
+ */
+static gint
+rspamd_re_cache_compile_class (struct rspamd_re_cache *cache,
+		struct rspamd_re_class *re_class,
+		const gchar *path,
+		gdouble max_time,
+		GError **err)
+{
+	gchar tmp_path[PATH_MAX];
+	hs_database_t *test_db;
+	gint fd, i, n, *hs_ids = NULL, pcre_flags, re_flags;
+	guint j;
+	guint64 crc;
+	rspamd_regexp_t *re;
+	struct rspamd_re_cache_elt *elt;
+	hs_compile_error_t *hs_errors;
+	guint *hs_flags = NULL;
+	const gchar **hs_pats = NULL;
+	gchar *hs_serialized;
+	gsize serialized_len;
+	struct iovec iov[7];
+
+	if (re_class->re_ids == NULL) {
+		return 0;
+	}
+
+	/* Write to a temporary file to avoid loading of partial databases */
+	rspamd_snprintf (tmp_path, sizeof (tmp_path), "%s.%P.tmp", path, getpid ());
+	fd = open (tmp_path, O_CREAT|O_TRUNC|O_EXCL|O_WRONLY, 00600);
+
+	if (fd == -1) {
+		g_set_error (err, rspamd_re_cache_quark (), errno, "cannot open file "
+				"%s: %s", tmp_path, strerror (errno));
+		return -1;
+	}
+
+	n = re_class->re_ids->len;
+	hs_flags = g_malloc0 (sizeof (*hs_flags) * n);
+	hs_ids = g_malloc (sizeof (*hs_ids) * n);
+	hs_pats = g_malloc (sizeof (*hs_pats) * n);
+	i = 0;
+
+	for (j = 0; j < re_class->re_ids->len; j ++) {
+		elt = g_ptr_array_index (cache->re,
+				g_array_index (re_class->re_ids, guint64, j));
+		re = elt->re;
+
+		pcre_flags = rspamd_regexp_get_pcre_flags (re);
+		re_flags = rspamd_regexp_get_flags (re);
+
+		if (re_flags & RSPAMD_REGEXP_FLAG_PCRE_ONLY) {
+			/* Do not try to compile bad regexp */
+			msg_info_re_cache (
+					"do not try compile %s to hyperscan as it is PCRE only",
+					rspamd_regexp_get_pattern (re));
+			continue;
+		}
+
+		hs_flags[i] = 0;
+#ifndef WITH_PCRE2
+		if (pcre_flags & PCRE_FLAG(UTF8)) {
+			hs_flags[i] |= HS_FLAG_UTF8;
+		}
+#else
+		if (pcre_flags & PCRE_FLAG(UTF)) {
+			hs_flags[i] |= HS_FLAG_UTF8;
+		}
+#endif
+		if (pcre_flags & PCRE_FLAG(CASELESS)) {
+			hs_flags[i] |= HS_FLAG_CASELESS;
+		}
+		if (pcre_flags & PCRE_FLAG(MULTILINE)) {
+			hs_flags[i] |= HS_FLAG_MULTILINE;
+		}
+		if (pcre_flags & PCRE_FLAG(DOTALL)) {
+			hs_flags[i] |= HS_FLAG_DOTALL;
+		}
+		if (rspamd_regexp_get_maxhits (re) == 1) {
+			hs_flags[i] |= HS_FLAG_SINGLEMATCH;
+		}
+
+		if (hs_compile (rspamd_regexp_get_pattern (re),
+				hs_flags[i],
+				HS_MODE_BLOCK,
+				&cache->plt,
+				&test_db,
+				&hs_errors) != HS_SUCCESS) {
+			msg_info_re_cache ("cannot compile %s to hyperscan, try prefilter match",
+					rspamd_regexp_get_pattern (re));
+			hs_free_compile_error (hs_errors);
+
+			/* The approximation operation might take a significant
+			 * amount of time, so we need to check if it's finite
+			 */
+			if (rspamd_re_cache_is_finite (cache, re, hs_flags[i], max_time)) {
+				hs_flags[i] |= HS_FLAG_PREFILTER;
+				hs_ids[i] = j;
+				hs_pats[i] = rspamd_regexp_get_pattern (re);
+				i++;
+			}
+		}
+		else {
+			hs_ids[i] = j;
+			hs_pats[i] = rspamd_regexp_get_pattern (re);
+			i ++;
+			hs_free_database (test_db);
+		}
+	}
+	/* Adjust real re number */
+	n = i;
+
+	if (n > 0) {
+		/* Create the hs tree */
+		if (hs_compile_multi (hs_pats,
+				hs_flags,
+				(guint *)hs_ids,
+				n,
+				HS_MODE_BLOCK,
+				&cache->plt,
+				&test_db,
+				&hs_errors) != HS_SUCCESS) {
+
+			g_set_error (err, rspamd_re_cache_quark (), EINVAL,
+					"cannot create tree of regexp when processing '%s': %s",
+					hs_pats[hs_errors->expression], hs_errors->message);
+			hs_free_compile_error (hs_errors);
+			n = -1;
+			goto end;
+		}
+
+		if (hs_serialize_database (test_db, &hs_serialized,
+				&serialized_len) != HS_SUCCESS) {
+			g_set_error (err,
+					rspamd_re_cache_quark (),
+					errno,
+					"cannot serialize tree of regexp for %s",
+					re_class->hash);
+			hs_free_database (test_db);
+			n = -1;
+			goto end;
+		}
+
+		hs_free_database (test_db);
+
+		/*
+		 * Magic - 8 bytes
+		 * Platform - sizeof (platform)
+		 * n - number of regexps
+		 * n * <regexp ids local to the class>
+		 * n * <regexp flags>
+		 * crc - 8 bytes checksum
+		 * <hyperscan blob>
+		 */
+		crc = XXH64 (hs_serialized, serialized_len, 0xdeadbabe);
+		iov[0].iov_base = (void *)rspamd_hs_magic;
+		iov[0].iov_len = RSPAMD_HS_MAGIC_LEN;
+		iov[1].iov_base = &cache->plt;
+		iov[1].iov_len = sizeof (cache->plt);
+		iov[2].iov_base = &n;
+		iov[2].iov_len = sizeof (n);
+		iov[3].iov_base = hs_ids;
+		iov[3].iov_len = sizeof (*hs_ids) * n;
+		iov[4].iov_base = hs_flags;
+		iov[4].iov_len = sizeof (*hs_flags) * n;
+		iov[5].iov_base = &crc;
+		iov[5].iov_len = sizeof (crc);
+		iov[6].iov_base = hs_serialized;
+		iov[6].iov_len = serialized_len;
+
+		if (writev (fd, iov, G_N_ELEMENTS (iov)) == -1) {
+			g_set_error (err,
+					rspamd_re_cache_quark (),
+					errno,
+					"cannot serialize tree of regexp to %s: %s",
+					tmp_path, strerror (errno));
+			g_free (hs_serialized);
+			n = -1;
+			goto end;
+		}
+
+		g_free (hs_serialized);
+
+		if (rename (tmp_path, path) == -1) {
+			g_set_error (err,
+					rspamd_re_cache_quark (),
+					errno,
+					"cannot rename %s to %s: %s",
+					tmp_path, path, strerror (errno));
+			n = -1;
+			goto end;
+		}
+
+		if (re_class->type_len > 0) {
+			msg_info_re_cache (
+					"compiled class %s(%*s) to cache %6s, %d regexps",
+					rspamd_re_cache_type_to_string (re_class->type),
+					(gint) re_class->type_len - 1,
+					re_class->type_data,
+					re_class->hash,
+					n);
+		}
+		else {
+			msg_info_re_cache (
+					"compiled class %s to cache %6s, %d regexps",
+					rspamd_re_cache_type_to_string (re_class->type),
+					re_class->hash,
+					n);
+		}
+	}
+
+end:
+	close (fd);
+
+	if (n <= 0) {
+		unlink (tmp_path);
+	}
+
+	g_free (hs_pats);
+	g_free (hs_ids);
+	g_free (hs_flags);
+
+	return n;
+}
+#endif
+
 gint
 rspamd_re_cache_compile_hyperscan (struct rspamd_re_cache *cache,
 		const char *cache_dir, gdouble max_time, gboolean silent,
-		GError **err)
+		guint max_procs, GError **err)
 {
 	g_assert (cache != NULL);
 	g_assert (cache_dir != NULL);
@@ -1049,21 +1924,18 @@ rspamd_re_cache_compile_hyperscan (struct rspamd_re_cache *cache,
 	g_set_error (err, rspamd_re_cache_quark (), EINVAL, "hyperscan is disabled");
 	return -1;
 #else
-	GHashTableIter it, cit;
+	GHashTableIter it;
 	gpointer k, v;
 	struct rspamd_re_class *re_class;
+	GPtrArray *pending;
 	gchar path[PATH_MAX];
-	hs_database_t *test_db;
-	gint fd, i, n, *hs_ids = NULL, pcre_flags, re_flags;
-	guint64 crc;
-	rspamd_regexp_t *re;
-	hs_compile_error_t *hs_errors;
-	guint *hs_flags = NULL;
-	const gchar **hs_pats = NULL;
-	gchar *hs_serialized;
-	gsize serialized_len, total = 0;
-	struct iovec iov[7];
+	gint n, status, ret = 0;
+	guint i, j, nprocs;
+	gsize total = 0;
+	pid_t *children, cld;
+	GError *cld_err = NULL;
 
+	pending = g_ptr_array_new ();
 	g_hash_table_iter_init (&it, cache->re_classes);
 
 	while (g_hash_table_iter_next (&it, &k, &v)) {
@@ -1072,17 +1944,10 @@ rspamd_re_cache_compile_hyperscan (struct rspamd_re_cache *cache,
 				G_DIR_SEPARATOR, re_class->hash);
 
 		if (rspamd_re_cache_is_valid_hyperscan_file (cache, path, TRUE, TRUE)) {
+			n = rspamd_re_cache_hyperscan_file_count (cache, path);
 
-			fd = open (path, O_RDONLY, 00600);
-
-			/* Read number of regexps */
-			g_assert (fd != -1);
-			lseek (fd, RSPAMD_HS_MAGIC_LEN + sizeof (cache->plt), SEEK_SET);
-			read (fd, &n, sizeof (n));
-			close (fd);
-
-			if (re_class->type_len > 0) {
-				if (!silent) {
+			if (!silent) {
+				if (re_class->type_len > 0) {
 					msg_info_re_cache (
 							"skip already valid class %s(%*s) to cache %6s, %d regexps",
 							rspamd_re_cache_type_to_string (re_class->type),
@@ -1091,9 +1956,7 @@ rspamd_re_cache_compile_hyperscan (struct rspamd_re_cache *cache,
 							re_class->hash,
 							n);
 				}
-			}
-			else {
-				if (!silent) {
+				else {
 					msg_info_re_cache (
 							"skip already valid class %s to cache %6s, %d regexps",
 							rspamd_re_cache_type_to_string (re_class->type),
@@ -1105,198 +1968,100 @@ rspamd_re_cache_compile_hyperscan (struct rspamd_re_cache *cache,
 			continue;
 		}
 
-		fd = open (path, O_CREAT|O_TRUNC|O_EXCL|O_WRONLY, 00600);
-
-		if (fd == -1) {
-			g_set_error (err, rspamd_re_cache_quark (), errno, "cannot open file "
-					"%s: %s", path, strerror (errno));
-			return -1;
-		}
-
-		g_hash_table_iter_init (&cit, re_class->re);
-		n = g_hash_table_size (re_class->re);
-		hs_flags = g_malloc0 (sizeof (*hs_flags) * n);
-		hs_ids = g_malloc (sizeof (*hs_ids) * n);
-		hs_pats = g_malloc (sizeof (*hs_pats) * n);
-		i = 0;
+		g_ptr_array_add (pending, re_class);
+	}
 
-		while (g_hash_table_iter_next (&cit, &k, &v)) {
-			re = v;
+	nprocs = MIN (max_procs, pending->len);
 
-			pcre_flags = rspamd_regexp_get_pcre_flags (re);
-			re_flags = rspamd_regexp_get_flags (re);
+	if (nprocs <= 1) {
+		for (i = 0; i < pending->len; i ++) {
+			re_class = g_ptr_array_index (pending, i);
+			rspamd_snprintf (path, sizeof (path), "%s%c%s.hs", cache_dir,
+					G_DIR_SEPARATOR, re_class->hash);
 
-			if (re_flags & RSPAMD_REGEXP_FLAG_PCRE_ONLY) {
-				/* Do not try to compile bad regexp */
-				msg_info_re_cache (
-						"do not try compile %s to hyperscan as it is PCRE only",
-						rspamd_regexp_get_pattern (re));
-				continue;
-			}
+			if ((n = rspamd_re_cache_compile_class (cache, re_class, path,
+					max_time, err)) == -1) {
+				g_ptr_array_free (pending, TRUE);
 
-			hs_flags[i] = 0;
-#ifndef WITH_PCRE2
-			if (pcre_flags & PCRE_FLAG(UTF8)) {
-				hs_flags[i] |= HS_FLAG_UTF8;
-			}
-#else
-			if (pcre_flags & PCRE_FLAG(UTF)) {
-				hs_flags[i] |= HS_FLAG_UTF8;
-			}
-#endif
-			if (pcre_flags & PCRE_FLAG(CASELESS)) {
-				hs_flags[i] |= HS_FLAG_CASELESS;
-			}
-			if (pcre_flags & PCRE_FLAG(MULTILINE)) {
-				hs_flags[i] |= HS_FLAG_MULTILINE;
-			}
-			if (pcre_flags & PCRE_FLAG(DOTALL)) {
-				hs_flags[i] |= HS_FLAG_DOTALL;
-			}
-			if (rspamd_regexp_get_maxhits (re) == 1) {
-				hs_flags[i] |= HS_FLAG_SINGLEMATCH;
+				return -1;
 			}
 
-			if (hs_compile (rspamd_regexp_get_pattern (re),
-					hs_flags[i],
-					HS_MODE_BLOCK,
-					&cache->plt,
-					&test_db,
-					&hs_errors) != HS_SUCCESS) {
-				msg_info_re_cache ("cannot compile %s to hyperscan, try prefilter match",
-						rspamd_regexp_get_pattern (re));
-				hs_free_compile_error (hs_errors);
-
-				/* The approximation operation might take a significant
-				 * amount of time, so we need to check if it's finite
-				 */
-				if (rspamd_re_cache_is_finite (cache, re, hs_flags[i], max_time)) {
-					hs_flags[i] |= HS_FLAG_PREFILTER;
-					hs_ids[i] = rspamd_regexp_get_cache_id (re);
-					hs_pats[i] = rspamd_regexp_get_pattern (re);
-					i++;
-				}
-			}
-			else {
-				hs_ids[i] = rspamd_regexp_get_cache_id (re);
-				hs_pats[i] = rspamd_regexp_get_pattern (re);
-				i ++;
-				hs_free_database (test_db);
-			}
+			total += n;
 		}
-		/* Adjust real re number */
-		n = i;
-
-		if (n > 0) {
-			/* Create the hs tree */
-			if (hs_compile_multi (hs_pats,
-					hs_flags,
-					hs_ids,
-					n,
-					HS_MODE_BLOCK,
-					&cache->plt,
-					&test_db,
-					&hs_errors) != HS_SUCCESS) {
-
-				g_set_error (err, rspamd_re_cache_quark (), EINVAL,
-						"cannot create tree of regexp when processing '%s': %s",
-						hs_pats[hs_errors->expression], hs_errors->message);
-				g_free (hs_flags);
-				g_free (hs_ids);
-				g_free (hs_pats);
-				close (fd);
-				hs_free_compile_error (hs_errors);
 
-				return -1;
-			}
+		g_ptr_array_free (pending, TRUE);
 
-			g_free (hs_pats);
+		return total;
+	}
 
-			if (hs_serialize_database (test_db, &hs_serialized,
-					&serialized_len) != HS_SUCCESS) {
-				g_set_error (err,
-						rspamd_re_cache_quark (),
-						errno,
-						"cannot serialize tree of regexp for %s",
-						re_class->hash);
+	/*
+	 * Classes are independent, so we compile them in several processes:
+	 * child number i compiles classes i, i + nprocs, i + 2 * nprocs...
+	 */
+	children = g_malloc0 (sizeof (*children) * nprocs);
+	/* We need to restore SIGCHLD processing */
+	signal (SIGCHLD, SIG_DFL);
 
-				close (fd);
-				g_free (hs_ids);
-				g_free (hs_flags);
-				hs_free_database (test_db);
+	for (i = 0; i < nprocs; i ++) {
+		cld = fork ();
 
-				return -1;
+		if (cld == -1) {
+			msg_err_re_cache ("cannot fork: %s", strerror (errno));
+			break;
+		}
+		else if (cld == 0) {
+			for (j = i; j < pending->len; j += nprocs) {
+				re_class = g_ptr_array_index (pending, j);
+				rspamd_snprintf (path, sizeof (path), "%s%c%s.hs", cache_dir,
+						G_DIR_SEPARATOR, re_class->hash);
+
+				if (rspamd_re_cache_compile_class (cache, re_class, path,
+						max_time, &cld_err) == -1) {
+					msg_err_re_cache ("cannot compile class %s: %e",
+							re_class->hash, cld_err);
+					exit (EXIT_FAILURE);
+				}
 			}
 
-			hs_free_database (test_db);
+			exit (EXIT_SUCCESS);
+		}
 
-			/*
-			 * Magic - 8 bytes
-			 * Platform - sizeof (platform)
-			 * n - number of regexps
-			 * n * <regexp ids>
-			 * n * <regexp flags>
-			 * crc - 8 bytes checksum
-			 * <hyperscan blob>
-			 */
-			crc = XXH64 (hs_serialized, serialized_len, 0xdeadbabe);
-			iov[0].iov_base = (void *)rspamd_hs_magic;
-			iov[0].iov_len = RSPAMD_HS_MAGIC_LEN;
-			iov[1].iov_base = &cache->plt;
-			iov[1].iov_len = sizeof (cache->plt);
-			iov[2].iov_base = &n;
-			iov[2].iov_len = sizeof (n);
-			iov[3].iov_base = hs_ids;
-			iov[3].iov_len = sizeof (*hs_ids) * n;
-			iov[4].iov_base = hs_flags;
-			iov[4].iov_len = sizeof (*hs_flags) * n;
-			iov[5].iov_base = &crc;
-			iov[5].iov_len = sizeof (crc);
-			iov[6].iov_base = hs_serialized;
-			iov[6].iov_len = serialized_len;
-
-			if (writev (fd, iov, G_N_ELEMENTS (iov)) == -1) {
-				g_set_error (err,
-						rspamd_re_cache_quark (),
-						errno,
-						"cannot serialize tree of regexp to %s: %s",
-						path, strerror (errno));
-				close (fd);
-				g_free (hs_ids);
-				g_free (hs_flags);
-				g_free (hs_serialized);
+		children[i] = cld;
+	}
 
-				return -1;
-			}
+	for (i = 0; i < nprocs; i ++) {
+		if (children[i] == 0) {
+			ret = -1;
+			continue;
+		}
 
-			if (re_class->type_len > 0) {
-				msg_info_re_cache (
-						"compiled class %s(%*s) to cache %6s, %d regexps",
-						rspamd_re_cache_type_to_string (re_class->type),
-						(gint) re_class->type_len - 1,
-						re_class->type_data,
-						re_class->hash,
-						n);
-			}
-			else {
-				msg_info_re_cache (
-						"compiled class %s to cache %6s, %d regexps",
-						rspamd_re_cache_type_to_string (re_class->type),
-						re_class->hash,
-						n);
-			}
+		if (waitpid (children[i], &status, 0) == -1 ||
+				!WIFEXITED (status) || WEXITSTATUS (status) != EXIT_SUCCESS) {
+			ret = -1;
+		}
+	}
 
-			total += n;
+	signal (SIGCHLD, SIG_IGN);
+	g_free (children);
 
-			g_free (hs_serialized);
-			g_free (hs_ids);
-			g_free (hs_flags);
+	if (ret == -1) {
+		g_set_error (err, rspamd_re_cache_quark (), EINVAL,
+				"cannot compile hyperscan classes, see log for details");
+	}
+	else {
+		for (i = 0; i < pending->len; i ++) {
+			re_class = g_ptr_array_index (pending, i);
+			rspamd_snprintf (path, sizeof (path), "%s%c%s.hs", cache_dir,
+					G_DIR_SEPARATOR, re_class->hash);
+			total += rspamd_re_cache_hyperscan_file_count (cache, path);
 		}
 
-		close (fd);
+		ret = total;
 	}
 
-	return total;
+	g_ptr_array_free (pending, TRUE);
+
+	return ret;
 #endif
 }
 
@@ -1545,10 +2310,20 @@ rspamd_re_cache_load_hyperscan (struct rspamd_re_cache *cache,
 			 * Now find hyperscan elts that are successfully compiled and
 			 * specify that they should be matched using hyperscan
 			 */
+			re_class->hs_vectored = TRUE;
+
 			for (i = 0; i < n; i ++) {
-				g_assert ((gint)cache->re->len > hs_ids[i] && hs_ids[i] >= 0);
+				/* Convert ids local to the class to the global ones */
+				g_assert (re_class->re_ids != NULL &&
+						(gint)re_class->re_ids->len > hs_ids[i] && hs_ids[i] >= 0);
+				hs_ids[i] = g_array_index (re_class->re_ids, guint64, hs_ids[i]);
 				elt = g_ptr_array_index (cache->re, hs_ids[i]);
 
+				if (!rspamd_re_cache_is_vector_safe (
+						rspamd_regexp_get_pattern (elt->re))) {
+					re_class->hs_vectored = FALSE;
+				}
+
 				if (hs_flags[i] & HS_FLAG_PREFILTER) {
 					elt->match_type = RSPAMD_RE_CACHE_HYPERSCAN_PRE;
 				}
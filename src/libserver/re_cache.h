@@ -141,11 +141,14 @@ const gchar * rspamd_re_cache_type_to_string (enum rspamd_re_type type);
 enum rspamd_re_type rspamd_re_cache_type_from_string (const char *str);
 
 /**
- * Compile expressions to the hyperscan tree and store in the `cache_dir`
+ * Compile expressions to the hyperscan tree and store in the `cache_dir`.
+ * Each class is stored in a separate file named by the hash of its regexps,
+ * so classes that are already compiled are skipped.
+ * @param max_procs maximum number of processes used to compile classes
  */
 gint rspamd_re_cache_compile_hyperscan (struct rspamd_re_cache *cache,
 		const char *cache_dir, gdouble max_time, gboolean silent,
-		GError **err);
+		guint max_procs, GError **err);
 
 
 /**
@@ -159,4 +162,16 @@ gboolean rspamd_re_cache_is_valid_hyperscan_file (struct rspamd_re_cache *cache,
  */
 gboolean rspamd_re_cache_load_hyperscan (struct rspamd_re_cache *cache,
 		const char *cache_dir);
+
+/**
+ * Extracts the longest literal string that must be present in any text
+ * matched by a regexp. The result is lowercased, as it is used for caseless
+ * search, and must be freed by caller
+ * @param pat pcre pattern
+ * @param pcre_flags flags of the pattern
+ * @param outlen length of the literal
+ * @return literal or NULL if no such literal can be reliably extracted
+ */
+gchar * rspamd_re_cache_extract_literal (const gchar *pat, gint pcre_flags,
+		gsize *outlen);
 #endif
@@ -71,26 +71,23 @@ void
 rspamd_roll_history_update (struct roll_history *history,
 	struct rspamd_task *task)
 {
-	guint row_num;
+	guint row_num, seq;
 	struct roll_history_row *row;
 	struct metric_result *metric_res;
 	struct history_metric_callback_data cbdata;
 
-	/* First of all obtain check and obtain row number */
-	g_atomic_int_compare_and_exchange (&history->cur_row, history->nrows, 0);
+	/* First of all obtain row number */
 #if ((GLIB_MAJOR_VERSION == 2) && (GLIB_MINOR_VERSION > 30))
 	row_num = g_atomic_int_add (&history->cur_row, 1);
 #else
 	row_num = g_atomic_int_exchange_and_add (&history->cur_row, 1);
 #endif
+	row = &history->rows[row_num % history->nrows];
+	seq = g_atomic_int_get (&row->seq);
 
-	if (row_num < history->nrows) {
-		row = &history->rows[row_num];
-		g_atomic_int_set (&row->completed, FALSE);
-	}
-	else {
-		/* Race condition */
-		history->cur_row = 0;
+	if ((seq & 1) || !g_atomic_int_compare_and_exchange (&row->seq,
+			seq, seq + 1)) {
+		/* Another process still writes this row, skip this message */
 		return;
 	}
 
@@ -110,16 +107,18 @@ rspamd_roll_history_update (struct roll_history *history,
 	rspamd_strlcpy (row->message_id, task->message_id,
 		sizeof (row->message_id));
 	if (task->user) {
-		rspamd_strlcpy (row->user, task->user, sizeof (row->message_id));
+		rspamd_strlcpy (row->user, task->user, sizeof (row->user));
 	}
 	else {
 		row->user[0] = '\0';
 	}
 
 	/* Get default metric */
-	metric_res = g_hash_table_lookup (task->results, DEFAULT_METRIC);
+	metric_res = rspamd_mempool_hash_lookup (task->results, DEFAULT_METRIC);
 	if (metric_res == NULL) {
 		row->symbols[0] = '\0';
+		row->score = 0;
+		row->required_score = 0;
 		row->action = METRIC_ACTION_NOACTION;
 	}
 	else {
@@ -142,7 +141,52 @@ rspamd_roll_history_update (struct roll_history *history,
 
 	row->scan_time = rspamd_get_ticks () - task->time_real;
 	row->len = task->msg.len;
-	g_atomic_int_set (&row->completed, TRUE);
+
+	/* Zero is reserved for empty rows */
+	seq += 2;
+	g_atomic_int_set (&row->seq, seq != 0 ? seq : 2);
+}
+
+gboolean
+rspamd_roll_history_get_row (struct roll_history *history, guint idx,
+	struct roll_history_row *row)
+{
+	struct roll_history_row *cur;
+	guint seq;
+
+	g_assert (idx < history->nrows);
+	cur = &history->rows[idx];
+	seq = g_atomic_int_get (&cur->seq);
+
+	if (seq == 0 || (seq & 1)) {
+		return FALSE;
+	}
+
+	memcpy (row, cur, sizeof (*row));
+
+	/* Row has been modified while we were copying it */
+	return g_atomic_int_get (&cur->seq) == seq;
+}
+
+void
+rspamd_roll_history_reset (struct roll_history *history)
+{
+	struct roll_history_row *row;
+	guint i, seq;
+
+	for (i = 0; i < history->nrows; i ++) {
+		row = &history->rows[i];
+		seq = g_atomic_int_get (&row->seq);
+
+		if (seq == 0 || (seq & 1) ||
+				!g_atomic_int_compare_and_exchange (&row->seq, seq, seq + 1)) {
+			/* Empty or being written by some worker */
+			continue;
+		}
+
+		memset (row, 0, G_STRUCT_OFFSET (struct roll_history_row, seq));
+		g_atomic_int_set (&row->seq, 0);
+	}
 }
 
 /**
@@ -303,7 +347,7 @@ rspamd_roll_history_load (struct roll_history *history, const gchar *filename)
 				row->action = ucl_object_toint (elt);
 			}
 
-			row->completed = TRUE;
+			row->seq = 2;
 		}
 	}
 
@@ -326,7 +370,7 @@ rspamd_roll_history_save (struct roll_history *history, const gchar *filename)
 	gint fd;
 	ucl_object_t *obj, *elt;
 	guint i;
-	struct roll_history_row *row;
+	struct roll_history_row row_copy, *row = &row_copy;
 	struct ucl_emitter_functions *emitter_func;
 
 	g_assert (history != NULL);
@@ -339,9 +383,7 @@ rspamd_roll_history_save (struct roll_history *history, const gchar *filename)
 	obj = ucl_object_typed_new (UCL_ARRAY);
 
 	for (i = 0; i < history->nrows; i ++) {
-		row = &history->rows[i];
-
-		if (!row->completed) {
+		if (!rspamd_roll_history_get_row (history, i, row)) {
 			continue;
 		}
 
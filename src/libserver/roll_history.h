@@ -21,7 +21,9 @@
 
 /*
  * Roll history is a special cycled buffer for checked messages, it is designed for writing history messages
- * and displaying them in webui
+ * and displaying them in webui. Rows are placed in shared memory and are
+ * updated by workers without locking: each row has a sequence number that is
+ * odd while the row is being written, so readers can detect torn copies.
  */
 
 #define HISTORY_MAX_ID 64
@@ -42,13 +44,13 @@ struct roll_history_row {
 	gdouble score;
 	gdouble required_score;
 	gint action;
-	guint completed;
+	guint seq;			/* 0 - empty, odd - being written, even - completed */
 };
 
 struct roll_history {
 	struct roll_history_row *rows;
 	guint nrows;
-	guint cur_row;
+	guint cur_row;		/* number of rows written, modulo nrows is the next row */
 };
 
 /**
@@ -67,6 +69,22 @@ struct roll_history * rspamd_roll_history_new (rspamd_mempool_t *pool,
 void rspamd_roll_history_update (struct roll_history *history,
 	struct rspamd_task *task);
 
+/**
+ * Get a consistent copy of the specified row
+ * @param history roll history object
+ * @param idx row index
+ * @param row output row
+ * @return TRUE if the row is completed and has been copied
+ */
+gboolean rspamd_roll_history_get_row (struct roll_history *history,
+	guint idx, struct roll_history_row *row);
+
+/**
+ * Clear all completed rows
+ * @param history roll history object
+ */
+void rspamd_roll_history_reset (struct roll_history *history);
+
 /**
  * Load previously saved history from file
  * @param history roll history object
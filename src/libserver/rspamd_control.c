@@ -19,6 +19,7 @@
 #include "http.h"
 #include "unix-std.h"
 #include "utlist.h"
+#include "worker_util.h"
 
 #ifdef HAVE_SYS_RESOURCE_H
 #include <sys/resource.h>
@@ -302,6 +303,8 @@ rspamd_control_write_reply (struct rspamd_control_session *session)
 				total_systime), "systime", 0, false);
 
 		ucl_object_insert_key (rep, cur, "total", 0, false);
+		ucl_object_insert_key (rep, rspamd_mempool_stat_ucl (), "mempool",
+				0, false);
 	}
 
 	rspamd_control_send_ucl (session, rep);
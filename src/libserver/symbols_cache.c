@@ -1023,7 +1023,7 @@ rspamd_symbols_cache_metric_limit (struct rspamd_task *task,
 		 */
 		while (cur) {
 			metric = cur->data;
-			res = g_hash_table_lookup (task->results, metric->name);
+			res = rspamd_mempool_hash_lookup (task->results, metric->name);
 
 			if (res) {
 				if (!check_metric_settings (task, metric, &ms)) {
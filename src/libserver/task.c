@@ -55,13 +55,10 @@ rspamd_task_new (struct rspamd_worker *worker, struct rspamd_config *cfg)
 
 	new_task->task_pool = rspamd_mempool_new (rspamd_mempool_suggest_size (), "task");
 
-	new_task->results = g_hash_table_new (rspamd_str_hash, rspamd_str_equal);
-	rspamd_mempool_add_destructor (new_task->task_pool,
-		(rspamd_mempool_destruct_t) g_hash_table_unref,
-		new_task->results);
+	new_task->results = rspamd_mempool_hash_new (new_task->task_pool,
+			rspamd_str_hash, rspamd_str_equal, 1);
 	new_task->re_rt = rspamd_re_cache_runtime_new (cfg->re_cache);
-	new_task->raw_headers = g_hash_table_new (rspamd_strcase_hash,
-			rspamd_strcase_equal);
+	new_task->raw_headers = rspamd_mime_headers_new (new_task->task_pool);
 	new_task->request_headers = g_hash_table_new_full (rspamd_ftok_icase_hash,
 			rspamd_ftok_icase_equal, rspamd_fstring_mapped_ftok_free,
 			rspamd_fstring_mapped_ftok_free);
@@ -74,26 +71,14 @@ rspamd_task_new (struct rspamd_worker *worker, struct rspamd_config *cfg)
 	rspamd_mempool_add_destructor (new_task->task_pool,
 		(rspamd_mempool_destruct_t) g_hash_table_unref,
 		new_task->reply_headers);
-	rspamd_mempool_add_destructor (new_task->task_pool,
-		(rspamd_mempool_destruct_t) g_hash_table_unref,
-		new_task->raw_headers);
-	new_task->emails = g_hash_table_new (rspamd_url_hash, rspamd_emails_cmp);
-	rspamd_mempool_add_destructor (new_task->task_pool,
-		(rspamd_mempool_destruct_t) g_hash_table_unref,
-		new_task->emails);
-	new_task->urls = g_hash_table_new (rspamd_url_hash, rspamd_urls_cmp);
-	rspamd_mempool_add_destructor (new_task->task_pool,
-		(rspamd_mempool_destruct_t) g_hash_table_unref,
-		new_task->urls);
-	new_task->parts = g_ptr_array_sized_new (4);
-	rspamd_mempool_add_destructor (new_task->task_pool,
-			rspamd_ptr_array_free_hard, new_task->parts);
-	new_task->text_parts = g_ptr_array_sized_new (2);
-	rspamd_mempool_add_destructor (new_task->task_pool,
-			rspamd_ptr_array_free_hard, new_task->text_parts);
-	new_task->received = g_ptr_array_sized_new (8);
-	rspamd_mempool_add_destructor (new_task->task_pool,
-			rspamd_ptr_array_free_hard, new_task->received);
+	/* Containers allocated from pool need no destructors */
+	new_task->emails = rspamd_url_set_new (new_task->task_pool, TRUE);
+	new_task->urls = rspamd_url_set_new (new_task->task_pool, FALSE);
+	new_task->parts = rspamd_mempool_ptr_array_new (new_task->task_pool, 4);
+	new_task->text_parts = rspamd_mempool_ptr_array_new (new_task->task_pool,
+			2);
+	new_task->received = rspamd_mempool_ptr_array_new (new_task->task_pool,
+			8);
 
 	new_task->sock = -1;
 	new_task->flags |= (RSPAMD_TASK_FLAG_MIME|RSPAMD_TASK_FLAG_JSON);
@@ -169,7 +154,11 @@ rspamd_task_free (struct rspamd_task *task)
 
 		for (i = 0; i < task->parts->len; i ++) {
 			p = g_ptr_array_index (task->parts, i);
-			g_byte_array_free (p->content, TRUE);
+
+			/* Content of parts from the native parser is in the pool */
+			if (p->mime != NULL) {
+				g_byte_array_free (p->content, TRUE);
+			}
 		}
 
 		for (i = 0; i < task->text_parts->len; i ++) {
@@ -179,14 +168,6 @@ rspamd_task_free (struct rspamd_task *task)
 			}
 		}
 
-		if (task->images) {
-			g_list_free (task->images);
-		}
-
-		if (task->messages) {
-			g_list_free (task->messages);
-		}
-
 		if (task->http_conn != NULL) {
 			rspamd_http_connection_unref (task->http_conn);
 		}
@@ -798,7 +779,7 @@ rspamd_task_log_metric_res (struct rspamd_task *task,
 	rspamd_fstring_t *symbuf;
 	struct symbol *sym;
 
-	mres = g_hash_table_lookup (task->results, DEFAULT_METRIC);
+	mres = rspamd_mempool_hash_lookup (task->results, DEFAULT_METRIC);
 
 	if (mres != NULL) {
 		switch (lf->type) {
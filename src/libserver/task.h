@@ -21,6 +21,7 @@
 #include "events.h"
 #include "util.h"
 #include "mem_pool.h"
+#include "hash.h"
 #include "dns.h"
 #include "re_cache.h"
 
@@ -100,6 +101,7 @@ enum rspamd_task_stage {
 #define RSPAMD_TASK_FLAG_LEARN_HAM (1 << 17)
 #define RSPAMD_TASK_FLAG_LEARN_AUTO (1 << 18)
 #define RSPAMD_TASK_FLAG_BROKEN_HEADERS (1 << 19)
+#define RSPAMD_TASK_FLAG_HEADERS_PREFETCHED (1 << 20)
 
 #define RSPAMD_TASK_IS_SKIPPED(task) (((task)->flags & RSPAMD_TASK_FLAG_SKIP))
 #define RSPAMD_TASK_IS_JSON(task) (((task)->flags & RSPAMD_TASK_FLAG_JSON))
@@ -141,15 +143,15 @@ struct rspamd_task {
 	struct rspamd_http_connection *http_conn;		/**< HTTP server connection							*/
 	struct rspamd_async_session * s;				/**< async session object							*/
 	GMimeMessage *message;							/**< message, parsed with GMime						*/
-	GPtrArray *parts;								/**< list of parsed parts							*/
-	GPtrArray *text_parts;							/**< list of text parts								*/
+	rspamd_mempool_ptr_array_t *parts;				/**< list of parsed parts							*/
+	rspamd_mempool_ptr_array_t *text_parts;			/**< list of text parts								*/
 	rspamd_ftok_t raw_headers_content;				/**< list of raw headers							*/
-	GPtrArray *received;							/**< list of received headers						*/
-	GHashTable *urls;								/**< list of parsed urls							*/
-	GHashTable *emails;								/**< list of parsed emails							*/
+	rspamd_mempool_ptr_array_t *received;			/**< list of received headers						*/
+	struct rspamd_url_set *urls;					/**< list of parsed urls							*/
+	struct rspamd_url_set *emails;					/**< list of parsed emails							*/
 	GList *images;									/**< list of images									*/
-	GHashTable *raw_headers;						/**< list of raw headers							*/
-	GHashTable *results;							/**< hash table of metric_result indexed by
+	struct rspamd_mime_headers *raw_headers;						/**< list of raw headers							*/
+	rspamd_mempool_hash_t *results;					/**< hash table of metric_result indexed by
 													 *    metric's name									*/
 	GPtrArray *tokens;								/**< statistics tokens */
 	InternetAddressList *rcpt_mime;					/**< list of all recipients							*/
@@ -1963,18 +1963,14 @@ rspamd_url_text_extract (rspamd_mempool_t *pool,
 						ex->len = url_end - url_start;
 						if (url->protocol == PROTOCOL_MAILTO) {
 							if (url->userlen > 0) {
-								if (!g_hash_table_lookup (task->emails, url)) {
-									g_hash_table_insert (task->emails, url,
-											url);
-								}
+								rspamd_url_set_add (task->emails, url);
 							}
 						}
 						else {
-							if (!g_hash_table_lookup (task->urls, url)) {
-								g_hash_table_insert (task->urls, url, url);
-							}
+							rspamd_url_set_add (task->urls, url);
 						}
-						part->urls_offset = g_list_prepend (
+						part->urls_offset = rspamd_mempool_glist_prepend (
+								task->task_pool,
 								part->urls_offset,
 								ex);
 
@@ -2003,12 +1999,7 @@ rspamd_url_text_extract (rspamd_mempool_t *pool,
 									msg_debug_task ("found url %s in query of url"
 											" %*s", url_str, url->querylen, url->query);
 
-									if (!g_hash_table_lookup (task->urls,
-											query_url)) {
-										g_hash_table_insert (task->urls,
-												query_url,
-												query_url);
-									}
+									rspamd_url_set_add (task->urls, query_url);
 								}
 							}
 						}
@@ -2029,8 +2020,6 @@ rspamd_url_text_extract (rspamd_mempool_t *pool,
 	/* Handle offsets of this part */
 	if (part->urls_offset != NULL) {
 		part->urls_offset = g_list_reverse (part->urls_offset);
-		rspamd_mempool_add_destructor (task->task_pool,
-				(rspamd_mempool_destruct_t) g_list_free, part->urls_offset);
 	}
 }
 
@@ -2221,6 +2210,139 @@ rspamd_url_get_next (rspamd_mempool_t *pool,
 	return NULL;
 }
 
+
+#define RSPAMD_URL_SET_MIN_BUCKETS 32
+
+struct rspamd_url_set *
+rspamd_url_set_new (rspamd_mempool_t *pool, gboolean emails)
+{
+	struct rspamd_url_set *set;
+
+	set = rspamd_mempool_alloc (pool, sizeof (*set));
+	set->pool = pool;
+	set->emails = emails;
+	set->urls = rspamd_mempool_ptr_array_new (pool, 16);
+	set->nbuckets = RSPAMD_URL_SET_MIN_BUCKETS;
+	set->index = rspamd_mempool_alloc0 (pool,
+			set->nbuckets * sizeof (*set->index));
+	set->hashes = rspamd_mempool_alloc (pool,
+			set->nbuckets * sizeof (*set->hashes));
+
+	return set;
+}
+
+static inline gboolean
+rspamd_url_set_equal (struct rspamd_url_set *set, struct rspamd_url *u1,
+		struct rspamd_url *u2)
+{
+	if (set->emails) {
+		return rspamd_emails_cmp (u1, u2);
+	}
+
+	return rspamd_urls_cmp (u1, u2);
+}
+
+/*
+ * Returns bucket where url is stored or the first empty bucket of its chain
+ */
+static guint
+rspamd_url_set_find_bucket (struct rspamd_url_set *set,
+		struct rspamd_url *url, guint h)
+{
+	guint pos, mask = set->nbuckets - 1;
+
+	pos = h & mask;
+
+	while (set->index[pos] != 0) {
+		if (set->hashes[pos] == h && rspamd_url_set_equal (set,
+				rspamd_url_set_index (set, set->index[pos] - 1), url)) {
+			break;
+		}
+
+		pos = (pos + 1) & mask;
+	}
+
+	return pos;
+}
+
+static void
+rspamd_url_set_grow (struct rspamd_url_set *set)
+{
+	guint *oindex = set->index, *ohashes = set->hashes;
+	guint i, pos, onbuckets = set->nbuckets, mask;
+
+	/* Previous storage is left in pool */
+	set->nbuckets *= 2;
+	mask = set->nbuckets - 1;
+	set->index = rspamd_mempool_alloc0 (set->pool,
+			set->nbuckets * sizeof (*set->index));
+	set->hashes = rspamd_mempool_alloc (set->pool,
+			set->nbuckets * sizeof (*set->hashes));
+
+	for (i = 0; i < onbuckets; i ++) {
+		if (oindex[i] != 0) {
+			pos = ohashes[i] & mask;
+
+			while (set->index[pos] != 0) {
+				pos = (pos + 1) & mask;
+			}
+
+			set->index[pos] = oindex[i];
+			set->hashes[pos] = ohashes[i];
+		}
+	}
+}
+
+struct rspamd_url *
+rspamd_url_set_lookup (struct rspamd_url_set *set, struct rspamd_url *url)
+{
+	guint pos;
+
+	pos = rspamd_url_set_find_bucket (set, url, rspamd_url_hash (url));
+
+	if (set->index[pos] != 0) {
+		return rspamd_url_set_index (set, set->index[pos] - 1);
+	}
+
+	return NULL;
+}
+
+gboolean
+rspamd_url_set_add (struct rspamd_url_set *set, struct rspamd_url *url)
+{
+	guint pos, h;
+
+	h = rspamd_url_hash (url);
+	pos = rspamd_url_set_find_bucket (set, url, h);
+
+	if (set->index[pos] != 0) {
+		return FALSE;
+	}
+
+	/* Keep load factor below 1/2 to have short chains */
+	if ((set->urls->len + 1) * 2 > set->nbuckets) {
+		rspamd_url_set_grow (set);
+		pos = rspamd_url_set_find_bucket (set, url, h);
+	}
+
+	rspamd_mempool_ptr_array_add (set->urls, url);
+	set->index[pos] = set->urls->len;
+	set->hashes[pos] = h;
+
+	return TRUE;
+}
+
+void
+rspamd_url_set_replace (struct rspamd_url_set *set, struct rspamd_url *url)
+{
+	guint pos;
+
+	if (!rspamd_url_set_add (set, url)) {
+		pos = rspamd_url_set_find_bucket (set, url, rspamd_url_hash (url));
+		set->urls->pdata[set->index[pos] - 1] = url;
+	}
+}
+
 /*
  * vi: ts=4
  */
@@ -133,4 +133,58 @@ rspamd_url_get_next (rspamd_mempool_t *pool,
  */
 gboolean rspamd_url_find_tld (const gchar *in, gsize inlen, rspamd_ftok_t *out);
 
+/*
+ * Set of unique urls. Urls are stored in a flat array in order of insertion,
+ * duplicates are detected by an open addressed index of positions in that
+ * array. All storage is allocated from a memory pool.
+ */
+struct rspamd_url_set {
+	rspamd_mempool_ptr_array_t *urls;	/**< urls in order of insertion		*/
+	guint *index;						/**< position + 1 or 0 if empty		*/
+	guint *hashes;						/**< hashes of urls in index		*/
+	guint nbuckets;
+	gboolean emails;
+	rspamd_mempool_t *pool;
+};
+
+/**
+ * Create new urls set
+ * @param pool memory pool
+ * @param emails if TRUE, then urls are compared as emails (user and host)
+ * @return new set
+ */
+struct rspamd_url_set * rspamd_url_set_new (rspamd_mempool_t *pool,
+		gboolean emails);
+
+/**
+ * Find url equal to the specified one
+ * @param set
+ * @param url
+ * @return url from the set or NULL
+ */
+struct rspamd_url * rspamd_url_set_lookup (struct rspamd_url_set *set,
+		struct rspamd_url *url);
+
+/**
+ * Add url to the set if it is not there
+ * @param set
+ * @param url
+ * @return TRUE if url has been added
+ */
+gboolean rspamd_url_set_add (struct rspamd_url_set *set,
+		struct rspamd_url *url);
+
+/**
+ * Add url to the set replacing an equal url if it exists, replaced url keeps
+ * its position
+ * @param set
+ * @param url
+ */
+void rspamd_url_set_replace (struct rspamd_url_set *set,
+		struct rspamd_url *url);
+
+#define rspamd_url_set_size(set) ((set)->urls->len)
+#define rspamd_url_set_index(set, i) \
+	((struct rspamd_url *)g_ptr_array_index ((set)->urls, (i)))
+
 #endif
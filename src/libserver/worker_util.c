@@ -398,6 +398,148 @@ rspamd_controller_send_ucl (struct rspamd_http_connection_entry *entry,
 	entry->is_reply = TRUE;
 }
 
+void
+rspamd_worker_stat_collect (struct rspamd_main *rspamd_main,
+		struct rspamd_stat *st)
+{
+	struct rspamd_stat *cur;
+	guint i, j;
+
+	memset (st, 0, sizeof (*st));
+
+	for (i = 0; i < rspamd_main->stat_slots->nslots; i ++) {
+		cur = rspamd_mempool_slot (rspamd_main->stat_slots, i);
+
+		st->messages_scanned += rspamd_atomic_load (&cur->messages_scanned);
+		st->messages_learned += rspamd_atomic_load (&cur->messages_learned);
+		st->connections_count += rspamd_atomic_load (&cur->connections_count);
+		st->control_connections_count +=
+				rspamd_atomic_load (&cur->control_connections_count);
+
+		for (j = 0; j < G_N_ELEMENTS (st->actions_stat); j ++) {
+			st->actions_stat[j] += rspamd_atomic_load (&cur->actions_stat[j]);
+		}
+	}
+}
+
+void
+rspamd_worker_stat_reset (struct rspamd_main *rspamd_main)
+{
+	struct rspamd_stat *cur;
+	guint i, j;
+
+	for (i = 0; i < rspamd_main->stat_slots->nslots; i ++) {
+		cur = rspamd_mempool_slot (rspamd_main->stat_slots, i);
+
+		rspamd_atomic_store (&cur->messages_scanned, 0);
+		rspamd_atomic_store (&cur->messages_learned, 0);
+		rspamd_atomic_store (&cur->connections_count, 0);
+		rspamd_atomic_store (&cur->control_connections_count, 0);
+
+		for (j = 0; j < G_N_ELEMENTS (cur->actions_stat); j ++) {
+			rspamd_atomic_store (&cur->actions_stat[j], 0);
+		}
+	}
+}
+
+/* Maximum number of allocation sites reported */
+#define MEMPOOL_SITES_REPORT 64
+
+static gint
+rspamd_mempool_site_cmp (gconstpointer a, gconstpointer b)
+{
+	const rspamd_mempool_site_stat_t *s1 = *(const rspamd_mempool_site_stat_t **)a,
+			*s2 = *(const rspamd_mempool_site_stat_t **)b;
+
+	if (s1->bytes == s2->bytes) {
+		return 0;
+	}
+
+	return s1->bytes < s2->bytes ? 1 : -1;
+}
+
+ucl_object_t *
+rspamd_mempool_stat_ucl (void)
+{
+	const rspamd_mempool_tag_stat_t *tags, *st;
+	const rspamd_mempool_site_stat_t *sites, *site;
+	ucl_object_t *top, *obj, *cur;
+	GPtrArray *sorted;
+	guint i, ntags, nsites;
+
+	top = ucl_object_typed_new (UCL_OBJECT);
+	ntags = rspamd_mempool_tags_stat (&tags);
+	obj = ucl_object_typed_new (UCL_OBJECT);
+
+	for (i = 0; i < ntags; i ++) {
+		st = &tags[i];
+
+		if (g_atomic_int_get (&st->state) != 2 || st->pools_allocated == 0) {
+			continue;
+		}
+
+		cur = ucl_object_typed_new (UCL_OBJECT);
+		ucl_object_insert_key (cur, ucl_object_fromint (st->pools_allocated),
+				"pools_allocated", 0, false);
+		ucl_object_insert_key (cur, ucl_object_fromint (st->pools_freed),
+				"pools_freed", 0, false);
+		ucl_object_insert_key (cur, ucl_object_fromint (st->bytes_allocated),
+				"bytes_allocated", 0, false);
+		ucl_object_insert_key (cur, ucl_object_fromint (st->chunks_allocated),
+				"chunks_allocated", 0, false);
+		ucl_object_insert_key (cur, ucl_object_fromint (st->oversized_chunks),
+				"chunks_oversized", 0, false);
+		ucl_object_insert_key (cur, ucl_object_fromint (st->destructors),
+				"destructors", 0, false);
+		ucl_object_insert_key (cur, ucl_object_fromint (st->max_bytes),
+				"max_bytes", 0, false);
+
+		if (st->pools_freed > 0) {
+			ucl_object_insert_key (cur,
+					ucl_object_fromint (st->bytes_allocated / st->pools_freed),
+					"avg_bytes", 0, false);
+			ucl_object_insert_key (cur,
+					ucl_object_fromdouble (st->lifetime / 1e6 / st->pools_freed),
+					"avg_lifetime", 0, false);
+		}
+
+		ucl_object_insert_key (obj, cur, st->tag, 0, true);
+	}
+
+	ucl_object_insert_key (top, obj, "tags", 0, false);
+
+	nsites = rspamd_mempool_sites_stat (&sites);
+	sorted = g_ptr_array_sized_new (nsites);
+
+	for (i = 0; i < nsites; i ++) {
+		site = &sites[i];
+
+		if (site->loc[0] != '\0' && site->count > 0) {
+			g_ptr_array_add (sorted, (gpointer)site);
+		}
+	}
+
+	g_ptr_array_sort (sorted, rspamd_mempool_site_cmp);
+	obj = ucl_object_typed_new (UCL_ARRAY);
+
+	for (i = 0; i < sorted->len && i < MEMPOOL_SITES_REPORT; i ++) {
+		site = g_ptr_array_index (sorted, i);
+		cur = ucl_object_typed_new (UCL_OBJECT);
+		ucl_object_insert_key (cur, ucl_object_fromstring (site->loc),
+				"loc", 0, false);
+		ucl_object_insert_key (cur, ucl_object_fromint (site->count),
+				"count", 0, false);
+		ucl_object_insert_key (cur, ucl_object_fromint (site->bytes),
+				"bytes", 0, false);
+		ucl_array_append (obj, cur);
+	}
+
+	g_ptr_array_free (sorted, TRUE);
+	ucl_object_insert_key (top, obj, "sites", 0, false);
+
+	return top;
+}
+
 static void
 rspamd_worker_drop_priv (struct rspamd_main *rspamd_main)
 {
@@ -512,6 +654,9 @@ rspamd_fork_worker (struct rspamd_main *rspamd_main,
 		}
 
 		g_random_set_seed (ottery_rand_uint32 ());
+		/* Use own statistics slot */
+		rspamd_main->stat = rspamd_mempool_slots_claim (rspamd_main->stat_slots,
+				getpid ());
 		/* Drop privilleges */
 		rspamd_worker_drop_priv (rspamd_main);
 		/* Set limits */
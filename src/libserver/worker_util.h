@@ -108,6 +108,26 @@ void rspamd_controller_send_string (struct rspamd_http_connection_entry *entry,
 void rspamd_controller_send_ucl (struct rspamd_http_connection_entry *entry,
 	ucl_object_t *obj);
 
+/**
+ * Return memory pool statistics per pool tag and sampled allocation sites
+ * @return new UCL object
+ */
+ucl_object_t * rspamd_mempool_stat_ucl (void);
+
+/**
+ * Sum statistics of all processes
+ * @param rspamd_main main structure
+ * @param st output statistics
+ */
+void rspamd_worker_stat_collect (struct rspamd_main *rspamd_main,
+		struct rspamd_stat *st);
+
+/**
+ * Reset statistics of all processes
+ * @param rspamd_main main structure
+ */
+void rspamd_worker_stat_reset (struct rspamd_main *rspamd_main);
+
 /**
  * Return worker's control structure by its type
  * @param type
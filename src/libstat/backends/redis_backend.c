@@ -62,6 +62,7 @@ struct redis_stat_runtime {
 	gchar *redis_object_expanded;
 	redisAsyncContext *redis;
 	guint64 learned;
+	gdouble req_token;
 	gint id;
 	enum rspamd_redis_connection_state conn_state;
 };
@@ -692,6 +693,9 @@ rspamd_redis_fin (gpointer data)
 {
 	struct redis_stat_runtime *rt = REDIS_RUNTIME (data);
 
+	/* Request has not been finished by callbacks */
+	rspamd_upstream_finish (rt->selected, &rt->req_token, FALSE);
+
 	if (rt->conn_state != RSPAMD_REDIS_CONNECTED) {
 		rt->conn_state = RSPAMD_REDIS_DISCONNECTED;
 	}
@@ -704,6 +708,9 @@ rspamd_redis_fin_learn (gpointer data)
 {
 	struct redis_stat_runtime *rt = REDIS_RUNTIME (data);
 
+	/* Request has not been finished by callbacks */
+	rspamd_upstream_finish (rt->selected, &rt->req_token, FALSE);
+
 	if (rt->conn_state != RSPAMD_REDIS_CONNECTED) {
 		rt->conn_state = RSPAMD_REDIS_DISCONNECTED;
 	}
@@ -721,6 +728,7 @@ rspamd_redis_timeout (gint fd, short what, gpointer d)
 
 	msg_err_task ("connection to redis server %s timed out",
 			rspamd_upstream_name (rt->selected));
+	rspamd_upstream_finish (rt->selected, &rt->req_token, FALSE);
 	rspamd_upstream_fail (rt->selected);
 	rt->conn_state = RSPAMD_REDIS_TIMEDOUT;
 	redisAsyncFree (rt->redis);
@@ -766,6 +774,7 @@ rspamd_redis_connected (redisAsyncContext *c, gpointer r, gpointer priv)
 
 			msg_debug_task ("connected to redis server, tokens learned for %s: %uL",
 					rt->redis_object_expanded, rt->learned);
+			rspamd_upstream_finish (rt->selected, &rt->req_token, TRUE);
 			rspamd_upstream_ok (rt->selected);
 			rspamd_session_remove_event (task->s, rspamd_redis_fin, rt);
 		}
@@ -777,6 +786,7 @@ rspamd_redis_connected (redisAsyncContext *c, gpointer r, gpointer priv)
 	else {
 		msg_err_task ("error getting reply from redis server %s: %s",
 				rspamd_upstream_name (rt->selected), c->errstr);
+		rspamd_upstream_finish (rt->selected, &rt->req_token, FALSE);
 		rspamd_upstream_fail (rt->selected);
 		rspamd_session_remove_event (task->s, rspamd_redis_fin, rt);
 	}
@@ -835,6 +845,7 @@ rspamd_redis_processed (redisAsyncContext *c, gpointer r, gpointer priv)
 
 			msg_debug_task ("received tokens for %s: %d processed, %d found",
 					rt->redis_object_expanded, processed, found);
+			rspamd_upstream_finish (rt->selected, &rt->req_token, TRUE);
 			rspamd_upstream_ok (rt->selected);
 			rspamd_session_remove_event (task->s, rspamd_redis_fin, rt);
 		}
@@ -845,6 +856,7 @@ rspamd_redis_processed (redisAsyncContext *c, gpointer r, gpointer priv)
 	else {
 		msg_err_task ("error getting reply from redis server %s: %s",
 				rspamd_upstream_name (rt->selected), c->errstr);
+		rspamd_upstream_finish (rt->selected, &rt->req_token, FALSE);
 		rspamd_upstream_fail (rt->selected);
 		rspamd_session_remove_event (task->s, rspamd_redis_fin, rt);
 	}
@@ -860,12 +872,14 @@ rspamd_redis_learned (redisAsyncContext *c, gpointer r, gpointer priv)
 	task = rt->task;
 
 	if (c->err == 0) {
+		rspamd_upstream_finish (rt->selected, &rt->req_token, TRUE);
 		rspamd_upstream_ok (rt->selected);
 		rspamd_session_remove_event (task->s, rspamd_redis_fin_learn, rt);
 	}
 	else {
 		msg_err_task ("error getting reply from redis server %s: %s",
 				rspamd_upstream_name (rt->selected), c->errstr);
+		rspamd_upstream_finish (rt->selected, &rt->req_token, FALSE);
 		rspamd_upstream_fail (rt->selected);
 		rspamd_session_remove_event (task->s, rspamd_redis_fin_learn, rt);
 	}
@@ -1087,6 +1101,7 @@ rspamd_redis_runtime (struct rspamd_task *task,
 	event_add (&rt->timeout_event, &tv);
 
 	rspamd_redis_maybe_auth (ctx, rt->redis);
+	rt->req_token = rspamd_upstream_start (rt->selected);
 	redisAsyncCommand (rt->redis, rspamd_redis_connected, rt, "HGET %s %s",
 			rt->redis_object_expanded, "learns");
 
@@ -1132,6 +1147,7 @@ rspamd_redis_process_tokens (struct rspamd_task *task,
 	rspamd_mempool_add_destructor (task->task_pool,
 				(rspamd_mempool_destruct_t)rspamd_fstring_free, query);
 
+	rt->req_token = rspamd_upstream_start (rt->selected);
 	ret = redisAsyncFormattedCommand (rt->redis, rspamd_redis_processed, rt,
 			query->str, query->len);
 	if (ret == REDIS_OK) {
@@ -1146,6 +1162,7 @@ rspamd_redis_process_tokens (struct rspamd_task *task,
 	}
 	else {
 		msg_err_task ("call to redis failed: %s", rt->redis->errstr);
+		rspamd_upstream_finish (rt->selected, &rt->req_token, FALSE);
 	}
 
 	return FALSE;
@@ -1196,6 +1213,7 @@ rspamd_redis_learn_tokens (struct rspamd_task *task, GPtrArray *tokens,
 	}
 
 	rt->selected = up;
+	rt->req_token = rspamd_upstream_start (rt->selected);
 
 	addr = rspamd_upstream_addr (up);
 	g_assert (addr != NULL);
@@ -1281,6 +1299,7 @@ rspamd_redis_learn_tokens (struct rspamd_task *task, GPtrArray *tokens,
 	}
 	else {
 		msg_err_task ("call to redis failed: %s", rt->redis->errstr);
+		rspamd_upstream_finish (rt->selected, &rt->req_token, FALSE);
 	}
 
 	return FALSE;
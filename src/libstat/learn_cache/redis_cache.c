@@ -44,6 +44,7 @@ struct rspamd_redis_cache_runtime {
 	struct upstream *selected;
 	struct event timeout_event;
 	redisAsyncContext *redis;
+	gdouble req_token;
 };
 
 static GQuark
@@ -70,6 +71,8 @@ rspamd_redis_cache_fin (gpointer data)
 {
 	struct rspamd_redis_cache_runtime *rt = data;
 
+	/* Request has not been finished by callbacks */
+	rspamd_upstream_finish (rt->selected, &rt->req_token, FALSE);
 	event_del (&rt->timeout_event);
 	redisAsyncFree (rt->redis);
 }
@@ -84,6 +87,7 @@ rspamd_redis_cache_timeout (gint fd, short what, gpointer d)
 
 	msg_err_task ("connection to redis server %s timed out",
 			rspamd_upstream_name (rt->selected));
+	rspamd_upstream_finish (rt->selected, &rt->req_token, FALSE);
 	rspamd_upstream_fail (rt->selected);
 	rspamd_session_remove_event (task->s, rspamd_redis_cache_fin, d);
 }
@@ -128,9 +132,11 @@ rspamd_stat_cache_redis_get (redisAsyncContext *c, gpointer r, gpointer priv)
 			/* Unlearn flag */
 			task->flags |= RSPAMD_TASK_FLAG_UNLEARN;
 		}
+		rspamd_upstream_finish (rt->selected, &rt->req_token, TRUE);
 		rspamd_upstream_ok (rt->selected);
 	}
 	else {
+		rspamd_upstream_finish (rt->selected, &rt->req_token, FALSE);
 		rspamd_upstream_fail (rt->selected);
 	}
 
@@ -148,9 +154,11 @@ rspamd_stat_cache_redis_set (redisAsyncContext *c, gpointer r, gpointer priv)
 
 	if (c->err == 0) {
 		/* XXX: we ignore results here */
+		rspamd_upstream_finish (rt->selected, &rt->req_token, TRUE);
 		rspamd_upstream_ok (rt->selected);
 	}
 	else {
+		rspamd_upstream_finish (rt->selected, &rt->req_token, FALSE);
 		rspamd_upstream_fail (rt->selected);
 	}
 
@@ -383,6 +391,8 @@ rspamd_stat_cache_redis_check (struct rspamd_task *task,
 
 	double_to_tv (rt->ctx->timeout, &tv);
 
+	rt->req_token = rspamd_upstream_start (rt->selected);
+
 	if (redisAsyncCommand (rt->redis, rspamd_stat_cache_redis_get, rt,
 			"HGET %s %s",
 			rt->ctx->redis_object, h) == REDIS_OK) {
@@ -390,6 +400,9 @@ rspamd_stat_cache_redis_check (struct rspamd_task *task,
 				rspamd_stat_cache_redis_quark ());
 		event_add (&rt->timeout_event, &tv);
 	}
+	else {
+		rspamd_upstream_finish (rt->selected, &rt->req_token, FALSE);
+	}
 
 	/* We need to return OK every time */
 	return RSPAMD_LEARN_OK;
@@ -411,6 +424,8 @@ rspamd_stat_cache_redis_learn (struct rspamd_task *task,
 	double_to_tv (rt->ctx->timeout, &tv);
 	flag = (task->flags & RSPAMD_TASK_FLAG_LEARN_SPAM) ? 1 : -1;
 
+	rt->req_token = rspamd_upstream_start (rt->selected);
+
 	if (redisAsyncCommand (rt->redis, rspamd_stat_cache_redis_set, rt,
 			"HSET %s %s %d",
 			rt->ctx->redis_object, h, flag) == REDIS_OK) {
@@ -418,6 +433,9 @@ rspamd_stat_cache_redis_learn (struct rspamd_task *task,
 				rspamd_stat_cache_redis_quark ());
 		event_add (&rt->timeout_event, &tv);
 	}
+	else {
+		rspamd_upstream_finish (rt->selected, &rt->req_token, FALSE);
+	}
 
 	/* We need to return OK every time */
 	return RSPAMD_LEARN_OK;
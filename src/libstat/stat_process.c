@@ -37,7 +37,7 @@ rspamd_stat_tokenize_header (struct rspamd_task *task,
 	struct raw_header *rh, *cur;
 	rspamd_ftok_t str;
 
-	rh = g_hash_table_lookup (task->raw_headers, name);
+	rh = rspamd_mime_headers_lookup (task->raw_headers, name);
 
 	if (rh != NULL) {
 
@@ -114,9 +114,9 @@ rspamd_stat_tokenize_parts_metadata (struct rspamd_stat_ctx *st_ctx,
 	for (i = 0; i < task->parts->len; i ++) {
 		part = g_ptr_array_index (task->parts, i);
 
-		if (GMIME_IS_MULTIPART (part->mime)) {
-			elt.begin = (gchar *)g_mime_multipart_get_boundary (
-					GMIME_MULTIPART (part->mime));
+		if (g_mime_content_type_is_type (part->type, "multipart", "*")) {
+			elt.begin = (gchar *)g_mime_content_type_get_parameter (part->type,
+					"boundary");
 
 			if (elt.begin) {
 				elt.len = strlen (elt.begin);
@@ -590,7 +590,7 @@ rspamd_stat_backends_post_learn (struct rspamd_stat_ctx *st_ctx,
 		}
 	}
 
-	g_atomic_int_add (&task->worker->srv->stat->messages_learned, 1);
+	rspamd_atomic_add (&task->worker->srv->stat->messages_learned, 1);
 
 	return res;
 }
@@ -712,7 +712,7 @@ rspamd_stat_check_autolearn (struct rspamd_task *task)
 					 * - We learn spam if action is ACTION_REJECT
 					 * - We learn ham if score is less than zero
 					 */
-					mres = g_hash_table_lookup (task->results, DEFAULT_METRIC);
+					mres = rspamd_mempool_hash_lookup (task->results, DEFAULT_METRIC);
 
 					if (mres) {
 						mres->action = rspamd_check_action_metric (task,
@@ -755,7 +755,7 @@ rspamd_stat_check_autolearn (struct rspamd_task *task)
 						spam_score = t;
 					}
 
-					mres = g_hash_table_lookup (task->results, DEFAULT_METRIC);
+					mres = rspamd_mempool_hash_lookup (task->results, DEFAULT_METRIC);
 
 					if (mres) {
 						if (mres->score >= spam_score) {
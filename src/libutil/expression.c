@@ -22,10 +22,11 @@
 #include "ottery.h"
 
 #define RSPAMD_EXPR_FLAG_NEGATE (1 << 0)
-#define RSPAMD_EXPR_FLAG_PROCESSED (1 << 1)
 
 #define MIN_RESORT_EVALS 50
 #define MAX_RESORT_EVALS 150
+/* Values stack depth that is evaluated without heap allocations */
+#define RSPAMD_EXPR_STACK_PREALLOC 32
 
 enum rspamd_expression_op {
 	OP_INVALID = 0,
@@ -59,15 +60,37 @@ struct rspamd_expression_elt {
 		} lim;
 	} p;
 	gint flags;
-	gint value;
 	gint priority;
 };
 
+/*
+ * AST is compiled to the postfix code that is evaluated using a values stack
+ * local for each evaluation, so the shared AST is never modified when
+ * processing
+ */
+enum rspamd_expression_insn_type {
+	INSN_ATOM = 0, /* push the value of an atom */
+	INSN_LIMIT, /* push a constant */
+	INSN_FIRST, /* apply operation to the first operand of a node */
+	INSN_OP, /* pop operand and apply operation to the accumulator */
+	INSN_JUMP /* skip the rest of a node if its value is already known */
+};
+
+struct rspamd_expression_insn {
+	enum rspamd_expression_insn_type type;
+	struct rspamd_expression_elt *elt;
+	struct rspamd_expression_elt *parelt;
+	gint lim;
+	guint jump;
+};
+
 struct rspamd_expression {
 	const struct rspamd_atom_subr *subr;
 	GArray *expressions;
 	GPtrArray *expression_stack;
 	GNode *ast;
+	GArray *code;
+	guint max_stack;
 	guint next_resort;
 	guint evals;
 };
@@ -354,6 +377,7 @@ rspamd_expression_destroy (struct rspamd_expression *expr)
 
 		g_array_free (expr->expressions, TRUE);
 		g_ptr_array_free (expr->expression_stack, TRUE);
+		g_array_free (expr->code, TRUE);
 		g_node_destroy (expr->ast);
 	}
 }
@@ -524,6 +548,116 @@ rspamd_expr_dup_elt (rspamd_mempool_t *pool, struct rspamd_expression_elt *elt)
 	return n;
 }
 
+static guint
+rspamd_ast_emit (struct rspamd_expression *expr,
+		enum rspamd_expression_insn_type type,
+		struct rspamd_expression_elt *elt,
+		struct rspamd_expression_elt *parelt,
+		gint lim)
+{
+	struct rspamd_expression_insn insn;
+
+	insn.type = type;
+	insn.elt = elt;
+	insn.parelt = parelt;
+	insn.lim = lim;
+	insn.jump = 0;
+	g_array_append_val (expr->code, insn);
+
+	return expr->code->len - 1;
+}
+
+/*
+ * Emits code for a node that leaves exactly one value on the stack above
+ * `depth` values. Jumps emitted for short-circuit evaluation are linked via
+ * their `jump` fields and patched to the end of the node afterwards.
+ */
+static void
+rspamd_ast_compile_node (struct rspamd_expression *expr, GNode *node,
+		guint depth)
+{
+	struct rspamd_expression_elt *elt = node->data, *celt, *parelt = NULL;
+	struct rspamd_expression_insn *insn;
+	GNode *cld;
+	gint lim = G_MININT;
+	guint nargs = 0, jumps = 0, idx;
+
+	if (depth + 1 > expr->max_stack) {
+		expr->max_stack = depth + 1;
+	}
+
+	switch (elt->type) {
+	case ELT_ATOM:
+		rspamd_ast_emit (expr, INSN_ATOM, elt, NULL, 0);
+		break;
+	case ELT_LIMIT:
+		rspamd_ast_emit (expr, INSN_LIMIT, elt, NULL, elt->p.lim.val);
+		break;
+	case ELT_OP:
+		g_assert (node->children != NULL);
+
+		/* Try to find limit at the parent node */
+		if (node->parent) {
+			parelt = node->parent->data;
+			celt = node->parent->children->data;
+
+			if (celt->type == ELT_LIMIT) {
+				lim = celt->p.lim.val;
+			}
+		}
+
+		DL_FOREACH (node->children, cld) {
+			celt = cld->data;
+
+			/* Save limit if we've found it */
+			if (celt->type == ELT_LIMIT) {
+				lim = celt->p.lim.val;
+				continue;
+			}
+
+			if (nargs == 0) {
+				rspamd_ast_compile_node (expr, cld, depth);
+				rspamd_ast_emit (expr, INSN_FIRST, elt, parelt, lim);
+			}
+			else {
+				rspamd_ast_compile_node (expr, cld, depth + 1);
+				rspamd_ast_emit (expr, INSN_OP, elt, parelt, lim);
+			}
+
+			nargs ++;
+
+			if (cld->next) {
+				idx = rspamd_ast_emit (expr, INSN_JUMP, elt, parelt, lim);
+				g_array_index (expr->code, struct rspamd_expression_insn,
+						idx).jump = jumps;
+				jumps = idx + 1;
+			}
+		}
+
+		if (nargs == 0) {
+			/* Node with no operands but limits */
+			rspamd_ast_emit (expr, INSN_LIMIT, elt, NULL, G_MININT);
+		}
+
+		/* Patch jumps to point after this node */
+		while (jumps != 0) {
+			insn = &g_array_index (expr->code, struct rspamd_expression_insn,
+					jumps - 1);
+			jumps = insn->jump;
+			insn->jump = expr->code->len;
+		}
+		break;
+	}
+}
+
+static void
+rspamd_ast_compile (struct rspamd_expression *expr)
+{
+	g_array_set_size (expr->code, 0);
+	expr->max_stack = 0;
+	rspamd_ast_compile_node (expr, expr->ast, 0);
+}
+
 gboolean
 rspamd_parse_expression (const gchar *line, gsize len,
 		const struct rspamd_atom_subr *subr, gpointer subr_data,
@@ -563,6 +697,9 @@ rspamd_parse_expression (const gchar *line, gsize len,
 			sizeof (struct rspamd_expression_elt));
 	operand_stack = g_ptr_array_sized_new (32);
 	e->ast = NULL;
+	e->code = g_array_new (FALSE, FALSE,
+			sizeof (struct rspamd_expression_insn));
+	e->max_stack = 0;
 	e->expression_stack = g_ptr_array_sized_new (32);
 	e->subr = subr;
 	e->evals = 0;
@@ -796,6 +933,7 @@ rspamd_parse_expression (const gchar *line, gsize len,
 	/* Now set less expensive branches to be evaluated first */
 	g_node_traverse (e->ast, G_POST_ORDER, G_TRAVERSE_NON_LEAVES, -1,
 			rspamd_ast_resort_traverse, NULL);
+	rspamd_ast_compile (e);
 
 	if (target) {
 		*target = e;
@@ -916,122 +1054,96 @@ rspamd_ast_do_op (struct rspamd_expression_elt *elt, gint val, gint acc, gint li
 }
 
 static gint
-rspamd_ast_process_node (struct rspamd_expression *expr, gint flags, GNode *node,
-		gpointer data)
+rspamd_ast_process_atom (struct rspamd_expression *expr,
+		struct rspamd_expression_elt *elt, gpointer data)
 {
-	struct rspamd_expression_elt *elt, *celt, *parelt = NULL;
-	GNode *cld;
-	gint acc = G_MININT, lim = G_MININT, val;
-	gdouble t1, t2;
+	gint val;
+	gdouble t1 = 0, t2;
 	gboolean calc_ticks = FALSE;
 
-	elt = node->data;
-
-	switch (elt->type) {
-	case ELT_ATOM:
-		if (!(elt->flags & RSPAMD_EXPR_FLAG_PROCESSED)) {
-
-			/*
-			 * Sometimes get ticks for this expression. 'Sometimes' here means
-			 * that we get lowest 5 bits of the counter `evals` and 5 bits
-			 * of some shifted address to provide some sort of jittering for
-			 * ticks evaluation
-			 */
-			if ((expr->evals & 0x1F) == (GPOINTER_TO_UINT (node) >> 4 & 0x1F)) {
-				calc_ticks = TRUE;
-				t1 = rspamd_get_ticks ();
-			}
-
-			elt->value = expr->subr->process (data, elt->p.atom);
-
-			if (elt->value) {
-				elt->p.atom->hits ++;
-			}
-
-			if (calc_ticks) {
-				t2 = rspamd_get_ticks ();
-				elt->p.atom->avg_ticks += ((t2 - t1) - elt->p.atom->avg_ticks) /
-						(expr->evals);
-			}
-
-			elt->flags |= RSPAMD_EXPR_FLAG_PROCESSED;
-		}
-
-		return elt->value;
-		break;
-	case ELT_LIMIT:
-
-		return elt->p.lim.val;
-		break;
-	case ELT_OP:
-		g_assert (node->children != NULL);
-		cld = node->children;
-
-		/* Try to find limit at the parent node */
-		if (node->parent) {
-			parelt = node->parent->data;
-			celt = node->parent->children->data;
-
-			if (celt->type == ELT_LIMIT) {
-				lim = celt->p.lim.val;
-			}
-		}
-
-		DL_FOREACH (node->children, cld) {
-			celt = cld->data;
-
-			/* Save limit if we've found it */
-			if (celt->type == ELT_LIMIT) {
-				lim = celt->p.lim.val;
-				continue;
-			}
-
-			val = rspamd_ast_process_node (expr, flags, cld, data);
-
-			if (acc == G_MININT) {
-				acc = val;
-			}
-
-			acc = rspamd_ast_do_op (elt, val, acc, lim);
-
-			if (!(flags & RSPAMD_EXPRESSION_FLAG_NOOPT)) {
-				if (rspamd_ast_node_done (elt, parelt, acc, lim)) {
-					return acc;
-				}
-			}
-		}
-		break;
+	/*
+	 * Sometimes get ticks for this expression. 'Sometimes' here means
+	 * that we get lowest 5 bits of the counter `evals` and 5 bits
+	 * of some shifted address to provide some sort of jittering for
+	 * ticks evaluation
+	 */
+	if ((expr->evals & 0x1F) == (GPOINTER_TO_UINT (elt) >> 4 & 0x1F)) {
+		calc_ticks = TRUE;
+		t1 = rspamd_get_ticks ();
 	}
 
-	return acc;
-}
+	val = expr->subr->process (data, elt->p.atom);
 
-static gboolean
-rspamd_ast_cleanup_traverse (GNode *n, gpointer d)
-{
-	struct rspamd_expression_elt *elt = n->data;
+	if (val) {
+		elt->p.atom->hits ++;
+	}
 
-	elt->value = 0;
-	elt->flags = 0;
+	if (calc_ticks) {
+		t2 = rspamd_get_ticks ();
+		elt->p.atom->avg_ticks += ((t2 - t1) - elt->p.atom->avg_ticks) /
+				(expr->evals);
+	}
 
-	return FALSE;
+	return val;
 }
 
 gint
 rspamd_process_expression (struct rspamd_expression *expr, gint flags,
 		gpointer data)
 {
-	gint ret = 0;
+	struct rspamd_expression_insn *insn;
+	gint stack_buf[RSPAMD_EXPR_STACK_PREALLOC], *stack = stack_buf;
+	gint ret = 0, val;
+	guint pc = 0, sp = 0;
 
 	g_assert (expr != NULL);
 	/* Ensure that stack is empty at this point */
 	g_assert (expr->expression_stack->len == 0);
 
-	ret = rspamd_ast_process_node (expr, flags, expr->ast, data);
+	if (expr->max_stack > G_N_ELEMENTS (stack_buf)) {
+		stack = g_malloc (expr->max_stack * sizeof (*stack));
+	}
 
-	/* Cleanup */
-	g_node_traverse (expr->ast, G_IN_ORDER, G_TRAVERSE_ALL, -1,
-			rspamd_ast_cleanup_traverse, NULL);
+	while (pc < expr->code->len) {
+		insn = &g_array_index (expr->code, struct rspamd_expression_insn, pc);
+		pc ++;
+
+		switch (insn->type) {
+		case INSN_ATOM:
+			stack[sp ++] = rspamd_ast_process_atom (expr, insn->elt, data);
+			break;
+		case INSN_LIMIT:
+			stack[sp ++] = insn->lim;
+			break;
+		case INSN_FIRST:
+			val = stack[sp - 1];
+
+			if (insn->elt->p.op != OP_PLUS) {
+				stack[sp - 1] = rspamd_ast_do_op (insn->elt, val, val,
+						insn->lim);
+			}
+			break;
+		case INSN_OP:
+			val = stack[-- sp];
+			stack[sp - 1] = rspamd_ast_do_op (insn->elt, val, stack[sp - 1],
+					insn->lim);
+			break;
+		case INSN_JUMP:
+			if (!(flags & RSPAMD_EXPRESSION_FLAG_NOOPT) &&
+					rspamd_ast_node_done (insn->elt, insn->parelt,
+							stack[sp - 1], insn->lim)) {
+				pc = insn->jump;
+			}
+			break;
+		}
+	}
+
+	g_assert (sp == 1);
+	ret = stack[0];
+
+	if (stack != stack_buf) {
+		g_free (stack);
+	}
 
 	expr->evals ++;
 
@@ -1046,6 +1158,8 @@ rspamd_process_expression (struct rspamd_expression *expr, gint flags,
 		/* Now set less expensive branches to be evaluated first */
 		g_node_traverse (expr->ast, G_POST_ORDER, G_TRAVERSE_NON_LEAVES, -1,
 				rspamd_ast_resort_traverse, NULL);
+		/* And rebuild code according to the new order */
+		rspamd_ast_compile (expr);
 	}
 
 	return ret;
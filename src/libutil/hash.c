@@ -222,6 +222,185 @@ rspamd_lru_hash_get_queue (rspamd_lru_hash_t *hash)
 	return hash->exp;
 }
 
+/**
+ * Pool hashing
+ */
+
+struct rspamd_mempool_hash_elt {
+	gpointer key;
+	gpointer value;
+};
+
+struct rspamd_mempool_hash_s {
+	rspamd_mempool_t *pool;
+	GHashFunc hfunc;
+	GEqualFunc eqfunc;
+	struct rspamd_mempool_hash_elt *elts;
+	guint nelts;
+	guint size; /* Power of two */
+};
+
+static struct rspamd_mempool_hash_elt *
+rspamd_mempool_hash_find (rspamd_mempool_hash_t *hash,
+	struct rspamd_mempool_hash_elt *elts, guint size, gconstpointer key)
+{
+	guint i, mask = size - 1;
+	struct rspamd_mempool_hash_elt *elt;
+
+	/* Linear probing, there is always a free slot */
+	i = hash->hfunc (key) & mask;
+
+	for (;;) {
+		elt = &elts[i];
+
+		if (elt->key == NULL || hash->eqfunc (elt->key, key)) {
+			return elt;
+		}
+
+		i = (i + 1) & mask;
+	}
+}
+
+static void
+rspamd_mempool_hash_grow (rspamd_mempool_hash_t *hash)
+{
+	struct rspamd_mempool_hash_elt *nelts, *elt;
+	guint i, nsize;
+
+	/* Old storage remains in pool until it is destroyed */
+	nsize = hash->size * 2;
+	nelts = rspamd_mempool_alloc0 (hash->pool, sizeof (*nelts) * nsize);
+
+	for (i = 0; i < hash->size; i ++) {
+		if (hash->elts[i].key != NULL) {
+			elt = rspamd_mempool_hash_find (hash, nelts, nsize,
+					hash->elts[i].key);
+			*elt = hash->elts[i];
+		}
+	}
+
+	hash->elts = nelts;
+	hash->size = nsize;
+}
+
+rspamd_mempool_hash_t *
+rspamd_mempool_hash_new (rspamd_mempool_t *pool,
+	GHashFunc hfunc,
+	GEqualFunc eqfunc,
+	guint size)
+{
+	rspamd_mempool_hash_t *hash;
+
+	g_assert (pool != NULL);
+
+	hash = rspamd_mempool_alloc (pool, sizeof (*hash));
+	hash->pool = pool;
+	hash->hfunc = hfunc;
+	hash->eqfunc = eqfunc;
+	hash->nelts = 0;
+	hash->size = 4;
+
+	/* Load factor is kept below 3/4 */
+	while (hash->size * 3 < size * 4) {
+		hash->size *= 2;
+	}
+
+	hash->elts = rspamd_mempool_alloc0 (pool,
+			sizeof (*hash->elts) * hash->size);
+
+	return hash;
+}
+
+void
+rspamd_mempool_hash_insert (rspamd_mempool_hash_t *hash,
+	gpointer key,
+	gpointer value)
+{
+	struct rspamd_mempool_hash_elt *elt;
+
+	g_assert (key != NULL);
+
+	elt = rspamd_mempool_hash_find (hash, hash->elts, hash->size, key);
+
+	if (elt->key == NULL) {
+		if ((hash->nelts + 1) * 4 > hash->size * 3) {
+			rspamd_mempool_hash_grow (hash);
+			elt = rspamd_mempool_hash_find (hash, hash->elts, hash->size, key);
+		}
+
+		hash->nelts ++;
+	}
+
+	elt->key = key;
+	elt->value = value;
+}
+
+gpointer
+rspamd_mempool_hash_lookup (rspamd_mempool_hash_t *hash,
+	gconstpointer key)
+{
+	struct rspamd_mempool_hash_elt *elt;
+
+	elt = rspamd_mempool_hash_find (hash, hash->elts, hash->size, key);
+
+	return elt->value;
+}
+
+guint
+rspamd_mempool_hash_size (rspamd_mempool_hash_t *hash)
+{
+	return hash->nelts;
+}
+
+void
+rspamd_mempool_hash_foreach (rspamd_mempool_hash_t *hash,
+	GHFunc func,
+	gpointer ud)
+{
+	guint i;
+
+	for (i = 0; i < hash->size; i ++) {
+		if (hash->elts[i].key != NULL) {
+			func (hash->elts[i].key, hash->elts[i].value, ud);
+		}
+	}
+}
+
+void
+rspamd_mempool_hash_iter_init (rspamd_mempool_hash_iter_t *it,
+	rspamd_mempool_hash_t *hash)
+{
+	it->hash = hash;
+	it->pos = 0;
+}
+
+gboolean
+rspamd_mempool_hash_iter_next (rspamd_mempool_hash_iter_t *it,
+	gpointer *key,
+	gpointer *value)
+{
+	rspamd_mempool_hash_t *hash = it->hash;
+
+	while (it->pos < hash->size) {
+		if (hash->elts[it->pos].key != NULL) {
+			if (key) {
+				*key = hash->elts[it->pos].key;
+			}
+			if (value) {
+				*value = hash->elts[it->pos].value;
+			}
+
+			it->pos ++;
+
+			return TRUE;
+		}
+
+		it->pos ++;
+	}
+
+	return FALSE;
+}
+
 /*
  * vi:ts=4
  */
@@ -8,6 +8,7 @@
 #define RSPAMD_HASH_H
 
 #include "config.h"
+#include "mem_pool.h"
 
 struct rspamd_lru_hash_s;
 typedef struct rspamd_lru_hash_s rspamd_lru_hash_t;
@@ -93,6 +94,76 @@ GHashTable *rspamd_lru_hash_get_htable (rspamd_lru_hash_t *hash);
  */
 GQueue *rspamd_lru_hash_get_queue (rspamd_lru_hash_t *hash);
 
+/*
+ * Hash table with storage allocated from a memory pool, it has no destructor
+ * and it is released when the pool is deleted. Elements cannot be removed.
+ */
+struct rspamd_mempool_hash_s;
+typedef struct rspamd_mempool_hash_s rspamd_mempool_hash_t;
+
+typedef struct rspamd_mempool_hash_iter_s {
+	rspamd_mempool_hash_t *hash;
+	guint pos;
+} rspamd_mempool_hash_iter_t;
+
+/**
+ * Create new pool hash
+ * @param pool memory pool for storage
+ * @param hfunc pointer to hash function
+ * @param eqfunc pointer to function for comparing keys
+ * @param size expected number of elements
+ * @return new hash object
+ */
+rspamd_mempool_hash_t * rspamd_mempool_hash_new (rspamd_mempool_t *pool,
+	GHashFunc hfunc,
+	GEqualFunc eqfunc,
+	guint size);
+
+/**
+ * Insert item in hash replacing the existing value
+ * @param hash hash object
+ * @param key key to insert (must not be NULL)
+ * @param value value of key
+ */
+void rspamd_mempool_hash_insert (rspamd_mempool_hash_t *hash,
+	gpointer key,
+	gpointer value);
+
+/**
+ * Lookup item from hash
+ * @param hash hash object
+ * @param key key to find
+ * @return value of key or NULL if key is not found
+ */
+gpointer rspamd_mempool_hash_lookup (rspamd_mempool_hash_t *hash,
+	gconstpointer key);
+
+/**
+ * Returns number of elements in hash
+ */
+guint rspamd_mempool_hash_size (rspamd_mempool_hash_t *hash);
+
+/**
+ * Call function for each element of hash
+ */
+void rspamd_mempool_hash_foreach (rspamd_mempool_hash_t *hash,
+	GHFunc func,
+	gpointer ud);
+
+/**
+ * Init iterator over hash elements
+ */
+void rspamd_mempool_hash_iter_init (rspamd_mempool_hash_iter_t *it,
+	rspamd_mempool_hash_t *hash);
+
+/**
+ * Get next element of hash
+ * @return FALSE if there are no more elements
+ */
+gboolean rspamd_mempool_hash_iter_next (rspamd_mempool_hash_iter_t *it,
+	gpointer *key,
+	gpointer *value);
+
 #endif
 
 /*
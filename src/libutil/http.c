@@ -84,6 +84,20 @@ static const rspamd_ftok_t date_header = {
 		.len = 4
 };
 
+/*
+ * Client HTTPCrypt session: ephemeral keypair reused for a bounded time
+ * and a cache of shared keys derived for it
+ */
+static struct rspamd_http_client_session {
+	struct rspamd_cryptobox_keypair *kp;
+	struct rspamd_keypair_cache *cache;
+	time_t ts;
+} http_session = {
+		.kp = NULL,
+		.cache = NULL,
+		.ts = 0
+};
+
 
 #define HTTP_ERROR http_error_quark ()
 GQuark
@@ -761,7 +775,8 @@ rspamd_http_on_message_complete (http_parser * parser)
 
 	priv = conn->priv;
 
-	if ((conn->opts & RSPAMD_HTTP_BODY_PARTIAL) == 0 && priv->encrypted) {
+	if (priv->encrypted) {
+		/* Encrypted body is never passed to the handler partially */
 		mode = rspamd_keypair_alg (priv->local_key);
 
 		if (priv->local_key == NULL || priv->msg->peer_key == NULL ||
@@ -1294,7 +1309,7 @@ rspamd_http_connection_encrypt_message (
 
 	cnt = i;
 
-	if ((nm = rspamd_pubkey_get_nm (peer_key))) {
+	if ((nm = rspamd_pubkey_get_nm (peer_key)) == NULL) {
 		nm = rspamd_pubkey_calculate_nm (peer_key, priv->local_key);
 	}
 
@@ -2306,6 +2321,37 @@ rspamd_http_connection_set_key (struct rspamd_http_connection *conn,
 	priv->local_key = rspamd_keypair_ref (key);
 }
 
+struct rspamd_cryptobox_keypair *
+rspamd_http_session_keypair (void)
+{
+	time_t now = time (NULL);
+
+	if (http_session.kp == NULL ||
+			now - http_session.ts > RSPAMD_HTTP_SESSION_KEY_TTL) {
+		if (http_session.kp != NULL) {
+			/* Connections that still use the old key hold their own refs */
+			rspamd_keypair_unref (http_session.kp);
+		}
+
+		http_session.kp = rspamd_keypair_new (RSPAMD_KEYPAIR_KEX,
+				RSPAMD_CRYPTOBOX_MODE_25519);
+		http_session.ts = now;
+	}
+
+	return rspamd_keypair_ref (http_session.kp);
+}
+
+struct rspamd_keypair_cache *
+rspamd_http_session_cache (void)
+{
+	if (http_session.cache == NULL) {
+		http_session.cache = rspamd_keypair_cache_new (
+				RSPAMD_HTTP_SESSION_CACHE_SIZE);
+	}
+
+	return http_session.cache;
+}
+
 gboolean
 rspamd_http_connection_is_encrypted (struct rspamd_http_connection *conn)
 {
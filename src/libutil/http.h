@@ -78,6 +78,12 @@ enum rspamd_http_options {
 	RSPAMD_HTTP_CLIENT_ENCRYPTED = 0x4 /**< Encrypt data for client */
 };
 
+/**
+ * Lifetime of the ephemeral client session keypair (in seconds)
+ */
+#define RSPAMD_HTTP_SESSION_KEY_TTL 120
+#define RSPAMD_HTTP_SESSION_CACHE_SIZE 64
+
 struct rspamd_http_connection_private;
 struct rspamd_http_connection;
 struct rspamd_http_connection_router;
@@ -164,6 +170,22 @@ struct rspamd_http_connection * rspamd_http_connection_new (
 void rspamd_http_connection_set_key (struct rspamd_http_connection *conn,
 		struct rspamd_cryptobox_keypair *key);
 
+/**
+ * Returns ephemeral client keypair that is shared by all client connections
+ * of the current process. Keypair is rotated every `RSPAMD_HTTP_SESSION_KEY_TTL`
+ * seconds, so peers could reuse shared keys derived for it instead of doing
+ * scalar multiplication for each request
+ * @return referenced keypair (must be released by a caller)
+ */
+struct rspamd_cryptobox_keypair * rspamd_http_session_keypair (void);
+
+/**
+ * Returns keypairs cache associated with the client session, this cache
+ * is owned by the library and must not be destroyed by a caller
+ * @return shared keypairs cache
+ */
+struct rspamd_keypair_cache * rspamd_http_session_cache (void);
+
 /**
  * Returns TRUE if a connection is encrypted
  * @param conn
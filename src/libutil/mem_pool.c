@@ -42,11 +42,44 @@
  */
 #undef MEMORY_GREEDY
 
+/*
+ * Private chains with payload up to 1Mb have power of two sizes (plus
+ * alignment slack) and they are returned to the local cache instead of
+ * the system allocator when a pool is destroyed
+ */
+#define CHAIN_MIN_CLASS 12
+#define CHAIN_MAX_CLASS 20
+#define CHAIN_CLASSES (CHAIN_MAX_CLASS - CHAIN_MIN_CLASS + 1)
+/* Maximum size of chains in cache */
+#define CHAIN_CACHE_MAX (8 * 1024 * 1024)
+/* Maximum page size suggested for a tag */
+#define ENTRY_MAX_SUGGESTION (1 << CHAIN_MAX_CLASS)
+
+struct rspamd_mempool_entry_point {
+	gsize avg_used;                 /**< moving average of memory used by pools */
+	gsize cur_suggestion;           /**< page size for new pools				*/
+	rspamd_mempool_tag_stat_t *st;  /**< shared statistics for this tag		*/
+};
+
+#define STAT_ADD(var, val) rspamd_atomic_add (&(var), (val))
+
 /* Internal statistic */
 static rspamd_mempool_stat_t *mem_pool_stat = NULL;
+static rspamd_mempool_tag_stat_t *mem_pool_tags = NULL;
+static rspamd_mempool_site_stat_t *mem_pool_sites = NULL;
+/* Allocations profiling */
+static guint profile_rate = 0;
+static guint profile_counter = 0;
 /* Environment variable */
 static gboolean env_checked = FALSE;
 static gboolean always_malloc = FALSE;
+/* Recycled chains */
+static struct _pool_chain *chain_cache[CHAIN_CLASSES];
+static gsize chain_cache_size = 0;
+G_LOCK_DEFINE_STATIC (chain_cache);
+/* Statistics per pool tag */
+static GHashTable *mempool_entries = NULL;
+G_LOCK_DEFINE_STATIC (mempool_entries);
 
 /**
  * Function that return free space in pool page
@@ -61,11 +94,96 @@ pool_chain_free (struct _pool_chain *chain)
 			chain->len - occupied : 0);
 }
 
+/*
+ * Returns class of a private chain of the specified size or -1 if chains of
+ * this size are not recycled
+ */
+static gint
+rspamd_mempool_chain_class (gsize size)
+{
+	gsize usable = size > MEM_ALIGNMENT ? size - MEM_ALIGNMENT : 1;
+	gint cls;
+
+	for (cls = CHAIN_MIN_CLASS; cls <= CHAIN_MAX_CLASS; cls ++) {
+		if (((gsize)1 << cls) >= usable) {
+			return cls - CHAIN_MIN_CLASS;
+		}
+	}
+
+	return -1;
+}
+
 static struct _pool_chain *
-rspamd_mempool_chain_new (gsize size, enum rspamd_mempool_chain_type pool_type)
+rspamd_mempool_chain_cache_pop (gint cls)
 {
 	struct _pool_chain *chain;
+
+	G_LOCK (chain_cache);
+	chain = chain_cache[cls];
+
+	if (chain != NULL) {
+		/* Next element is stored in the chain's payload */
+		memcpy (&chain_cache[cls], chain->begin, sizeof (chain));
+		chain_cache_size -= chain->len;
+	}
+
+	G_UNLOCK (chain_cache);
+
+	return chain;
+}
+
+static gboolean
+rspamd_mempool_chain_cache_push (struct _pool_chain *chain)
+{
+	gint cls;
+	gboolean ret = FALSE;
+
+	cls = rspamd_mempool_chain_class (chain->len);
+
+	if (cls == -1 ||
+			chain->len != ((gsize)1 << (cls + CHAIN_MIN_CLASS)) + MEM_ALIGNMENT) {
+		return FALSE;
+	}
+
+	G_LOCK (chain_cache);
+
+	if (chain_cache_size + chain->len <= CHAIN_CACHE_MAX) {
+		memcpy (chain->begin, &chain_cache[cls], sizeof (chain));
+		chain_cache[cls] = chain;
+		chain_cache_size += chain->len;
+		ret = TRUE;
+	}
+
+	G_UNLOCK (chain_cache);
+
+	return ret;
+}
+
+static void
+rspamd_mempool_chain_free (struct _pool_chain *chain,
+		enum rspamd_mempool_chain_type pool_type)
+{
+	gsize len;
+
+	g_atomic_int_add (&mem_pool_stat->bytes_allocated, -((gint)chain->len));
+	g_atomic_int_add (&mem_pool_stat->chunks_allocated, -1);
+
+	len = chain->len + sizeof (struct _pool_chain);
+
+	if (pool_type == RSPAMD_MEMPOOL_SHARED) {
+		munmap ((void *)chain, len);
+	}
+	else if (!rspamd_mempool_chain_cache_push (chain)) {
+		g_slice_free1 (len, chain);
+	}
+}
+
+static struct _pool_chain *
+rspamd_mempool_chain_new (gsize size, enum rspamd_mempool_chain_type pool_type)
+{
+	struct _pool_chain *chain = NULL;
 	gpointer map;
+	gint cls;
 
 	g_return_val_if_fail (size > 0, NULL);
 
@@ -111,9 +229,19 @@ rspamd_mempool_chain_new (gsize size, enum rspamd_mempool_chain_type pool_type)
 		g_atomic_int_add (&mem_pool_stat->bytes_allocated, size);
 	}
 	else {
-		map = g_slice_alloc (sizeof (struct _pool_chain) + size);
-		chain = map;
-		chain->begin = ((guint8 *) chain) + sizeof (struct _pool_chain);
+		cls = rspamd_mempool_chain_class (size);
+
+		if (cls != -1) {
+			size = ((gsize)1 << (cls + CHAIN_MIN_CLASS)) + MEM_ALIGNMENT;
+			chain = rspamd_mempool_chain_cache_pop (cls);
+		}
+
+		if (chain == NULL) {
+			map = g_slice_alloc (sizeof (struct _pool_chain) + size);
+			chain = map;
+			chain->begin = ((guint8 *) chain) + sizeof (struct _pool_chain);
+		}
+
 		g_atomic_int_add (&mem_pool_stat->bytes_allocated, size);
 		g_atomic_int_inc (&mem_pool_stat->chunks_allocated);
 	}
@@ -187,6 +315,163 @@ rspamd_mempool_append_chain (rspamd_mempool_t * pool,
 	g_ptr_array_add (pool->pools[pool_type], chain);
 }
 
+static gpointer
+rspamd_mempool_shared_map (gsize len)
+{
+	gpointer map;
+
+#if defined(HAVE_MMAP_ANON)
+	map = mmap (NULL,
+			len,
+			PROT_READ | PROT_WRITE,
+			MAP_ANON | MAP_SHARED,
+			-1,
+			0);
+	if (map == MAP_FAILED) {
+		msg_err ("cannot allocate %z bytes, aborting", len);
+		abort ();
+	}
+#elif defined(HAVE_MMAP_ZERO)
+	gint fd;
+
+	fd = open ("/dev/zero", O_RDWR);
+	g_assert (fd != -1);
+	map = mmap (NULL,
+			len,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED,
+			fd,
+			0);
+	if (map == MAP_FAILED) {
+		msg_err ("cannot allocate %z bytes, aborting", len);
+		abort ();
+	}
+	close (fd);
+#else
+#       error No mmap methods are defined
+#endif
+	memset (map, 0, len);
+
+	return map;
+}
+
+/*
+ * Find or claim the slot for the specified tag in the shared table: slot
+ * state is 0 for free slots, 1 when a slot is being initialised and 2 when
+ * it is ready
+ */
+static rspamd_mempool_tag_stat_t *
+rspamd_mempool_get_tag_stat (const gchar *tag)
+{
+	rspamd_mempool_tag_stat_t *st;
+	guint i;
+
+	for (i = 0; i < MEMPOOL_MAX_TAGS; i ++) {
+		st = &mem_pool_tags[i];
+
+		if (g_atomic_int_get (&st->state) == 2) {
+			if (strcmp (st->tag, tag) == 0) {
+				return st;
+			}
+		}
+		else if (g_atomic_int_compare_and_exchange (&st->state, 0, 1)) {
+			rspamd_strlcpy (st->tag, tag, sizeof (st->tag));
+			g_atomic_int_set (&st->state, 2);
+
+			return st;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+rspamd_mempool_profile_site (const gchar *loc, gsize size)
+{
+	rspamd_mempool_site_stat_t *site;
+	guint i, h;
+
+	if (++ profile_counter % profile_rate != 0) {
+		return;
+	}
+
+	h = (GPOINTER_TO_SIZE (loc) >> 3) % MEMPOOL_MAX_SITES;
+
+	/* Open addressing by the address of location string */
+	for (i = 0; i < MEMPOOL_MAX_SITES; i ++) {
+		site = &mem_pool_sites[(h + i) % MEMPOOL_MAX_SITES];
+
+		if (g_atomic_pointer_get (&site->key) == loc) {
+			break;
+		}
+
+		if (g_atomic_pointer_compare_and_exchange (&site->key, NULL, loc)) {
+			rspamd_strlcpy (site->loc, loc, sizeof (site->loc));
+			break;
+		}
+
+		if (g_atomic_pointer_get (&site->key) == loc) {
+			break;
+		}
+	}
+
+	if (i < MEMPOOL_MAX_SITES) {
+		STAT_ADD (site->count, profile_rate);
+		STAT_ADD (site->bytes, (guint64)size * profile_rate);
+	}
+}
+
+static struct rspamd_mempool_entry_point *
+rspamd_mempool_get_entry (const gchar *tag)
+{
+	struct rspamd_mempool_entry_point *entry;
+	gchar *key;
+
+	G_LOCK (mempool_entries);
+
+	if (mempool_entries == NULL) {
+		mempool_entries = g_hash_table_new (rspamd_str_hash, rspamd_str_equal);
+	}
+
+	entry = g_hash_table_lookup (mempool_entries, tag);
+
+	if (entry == NULL) {
+		entry = g_malloc0 (sizeof (*entry));
+		entry->st = rspamd_mempool_get_tag_stat (tag);
+		key = g_malloc (MEMPOOL_TAG_LEN);
+		rspamd_strlcpy (key, tag, MEMPOOL_TAG_LEN);
+		g_hash_table_insert (mempool_entries, key, entry);
+	}
+
+	G_UNLOCK (mempool_entries);
+
+	return entry;
+}
+
+/*
+ * Adjust page size for pools with the same tag, so most of them would fit
+ * in a single chain
+ */
+static void
+rspamd_mempool_entry_update (struct rspamd_mempool_entry_point *entry,
+		gsize used)
+{
+	gsize suggestion = 1;
+
+	if (entry->avg_used == 0) {
+		entry->avg_used = used;
+	}
+	else {
+		entry->avg_used = (entry->avg_used * 7 + used) / 8;
+	}
+
+	while (suggestion < entry->avg_used && suggestion < ENTRY_MAX_SUGGESTION) {
+		suggestion <<= 1;
+	}
+
+	entry->cur_suggestion = suggestion;
+}
+
 /**
  * Allocate new memory poll
  * @param size size of pool's page
@@ -196,48 +481,19 @@ rspamd_mempool_t *
 rspamd_mempool_new (gsize size, const gchar *tag)
 {
 	rspamd_mempool_t *new;
-	gpointer map;
 	unsigned char uidbuf[10];
 	const gchar hexdigits[] = "0123456789abcdef";
 	unsigned i;
 
 	g_return_val_if_fail (size > 0, NULL);
-	/* Allocate statistic structure if it is not allocated before */
+	/* Allocate statistic structures if they are not allocated before */
 	if (mem_pool_stat == NULL) {
-#if defined(HAVE_MMAP_ANON)
-		map = mmap (NULL,
-				sizeof (rspamd_mempool_stat_t),
-				PROT_READ | PROT_WRITE,
-				MAP_ANON | MAP_SHARED,
-				-1,
-				0);
-		if (map == MAP_FAILED) {
-			msg_err ("cannot allocate %z bytes, aborting",
+		mem_pool_stat = rspamd_mempool_shared_map (
 				sizeof (rspamd_mempool_stat_t));
-			abort ();
-		}
-		mem_pool_stat = (rspamd_mempool_stat_t *)map;
-#elif defined(HAVE_MMAP_ZERO)
-		gint fd;
-
-		fd = open ("/dev/zero", O_RDWR);
-		g_assert (fd != -1);
-		map = mmap (NULL,
-				sizeof (rspamd_mempool_stat_t),
-				PROT_READ | PROT_WRITE,
-				MAP_SHARED,
-				fd,
-				0);
-		if (map == MAP_FAILED) {
-			msg_err ("cannot allocate %z bytes, aborting",
-				sizeof (rspamd_mempool_stat_t));
-			abort ();
-		}
-		mem_pool_stat = (rspamd_mempool_stat_t *)map;
-#else
-#       error No mmap methods are defined
-#endif
-		memset (map, 0, sizeof (rspamd_mempool_stat_t));
+		mem_pool_tags = rspamd_mempool_shared_map (
+				sizeof (rspamd_mempool_tag_stat_t) * MEMPOOL_MAX_TAGS);
+		mem_pool_sites = rspamd_mempool_shared_map (
+				sizeof (rspamd_mempool_site_stat_t) * MEMPOOL_MAX_SITES);
 	}
 
 	if (!env_checked) {
@@ -260,6 +516,16 @@ rspamd_mempool_new (gsize size, const gchar *tag)
 
 	if (tag) {
 		rspamd_strlcpy (new->tag.tagname, tag, sizeof (new->tag.tagname));
+		new->entry = rspamd_mempool_get_entry (new->tag.tagname);
+
+		if (new->entry->cur_suggestion > size) {
+			new->elt_len = new->entry->cur_suggestion;
+		}
+
+		if (new->entry->st) {
+			g_atomic_int_inc (&new->entry->st->pools_allocated);
+			new->start_time = g_get_monotonic_time ();
+		}
 	}
 	else {
 		new->tag.tagname[0] = '\0';
@@ -280,14 +546,20 @@ rspamd_mempool_new (gsize size, const gchar *tag)
 
 static void *
 memory_pool_alloc_common (rspamd_mempool_t * pool, gsize size,
-		enum rspamd_mempool_chain_type pool_type)
+		enum rspamd_mempool_chain_type pool_type, const gchar *loc)
 {
 	guint8 *tmp;
 	struct _pool_chain *new, *cur;
+	rspamd_mempool_tag_stat_t *st;
 	gsize free = 0;
 
 	if (pool) {
 		POOL_MTX_LOCK ();
+
+		if (G_UNLIKELY (profile_rate > 0)) {
+			rspamd_mempool_profile_site (loc, size);
+		}
+
 		if (always_malloc && pool_type != RSPAMD_MEMPOOL_SHARED) {
 			void *ptr;
 
@@ -320,6 +592,15 @@ memory_pool_alloc_common (rspamd_mempool_t * pool, gsize size,
 				mem_pool_stat->oversized_chunks++;
 				new = rspamd_mempool_chain_new (
 						size + pool->elt_len + MEM_ALIGNMENT, pool_type);
+
+				if (pool->entry && pool->entry->st) {
+					STAT_ADD (pool->entry->st->oversized_chunks, 1);
+				}
+			}
+
+			if (pool->entry && (st = pool->entry->st) != NULL) {
+				STAT_ADD (st->chunks_allocated, 1);
+				STAT_ADD (st->bytes_allocated, new->len);
 			}
 
 			/* Connect to pool subsystem */
@@ -345,21 +626,24 @@ memory_pool_alloc_common (rspamd_mempool_t * pool, gsize size,
 
 
 void *
-rspamd_mempool_alloc (rspamd_mempool_t * pool, gsize size)
+rspamd_mempool_alloc_full (rspamd_mempool_t * pool, gsize size,
+		const gchar *loc)
 {
-	return memory_pool_alloc_common (pool, size, RSPAMD_MEMPOOL_NORMAL);
+	return memory_pool_alloc_common (pool, size, RSPAMD_MEMPOOL_NORMAL, loc);
 }
 
 void *
-rspamd_mempool_alloc_tmp (rspamd_mempool_t * pool, gsize size)
+rspamd_mempool_alloc_tmp_full (rspamd_mempool_t * pool, gsize size,
+		const gchar *loc)
 {
-	return memory_pool_alloc_common (pool, size, RSPAMD_MEMPOOL_TMP);
+	return memory_pool_alloc_common (pool, size, RSPAMD_MEMPOOL_TMP, loc);
 }
 
 void *
-rspamd_mempool_alloc0 (rspamd_mempool_t * pool, gsize size)
+rspamd_mempool_alloc0_full (rspamd_mempool_t * pool, gsize size,
+		const gchar *loc)
 {
-	void *pointer = rspamd_mempool_alloc (pool, size);
+	void *pointer = rspamd_mempool_alloc_full (pool, size, loc);
 	if (pointer) {
 		memset (pointer, 0, size);
 	}
@@ -367,9 +651,10 @@ rspamd_mempool_alloc0 (rspamd_mempool_t * pool, gsize size)
 }
 
 void *
-rspamd_mempool_alloc0_tmp (rspamd_mempool_t * pool, gsize size)
+rspamd_mempool_alloc0_tmp_full (rspamd_mempool_t * pool, gsize size,
+		const gchar *loc)
 {
-	void *pointer = rspamd_mempool_alloc_tmp (pool, size);
+	void *pointer = rspamd_mempool_alloc_tmp_full (pool, size, loc);
 	if (pointer) {
 		memset (pointer, 0, size);
 	}
@@ -377,9 +662,10 @@ rspamd_mempool_alloc0_tmp (rspamd_mempool_t * pool, gsize size)
 }
 
 void *
-rspamd_mempool_alloc0_shared (rspamd_mempool_t * pool, gsize size)
+rspamd_mempool_alloc0_shared_full (rspamd_mempool_t * pool, gsize size,
+		const gchar *loc)
 {
-	void *pointer = rspamd_mempool_alloc_shared (pool, size);
+	void *pointer = rspamd_mempool_alloc_shared_full (pool, size, loc);
 	if (pointer) {
 		memset (pointer, 0, size);
 	}
@@ -387,14 +673,16 @@ rspamd_mempool_alloc0_shared (rspamd_mempool_t * pool, gsize size)
 }
 
 void *
-rspamd_mempool_alloc_shared (rspamd_mempool_t * pool, gsize size)
+rspamd_mempool_alloc_shared_full (rspamd_mempool_t * pool, gsize size,
+		const gchar *loc)
 {
-	return memory_pool_alloc_common (pool, size, RSPAMD_MEMPOOL_SHARED);
+	return memory_pool_alloc_common (pool, size, RSPAMD_MEMPOOL_SHARED, loc);
 }
 
 
 gchar *
-rspamd_mempool_strdup (rspamd_mempool_t * pool, const gchar *src)
+rspamd_mempool_strdup_full (rspamd_mempool_t * pool, const gchar *src,
+		const gchar *loc)
 {
 	gsize len;
 	gchar *newstr;
@@ -404,7 +692,7 @@ rspamd_mempool_strdup (rspamd_mempool_t * pool, const gchar *src)
 	}
 
 	len = strlen (src);
-	newstr = rspamd_mempool_alloc (pool, len + 1);
+	newstr = rspamd_mempool_alloc_full (pool, len + 1, loc);
 	memcpy (newstr, src, len);
 	newstr[len] = '\0';
 
@@ -412,7 +700,8 @@ rspamd_mempool_strdup (rspamd_mempool_t * pool, const gchar *src)
 }
 
 gchar *
-rspamd_mempool_fstrdup (rspamd_mempool_t * pool, const struct f_str_s *src)
+rspamd_mempool_fstrdup_full (rspamd_mempool_t * pool,
+		const struct f_str_s *src, const gchar *loc)
 {
 	gchar *newstr;
 
@@ -420,7 +709,7 @@ rspamd_mempool_fstrdup (rspamd_mempool_t * pool, const struct f_str_s *src)
 		return NULL;
 	}
 
-	newstr = rspamd_mempool_alloc (pool, src->len + 1);
+	newstr = rspamd_mempool_alloc_full (pool, src->len + 1, loc);
 	memcpy (newstr, src->str, src->len);
 	newstr[src->len] = '\0';
 
@@ -428,7 +717,8 @@ rspamd_mempool_fstrdup (rspamd_mempool_t * pool, const struct f_str_s *src)
 }
 
 gchar *
-rspamd_mempool_ftokdup (rspamd_mempool_t *pool, const rspamd_ftok_t *src)
+rspamd_mempool_ftokdup_full (rspamd_mempool_t *pool, const rspamd_ftok_t *src,
+		const gchar *loc)
 {
 	gchar *newstr;
 
@@ -436,7 +726,7 @@ rspamd_mempool_ftokdup (rspamd_mempool_t *pool, const rspamd_ftok_t *src)
 		return NULL;
 	}
 
-	newstr = rspamd_mempool_alloc (pool, src->len + 1);
+	newstr = rspamd_mempool_alloc_full (pool, src->len + 1, loc);
 	memcpy (newstr, src->begin, src->len);
 	newstr[src->len] = '\0';
 
@@ -444,7 +734,8 @@ rspamd_mempool_ftokdup (rspamd_mempool_t *pool, const rspamd_ftok_t *src)
 }
 
 gchar *
-rspamd_mempool_strdup_shared (rspamd_mempool_t * pool, const gchar *src)
+rspamd_mempool_strdup_shared_full (rspamd_mempool_t * pool, const gchar *src,
+		const gchar *loc)
 {
 	gsize len;
 	gchar *newstr;
@@ -454,7 +745,7 @@ rspamd_mempool_strdup_shared (rspamd_mempool_t * pool, const gchar *src)
 	}
 
 	len = strlen (src);
-	newstr = rspamd_mempool_alloc_shared (pool, len + 1);
+	newstr = rspamd_mempool_alloc_shared_full (pool, len + 1, loc);
 	memcpy (newstr, src, len);
 	newstr[len] = '\0';
 
@@ -505,9 +796,10 @@ rspamd_mempool_delete (rspamd_mempool_t * pool)
 {
 	struct _pool_chain *cur;
 	struct _pool_destructors *destructor;
+	rspamd_mempool_tag_stat_t *st;
 	gpointer ptr;
-	guint i, j;
-	gsize len;
+	guint i, j, ndestructors;
+	gsize used = 0, total = 0;
 
 	POOL_MTX_LOCK ();
 
@@ -520,24 +812,21 @@ rspamd_mempool_delete (rspamd_mempool_t * pool)
 		}
 	}
 
+	ndestructors = pool->destructors->len;
 	g_array_free (pool->destructors, TRUE);
 
 	for (i = 0; i < G_N_ELEMENTS (pool->pools); i ++) {
 		if (pool->pools[i]) {
 			for (j = 0; j < pool->pools[i]->len; j++) {
 				cur = g_ptr_array_index (pool->pools[i], j);
-				g_atomic_int_add (&mem_pool_stat->bytes_allocated,
-						-((gint)cur->len));
-				g_atomic_int_add (&mem_pool_stat->chunks_allocated, -1);
-
-				len = cur->len + sizeof (struct _pool_chain);
 
-				if (i == RSPAMD_MEMPOOL_SHARED) {
-					munmap ((void *)cur, len);
-				}
-				else {
-					g_slice_free1 (len, cur);
+				if (i == RSPAMD_MEMPOOL_NORMAL) {
+					used += cur->pos - cur->begin;
 				}
+
+				total += cur->len;
+
+				rspamd_mempool_chain_free (cur, i);
 			}
 
 			g_ptr_array_free (pool->pools[i], TRUE);
@@ -557,6 +846,21 @@ rspamd_mempool_delete (rspamd_mempool_t * pool)
 		g_ptr_array_free (pool->trash_stack, TRUE);
 	}
 
+	if (pool->entry && used > 0) {
+		rspamd_mempool_entry_update (pool->entry, used);
+	}
+
+	if (pool->entry && (st = pool->entry->st) != NULL) {
+		g_atomic_int_inc (&st->pools_freed);
+		STAT_ADD (st->destructors, ndestructors);
+		STAT_ADD (st->lifetime, g_get_monotonic_time () - pool->start_time);
+
+		/* Racy but that's just a statistics */
+		if (st->max_bytes < total) {
+			st->max_bytes = total;
+		}
+	}
+
 	g_atomic_int_inc (&mem_pool_stat->pools_freed);
 	POOL_MTX_UNLOCK ();
 	g_slice_free (rspamd_mempool_t, pool);
@@ -567,19 +871,13 @@ rspamd_mempool_cleanup_tmp (rspamd_mempool_t * pool)
 {
 	struct _pool_chain *cur;
 	guint i;
-	gsize len;
 
 	POOL_MTX_LOCK ();
 
 	if (pool->pools[RSPAMD_MEMPOOL_TMP]) {
 		for (i = 0; i < pool->pools[RSPAMD_MEMPOOL_TMP]->len; i++) {
 			cur = g_ptr_array_index (pool->pools[RSPAMD_MEMPOOL_TMP], i);
-			g_atomic_int_add (&mem_pool_stat->bytes_allocated,
-					-((gint)cur->len));
-			g_atomic_int_add (&mem_pool_stat->chunks_allocated, -1);
-			len = cur->len + sizeof (struct _pool_chain);
-
-			g_slice_free1 (len, cur);
+			rspamd_mempool_chain_free (cur, RSPAMD_MEMPOOL_TMP);
 		}
 
 		g_ptr_array_free (pool->pools[RSPAMD_MEMPOOL_TMP], TRUE);
@@ -608,11 +906,54 @@ rspamd_mempool_stat (rspamd_mempool_stat_t * st)
 void
 rspamd_mempool_stat_reset (void)
 {
+	rspamd_mempool_tag_stat_t *st;
+	guint i;
+
 	if (mem_pool_stat != NULL) {
 		memset (mem_pool_stat, 0, sizeof (rspamd_mempool_stat_t));
+
+		/* Keep tags slots as they are referenced by pools */
+		for (i = 0; i < MEMPOOL_MAX_TAGS; i ++) {
+			st = &mem_pool_tags[i];
+			st->pools_allocated = 0;
+			st->pools_freed = 0;
+			st->bytes_allocated = 0;
+			st->chunks_allocated = 0;
+			st->oversized_chunks = 0;
+			st->destructors = 0;
+			st->lifetime = 0;
+			st->max_bytes = 0;
+		}
+
+		for (i = 0; i < MEMPOOL_MAX_SITES; i ++) {
+			mem_pool_sites[i].count = 0;
+			mem_pool_sites[i].bytes = 0;
+		}
 	}
 }
 
+guint
+rspamd_mempool_tags_stat (const rspamd_mempool_tag_stat_t **st)
+{
+	*st = mem_pool_tags;
+
+	return mem_pool_tags != NULL ? MEMPOOL_MAX_TAGS : 0;
+}
+
+guint
+rspamd_mempool_sites_stat (const rspamd_mempool_site_stat_t **st)
+{
+	*st = mem_pool_sites;
+
+	return mem_pool_sites != NULL ? MEMPOOL_MAX_SITES : 0;
+}
+
+void
+rspamd_mempool_set_profile_rate (guint rate)
+{
+	profile_rate = rate;
+}
+
 /* By default allocate 8Kb chunks of memory */
 #define FIXED_POOL_SIZE 8192
 gsize
@@ -840,6 +1181,131 @@ rspamd_mempool_wunlock_rwlock (rspamd_mempool_rwlock_t * lock)
 }
 #endif
 
+rspamd_mempool_ptr_array_t *
+rspamd_mempool_ptr_array_new (rspamd_mempool_t *pool, guint reserved)
+{
+	rspamd_mempool_ptr_array_t *ar;
+
+	ar = rspamd_mempool_alloc (pool, sizeof (*ar));
+	ar->pool = pool;
+	ar->len = 0;
+	ar->alloc = MAX (reserved, 4);
+	ar->pdata = rspamd_mempool_alloc (pool, sizeof (gpointer) * ar->alloc);
+
+	return ar;
+}
+
+void
+rspamd_mempool_ptr_array_add (rspamd_mempool_ptr_array_t *ar, gpointer p)
+{
+	gpointer *ndata;
+
+	if (ar->len == ar->alloc) {
+		/* Previous storage is left in pool */
+		ndata = rspamd_mempool_alloc (ar->pool,
+				sizeof (gpointer) * ar->alloc * 2);
+		memcpy (ndata, ar->pdata, sizeof (gpointer) * ar->len);
+		ar->pdata = ndata;
+		ar->alloc *= 2;
+	}
+
+	ar->pdata[ar->len ++] = p;
+}
+
+GList *
+rspamd_mempool_glist_prepend (rspamd_mempool_t *pool, GList *l, gpointer p)
+{
+	GList *cell;
+
+	cell = rspamd_mempool_alloc (pool, sizeof (*cell));
+	cell->prev = NULL;
+	cell->data = p;
+	cell->next = l;
+
+	if (l) {
+		l->prev = cell;
+	}
+
+	return cell;
+}
+
+GList *
+rspamd_mempool_glist_append (rspamd_mempool_t *pool, GList *l, gpointer p)
+{
+	GList *cell, *last;
+
+	cell = rspamd_mempool_alloc (pool, sizeof (*cell));
+	cell->next = NULL;
+	cell->data = p;
+
+	if (l) {
+		last = g_list_last (l);
+		last->next = cell;
+		cell->prev = last;
+	}
+	else {
+		cell->prev = NULL;
+		l = cell;
+	}
+
+	return l;
+}
+
+rspamd_mempool_slots_t *
+rspamd_mempool_slots_new (rspamd_mempool_t *pool, gsize slot_size,
+		guint nslots)
+{
+	rspamd_mempool_slots_t *slots;
+
+	g_assert (nslots > 0);
+
+	slots = rspamd_mempool_alloc0_shared (pool, sizeof (*slots));
+	slots->nslots = nslots;
+	/* Avoid false sharing between slots */
+	slots->slot_size = (slot_size + MEMPOOL_CACHE_LINE - 1) &
+			~((gsize)MEMPOOL_CACHE_LINE - 1);
+	slots->owners = rspamd_mempool_alloc0_shared (pool,
+			sizeof (pid_t) * nslots);
+	slots->data = rspamd_mempool_alloc0_shared (pool,
+			slots->slot_size * nslots + MEMPOOL_CACHE_LINE);
+	slots->data = align_ptr (slots->data, MEMPOOL_CACHE_LINE);
+
+	return slots;
+}
+
+gpointer
+rspamd_mempool_slots_claim (rspamd_mempool_slots_t *slots, pid_t pid)
+{
+	guint i;
+
+	for (i = 1; i < slots->nslots; i ++) {
+		if (g_atomic_int_get (&slots->owners[i]) == pid) {
+			return rspamd_mempool_slot (slots, i);
+		}
+	}
+
+	for (i = 1; i < slots->nslots; i ++) {
+		if (g_atomic_int_get (&slots->owners[i]) == 0 &&
+				g_atomic_int_compare_and_exchange (&slots->owners[i], 0, pid)) {
+			return rspamd_mempool_slot (slots, i);
+		}
+	}
+
+	return rspamd_mempool_slot (slots, 0);
+}
+
+void
+rspamd_mempool_slots_release (rspamd_mempool_slots_t *slots, pid_t pid)
+{
+	guint i;
+
+	for (i = 1; i < slots->nslots; i ++) {
+		if (g_atomic_int_compare_and_exchange (&slots->owners[i], pid, 0)) {
+			break;
+		}
+	}
+}
+
 void
 rspamd_mempool_set_variable (rspamd_mempool_t *pool,
 	const gchar *name,
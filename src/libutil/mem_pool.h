@@ -24,6 +24,20 @@ struct f_str_s;
 #define MEM_ALIGNMENT   16    /* Better for SSE */
 #define align_ptr(p, a)                                                   \
     (guint8 *) (((uintptr_t) (p) + ((uintptr_t) a - 1)) & ~((uintptr_t) a - 1))
+#define MEMPOOL_CACHE_LINE 64
+
+/*
+ * Relaxed atomic operations for counters placed in shared memory
+ */
+#ifdef HAVE_ATOMIC_BUILTINS
+#define rspamd_atomic_add(ptr, val) __atomic_add_fetch ((ptr), (val), __ATOMIC_RELAXED)
+#define rspamd_atomic_load(ptr) __atomic_load_n ((ptr), __ATOMIC_RELAXED)
+#define rspamd_atomic_store(ptr, val) __atomic_store_n ((ptr), (val), __ATOMIC_RELAXED)
+#else
+#define rspamd_atomic_add(ptr, val) (*(ptr) += (val))
+#define rspamd_atomic_load(ptr) (*(ptr))
+#define rspamd_atomic_store(ptr, val) (*(ptr) = (val))
+#endif
 
 enum rspamd_mempool_chain_type {
 	RSPAMD_MEMPOOL_NORMAL = 0,
@@ -86,6 +100,11 @@ struct rspamd_mempool_tag {
 	gchar uid[MEMPOOL_UID_LEN];             /**< unique id								*/
 };
 
+/**
+ * Allocation statistics for pools with the same tag
+ */
+struct rspamd_mempool_entry_point;
+
 /**
  * Memory pool type
  */
@@ -96,6 +115,8 @@ typedef struct memory_pool_s {
 	GPtrArray *trash_stack;
 	GHashTable *variables;                  /**< private memory pool variables			*/
 	gsize elt_len;							/**< size of an element						*/
+	struct rspamd_mempool_entry_point *entry; /**< statistics for this tag				*/
+	gint64 start_time;                      /**< monotonic time of creation				*/
 	struct rspamd_mempool_tag tag;          /**< memory pool tag						*/
 } rspamd_mempool_t;
 
@@ -112,11 +133,71 @@ typedef struct memory_pool_stat_s {
 	guint oversized_chunks;             /**< oversized chunks									*/
 } rspamd_mempool_stat_t;
 
+/**
+ * Array of cache line aligned slots in shared memory. Each process claims its
+ * own slot without locking and updates it with no contention, whilst readers
+ * aggregate all slots. Slot 0 is never claimed and is shared by processes that
+ * could not get a slot of their own
+ */
+typedef struct memory_pool_slots_s {
+	guint nslots;                       /**< number of slots					*/
+	gsize slot_size;                    /**< size of a slot (aligned)			*/
+	pid_t *owners;                      /**< pids of processes owning slots		*/
+	guint8 *data;                       /**< slots data							*/
+} rspamd_mempool_slots_t;
+
+#define rspamd_mempool_slot(slots, idx) \
+	((gpointer)((slots)->data + (gsize)(idx) * (slots)->slot_size))
+
+/**
+ * Array of pointers allocated from a memory pool, it has the same layout of
+ * public fields as GPtrArray, so g_ptr_array_index could be used for it
+ */
+typedef struct memory_pool_ptr_array_s {
+	gpointer *pdata;                    /**< elements							*/
+	guint len;                          /**< number of elements					*/
+	guint alloc;                        /**< number of allocated elements		*/
+	rspamd_mempool_t *pool;             /**< pool for storage					*/
+} rspamd_mempool_ptr_array_t;
+
+#define MEMPOOL_MAX_TAGS 64
+#define MEMPOOL_MAX_SITES 512
+#define MEMPOOL_SITE_LEN 64
+
+/**
+ * Statistics for pools with the same tag
+ */
+typedef struct memory_pool_tag_stat_s {
+	gchar tag[MEMPOOL_TAG_LEN];         /**< tag of pools						*/
+	gint state;                         /**< slot state (private)				*/
+	guint pools_allocated;              /**< number of pools allocated			*/
+	guint pools_freed;                  /**< number of pools freed				*/
+	guint64 bytes_allocated;            /**< bytes in chains allocated			*/
+	guint64 chunks_allocated;           /**< number of chains allocated			*/
+	guint64 oversized_chunks;           /**< oversized chains allocated			*/
+	guint64 destructors;                /**< destructors called					*/
+	guint64 lifetime;                   /**< sum of freed pools lifetimes (us)	*/
+	guint64 max_bytes;                  /**< largest pool size					*/
+} rspamd_mempool_tag_stat_t;
+
+/**
+ * Sampled allocations for a single allocation site
+ */
+typedef struct memory_pool_site_stat_s {
+	const gchar *key;                   /**< site key (private)					*/
+	gchar loc[MEMPOOL_SITE_LEN];        /**< source location					*/
+	guint64 count;                      /**< estimated number of allocations	*/
+	guint64 bytes;                      /**< estimated bytes allocated			*/
+} rspamd_mempool_site_stat_t;
+
 
 
 /**
- * Allocate new memory poll
+ * Allocate new memory poll. If `tag` is not NULL, then the page size can be
+ * increased according to the memory used by the previous pools with the same
+ * tag
  * @param size size of pool's page
+ * @param tag pool tag
  * @return new memory pool object
  */
 rspamd_mempool_t *rspamd_mempool_new (gsize size, const gchar *tag);
@@ -127,7 +208,10 @@ rspamd_mempool_t *rspamd_mempool_new (gsize size, const gchar *tag);
  * @param size bytes to allocate
  * @return pointer to allocated object
  */
-void * rspamd_mempool_alloc (rspamd_mempool_t * pool, gsize size);
+void * rspamd_mempool_alloc_full (rspamd_mempool_t * pool, gsize size,
+	const gchar *loc);
+#define rspamd_mempool_alloc(pool, size) \
+	rspamd_mempool_alloc_full ((pool), (size), G_STRLOC)
 
 /**
  * Get memory from temporary pool
@@ -135,7 +219,10 @@ void * rspamd_mempool_alloc (rspamd_mempool_t * pool, gsize size);
  * @param size bytes to allocate
  * @return pointer to allocated object
  */
-void * rspamd_mempool_alloc_tmp (rspamd_mempool_t * pool, gsize size);
+void * rspamd_mempool_alloc_tmp_full (rspamd_mempool_t * pool, gsize size,
+	const gchar *loc);
+#define rspamd_mempool_alloc_tmp(pool, size) \
+	rspamd_mempool_alloc_tmp_full ((pool), (size), G_STRLOC)
 
 /**
  * Get memory and set it to zero
@@ -143,7 +230,10 @@ void * rspamd_mempool_alloc_tmp (rspamd_mempool_t * pool, gsize size);
  * @param size bytes to allocate
  * @return pointer to allocated object
  */
-void * rspamd_mempool_alloc0 (rspamd_mempool_t * pool, gsize size);
+void * rspamd_mempool_alloc0_full (rspamd_mempool_t * pool, gsize size,
+	const gchar *loc);
+#define rspamd_mempool_alloc0(pool, size) \
+	rspamd_mempool_alloc0_full ((pool), (size), G_STRLOC)
 
 /**
  * Get memory and set it to zero
@@ -151,7 +241,10 @@ void * rspamd_mempool_alloc0 (rspamd_mempool_t * pool, gsize size);
  * @param size bytes to allocate
  * @return pointer to allocated object
  */
-void * rspamd_mempool_alloc0_tmp (rspamd_mempool_t * pool, gsize size);
+void * rspamd_mempool_alloc0_tmp_full (rspamd_mempool_t * pool, gsize size,
+	const gchar *loc);
+#define rspamd_mempool_alloc0_tmp(pool, size) \
+	rspamd_mempool_alloc0_tmp_full ((pool), (size), G_STRLOC)
 
 /**
  * Cleanup temporary data in pool
@@ -164,7 +257,10 @@ void rspamd_mempool_cleanup_tmp (rspamd_mempool_t * pool);
  * @param src source string
  * @return pointer to newly created string that is copy of src
  */
-gchar * rspamd_mempool_strdup (rspamd_mempool_t * pool, const gchar *src);
+gchar * rspamd_mempool_strdup_full (rspamd_mempool_t * pool, const gchar *src,
+	const gchar *loc);
+#define rspamd_mempool_strdup(pool, src) \
+	rspamd_mempool_strdup_full ((pool), (src), G_STRLOC)
 
 /**
  * Make a copy of fixed string in pool as null terminated string
@@ -172,8 +268,10 @@ gchar * rspamd_mempool_strdup (rspamd_mempool_t * pool, const gchar *src);
  * @param src source string
  * @return pointer to newly created string that is copy of src
  */
-gchar * rspamd_mempool_fstrdup (rspamd_mempool_t * pool,
-	const struct f_str_s *src);
+gchar * rspamd_mempool_fstrdup_full (rspamd_mempool_t * pool,
+	const struct f_str_s *src, const gchar *loc);
+#define rspamd_mempool_fstrdup(pool, src) \
+	rspamd_mempool_fstrdup_full ((pool), (src), G_STRLOC)
 
 struct f_str_tok;
 
@@ -183,18 +281,28 @@ struct f_str_tok;
  * @param src source string
  * @return pointer to newly created string that is copy of src
  */
-gchar * rspamd_mempool_ftokdup (rspamd_mempool_t *pool,
-		const struct f_str_tok *src);
+gchar * rspamd_mempool_ftokdup_full (rspamd_mempool_t *pool,
+		const struct f_str_tok *src, const gchar *loc);
+#define rspamd_mempool_ftokdup(pool, src) \
+	rspamd_mempool_ftokdup_full ((pool), (src), G_STRLOC)
 
 /**
  * Allocate piece of shared memory
  * @param pool memory pool object
  * @param size bytes to allocate
  */
-void * rspamd_mempool_alloc_shared (rspamd_mempool_t * pool, gsize size);
-void * rspamd_mempool_alloc0_shared (rspamd_mempool_t *pool, gsize size);
-gchar * rspamd_mempool_strdup_shared (rspamd_mempool_t * pool,
-	const gchar *src);
+void * rspamd_mempool_alloc_shared_full (rspamd_mempool_t * pool, gsize size,
+	const gchar *loc);
+void * rspamd_mempool_alloc0_shared_full (rspamd_mempool_t *pool, gsize size,
+	const gchar *loc);
+gchar * rspamd_mempool_strdup_shared_full (rspamd_mempool_t * pool,
+	const gchar *src, const gchar *loc);
+#define rspamd_mempool_alloc_shared(pool, size) \
+	rspamd_mempool_alloc_shared_full ((pool), (size), G_STRLOC)
+#define rspamd_mempool_alloc0_shared(pool, size) \
+	rspamd_mempool_alloc0_shared_full ((pool), (size), G_STRLOC)
+#define rspamd_mempool_strdup_shared(pool, src) \
+	rspamd_mempool_strdup_shared_full ((pool), (src), G_STRLOC)
 /**
  * Add destructor callback to pool
  * @param pool memory pool object
@@ -246,6 +354,70 @@ void rspamd_mempool_lock_mutex (rspamd_mempool_mutex_t *mutex);
  */
 void rspamd_mempool_unlock_mutex (rspamd_mempool_mutex_t *mutex);
 
+/**
+ * Allocate slots array in shared memory
+ * @param pool memory pool object
+ * @param slot_size size of a single slot
+ * @param nslots number of slots including the shared one
+ * @return new slots array with all slots zeroed
+ */
+rspamd_mempool_slots_t * rspamd_mempool_slots_new (rspamd_mempool_t *pool,
+		gsize slot_size, guint nslots);
+
+/**
+ * Claim a slot for the specified process, if the process already owns a slot
+ * then it is returned. Counters in a slot are preserved when it is reclaimed.
+ * @param slots slots array
+ * @param pid owner
+ * @return slot owned by pid or the shared slot if there are no free slots
+ */
+gpointer rspamd_mempool_slots_claim (rspamd_mempool_slots_t *slots, pid_t pid);
+
+/**
+ * Release a slot owned by the specified process
+ * @param slots slots array
+ * @param pid owner
+ */
+void rspamd_mempool_slots_release (rspamd_mempool_slots_t *slots, pid_t pid);
+
+/**
+ * Create new pointers array, its storage is released with the pool
+ * @param pool memory pool object
+ * @param reserved number of preallocated elements
+ * @return new array
+ */
+rspamd_mempool_ptr_array_t * rspamd_mempool_ptr_array_new (
+		rspamd_mempool_t *pool, guint reserved);
+
+/**
+ * Append element to pointers array
+ * @param ar array
+ * @param p element
+ */
+void rspamd_mempool_ptr_array_add (rspamd_mempool_ptr_array_t *ar,
+		gpointer p);
+
+/**
+ * Prepend element to a list with nodes allocated from the pool, such a list
+ * must not be freed with g_list_free
+ * @param pool memory pool object
+ * @param l list
+ * @param p element
+ * @return new head of list
+ */
+GList * rspamd_mempool_glist_prepend (rspamd_mempool_t *pool, GList *l,
+		gpointer p);
+
+/**
+ * Append element to a list with nodes allocated from the pool
+ * @param pool memory pool object
+ * @param l list
+ * @param p element
+ * @return new head of list
+ */
+GList * rspamd_mempool_glist_append (rspamd_mempool_t *pool, GList *l,
+		gpointer p);
+
 /**
  * Create new rwlock and place it in shared memory
  * @param pool memory pool object
@@ -288,6 +460,28 @@ void rspamd_mempool_stat (rspamd_mempool_stat_t *st);
  */
 void rspamd_mempool_stat_reset (void);
 
+/**
+ * Get statistics for pool tags, the array is shared between all processes
+ * and unused slots have an empty tag
+ * @param st output array of MEMPOOL_MAX_TAGS elements
+ * @return number of elements in array
+ */
+guint rspamd_mempool_tags_stat (const rspamd_mempool_tag_stat_t **st);
+
+/**
+ * Get sampled allocation sites statistics, the array is shared between all
+ * processes and unused slots have an empty location
+ * @param st output array of MEMPOOL_MAX_SITES elements
+ * @return number of elements in array
+ */
+guint rspamd_mempool_sites_stat (const rspamd_mempool_site_stat_t **st);
+
+/**
+ * Sample every `rate` allocation to collect allocation sites statistics
+ * @param rate sampling rate, 0 disables profiling
+ */
+void rspamd_mempool_set_profile_rate (guint rate);
+
 /**
  * Get optimal pool size based on page size for this system
  * @return size of memory page in system
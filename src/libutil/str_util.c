@@ -84,6 +84,25 @@ rspamd_str_lc (gchar *str, guint size)
 
 }
 
+void
+rspamd_str_copy_lc (const gchar *src, gchar *dst, gsize size)
+{
+	const guchar *s = (const guchar *)src, *end = s + size;
+
+	while (end - s >= 4) {
+		dst[0] = lc_map[s[0]];
+		dst[1] = lc_map[s[1]];
+		dst[2] = lc_map[s[2]];
+		dst[3] = lc_map[s[3]];
+		dst += 4;
+		s += 4;
+	}
+
+	while (s < end) {
+		*dst++ = lc_map[*s++];
+	}
+}
+
 gint
 rspamd_lc_cmp (const gchar *s, const gchar *d, gsize l)
 {
@@ -1419,6 +1438,72 @@ rspamd_decode_hex_buf (const gchar *in, gsize inlen,
 	return -1;
 }
 
+gssize
+rspamd_decode_qp_buf (const gchar *in, gsize inlen,
+		gchar *out, gsize outlen)
+{
+	const gchar *p = in, *end = in + inlen, *t;
+	gchar *o = out, *oend = out + outlen;
+
+	while (p < end) {
+		if (o >= oend) {
+			return -1;
+		}
+
+		if (*p != '=') {
+			/* Copy everything up to the next escape at once */
+			t = memchr (p, '=', end - p);
+
+			if (t == NULL) {
+				t = end;
+			}
+
+			if (t - p > oend - o) {
+				return -1;
+			}
+
+			memmove (o, p, t - p);
+			o += t - p;
+			p = t;
+			continue;
+		}
+
+		p ++;
+		/* Soft line break may be preceded by transport padding */
+		t = p;
+
+		while (t < end && (*t == ' ' || *t == '\t')) {
+			t ++;
+		}
+
+		if (t == end) {
+			break;
+		}
+		else if (*t == '\r' || *t == '\n') {
+			if (*t == '\r') {
+				t ++;
+			}
+			if (t < end && *t == '\n') {
+				t ++;
+			}
+
+			p = t;
+		}
+		else if (end - p >= 2 && g_ascii_isxdigit (p[0]) &&
+				g_ascii_isxdigit (p[1])) {
+			*o++ = (g_ascii_xdigit_value (p[0]) << 4) |
+					g_ascii_xdigit_value (p[1]);
+			p += 2;
+		}
+		else {
+			/* Invalid escape */
+			*o++ = '=';
+		}
+	}
+
+	return (o - out);
+}
+
 guchar*
 rspamd_decode_hex (const gchar *in, gsize inlen)
 {
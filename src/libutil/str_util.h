@@ -29,6 +29,10 @@ gint rspamd_lc_cmp (const gchar *s, const gchar *d, gsize l);
  * Convert string to lowercase in-place using ASCII conversion
  */
 void rspamd_str_lc (gchar *str, guint size);
+/**
+ * Copy string to `dst` converting it to lowercase using ASCII conversion
+ */
+void rspamd_str_copy_lc (const gchar *src, gchar *dst, gsize size);
 /**
  * Convert string to lowercase in-place using utf (limited) conversion
  */
@@ -175,6 +179,17 @@ gint rspamd_encode_hex_buf (const guchar *in, gsize inlen, gchar *out,
 gint rspamd_decode_hex_buf (const gchar *in, gsize inlen,
 		guchar *out, gsize outlen);
 
+/**
+ * Decode quoted-printable encoded buffer, invalid escapes are copied as is
+ * @param in input
+ * @param inlen input length
+ * @param out output buf (may overlap with `in`)
+ * @param outlen output buf len
+ * @return decoded len if `outlen` is enough to decode `inlen` or -1
+ */
+gssize rspamd_decode_qp_buf (const gchar *in, gsize inlen,
+		gchar *out, gsize outlen);
+
 /**
  * Encode string using base64 encoding
  * @param in input
@@ -38,6 +38,8 @@ struct upstream {
 	guint errors;
 	guint dns_requests;
 	gint active_idx;
+	guint inflight;
+	gdouble latency;
 	gchar *name;
 	struct event ev;
 	struct timeval tv;
@@ -88,6 +90,10 @@ static gdouble default_revive_jitter = 0.4;
 static gdouble default_error_time = 10;
 static gdouble default_dns_timeout = 1.0;
 static guint default_dns_retransmits = 2;
+/* Smoothing factor for latency EWMA */
+static const gdouble latency_alpha = 0.2;
+/* Latency assumed for a failed request */
+static const gdouble latency_fail_penalty = 1.0;
 
 void
 rspamd_upstreams_library_config (struct rspamd_config *cfg,
@@ -308,6 +314,32 @@ rspamd_upstream_dns_cb (struct rdns_reply *reply, void *arg)
 	REF_RELEASE (up);
 }
 
+/*
+ * Mean latency of alive upstreams in a list, 0 if there are no samples
+ */
+static gdouble
+rspamd_upstream_peers_latency (struct upstream_list *ls)
+{
+	struct upstream *peer;
+	gdouble sum = 0;
+	guint i, cnt = 0;
+
+	rspamd_mutex_lock (ls->lock);
+
+	for (i = 0; i < ls->alive->len; i ++) {
+		peer = g_ptr_array_index (ls->alive, i);
+
+		if (peer->latency > 0) {
+			sum += peer->latency;
+			cnt ++;
+		}
+	}
+
+	rspamd_mutex_unlock (ls->lock);
+
+	return cnt > 0 ? sum / cnt : 0;
+}
+
 static void
 rspamd_upstream_revive_cb (int fd, short what, void *arg)
 {
@@ -315,7 +347,13 @@ rspamd_upstream_revive_cb (int fd, short what, void *arg)
 
 	rspamd_mutex_lock (up->lock);
 	event_del (&up->ev);
+
 	if (up->ls) {
+		/*
+		 * Forget latency collected before the upstream was marked as dead,
+		 * but do not let it win every comparison until the first sample
+		 */
+		up->latency = rspamd_upstream_peers_latency (up->ls);
 		rspamd_upstream_set_active (up->ls, up);
 	}
 
@@ -365,6 +403,65 @@ rspamd_upstream_set_inactive (struct upstream_list *ls, struct upstream *up)
 	rspamd_mutex_unlock (ls->lock);
 }
 
+static void
+rspamd_upstream_update_latency (struct upstream *up, gdouble latency)
+{
+	if (up->latency == 0) {
+		up->latency = latency;
+	}
+	else {
+		up->latency += latency_alpha * (latency - up->latency);
+	}
+}
+
+void
+rspamd_upstream_latency (struct upstream *up, gdouble latency)
+{
+	if (latency < 0) {
+		return;
+	}
+
+	rspamd_mutex_lock (up->lock);
+	rspamd_upstream_update_latency (up, latency);
+	rspamd_mutex_unlock (up->lock);
+}
+
+gdouble
+rspamd_upstream_start (struct upstream *up)
+{
+	gdouble now;
+
+	rspamd_mutex_lock (up->lock);
+	up->inflight ++;
+	rspamd_mutex_unlock (up->lock);
+
+	now = rspamd_get_ticks ();
+
+	/* Zero token means that request is finished */
+	return now > 0 ? now : G_MINDOUBLE;
+}
+
+void
+rspamd_upstream_finish (struct upstream *up, gdouble *token, gboolean success)
+{
+	if (*token == 0) {
+		return;
+	}
+
+	rspamd_mutex_lock (up->lock);
+
+	if (up->inflight > 0) {
+		up->inflight --;
+	}
+
+	/* Failed request slows down this upstream for latency based rotation */
+	rspamd_upstream_update_latency (up, success ?
+			MAX (rspamd_get_ticks () - *token, 0) : latency_fail_penalty);
+	rspamd_mutex_unlock (up->lock);
+
+	*token = 0;
+}
+
 void
 rspamd_upstream_fail (struct upstream *up)
 {
@@ -607,6 +704,12 @@ rspamd_upstreams_parse_line (struct upstream_list *ups,
 		ups->rot_alg = RSPAMD_UPSTREAM_HASHED;
 		p += sizeof ("hash:") - 1;
 	}
+	else if (g_ascii_strncasecmp (p,
+			"latency:",
+			sizeof ("latency:") - 1) == 0) {
+		ups->rot_alg = RSPAMD_UPSTREAM_LATENCY;
+		p += sizeof ("latency:") - 1;
+	}
 	else if (g_ascii_strncasecmp (p,
 			"sequential:",
 			sizeof ("sequential:") - 1) == 0) {
@@ -778,6 +881,51 @@ rspamd_upstream_get_hashed (struct upstream_list *ups, const guint8 *key, guint
 	return g_ptr_array_index (ups->alive, idx);
 }
 
+static inline gdouble
+rspamd_upstream_latency_score (struct upstream *up)
+{
+	/* Expected wait time if we queue one more request to this upstream */
+	return up->latency * (up->inflight + 1);
+}
+
+/*
+ * Power of two choices: select two random alive upstreams and use the one
+ * with the lower expected latency. It avoids herding all requests to a single
+ * fastest upstream while still moving load away from slow ones.
+ */
+static struct upstream*
+rspamd_upstream_get_latency (struct upstream_list *ups)
+{
+	struct upstream *selected, *alt;
+	guint i1, i2;
+
+	rspamd_mutex_lock (ups->lock);
+
+	if (ups->alive->len == 1) {
+		selected = g_ptr_array_index (ups->alive, 0);
+	}
+	else {
+		i1 = ottery_rand_range (ups->alive->len - 1);
+		i2 = ottery_rand_range (ups->alive->len - 2);
+
+		if (i2 >= i1) {
+			i2 ++;
+		}
+
+		selected = g_ptr_array_index (ups->alive, i1);
+		alt = g_ptr_array_index (ups->alive, i2);
+
+		if (rspamd_upstream_latency_score (alt) <
+				rspamd_upstream_latency_score (selected)) {
+			selected = alt;
+		}
+	}
+
+	rspamd_mutex_unlock (ups->lock);
+
+	return selected;
+}
+
 struct upstream*
 rspamd_upstream_get (struct upstream_list *ups,
 		enum rspamd_upstream_rotation default_type,
@@ -809,6 +957,8 @@ rspamd_upstream_get (struct upstream_list *ups,
 		return rspamd_upstream_get_round_robin (ups, TRUE);
 	case RSPAMD_UPSTREAM_MASTER_SLAVE:
 		return rspamd_upstream_get_round_robin (ups, FALSE);
+	case RSPAMD_UPSTREAM_LATENCY:
+		return rspamd_upstream_get_latency (ups);
 	case RSPAMD_UPSTREAM_SEQUENTIAL:
 		if (ups->cur_elt >= ups->alive->len) {
 			ups->cur_elt = 0;
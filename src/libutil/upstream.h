@@ -12,6 +12,7 @@ enum rspamd_upstream_rotation {
 	RSPAMD_UPSTREAM_ROUND_ROBIN,
 	RSPAMD_UPSTREAM_MASTER_SLAVE,
 	RSPAMD_UPSTREAM_SEQUENTIAL,
+	RSPAMD_UPSTREAM_LATENCY,
 	RSPAMD_UPSTREAM_UNDEF
 };
 
@@ -59,6 +60,35 @@ void rspamd_upstream_fail (struct upstream *up);
  */
 void rspamd_upstream_ok (struct upstream *up);
 
+/**
+ * Report the time spent for a request to an upstream. This value is used by
+ * `latency` rotation to prefer faster upstreams. It does not change number of
+ * requests in flight, use `rspamd_upstream_start` and `rspamd_upstream_finish`
+ * to track them
+ * @param up upstream
+ * @param latency time in seconds
+ */
+void rspamd_upstream_latency (struct upstream *up, gdouble latency);
+
+/**
+ * Start a request to an upstream: it is counted as in flight by `latency`
+ * rotation until `rspamd_upstream_finish` is called with the returned token
+ * @param up upstream
+ * @return non-zero token
+ */
+gdouble rspamd_upstream_start (struct upstream *up);
+
+/**
+ * Finish a request started by `rspamd_upstream_start` and record its latency.
+ * Token is reset to zero and calls with zero token are ignored, so it is safe
+ * to call this function from both completion callbacks and destructors
+ * @param up upstream
+ * @param token pointer to token returned by `rspamd_upstream_start`
+ * @param success if FALSE, then request is accounted with a failure penalty
+ */
+void rspamd_upstream_finish (struct upstream *up, gdouble *token,
+		gboolean success);
+
 /**
  * Create new list of upstreams
  * @return
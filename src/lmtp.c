@@ -274,7 +274,7 @@ accept_socket (gint fd, short what, void *arg)
 	new_task->ev_base = worker->ctx;
 	rspamd_mempool_add_destructor (new_task->task_pool,
 		(rspamd_mempool_destruct_t) g_hash_table_destroy, new_task->results);
-	worker->srv->stat->connections_count++;
+	rspamd_atomic_add (&worker->srv->stat->connections_count, 1);
 	lmtp->task = new_task;
 	lmtp->state = LMTP_READ_LHLO;
 
@@ -451,7 +451,7 @@ rspamd_lua_consolidation_func (struct rspamd_task *task,
 		return 0;
 	}
 
-	metric_res = g_hash_table_lookup (task->results, metric_name);
+	metric_res = rspamd_mempool_hash_lookup (task->results, metric_name);
 	if (metric_res == NULL) {
 		return res;
 	}
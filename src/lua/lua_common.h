@@ -163,8 +163,9 @@ struct rspamd_lua_text * lua_check_text (lua_State * L, gint pos);
 /**
  * Push specific header to lua
  */
+struct rspamd_mime_headers;
 gint rspamd_lua_push_header (lua_State * L,
-	GHashTable *hdrs,
+	struct rspamd_mime_headers *hdrs,
 	const gchar *name,
 	gboolean strong,
 	gboolean full,
@@ -1455,6 +1455,7 @@ lua_config_add_composite (lua_State * L)
 				composite = rspamd_mempool_alloc (cfg->cfg_pool,
 						sizeof (struct rspamd_composite));
 				composite->expr = expr;
+				composite->sym = name;
 				composite->id = g_hash_table_size (cfg->composite_symbols);
 				g_hash_table_insert (cfg->composite_symbols,
 						(gpointer)name,
@@ -357,16 +357,16 @@ static gint
 lua_html_tag_get_parent (lua_State *L)
 {
 	struct html_tag *tag = lua_check_html_tag (L, 1), **ptag;
-	GNode *node;
 
 	if (tag != NULL) {
-		node = tag->parent;
-
-		if (node && node->data) {
+		if (tag->parent) {
 			ptag = lua_newuserdata (L, sizeof (gpointer));
-			*ptag = node->data;
+			*ptag = tag->parent;
 			rspamd_lua_setclass (L, "rspamd{html_tag}", -1);
 		}
+		else {
+			lua_pushnil (L);
+		}
 	}
 	else {
 		lua_error (L);
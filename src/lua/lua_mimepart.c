@@ -447,16 +447,18 @@ lua_mimepart_get_content (lua_State * L)
 {
 	struct mime_part *part = lua_check_mimepart (L);
 	struct rspamd_lua_text *t;
+	GByteArray *content;
 
 	if (part == NULL) {
 		lua_pushnil (L);
 		return 1;
 	}
 
+	content = rspamd_mime_part_get_content (part);
 	t = lua_newuserdata (L, sizeof (*t));
 	rspamd_lua_setclass (L, "rspamd{text}", -1);
-	t->start = part->content->data;
-	t->len = part->content->len;
+	t->start = content->data;
+	t->len = content->len;
 	t->own = FALSE;
 
 	return 1;
@@ -472,7 +474,7 @@ lua_mimepart_get_length (lua_State * L)
 		return 1;
 	}
 
-	lua_pushinteger (L, part->content->len);
+	lua_pushinteger (L, rspamd_mime_part_get_content (part)->len);
 
 	return 1;
 }
@@ -238,9 +238,14 @@ LUA_FUNCTION_DEF (task, get_raw_headers);
  * - `real_hostname` - hostname as resolved by MTA
  * - `real_ip` - string representation of IP as resolved by PTR request of MTA
  * - `by_hostname` - MTA hostname
+ * - `proto` - protocol from `with` clause: `smtp`, `esmtp`, `lmtp`, `imap`, `local`, `http` or `unknown`
+ * - `timestamp` - time after `;` as unix timestamp (0 if it cannot be parsed)
+ * - `tls` - `true` if a message was received over SSL/TLS
+ * - `authenticated` - `true` if a sender was authenticated (e.g. `with ESMTPSA`)
  *
  * Please note that in some situations rspamd cannot parse all the fields of received headers.
  * In that case you should check all strings for validity.
+ * The list is built once per task and shared between callers, so it must not be modified.
  * @return {table of tables} list of received headers described above
  */
 LUA_FUNCTION_DEF (task, get_received_headers);
@@ -874,7 +879,8 @@ lua_task_set_pre_result (lua_State * L)
 				action_str = rspamd_mempool_strdup (task->task_pool,
 						luaL_checkstring (L, 3));
 				task->pre_result.str = action_str;
-				task->messages = g_list_prepend (task->messages, action_str);
+				task->messages = rspamd_mempool_glist_prepend (task->task_pool,
+						task->messages, action_str);
 			}
 			else {
 				task->pre_result.str = "unknown";
@@ -900,42 +906,39 @@ lua_task_set_pre_result (lua_State * L)
 	return 0;
 }
 
-struct lua_tree_cb_data {
-	lua_State *L;
-	int i;
-};
-
+/* Appends urls from a set to the table on top of the stack */
 static void
-lua_tree_url_callback (gpointer key, gpointer value, gpointer ud)
+lua_task_push_url_set (lua_State *L, struct rspamd_url_set *set, gint *pidx)
 {
 	struct rspamd_lua_url *url;
-	struct lua_tree_cb_data *cb = ud;
+	guint i;
 
-	url = lua_newuserdata (cb->L, sizeof (struct rspamd_lua_url));
-	rspamd_lua_setclass (cb->L, "rspamd{url}", -1);
-	url->url = value;
-	lua_rawseti (cb->L, -2, cb->i++);
+	for (i = 0; i < rspamd_url_set_size (set); i ++) {
+		url = lua_newuserdata (L, sizeof (struct rspamd_lua_url));
+		rspamd_lua_setclass (L, "rspamd{url}", -1);
+		url->url = rspamd_url_set_index (set, i);
+		lua_rawseti (L, -2, (*pidx)++);
+	}
 }
 
 static gint
 lua_task_get_urls (lua_State * L)
 {
 	struct rspamd_task *task = lua_check_task (L, 1);
-	struct lua_tree_cb_data cb;
 	gboolean need_emails = FALSE;
+	gint idx = 1;
 
 	if (task) {
 		if (lua_gettop (L) >= 2) {
 			need_emails = lua_toboolean (L, 2);
 		}
 
-		lua_newtable (L);
-		cb.i = 1;
-		cb.L = L;
-		g_hash_table_foreach (task->urls, lua_tree_url_callback, &cb);
+		lua_createtable (L, rspamd_url_set_size (task->urls) +
+				(need_emails ? rspamd_url_set_size (task->emails) : 0), 0);
+		lua_task_push_url_set (L, task->urls, &idx);
 
 		if (need_emails) {
-			g_hash_table_foreach (task->emails, lua_tree_url_callback, &cb);
+			lua_task_push_url_set (L, task->emails, &idx);
 		}
 	}
 	else {
@@ -956,11 +959,11 @@ lua_task_has_urls (lua_State * L)
 			need_emails = lua_toboolean (L, 2);
 		}
 
-		if (g_hash_table_size (task->urls) > 0) {
+		if (rspamd_url_set_size (task->urls) > 0) {
 			ret = TRUE;
 		}
 
-		if (need_emails && g_hash_table_size (task->emails) > 0) {
+		if (need_emails && rspamd_url_set_size (task->emails) > 0) {
 			ret = TRUE;
 		}
 	}
@@ -997,13 +1000,11 @@ static gint
 lua_task_get_emails (lua_State * L)
 {
 	struct rspamd_task *task = lua_check_task (L, 1);
-	struct lua_tree_cb_data cb;
+	gint idx = 1;
 
 	if (task) {
-		lua_newtable (L);
-		cb.i = 1;
-		cb.L = L;
-		g_hash_table_foreach (task->emails, lua_tree_url_callback, &cb);
+		lua_createtable (L, rspamd_url_set_size (task->emails), 0);
+		lua_task_push_url_set (L, task->emails, &idx);
 	}
 	else {
 		return luaL_error (L, "invalid arguments");
@@ -1159,7 +1160,7 @@ lua_task_set_request_header (lua_State *L)
 
 gint
 rspamd_lua_push_header (lua_State * L,
-		GHashTable *hdrs,
+		struct rspamd_mime_headers *hdrs,
 		const gchar *name,
 		gboolean strong,
 		gboolean full,
@@ -1170,7 +1171,7 @@ rspamd_lua_push_header (lua_State * L,
 	gint i = 1;
 	const gchar *val;
 
-	rh = g_hash_table_lookup (hdrs, name);
+	rh = rspamd_mime_headers_lookup (hdrs, name);
 
 	if (rh == NULL) {
 		lua_pushnil (L);
@@ -1297,14 +1298,63 @@ lua_task_get_raw_headers (lua_State *L)
 	return 1;
 }
 
+#define RSPAMD_RECEIVED_LUA_VAR "received_headers_lua"
+
+struct lua_task_received_cache {
+	lua_State *L;
+	gint ref;
+};
+
+static void
+lua_task_received_cache_dtor (gpointer p)
+{
+	struct lua_task_received_cache *cache = p;
+
+	luaL_unref (cache->L, LUA_REGISTRYINDEX, cache->ref);
+}
+
+static const gchar *
+lua_task_received_proto (enum rspamd_received_type type)
+{
+	switch (type) {
+	case RSPAMD_RECEIVED_SMTP:
+		return "smtp";
+	case RSPAMD_RECEIVED_ESMTP:
+		return "esmtp";
+	case RSPAMD_RECEIVED_LMTP:
+		return "lmtp";
+	case RSPAMD_RECEIVED_IMAP:
+		return "imap";
+	case RSPAMD_RECEIVED_LOCAL:
+		return "local";
+	case RSPAMD_RECEIVED_HTTP:
+		return "http";
+	default:
+		break;
+	}
+
+	return "unknown";
+}
+
 static gint
 lua_task_get_received_headers (lua_State * L)
 {
 	struct rspamd_task *task = lua_check_task (L, 1);
 	struct received_header *rh;
+	struct lua_task_received_cache *cache;
 	guint i, k = 1;
 
 	if (task) {
+		cache = rspamd_mempool_get_variable (task->task_pool,
+				RSPAMD_RECEIVED_LUA_VAR);
+
+		if (cache != NULL) {
+			/* Table has been already built for this task */
+			lua_rawgeti (L, LUA_REGISTRYINDEX, cache->ref);
+
+			return 1;
+		}
+
 		lua_newtable (L);
 
 		for (i = 0; i < task->received->len; i ++) {
@@ -1328,8 +1378,27 @@ lua_task_get_received_headers (lua_State * L)
 			rspamd_lua_ip_push_fromstring (L, rh->real_ip);
 			lua_settable (L, -3);
 			rspamd_lua_table_set (L, "by_hostname", rh->by_hostname);
+			rspamd_lua_table_set (L, "proto",
+					lua_task_received_proto (rh->type));
+			lua_pushstring (L, "timestamp");
+			lua_pushnumber (L, rh->timestamp);
+			lua_settable (L, -3);
+			lua_pushstring (L, "tls");
+			lua_pushboolean (L, rh->flags & RSPAMD_RECEIVED_FLAG_SSL);
+			lua_settable (L, -3);
+			lua_pushstring (L, "authenticated");
+			lua_pushboolean (L, rh->flags & RSPAMD_RECEIVED_FLAG_AUTHENTICATED);
+			lua_settable (L, -3);
 			lua_rawseti (L, -2, k ++);
 		}
+
+		/* Registry is shared between the main state and its coroutines */
+		cache = rspamd_mempool_alloc (task->task_pool, sizeof (*cache));
+		cache->L = task->cfg->lua_state;
+		lua_pushvalue (L, -1);
+		cache->ref = luaL_ref (L, LUA_REGISTRYINDEX);
+		rspamd_mempool_set_variable (task->task_pool, RSPAMD_RECEIVED_LUA_VAR,
+				cache, lua_task_received_cache_dtor);
 	}
 	else {
 		return luaL_error (L, "invalid arguments");
@@ -1849,7 +1918,7 @@ lua_push_symbol_result (lua_State *L,
 	gint j;
 	GList *opt;
 
-	metric_res = g_hash_table_lookup (task->results, metric->name);
+	metric_res = rspamd_mempool_hash_lookup (task->results, metric->name);
 	if (metric_res) {
 		if ((s = g_hash_table_lookup (metric_res->symbols, symbol)) != NULL) {
 			j = 1;
@@ -1952,7 +2021,7 @@ lua_task_has_symbol (lua_State *L)
 	symbol = luaL_checkstring (L, 2);
 
 	if (task && symbol) {
-		mres = g_hash_table_lookup (task->results, DEFAULT_METRIC);
+		mres = rspamd_mempool_hash_lookup (task->results, DEFAULT_METRIC);
 
 		if (mres) {
 			found = g_hash_table_lookup (mres->symbols, symbol) != NULL;
@@ -2439,7 +2508,7 @@ lua_task_get_metric_score (lua_State *L)
 
 	if (task && metric_name) {
 		if ((metric_res =
-			g_hash_table_lookup (task->results, metric_name)) != NULL) {
+			rspamd_mempool_hash_lookup (task->results, metric_name)) != NULL) {
 			lua_newtable (L);
 			lua_pushnumber (L, metric_res->score);
 			lua_rawseti (L, -2, 1);
@@ -2477,7 +2546,7 @@ lua_task_get_metric_action (lua_State *L)
 
 	if (task && metric_name) {
 		if ((metric_res =
-			g_hash_table_lookup (task->results, metric_name)) != NULL) {
+			rspamd_mempool_hash_lookup (task->results, metric_name)) != NULL) {
 			action = rspamd_check_action_metric (task, metric_res->score,
 					NULL,
 					metric_res->metric);
@@ -2546,7 +2615,7 @@ lua_image_get_size (lua_State *L)
 	struct rspamd_image *img = lua_check_image (L);
 
 	if (img != NULL) {
-		lua_pushinteger (L, img->data->len);
+		lua_pushinteger (L, rspamd_mime_part_get_content (img->part)->len);
 	}
 	else {
 		return luaL_error (L, "invalid arguments");
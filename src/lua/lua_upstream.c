@@ -133,8 +133,9 @@ lua_upstream_fail (lua_State *L)
 }
 
 /***
- * @method upstream:ok()
+ * @method upstream:ok([latency])
  * Indicates upstream success. Resets errors count for an upstream.
+ * @param {number} latency optional time of the request in seconds used by `latency` rotation
  */
 static gint
 lua_upstream_ok (lua_State *L)
@@ -142,6 +143,10 @@ lua_upstream_ok (lua_State *L)
 	struct upstream *up = lua_check_upstream (L);
 
 	if (up) {
+		if (lua_type (L, 2) == LUA_TNUMBER) {
+			rspamd_upstream_latency (up, lua_tonumber (L, 2));
+		}
+
 		rspamd_upstream_ok (up);
 	}
 
@@ -20,6 +20,7 @@
 #include "cfg_rcl.h"
 #include "tokenizers/tokenizers.h"
 #include "libserver/url.h"
+#include "cryptobox.h"
 #include <math.h>
 #include <glob.h>
 
@@ -413,8 +414,6 @@ lua_util_decode_base64 (lua_State *L)
 	const gchar *s = NULL;
 	gsize inlen, outlen;
 	gboolean zero_copy = FALSE, grab_own = FALSE;
-	gint state = 0;
-	guint save = 0;
 
 	if (lua_type (L, 1) == LUA_TSTRING) {
 		s = luaL_checklstring (L, 1, &inlen);
@@ -436,7 +435,8 @@ lua_util_decode_base64 (lua_State *L)
 	if (s != NULL) {
 		if (zero_copy) {
 			/* Decode in place */
-			outlen = g_base64_decode_step (s, inlen, (guchar *)s, &state, &save);
+			outlen = inlen;
+			rspamd_cryptobox_base64_decode (s, inlen, (guchar *)s, &outlen);
 			t = lua_newuserdata (L, sizeof (*t));
 			rspamd_lua_setclass (L, "rspamd{text}", -1);
 			t->start = s;
@@ -448,8 +448,9 @@ lua_util_decode_base64 (lua_State *L)
 			rspamd_lua_setclass (L, "rspamd{text}", -1);
 			t->len = (inlen / 4) * 3 + 3;
 			t->start = g_malloc (t->len);
-			outlen = g_base64_decode_step (s, inlen, (guchar *)t->start,
-					&state, &save);
+			outlen = t->len;
+			rspamd_cryptobox_base64_decode (s, inlen, (guchar *)t->start,
+					&outlen);
 			t->len = outlen;
 			t->own = TRUE;
 		}
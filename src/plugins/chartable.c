@@ -118,87 +118,26 @@ chartable_module_reconfig (struct rspamd_config *cfg)
 }
 
 static gboolean
-check_part (struct mime_text_part *part, gboolean raw_mode)
+check_part (struct mime_text_part *part)
 {
-	guchar *p, *p1;
-	gunichar c, t;
-	GUnicodeScript scc, sct;
-	guint32 mark = 0, total = 0, max = 0, i;
-	guint32 remain = part->content->len;
-	guint32 scripts[G_UNICODE_SCRIPT_NKO];
-	GUnicodeScript sel = 0;
-
-	p = part->content->data;
-
-	if (IS_PART_UTF (part) || raw_mode) {
-		while (remain > 1) {
-			if ((g_ascii_isalpha (*p) &&
-				(*(p + 1) & 0x80)) ||
-				((*p & 0x80) && g_ascii_isalpha (*(p + 1)))) {
-				mark++;
-				total++;
-			}
-			/* Current and next symbols are of one class */
-			else if (((*p & 0x80) &&
-				(*(p + 1) & 0x80)) ||
-				(g_ascii_isalpha (*p) && g_ascii_isalpha (*(p + 1)))) {
-				total++;
-			}
-			p++;
-			remain--;
-		}
-	}
-	else {
-		memset (&scripts, 0, sizeof (scripts));
-		while (remain > 0) {
-			c = g_utf8_get_char_validated (p, remain);
-			if (c == (gunichar) - 2 || c == (gunichar) - 1) {
-				/* Invalid characters detected, stop processing */
-				return FALSE;
-			}
-
-			scc = g_unichar_get_script (c);
-			if (scc < (gint)G_N_ELEMENTS (scripts)) {
-				scripts[scc]++;
-			}
-			p1 = g_utf8_next_char (p);
-			remain -= p1 - p;
-			p = p1;
-
-			if (remain > 0) {
-				t = g_utf8_get_char_validated (p, remain);
-				if (t == (gunichar) - 2 || t == (gunichar) - 1) {
-					/* Invalid characters detected, stop processing */
-					return FALSE;
-				}
-				sct = g_unichar_get_script (t);
-				if (g_unichar_isalpha (c) && g_unichar_isalpha (t)) {
-					/* We have two unicode alphanumeric characters, so we can check its script */
-					if (sct != scc) {
-						mark++;
-					}
-					total++;
-				}
-				p1 = g_utf8_next_char (p);
-				remain -= p1 - p;
-				p = p1;
-			}
-		}
-		/* Detect the mostly charset of this part */
-		for (i = 0; i < G_N_ELEMENTS (scripts); i++) {
-			if (scripts[i] > max) {
-				max = scripts[i];
-				sel = i;
-			}
-		}
-		part->script = sel;
+	const struct rspamd_mime_text_stat *st = &part->text_stat;
+
+	/*
+	 * Statistics are collected when a part is processed: for utf8 parts it
+	 * counts pairs of alphabetic characters of different scripts, for raw
+	 * parts it counts 7 bit letters next to 8 bit characters
+	 */
+	if (IS_PART_UTF (part) && st->invalid_utf) {
+		/* Invalid characters detected, do not check */
+		return FALSE;
 	}
 
-	if (total == 0) {
-		return 0;
+	if (st->alpha_pairs == 0) {
+		return FALSE;
 	}
 
-	return ((double)mark / (double)total) > chartable_module_ctx->threshold;
+	return ((double)st->script_changes / (double)st->alpha_pairs) >
+			chartable_module_ctx->threshold;
 }
 
 static void
@@ -210,7 +149,7 @@ chartable_symbol_callback (struct rspamd_task *task, void *unused)
 	for (i = 0; i < task->text_parts->len; i ++) {
 		part = g_ptr_array_index (task->text_parts, i);
 
-		if (!IS_PART_EMPTY (part) && check_part (part, task->cfg->raw_mode)) {
+		if (!IS_PART_EMPTY (part) && check_part (part)) {
 			rspamd_task_insert_result (task, chartable_module_ctx->symbol, 1, NULL);
 		}
 	}
@@ -104,6 +104,7 @@ struct fuzzy_client_session {
 	struct event ev;
 	struct event timev;
 	struct timeval tv;
+	gdouble req_token;
 	gint state;
 	gint fd;
 	guint retransmits;
@@ -889,6 +890,9 @@ fuzzy_io_fin (void *ud)
 {
 	struct fuzzy_client_session *session = ud;
 
+	/* Request has not been finished by io callbacks */
+	rspamd_upstream_finish (session->server, &session->req_token, FALSE);
+
 	if (session->commands) {
 		g_ptr_array_free (session->commands, TRUE);
 	}
@@ -904,19 +908,20 @@ fuzzy_preprocess_words (struct mime_text_part *part, rspamd_mempool_t *pool)
 	return part->normalized_words;
 }
 
+/*
+ * Fills encrypted header of a command, payload itself is encrypted by
+ * fuzzy_encrypt_commands for all commands at once
+ */
 static void
-fuzzy_encrypt_cmd (struct fuzzy_rule *rule,
-		struct rspamd_fuzzy_encrypted_req_hdr *hdr,
-		guchar *data, gsize datalen)
+fuzzy_init_encrypted_hdr (struct fuzzy_rule *rule,
+		struct rspamd_fuzzy_encrypted_req_hdr *hdr)
 {
 	const guchar *pk;
 	guint pklen;
 
 	g_assert (hdr != NULL);
-	g_assert (data != NULL);
 	g_assert (rule != NULL);
 
-	/* Encrypt data */
 	memcpy (hdr->magic,
 			fuzzy_encrypted_magic,
 			sizeof (hdr->magic));
@@ -926,11 +931,39 @@ fuzzy_encrypt_cmd (struct fuzzy_rule *rule,
 	memcpy (hdr->pubkey, pk, MIN (pklen, sizeof (hdr->pubkey)));
 	pk = rspamd_pubkey_get_pk (rule->peer_key, &pklen);
 	memcpy (hdr->key_id, pk, MIN (sizeof (hdr->key_id), pklen));
+}
+
+/*
+ * Encrypts payloads of all commands generated for a rule in a single batch
+ */
+static void
+fuzzy_encrypt_commands (struct fuzzy_rule *rule, GPtrArray *commands)
+{
+	struct rspamd_cryptobox_batch_elt *elts;
+	struct rspamd_fuzzy_encrypted_req_hdr *hdr;
+	struct fuzzy_cmd_io *io;
+	const guchar *nm;
+	guint i;
+
 	rspamd_keypair_cache_process (fuzzy_module_ctx->keypairs_cache,
 			rule->local_key, rule->peer_key);
-	rspamd_cryptobox_encrypt_nm_inplace (data, datalen,
-			hdr->nonce, rspamd_pubkey_get_nm (rule->peer_key), hdr->mac,
+	nm = rspamd_pubkey_get_nm (rule->peer_key);
+	elts = g_new0 (struct rspamd_cryptobox_batch_elt, commands->len);
+
+	for (i = 0; i < commands->len; i ++) {
+		io = g_ptr_array_index (commands, i);
+		/* Both encrypted commands start with the header */
+		hdr = io->io.iov_base;
+		elts[i].data = (guchar *)io->io.iov_base + sizeof (*hdr);
+		elts[i].len = io->io.iov_len - sizeof (*hdr);
+		elts[i].nonce = hdr->nonce;
+		elts[i].nm = nm;
+		elts[i].mac = hdr->mac;
+	}
+
+	rspamd_cryptobox_encrypt_nm_batch (elts, commands->len,
 			rspamd_pubkey_alg (rule->peer_key));
+	g_free (elts);
 }
 
 static struct fuzzy_cmd_io *
@@ -945,12 +978,10 @@ fuzzy_cmd_from_task_meta (struct fuzzy_rule *rule,
 	struct rspamd_fuzzy_encrypted_cmd *enccmd;
 	struct fuzzy_cmd_io *io;
 	rspamd_cryptobox_hash_state_t st;
-
-	GHashTableIter it;
-	gpointer k, v;
 	struct rspamd_url *u;
 	struct raw_header *rh;
 	GList *cur;
+	guint i;
 
 	if (rule->peer_key) {
 		enccmd = rspamd_mempool_alloc0 (pool, sizeof (*enccmd));
@@ -971,10 +1002,8 @@ fuzzy_cmd_from_task_meta (struct fuzzy_rule *rule,
 	/* Use blake2b for digest */
 	rspamd_cryptobox_hash_init (&st, rule->hash_key->str, rule->hash_key->len);
 	/* Hash URL's */
-	g_hash_table_iter_init (&it, task->urls);
-
-	while (g_hash_table_iter_next (&it, &k, &v)) {
-		u = v;
+	for (i = 0; i < rspamd_url_set_size (task->urls); i ++) {
+		u = rspamd_url_set_index (task->urls, i);
 		if (u->hostlen > 0) {
 			rspamd_cryptobox_hash_update (&st, u->host, u->hostlen);
 		}
@@ -987,7 +1016,7 @@ fuzzy_cmd_from_task_meta (struct fuzzy_rule *rule,
 	cur = rule->fuzzy_headers;
 
 	while (cur) {
-		rh = g_hash_table_lookup (task->raw_headers, cur->data);
+		rh = rspamd_mime_headers_lookup (task->raw_headers, cur->data);
 
 		while (rh) {
 			if (rh->decoded) {
@@ -1007,7 +1036,7 @@ fuzzy_cmd_from_task_meta (struct fuzzy_rule *rule,
 	io->tag = cmd->tag;
 
 	if (rule->peer_key) {
-		fuzzy_encrypt_cmd (rule, &enccmd->hdr, (guchar *)cmd, sizeof (*cmd));
+		fuzzy_init_encrypted_hdr (rule, &enccmd->hdr);
 		io->io.iov_base = enccmd;
 		io->io.iov_len = sizeof (*enccmd);
 	}
@@ -1083,8 +1112,7 @@ fuzzy_cmd_from_text_part (struct fuzzy_rule *rule,
 	io->flags = 0;
 
 	if (rule->peer_key) {
-		/* Encrypt data */
-		fuzzy_encrypt_cmd (rule, &encshcmd->hdr, (guchar *) shcmd, sizeof (*shcmd));
+		fuzzy_init_encrypted_hdr (rule, &encshcmd->hdr);
 		io->io.iov_base = encshcmd;
 		io->io.iov_len = sizeof (*encshcmd);
 	}
@@ -1137,7 +1165,7 @@ fuzzy_cmd_from_data_part (struct fuzzy_rule *rule,
 
 	if (rule->peer_key) {
 		g_assert (enccmd != NULL);
-		fuzzy_encrypt_cmd (rule, &enccmd->hdr, (guchar *) cmd, sizeof (*cmd));
+		fuzzy_init_encrypted_hdr (rule, &enccmd->hdr);
 		io->io.iov_base = enccmd;
 		io->io.iov_len = sizeof (*enccmd);
 	}
@@ -1419,11 +1447,13 @@ fuzzy_check_io_callback (gint fd, short what, void *arg)
 			session->state == 1 ? "read" : "write",
 			errno,
 			strerror (errno));
+		rspamd_upstream_finish (session->server, &session->req_token, FALSE);
 		rspamd_upstream_fail (session->server);
 		rspamd_session_remove_event (session->task->s, fuzzy_io_fin, session);
 	}
 	else {
 		/* Read something from network */
+		rspamd_upstream_finish (session->server, &session->req_token, TRUE);
 		rspamd_upstream_ok (session->server);
 		guint nreplied = 0;
 
@@ -1461,6 +1491,7 @@ fuzzy_check_timer_callback (gint fd, short what, void *arg)
 		msg_err_task ("got IO timeout with server %s, after %d retransmits",
 				rspamd_upstream_name (session->server),
 				session->retransmits);
+		rspamd_upstream_finish (session->server, &session->req_token, FALSE);
 		rspamd_upstream_fail (session->server);
 		rspamd_session_remove_event (session->task->s, fuzzy_io_fin, session);
 	}
@@ -1697,6 +1728,7 @@ fuzzy_generate_commands (struct rspamd_task *task, struct fuzzy_rule *rule,
 	struct mime_part *mime_part;
 	struct rspamd_image *image;
 	struct fuzzy_cmd_io *io;
+	GByteArray *data;
 	guint i;
 	GPtrArray *res;
 
@@ -1746,22 +1778,25 @@ fuzzy_generate_commands (struct rspamd_task *task, struct fuzzy_rule *rule,
 	cur = task->images;
 	while (cur) {
 		image = cur->data;
-		if (image->data->len > 0) {
-			if (fuzzy_module_ctx->min_height <= 0 || image->height >=
-				fuzzy_module_ctx->min_height) {
-				if (fuzzy_module_ctx->min_width <= 0 || image->width >=
-					fuzzy_module_ctx->min_width) {
+		if (fuzzy_module_ctx->min_height <= 0 || image->height >=
+			fuzzy_module_ctx->min_height) {
+			if (fuzzy_module_ctx->min_width <= 0 || image->width >=
+				fuzzy_module_ctx->min_width) {
+				/* Image data is decoded here if it has not been decoded yet */
+				data = rspamd_mime_part_get_content (image->part);
+
+				if (data->len > 0) {
 					if (c == FUZZY_CHECK) {
 						io = fuzzy_cmd_from_data_part (rule, c, flag, value,
 								task->task_pool,
-								image->data->data, image->data->len);
+								data->data, data->len);
 						if (io) {
 							g_ptr_array_add (res, io);
 						}
 					}
 					io = fuzzy_cmd_from_data_part (rule, c, flag, value,
 							task->task_pool,
-							image->data->data, image->data->len);
+							data->data, data->len);
 					if (io) {
 						g_ptr_array_add (res, io);
 					}
@@ -1775,13 +1810,18 @@ fuzzy_generate_commands (struct rspamd_task *task, struct fuzzy_rule *rule,
 	for (i = 0; i < task->parts->len; i ++) {
 		mime_part = g_ptr_array_index (task->parts, i);
 
-		if (mime_part->content->len > 0 &&
-			fuzzy_check_content_type (rule, mime_part->type)) {
-			if (fuzzy_module_ctx->min_bytes <= 0 || mime_part->content->len >=
+		if (!fuzzy_check_content_type (rule, mime_part->type)) {
+			continue;
+		}
+
+		data = rspamd_mime_part_get_content (mime_part);
+
+		if (data->len > 0) {
+			if (fuzzy_module_ctx->min_bytes <= 0 || data->len >=
 				fuzzy_module_ctx->min_bytes) {
 				io = fuzzy_cmd_from_data_part (rule, c, flag, value,
 						task->task_pool,
-						mime_part->content->data, mime_part->content->len);
+						data->data, data->len);
 				if (io) {
 					g_ptr_array_add (res, io);
 				}
@@ -1803,6 +1843,10 @@ fuzzy_generate_commands (struct rspamd_task *task, struct fuzzy_rule *rule,
 		return NULL;
 	}
 
+	if (rule->peer_key) {
+		fuzzy_encrypt_commands (rule, res);
+	}
+
 	return res;
 }
 
@@ -1840,6 +1884,7 @@ register_fuzzy_client_call (struct rspamd_task *task,
 			session->fd = sock;
 			session->server = selected;
 			session->rule = rule;
+			session->req_token = rspamd_upstream_start (selected);
 
 			event_set (&session->ev, sock, EV_WRITE, fuzzy_check_io_callback,
 					session);
@@ -373,7 +373,8 @@ spf_check_element (struct spf_addr *addr, struct rspamd_task *task)
 				spf_symbol,
 				1,
 				opts);
-		task->messages = g_list_prepend (task->messages, (gpointer)spf_message);
+		task->messages = rspamd_mempool_glist_prepend (task->task_pool,
+				task->messages, (gpointer)spf_message);
 		return TRUE;
 	}
 
@@ -1224,6 +1224,8 @@ free_redirector_session (void *ud)
 {
 	struct redirector_param *param = (struct redirector_param *)ud;
 
+	/* Request has not been finished by http callbacks */
+	rspamd_upstream_finish (param->redirector, &param->req_token, FALSE);
 	rspamd_http_connection_unref (param->conn);
 	close (param->sock);
 }
@@ -1239,6 +1241,7 @@ surbl_redirector_error (struct rspamd_http_connection *conn,
 	msg_err_task ("connection with http server %s terminated incorrectly: %e",
 		rspamd_inet_address_to_string (rspamd_upstream_addr (param->redirector)),
 		err);
+	rspamd_upstream_finish (param->redirector, &param->req_token, FALSE);
 	rspamd_upstream_fail (param->redirector);
 	rspamd_session_remove_event (param->task->s, free_redirector_session,
 			param);
@@ -1292,6 +1295,7 @@ surbl_redirector_finish (struct rspamd_http_connection *conn,
 				param->url->urllen, param->url->string);
 	}
 
+	rspamd_upstream_finish (param->redirector, &param->req_token, TRUE);
 	rspamd_upstream_ok (param->redirector);
 	rspamd_session_remove_event (param->task->s, free_redirector_session,
 			param);
@@ -1341,6 +1345,7 @@ register_redirector_call (struct rspamd_url *url, struct rspamd_task *task,
 	param->suffix = suffix;
 	param->redirector = selected;
 	param->tree = tree;
+	param->req_token = rspamd_upstream_start (selected);
 	timeout = rspamd_mempool_alloc (task->task_pool, sizeof (struct timeval));
 	double_to_tv (surbl_module_ctx->read_timeout, timeout);
 
@@ -1373,11 +1378,9 @@ surbl_redirector_trie_cb (int strnum, int textpos, void *context)
 }
 
 static void
-surbl_tree_url_callback (gpointer key, gpointer value, void *data)
+surbl_tree_url_callback (struct rspamd_url *url, struct redirector_param *param)
 {
-	struct redirector_param *param = data;
 	struct rspamd_task *task;
-	struct rspamd_url *url = value;
 	rspamd_regexp_t *re;
 	gint idx = 0, state = 0;
 	ac_trie_pat_t *pat;
@@ -1457,7 +1460,10 @@ surbl_test_url (struct rspamd_task *task, void *user_data)
 	rspamd_mempool_add_destructor (task->task_pool,
 		(rspamd_mempool_destruct_t)g_hash_table_unref,
 		param.tree);
-	g_hash_table_foreach (task->urls, surbl_tree_url_callback, &param);
+
+	for (i = 0; i < rspamd_url_set_size (task->urls); i ++) {
+		surbl_tree_url_callback (rspamd_url_set_index (task->urls, i), &param);
+	}
 
 	/* We also need to check and process img URLs */
 	if (suffix->options & SURBL_OPTION_CHECKIMAGES) {
@@ -1474,7 +1480,7 @@ surbl_test_url (struct rspamd_task *task, void *user_data)
 								img->src, strlen (img->src), NULL);
 
 						if (url) {
-							surbl_tree_url_callback (url, url, &param);
+							surbl_tree_url_callback (url, &param);
 							msg_debug_task ("checked image url %s over %s",
 									img->src, suffix->suffix);
 						}
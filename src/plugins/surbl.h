@@ -62,6 +62,7 @@ struct redirector_param {
 	struct rspamd_task *task;
 	struct upstream *redirector;
 	struct rspamd_http_connection *conn;
+	gdouble req_token;
 	gint sock;
 	GHashTable *tree;
 	struct suffix_item *suffix;
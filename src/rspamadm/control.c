@@ -43,6 +43,7 @@ struct rspamadm_command control_command = {
 struct rspamadm_control_cbdata {
 	lua_State *L;
 	const gchar *path;
+	const gchar *key;
 	gint argc;
 	gchar **argv;
 };
@@ -76,6 +77,7 @@ rspamadm_control_help (gboolean full_help)
 				"--help: shows available options and commands\n\n"
 				"Supported commands:\n"
 				"stat - show statistics\n"
+				"mempool - show memory pools statistics\n"
 				"reload - reload workers dynamic data\n"
 				"reresolve - resolve upstreams addresses\n";
 	}
@@ -99,6 +101,7 @@ rspamd_control_finish_handler (struct rspamd_http_connection *conn,
 {
 	struct ucl_parser *parser;
 	ucl_object_t *obj;
+	const ucl_object_t *elt;
 	rspamd_fstring_t *out;
 	struct rspamadm_control_cbdata *cbdata = conn->ud;
 
@@ -113,6 +116,25 @@ rspamd_control_finish_handler (struct rspamd_http_connection *conn,
 		obj = ucl_parser_get_object (parser);
 		out = rspamd_fstring_new ();
 
+		if (cbdata->key) {
+			/* Output merely the requested part of reply */
+			elt = ucl_object_lookup (obj, cbdata->key);
+
+			if (elt == NULL) {
+				rspamd_fprintf (stderr, "no %s in server's reply\n",
+						cbdata->key);
+				rspamd_fstring_free (out);
+				ucl_object_unref (obj);
+				ucl_parser_free (parser);
+
+				return 0;
+			}
+
+			elt = ucl_object_ref (elt);
+			ucl_object_unref (obj);
+			obj = (ucl_object_t *)elt;
+		}
+
 		if (json) {
 			rspamd_ucl_emit_fstring (obj, UCL_EMIT_JSON, &out);
 		}
@@ -153,7 +175,7 @@ rspamadm_control (gint argc, gchar **argv)
 	GOptionContext *context;
 	GError *error = NULL;
 	struct event_base *ev_base;
-	const gchar *cmd, *path = NULL;
+	const gchar *cmd, *path = NULL, *key = NULL;
 	struct rspamd_http_connection *conn;
 	struct rspamd_http_message *msg;
 	rspamd_inet_addr_t *addr;
@@ -188,6 +210,10 @@ rspamadm_control (gint argc, gchar **argv)
 	if (g_ascii_strcasecmp (cmd, "stat") == 0) {
 		path = "/stat";
 	}
+	else if (g_ascii_strcasecmp (cmd, "mempool") == 0) {
+		path = "/stat";
+		key = "mempool";
+	}
 	else if (g_ascii_strcasecmp (cmd, "reload") == 0) {
 		path = "/reload";
 	}
@@ -237,6 +263,7 @@ rspamadm_control (gint argc, gchar **argv)
 	cbdata.argc = argc;
 	cbdata.argv = argv;
 	cbdata.path = path;
+	cbdata.key = key;
 
 	rspamd_http_connection_write_message (conn, msg, NULL, NULL, &cbdata, sock,
 			&tv, ev_base);
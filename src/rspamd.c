@@ -834,6 +834,7 @@ rspamd_cld_handler (gint signo, short what, gpointer arg)
 
 		g_hash_table_remove (rspamd_main->workers, GSIZE_TO_POINTER (
 				wrk));
+		rspamd_mempool_slots_release (rspamd_main->stat_slots, wrk);
 
 		if (WIFEXITED (res) && WEXITSTATUS (res) == 0) {
 			/* Normal worker termination, do not fork one more */
@@ -980,8 +981,12 @@ main (gint argc, gchar **argv, gchar **env)
 
 	rspamd_main->server_pool = rspamd_mempool_new (rspamd_mempool_suggest_size (),
 			"main");
-	rspamd_main->stat = rspamd_mempool_alloc0_shared (rspamd_main->server_pool,
-			sizeof (struct rspamd_stat));
+	rspamd_main->stat_slots = rspamd_mempool_slots_new (
+			rspamd_main->server_pool,
+			sizeof (struct rspamd_stat),
+			RSPAMD_STAT_SLOTS);
+	/* Workers claim their own slots after fork */
+	rspamd_main->stat = rspamd_mempool_slot (rspamd_main->stat_slots, 0);
 	rspamd_main->cfg = rspamd_config_new ();
 	rspamd_main->spairs = g_hash_table_new_full (rspamd_spair_hash,
 			rspamd_spair_equal, g_free, rspamd_spair_close);
@@ -1125,12 +1130,13 @@ main (gint argc, gchar **argv, gchar **env)
 	msg_info_main ("cpu features: %s",
 			rspamd_main->cfg->libs_ctx->crypto_ctx->cpu_extensions);
 	msg_info_main ("cryptobox configuration: curve25519(%s), "
-			"chacha20(%s), poly1305(%s), siphash(%s), blake2(%s)",
+			"chacha20(%s), poly1305(%s), siphash(%s), blake2(%s), base64(%s)",
 			rspamd_main->cfg->libs_ctx->crypto_ctx->curve25519_impl,
 			rspamd_main->cfg->libs_ctx->crypto_ctx->chacha20_impl,
 			rspamd_main->cfg->libs_ctx->crypto_ctx->poly1305_impl,
 			rspamd_main->cfg->libs_ctx->crypto_ctx->siphash_impl,
-			rspamd_main->cfg->libs_ctx->crypto_ctx->blake2_impl);
+			rspamd_main->cfg->libs_ctx->crypto_ctx->blake2_impl,
+			rspamd_main->cfg->libs_ctx->crypto_ctx->base64_impl);
 
 	/* Daemonize */
 	if (!no_fork && daemon (0, 0) == -1) {
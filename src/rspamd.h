@@ -205,6 +205,12 @@ struct rspamd_cryptobox_library_ctx;
 /**
  * Server statistics
  */
+/* Number of per process statistics slots */
+#define RSPAMD_STAT_SLOTS 256
+
+/**
+ * Server statistics, every process updates its own copy in shared memory
+ */
 struct rspamd_stat {
 	guint messages_scanned;                             /**< total number of messages scanned				*/
 	guint actions_stat[METRIC_ACTION_NOACTION + 1];     /**< statistic for each action						*/
@@ -223,6 +229,7 @@ struct rspamd_main {
 	rspamd_pidfh_t *pfh;                                        /**< struct pidfh for pidfile						*/
 	GQuark type;                                                /**< process type									*/
 	struct rspamd_stat *stat;                                   /**< pointer to statistics							*/
+	rspamd_mempool_slots_t *stat_slots;                         /**< statistics of all processes					*/
 
 	rspamd_mempool_t *server_pool;                              /**< server's memory pool							*/
 	GHashTable *workers;                                        /**< workers pool indexed by pid                    */
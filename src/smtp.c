@@ -698,7 +698,7 @@ accept_socket (gint fd, short what, void *arg)
 	session->session_time = time (NULL);
 	session->resolver = ctx->resolver;
 	session->ev_base = ctx->ev_base;
-	worker->srv->stat->connections_count++;
+	rspamd_atomic_add (&worker->srv->stat->connections_count, 1);
 
 	/* Resolve client's addr */
 	/* Set up async session */
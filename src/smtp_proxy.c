@@ -928,7 +928,7 @@ accept_socket (gint fd, short what, void *arg)
 	session->upstream_sock = -1;
 	session->ptr_str = rdns_generate_ptr_from_str (rspamd_inet_address_to_string (
 				addr));
-	worker->srv->stat->connections_count++;
+	rspamd_atomic_add (&worker->srv->stat->connections_count, 1);
 
 	/* Resolve client's addr */
 	/* Set up async session */
@@ -38,6 +38,10 @@
 #define DEFAULT_WORKER_IO_TIMEOUT 60000
 /* Timeout for task processing */
 #define DEFAULT_TASK_TIMEOUT 8.0
+/* Do not search for the end of headers in streaming mode after this size */
+#define STREAMING_MAX_HEADERS_SIZE 65536
+/* Maximum number of DKIM signatures whose keys are prefetched */
+#define STREAMING_MAX_DKIM_PREFETCH 4
 
 gpointer init_worker (struct rspamd_config *cfg);
 void start_worker (struct rspamd_worker *worker);
@@ -97,6 +101,8 @@ struct rspamd_worker_ctx {
 	struct rspamd_cryptobox_keypair *key;
 	/* Keys cache */
 	struct rspamd_keypair_cache *keys_cache;
+	/* Start DNS lookups as soon as message headers are received */
+	gboolean streaming;
 	/* Configuration */
 	struct rspamd_config *cfg;
 };
@@ -170,12 +176,11 @@ rspamd_worker_guard_handler (gint fd, short what, void *data)
 	}
 }
 
-static gint
-rspamd_worker_body_handler (struct rspamd_http_connection *conn,
+static void
+rspamd_worker_start_task (struct rspamd_task *task,
 	struct rspamd_http_message *msg,
 	const gchar *chunk, gsize len)
 {
-	struct rspamd_task *task = (struct rspamd_task *) conn->ud;
 	struct rspamd_worker_ctx *ctx;
 	struct timeval task_tv;
 	struct event *guard_ev;
@@ -216,6 +221,224 @@ rspamd_worker_body_handler (struct rspamd_http_connection *conn,
 	task->guard_ev = guard_ev;
 
 	rspamd_task_process (task, RSPAMD_TASK_PROCESS_ALL);
+}
+
+static void
+rspamd_worker_prefetch_cb (struct rdns_reply *reply, gpointer ud)
+{
+	/* We merely warm the cache of the recursive resolver */
+}
+
+static void
+rspamd_worker_prefetch (struct rspamd_task *task, enum rdns_request_type type,
+		const gchar *name)
+{
+	msg_debug_task ("prefetch %s", name);
+	/* Not bound to the task session as the task might finish earlier */
+	make_dns_request (task->resolver, NULL, NULL, rspamd_worker_prefetch_cb,
+			NULL, type, name);
+}
+
+/*
+ * Envelope data is passed in HTTP headers, so we can request SPF record
+ * for the sender's domain and PTR for the client's address
+ */
+static void
+rspamd_worker_prefetch_envelope (struct rspamd_task *task,
+		struct rspamd_http_message *msg)
+{
+	const rspamd_ftok_t *tok;
+	const gchar *p, *end, *dom = NULL;
+	gchar *name;
+
+	tok = rspamd_http_message_find_header (msg, "From");
+
+	if (tok != NULL) {
+		p = tok->begin;
+		end = tok->begin + tok->len;
+
+		while (p < end) {
+			if (*p == '@') {
+				dom = p + 1;
+			}
+			else if (dom != NULL && (*p == '>' || g_ascii_isspace (*p))) {
+				break;
+			}
+
+			p ++;
+		}
+
+		if (dom != NULL && p > dom) {
+			name = rspamd_mempool_alloc (task->task_pool, p - dom + 1);
+			rspamd_strlcpy (name, dom, p - dom + 1);
+			rspamd_worker_prefetch (task, RDNS_REQUEST_TXT, name);
+		}
+	}
+
+	if (rspamd_http_message_find_header (msg, "Hostname") == NULL) {
+		tok = rspamd_http_message_find_header (msg, "IP");
+
+		if (tok != NULL && tok->len < INET6_ADDRSTRLEN) {
+			gchar ipbuf[INET6_ADDRSTRLEN + 1];
+
+			rspamd_strlcpy (ipbuf, tok->begin, tok->len + 1);
+			name = rdns_generate_ptr_from_str (ipbuf);
+
+			if (name != NULL) {
+				rspamd_worker_prefetch (task, RDNS_REQUEST_PTR, name);
+				free (name);
+			}
+		}
+	}
+}
+
+/*
+ * Extracts the value of a DKIM tag from the signature header
+ */
+static gboolean
+rspamd_worker_dkim_tag (const gchar *begin, const gchar *end, gchar tag,
+		rspamd_ftok_t *res)
+{
+	const gchar *p = begin, *c;
+
+	while (p < end) {
+		/* Skip spaces and folding */
+		while (p < end && g_ascii_isspace (*p)) {
+			p ++;
+		}
+
+		c = p;
+
+		while (p < end && *p != ';') {
+			p ++;
+		}
+
+		if (p - c > 2 && c[0] == tag && c[1] == '=') {
+			c += 2;
+
+			while (c < p && g_ascii_isspace (*c)) {
+				c ++;
+			}
+
+			res->begin = c;
+
+			while (c < p && !g_ascii_isspace (*c)) {
+				c ++;
+			}
+
+			res->len = c - res->begin;
+
+			return res->len > 0;
+		}
+
+		p ++;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Requests DKIM keys for all DKIM signatures found in the raw headers
+ */
+static void
+rspamd_worker_prefetch_dkim (struct rspamd_task *task, const gchar *begin,
+		gsize len)
+{
+	static const gchar dkim_hdr[] = "DKIM-Signature:";
+	const gchar *p = begin, *end = begin + len, *hend;
+	goffset pos;
+	rspamd_ftok_t dom, sel;
+	gchar *name;
+	guint nsigs = 0;
+
+	while (p < end && nsigs < STREAMING_MAX_DKIM_PREFETCH) {
+		pos = rspamd_substring_search_caseless (p, end - p, dkim_hdr,
+				sizeof (dkim_hdr) - 1);
+
+		if (pos == -1) {
+			break;
+		}
+
+		p += pos;
+
+		if (p != begin && p[-1] != '\n') {
+			/* Not at the beginning of a line */
+			p += sizeof (dkim_hdr) - 1;
+			continue;
+		}
+
+		p += sizeof (dkim_hdr) - 1;
+		hend = p;
+
+		/* Find the end of a folded header */
+		while (hend < end) {
+			if (*hend == '\n' && (hend + 1 >= end ||
+					(hend[1] != ' ' && hend[1] != '\t'))) {
+				break;
+			}
+
+			hend ++;
+		}
+
+		if (rspamd_worker_dkim_tag (p, hend, 'd', &dom) &&
+				rspamd_worker_dkim_tag (p, hend, 's', &sel)) {
+			name = rspamd_mempool_alloc (task->task_pool,
+					sel.len + dom.len + sizeof ("._domainkey."));
+			rspamd_snprintf (name, sel.len + dom.len + sizeof ("._domainkey."),
+					"%T._domainkey.%T", &sel, &dom);
+			rspamd_worker_prefetch (task, RDNS_REQUEST_TXT, name);
+			nsigs ++;
+		}
+
+		p = hend;
+	}
+}
+
+/*
+ * Called for each portion of the unencrypted body in streaming mode
+ */
+static void
+rspamd_worker_stream_chunk (struct rspamd_task *task,
+		struct rspamd_http_message *msg)
+{
+	GString str;
+	goffset hdr_pos;
+
+	if (task->flags & RSPAMD_TASK_FLAG_HEADERS_PREFETCHED) {
+		return;
+	}
+
+	str.str = msg->body->str;
+	str.len = msg->body->len;
+	hdr_pos = rspamd_string_find_eoh (&str);
+
+	if (hdr_pos > 0 && (gsize)hdr_pos < str.len) {
+		task->flags |= RSPAMD_TASK_FLAG_HEADERS_PREFETCHED;
+		rspamd_worker_prefetch_envelope (task, msg);
+		rspamd_worker_prefetch_dkim (task, str.str, hdr_pos);
+	}
+	else if (str.len > STREAMING_MAX_HEADERS_SIZE) {
+		/* Give up */
+		task->flags |= RSPAMD_TASK_FLAG_HEADERS_PREFETCHED;
+	}
+}
+
+static gint
+rspamd_worker_body_handler (struct rspamd_http_connection *conn,
+	struct rspamd_http_message *msg,
+	const gchar *chunk, gsize len)
+{
+	struct rspamd_task *task = (struct rspamd_task *) conn->ud;
+
+	if ((conn->opts & RSPAMD_HTTP_BODY_PARTIAL) &&
+			!rspamd_http_connection_is_encrypted (conn)) {
+		/* Message is still being received */
+		rspamd_worker_stream_chunk (task, msg);
+
+		return 0;
+	}
+
+	rspamd_worker_start_task (task, msg, chunk, len);
 
 	return 0;
 }
@@ -237,6 +460,13 @@ rspamd_worker_finish_handler (struct rspamd_http_connection *conn,
 {
 	struct rspamd_task *task = (struct rspamd_task *) conn->ud;
 
+	if ((conn->opts & RSPAMD_HTTP_BODY_PARTIAL) && task->processed_stages == 0 &&
+			!(task->flags & RSPAMD_TASK_FLAG_PROCESSING)) {
+		/* Streaming mode: the whole message has been received */
+		rspamd_worker_start_task (task, msg, msg->body_buf.begin,
+				msg->body_buf.len);
+	}
+
 	if (task->processed_stages & RSPAMD_TASK_STAGE_REPLIED) {
 		/* We are done here */
 		msg_debug_task ("normally closing connection from: %s",
@@ -298,7 +528,7 @@ accept_socket (gint fd, short what, void *arg)
 	task->sock = nfd;
 	task->client_addr = addr;
 
-	worker->srv->stat->connections_count++;
+	rspamd_atomic_add (&worker->srv->stat->connections_count, 1);
 	task->resolver = ctx->resolver;
 	/* TODO: allow to disable autolearn in protocol */
 	task->flags |= RSPAMD_TASK_FLAG_LEARN_AUTO;
@@ -307,7 +537,7 @@ accept_socket (gint fd, short what, void *arg)
 		rspamd_worker_body_handler,
 		rspamd_worker_error_handler,
 		rspamd_worker_finish_handler,
-		0,
+		ctx->streaming ? RSPAMD_HTTP_BODY_PARTIAL : 0,
 		RSPAMD_HTTP_SERVER,
 		ctx->keys_cache);
 	task->ev_base = ctx->ev_base;
@@ -454,6 +684,16 @@ init_worker (struct rspamd_config *cfg)
 			0,
 			"Encryption keypair");
 
+	rspamd_rcl_register_worker_option (cfg,
+			type,
+			"streaming",
+			rspamd_rcl_parse_struct_boolean,
+			ctx,
+			G_STRUCT_OFFSET (struct rspamd_worker_ctx, streaming),
+			0,
+			"Start DNS lookups for the envelope and DKIM signatures as soon as "
+			"message headers are received");
+
 	return ctx;
 }
 
@@ -8,6 +8,8 @@ context("Base64 encodning", function()
     char * rspamd_encode_base64 (const unsigned char *in, size_t inlen, 
       size_t str_len, size_t *outlen);
     void g_free(void *ptr);
+    int rspamd_cryptobox_base64_decode (const char *in, size_t inlen,
+      unsigned char *out, size_t *outlen);
     int memcmp(const void *a1, const void *a2, size_t len);
   ]]
   
@@ -109,4 +111,21 @@ vehemence of any carnal pleasure.]]
       assert_equal(cmp, 0, "fuzz test failed for length: " .. tostring(l))
     end
   end)
+  test("Base64 fuzz test (optimized decoder)", function()
+    for i = 1,1000 do
+      local b, l = random_buf(4096)
+      local nl = ffi.new("size_t [1]")
+      local lim = ffi.C.ottery_rand_unsigned() % 64 + 10
+      local ben = ffi.C.rspamd_encode_base64(b, l, lim, nl)
+      local nb = ffi.new("unsigned char[?]", l + 3)
+      local ol = ffi.new("size_t [1]", l + 3)
+      local res = ffi.C.rspamd_cryptobox_base64_decode(ben, nl[0], nb, ol)
+
+      local cmp = ffi.C.memcmp(b, nb, l)
+      ffi.C.g_free(ben)
+      assert_true(res ~= 0, "decode failed for length: " .. tostring(l))
+      assert_equal(tonumber(ol[0]), l, "bad decoded length: " .. tostring(l))
+      assert_equal(cmp, 0, "fuzz test failed for length: " .. tostring(l))
+    end
+  end)
 end)
\ No newline at end of file
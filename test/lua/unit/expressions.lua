@@ -87,6 +87,9 @@ context("Rspamd expressions", function()
        {'F && ((A + B + C + D) > 1)', 0},
        {'(E) && ((B + B + B + B) >= 1)', 0},
        {'!!C', 1},
+       {'A + B >= 2', 0},
+       {'B + A + C >= 2', 1},
+       {'(A & C) + (E | F) + !B > 2', 1},
     }
     for _,c in ipairs(cases) do
       local expr,err = rspamd_expression.create(c[1],
@@ -24,6 +24,7 @@
 static const int mapping_size = 64 * 8192 + 1;
 static const int max_seg = 32;
 static const int random_fuzz_cnt = 10000;
+#define BATCH_CNT 37
 enum rspamd_cryptobox_mode mode = RSPAMD_CRYPTOBOX_MODE_25519;
 
 static void *
@@ -164,6 +165,10 @@ rspamd_cryptobox_test_func (void)
 	double t1, t2;
 	gint i, cnt, ms;
 	gboolean checked_openssl = FALSE;
+	struct rspamd_cryptobox_batch_elt batch[BATCH_CNT];
+	rspamd_nm_t batch_keys[BATCH_CNT];
+	rspamd_nonce_t batch_nonces[BATCH_CNT];
+	rspamd_mac_t batch_macs[BATCH_CNT];
 
 	map = create_mapping (mapping_size, &begin, &end);
 
@@ -300,6 +305,35 @@ start:
 
 	msg_info ("constrainted split of %d chunks encryption: %.6f", cnt, t2 - t1);
 
+	/* Batch of short independent messages */
+	for (i = 0; i < BATCH_CNT; i ++) {
+		ottery_rand_bytes (batch_keys[i], sizeof (batch_keys[i]));
+		ottery_rand_bytes (batch_nonces[i], sizeof (batch_nonces[i]));
+		batch[i].data = begin + i * 128;
+		batch[i].len = ottery_rand_range (127) + 1;
+		batch[i].nonce = batch_nonces[i];
+		batch[i].nm = batch_keys[i];
+		batch[i].mac = batch_macs[i];
+	}
+
+	t1 = rspamd_get_ticks ();
+	rspamd_cryptobox_encrypt_nm_batch (batch, BATCH_CNT, mode);
+	t2 = rspamd_get_ticks ();
+
+	for (i = 0; i < BATCH_CNT; i ++) {
+		check_result (batch_keys[i], batch_nonces[i], batch_macs[i],
+				batch[i].data, batch[i].data + batch[i].len);
+	}
+
+	msg_info ("batch of %d messages encryption: %.6f", BATCH_CNT, t2 - t1);
+
+	rspamd_cryptobox_encrypt_nm_batch (batch, BATCH_CNT, mode);
+	batch_macs[BATCH_CNT / 2][0] ^= 0xff;
+	g_assert (rspamd_cryptobox_decrypt_nm_batch (batch, BATCH_CNT, mode) ==
+			BATCH_CNT - 1);
+	g_assert (!batch[BATCH_CNT / 2].ok);
+	memset (batch[BATCH_CNT / 2].data, 0, batch[BATCH_CNT / 2].len);
+
 	for (i = 0; i < random_fuzz_cnt; i ++) {
 		ms = ottery_rand_range (i % max_seg * 2) + 1;
 		cnt = create_random_split (seg, ms, begin, end);
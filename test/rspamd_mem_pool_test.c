@@ -1,5 +1,6 @@
 #include "config.h"
 #include "mem_pool.h"
+#include "hash.h"
 #include "tests.h"
 #include "unix-std.h"
 #include <math.h>
@@ -16,9 +17,14 @@ rspamd_mem_pool_test_func ()
 {
 	rspamd_mempool_t *pool;
 	rspamd_mempool_stat_t st;
+	rspamd_mempool_slots_t *slots;
+	rspamd_mempool_ptr_array_t *ar;
+	rspamd_mempool_hash_t *hash;
+	GList *list;
+	guint *cnt;
 	char *tmp, *tmp2, *tmp3;
 	pid_t pid;
-	int ret;
+	int ret, i;
 
 	pool = rspamd_mempool_new (sizeof (TEST_BUF), NULL);
 	tmp = rspamd_mempool_alloc (pool, sizeof (TEST_BUF));
@@ -35,5 +41,77 @@ rspamd_mem_pool_test_func ()
 	
 	rspamd_mempool_delete (pool);
 	rspamd_mempool_stat (&st);
-	
+
+	/* Pages of tagged pools grow according to the previous usage */
+	pool = rspamd_mempool_new (4096, "test");
+	for (i = 0; i < 64; i ++) {
+		tmp = rspamd_mempool_alloc (pool, 1024);
+		memset (tmp, 'a', 1024);
+	}
+	rspamd_mempool_delete (pool);
+
+	pool = rspamd_mempool_new (4096, "test");
+	g_assert (pool->elt_len >= 64 * 1024);
+	tmp = rspamd_mempool_alloc (pool, 32 * 1024);
+	g_assert (pool->pools[RSPAMD_MEMPOOL_NORMAL]->len == 1);
+	rspamd_mempool_delete (pool);
+
+	/* Each process updates its own slot */
+	pool = rspamd_mempool_new (rspamd_mempool_suggest_size (), NULL);
+	slots = rspamd_mempool_slots_new (pool, sizeof (guint), 4);
+	g_assert (slots->slot_size == MEMPOOL_CACHE_LINE);
+
+	for (i = 0; i < 2; i ++) {
+		pid = fork ();
+
+		if (pid == 0) {
+			cnt = rspamd_mempool_slots_claim (slots, getpid ());
+			g_assert (cnt != rspamd_mempool_slot (slots, 0));
+			rspamd_atomic_add (cnt, 100);
+			exit (EXIT_SUCCESS);
+		}
+
+		g_assert (pid != -1);
+		g_assert (waitpid (pid, &ret, 0) == pid);
+		g_assert (WIFEXITED (ret) && WEXITSTATUS (ret) == 0);
+		/* Counters survive slot release */
+		rspamd_mempool_slots_release (slots, pid);
+	}
+
+	for (i = 0, ret = 0; i < (gint)slots->nslots; i ++) {
+		ret += *(guint *)rspamd_mempool_slot (slots, i);
+	}
+
+	g_assert (ret == 200);
+	rspamd_mempool_delete (pool);
+
+	/* Containers allocated from pool */
+	pool = rspamd_mempool_new (rspamd_mempool_suggest_size (), NULL);
+	ar = rspamd_mempool_ptr_array_new (pool, 1);
+	hash = rspamd_mempool_hash_new (pool, g_direct_hash, g_direct_equal, 0);
+	list = NULL;
+
+	for (i = 0; i < 100; i ++) {
+		rspamd_mempool_ptr_array_add (ar, GINT_TO_POINTER (i));
+		rspamd_mempool_hash_insert (hash, GINT_TO_POINTER (i + 1),
+				GINT_TO_POINTER (i));
+		list = rspamd_mempool_glist_prepend (pool, list, GINT_TO_POINTER (i));
+	}
+
+	rspamd_mempool_hash_insert (hash, GINT_TO_POINTER (1), GINT_TO_POINTER (42));
+	g_assert (ar->len == 100);
+	g_assert (rspamd_mempool_hash_size (hash) == 100);
+	g_assert (g_list_length (list) == 100);
+
+	for (i = 0; i < 100; i ++) {
+		g_assert (GPOINTER_TO_INT (g_ptr_array_index (ar, i)) == i);
+	}
+
+	g_assert (GPOINTER_TO_INT (rspamd_mempool_hash_lookup (hash,
+			GINT_TO_POINTER (1))) == 42);
+	g_assert (GPOINTER_TO_INT (rspamd_mempool_hash_lookup (hash,
+			GINT_TO_POINTER (100))) == 99);
+	g_assert (rspamd_mempool_hash_lookup (hash, GINT_TO_POINTER (101)) == NULL);
+	g_assert (GPOINTER_TO_INT (list->data) == 99);
+	rspamd_mempool_delete (pool);
 }
@@ -0,0 +1,253 @@
+#include "config.h"
+#include "rspamd.h"
+#include "task.h"
+#include "message.h"
+#include "mime_parser.h"
+#include "tests.h"
+
+/* Nested multiparts, inner boundary has the outer one as a prefix */
+static const gchar nested_msg[] =
+		"Content-Type: multipart/mixed; boundary=\"outer\"\r\n"
+		"\r\n"
+		"This is a preamble\r\n"
+		"--outer\r\n"
+		"Content-Type: multipart/alternative; boundary=\"outer_inner\"\r\n"
+		"\r\n"
+		"--outer_inner\r\n"
+		"Content-Type: text/plain\r\n"
+		"\r\n"
+		"plain text\r\n"
+		"--outer_inner\r\n"
+		"Content-Type: text/html\r\n"
+		"\r\n"
+		"<b>html</b>\r\n"
+		"--outer_inner--\r\n"
+		"\r\n"
+		"--outer\r\n"
+		"Content-Type: application/octet-stream\r\n"
+		"Content-Transfer-Encoding: base64\r\n"
+		"Content-Disposition: attachment; filename=\"a.bin\"\r\n"
+		"\r\n"
+		"aGVsbG8gd29ybGQ=\r\n"
+		"--outer\r\n"
+		"Content-Type: text/plain; charset=utf-8\r\n"
+		"Content-Transfer-Encoding: quoted-printable\r\n"
+		"\r\n"
+		"soft=\r\n"
+		" break =3D ok\r\n"
+		"--outer--\r\n"
+		"This is an epilogue\r\n";
+
+/* No closing delimiter, the last part lasts until the end of message */
+static const gchar unclosed_msg[] =
+		"Content-Type: multipart/mixed; boundary=\"b1\"\r\n"
+		"\r\n"
+		"--b1\r\n"
+		"Content-Type: text/plain\r\n"
+		"\r\n"
+		"first\r\n"
+		"--b1x is not a delimiter\r\n"
+		"--b1 \r\n"
+		"Content-Type: text/plain\r\n"
+		"\r\n"
+		"last part without end\r\n";
+
+/* Part without headers, its body has an empty line */
+static const gchar headerless_msg[] =
+		"Content-Type: multipart/mixed; boundary=\"b\"\r\n"
+		"\r\n"
+		"--b\r\n"
+		"\r\n"
+		"line1\r\n"
+		"\r\n"
+		"line2\r\n"
+		"--b--\r\n";
+
+static const gchar rfc822_msg[] =
+		"Content-Type: multipart/mixed; boundary=\"m\"\r\n"
+		"\r\n"
+		"--m\r\n"
+		"Content-Type: text/plain\r\n"
+		"\r\n"
+		"body\r\n"
+		"--m\r\n"
+		"Content-Type: message/rfc822\r\n"
+		"\r\n"
+		"Subject: inner\r\n"
+		"Content-Type: text/plain\r\n"
+		"\r\n"
+		"inner body\r\n"
+		"--m--\r\n";
+
+static const struct {
+	const gchar *in;
+	const gchar *out;
+} qp_cases[] = {
+	{"a=3Db", "a=b"},
+	{"=41=42=43", "ABC"},
+	{"soft=\r\nbreak", "softbreak"},
+	{"soft=\nbreak", "softbreak"},
+	{"soft= \t\r\nbreak", "softbreak"},
+	{"end=", "end"},
+	{"end= ", "end"},
+	{"bad=ZZ", "bad=ZZ"},
+	{"short=4", "short=4"},
+	{"", ""},
+};
+
+static void
+rspamd_mime_parser_check_content (struct mime_part *part, const gchar *str)
+{
+	GByteArray *content;
+
+	content = rspamd_mime_part_get_content (part);
+	g_assert (content != NULL);
+	g_assert (content->len == strlen (str));
+	g_assert (memcmp (content->data, str, content->len) == 0);
+}
+
+static struct mime_part *
+rspamd_mime_parser_get_part (struct rspamd_task *task, guint i)
+{
+	g_assert (i < task->parts->len);
+
+	return g_ptr_array_index (task->parts, i);
+}
+
+static void
+rspamd_mime_parser_test_nested (struct rspamd_config *cfg)
+{
+	struct rspamd_task *task;
+	struct mime_part *part;
+
+	task = rspamd_task_new (NULL, cfg);
+	g_assert (rspamd_mime_parse_task (task, nested_msg,
+			sizeof (nested_msg) - 1) == 6);
+	g_assert (task->parts->len == 6);
+
+	part = rspamd_mime_parser_get_part (task, 0);
+	g_assert (g_mime_content_type_is_type (part->type, "multipart", "mixed"));
+	g_assert (part->parent == NULL);
+
+	part = rspamd_mime_parser_get_part (task, 1);
+	g_assert (g_mime_content_type_is_type (part->type, "multipart",
+			"alternative"));
+	g_assert (part->parent == rspamd_mime_parser_get_part (task, 0));
+
+	part = rspamd_mime_parser_get_part (task, 2);
+	g_assert (g_mime_content_type_is_type (part->type, "text", "plain"));
+	g_assert (part->parent == rspamd_mime_parser_get_part (task, 1));
+	rspamd_mime_parser_check_content (part, "plain text");
+
+	part = rspamd_mime_parser_get_part (task, 3);
+	g_assert (g_mime_content_type_is_type (part->type, "text", "html"));
+	rspamd_mime_parser_check_content (part, "<b>html</b>");
+
+	part = rspamd_mime_parser_get_part (task, 4);
+	g_assert (g_mime_content_type_is_type (part->type, "application",
+			"octet-stream"));
+	g_assert (part->parent == rspamd_mime_parser_get_part (task, 0));
+	g_assert (part->filename != NULL);
+	g_assert_cmpstr (part->filename, ==, "a.bin");
+	rspamd_mime_parser_check_content (part, "hello world");
+
+	/* Epilogue must not be a part of the last part */
+	part = rspamd_mime_parser_get_part (task, 5);
+	g_assert (g_mime_content_type_is_type (part->type, "text", "plain"));
+	rspamd_mime_parser_check_content (part, "soft break = ok");
+
+	rspamd_task_free (task);
+}
+
+static void
+rspamd_mime_parser_test_unclosed (struct rspamd_config *cfg)
+{
+	struct rspamd_task *task;
+	struct mime_part *part;
+
+	task = rspamd_task_new (NULL, cfg);
+	g_assert (rspamd_mime_parse_task (task, unclosed_msg,
+			sizeof (unclosed_msg) - 1) == 3);
+
+	part = rspamd_mime_parser_get_part (task, 1);
+	rspamd_mime_parser_check_content (part,
+			"first\r\n--b1x is not a delimiter");
+
+	part = rspamd_mime_parser_get_part (task, 2);
+	rspamd_mime_parser_check_content (part, "last part without end\r\n");
+
+	rspamd_task_free (task);
+}
+
+static void
+rspamd_mime_parser_test_headerless (struct rspamd_config *cfg)
+{
+	struct rspamd_task *task;
+	struct mime_part *part;
+
+	task = rspamd_task_new (NULL, cfg);
+	g_assert (rspamd_mime_parse_task (task, headerless_msg,
+			sizeof (headerless_msg) - 1) == 2);
+
+	part = rspamd_mime_parser_get_part (task, 1);
+	g_assert (g_mime_content_type_is_type (part->type, "text", "plain"));
+	rspamd_mime_parser_check_content (part, "line1\r\n\r\nline2");
+
+	rspamd_task_free (task);
+}
+
+static void
+rspamd_mime_parser_test_rfc822 (struct rspamd_config *cfg)
+{
+	struct rspamd_task *task;
+	struct mime_part *part;
+
+	task = rspamd_task_new (NULL, cfg);
+	/* Container of the attached message is not a part itself */
+	g_assert (rspamd_mime_parse_task (task, rfc822_msg,
+			sizeof (rfc822_msg) - 1) == 3);
+
+	part = rspamd_mime_parser_get_part (task, 1);
+	rspamd_mime_parser_check_content (part, "body");
+
+	part = rspamd_mime_parser_get_part (task, 2);
+	g_assert (g_mime_content_type_is_type (part->type, "text", "plain"));
+	g_assert (part->parent == rspamd_mime_parser_get_part (task, 0));
+	rspamd_mime_parser_check_content (part, "inner body");
+
+	rspamd_task_free (task);
+}
+
+static void
+rspamd_mime_parser_test_qp (void)
+{
+	gchar out[64];
+	gssize olen;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (qp_cases); i ++) {
+		olen = rspamd_decode_qp_buf (qp_cases[i].in, strlen (qp_cases[i].in),
+				out, sizeof (out));
+		g_assert (olen == (gssize)strlen (qp_cases[i].out));
+		g_assert (memcmp (out, qp_cases[i].out, olen) == 0);
+	}
+
+	/* Output buffer is too small */
+	g_assert (rspamd_decode_qp_buf ("abcdef", 6, out, 3) == -1);
+}
+
+void
+rspamd_mime_parser_test_func (void)
+{
+	struct rspamd_config *cfg;
+
+	cfg = rspamd_config_new ();
+
+	rspamd_mime_parser_test_nested (cfg);
+	rspamd_mime_parser_test_unclosed (cfg);
+	rspamd_mime_parser_test_headerless (cfg);
+	rspamd_mime_parser_test_rfc822 (cfg);
+	rspamd_mime_parser_test_qp ();
+
+	REF_RELEASE (cfg);
+}
@@ -0,0 +1,49 @@
+#include "config.h"
+#include "rspamd.h"
+#include "re_cache.h"
+#include "tests.h"
+
+static const struct {
+	const gchar *pattern;
+	const gchar *literal;
+} literal_cases[] = {
+	{"hello world", "hello world"},
+	{"Foo\\d+Barbaz", "barbaz"},
+	{"abc\\dxyzzy", "xyzzy"},
+	{"[]x]hello", "hello"},
+	/* POSIX classes inside brackets are single tokens */
+	{"[[:digit:]]abc", "abc"},
+	{"[[:digit:]x]abcd", "abcd"},
+	{"foo[[:alpha:]]barbaz", "barbaz"},
+	{"[[.a.]]xyzw", "xyzw"},
+	{"[[=e=]]xyzw", "xyzw"},
+	/* Unterminated POSIX class */
+	{"[[:digit:]abc", NULL},
+	/* No required literal */
+	{"hello|world", NULL},
+	{"(?x)abcd", NULL},
+	{"ab", NULL},
+};
+
+void
+rspamd_re_cache_test_func (void)
+{
+	gchar *lit;
+	gsize len;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (literal_cases); i ++) {
+		lit = rspamd_re_cache_extract_literal (literal_cases[i].pattern, 0,
+				&len);
+
+		if (literal_cases[i].literal == NULL) {
+			g_assert (lit == NULL);
+		}
+		else {
+			g_assert (lit != NULL);
+			g_assert_cmpstr (lit, ==, literal_cases[i].literal);
+			g_assert (len == strlen (literal_cases[i].literal));
+			g_free (lit);
+		}
+	}
+}
@@ -0,0 +1,97 @@
+#include "config.h"
+#include "rspamd.h"
+#include "message.h"
+#include "tests.h"
+
+static const struct {
+	const gchar *value;
+	enum rspamd_received_type type;
+	gint flags;
+} received_cases[] = {
+	/* Postfix */
+	{"from mail.example.com (mail.example.com [192.0.2.1]) "
+			"(using TLSv1.2 with cipher ECDHE-RSA-AES256-GCM-SHA384 "
+			"(256/256 bits)) (No client certificate requested) "
+			"by mx.example.org (Postfix) with ESMTP id 3F2A1C0A1B; "
+			"Mon, 1 Jan 2018 10:00:00 +0000",
+			RSPAMD_RECEIVED_ESMTP, RSPAMD_RECEIVED_FLAG_SSL},
+	{"from mail.example.com (mail.example.com [192.0.2.1]) "
+			"(using tlsv1.3 with cipher TLS_AES_256_GCM_SHA384 "
+			"(256/256 bits)) by mx.example.org (Postfix) with ESMTP id 3F2A1; "
+			"Mon, 1 Jan 2018 10:00:00 +0000",
+			RSPAMD_RECEIVED_ESMTP, RSPAMD_RECEIVED_FLAG_SSL},
+	{"from SSL-gw.example.com (SSL-gw.example.com [192.0.2.2]) "
+			"by mx.example.org (Postfix) with ESMTP id 1A2B3C; "
+			"Mon, 1 Jan 2018 10:00:00 +0000",
+			RSPAMD_RECEIVED_ESMTP, 0},
+	{"from ssl.example.com (ssl.example.com [192.0.2.2]) "
+			"by mx.example.org (Postfix) with SMTP id 1A2B3C; "
+			"Mon, 1 Jan 2018 10:00:00 +0000",
+			RSPAMD_RECEIVED_SMTP, 0},
+	/* Exim */
+	{"from [192.0.2.3] (port=51234 helo=client.example.com) "
+			"by mx.example.org with esmtpsa (TLS1.2) "
+			"tls TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384 (Exim 4.90_1) "
+			"(envelope-from <a@example.com>) id 1eXyZa-0001Bc-De; "
+			"Mon, 01 Jan 2018 10:00:00 +0000",
+			RSPAMD_RECEIVED_ESMTP,
+			RSPAMD_RECEIVED_FLAG_SSL|RSPAMD_RECEIVED_FLAG_AUTHENTICATED},
+	{"from tls.example.com ([192.0.2.3]) by mx.example.org with esmtp "
+			"(Exim 4.90_1) (envelope-from <a@example.com>) "
+			"id 1eXyZa-0001Bc-De; Mon, 01 Jan 2018 10:00:00 +0000",
+			RSPAMD_RECEIVED_ESMTP, 0},
+	/* Sendmail */
+	{"from client.example.com (client.example.com [192.0.2.4]) "
+			"by mx.example.org (8.15.2/8.15.2) with ESMTP id w01A0Abc012345 "
+			"(version=TLSv1.2 cipher=ECDHE-RSA-AES256-GCM-SHA384 bits=256 "
+			"verify=NO) for <u@example.org>; Mon, 1 Jan 2018 10:00:00 +0000",
+			RSPAMD_RECEIVED_ESMTP, RSPAMD_RECEIVED_FLAG_SSL},
+	{"from client.example.com (client.example.com [192.0.2.4]) "
+			"by mx.example.org (8.15.2/8.15.2) with ESMTP id w01A0Abc012345 "
+			"for <u@example.org>; Mon, 1 Jan 2018 10:00:00 +0000",
+			RSPAMD_RECEIVED_ESMTP, 0},
+	/* qmail */
+	{"(qmail 12345 invoked from network [192.0.2.5/client.example.com]); "
+			"1 Jan 2018 10:00:00 -0000",
+			RSPAMD_RECEIVED_UNKNOWN, 0},
+	{"from unknown (HELO client.example.com) (192.0.2.6) "
+			"by mx.example.org with ESMTPS; 1 Jan 2018 10:00:00 -0000",
+			RSPAMD_RECEIVED_ESMTP, RSPAMD_RECEIVED_FLAG_SSL},
+	{"from unknown (HELO ssl) (192.0.2.6) "
+			"by mx.example.org with SMTP; 1 Jan 2018 10:00:00 -0000",
+			RSPAMD_RECEIVED_SMTP, 0},
+};
+
+void
+rspamd_received_test_func (void)
+{
+	rspamd_mempool_t *pool;
+	struct raw_header rh;
+	struct received_header r;
+	guint i;
+
+	pool = rspamd_mempool_new (rspamd_mempool_suggest_size (), NULL);
+
+	for (i = 0; i < G_N_ELEMENTS (received_cases); i ++) {
+		memset (&rh, 0, sizeof (rh));
+		memset (&r, 0, sizeof (r));
+		rh.decoded = (gchar *)received_cases[i].value;
+		rh.decoded_len = strlen (rh.decoded);
+
+		rspamd_message_parse_received (pool, &rh, &r);
+
+		g_assert (r.type == received_cases[i].type);
+		g_assert (r.flags == received_cases[i].flags);
+		g_assert (r.timestamp != 0);
+	}
+
+	/* qmail from network format */
+	memset (&rh, 0, sizeof (rh));
+	memset (&r, 0, sizeof (r));
+	rh.decoded = (gchar *)received_cases[8].value;
+	rspamd_message_parse_received (pool, &rh, &r);
+	g_assert_cmpstr (r.real_ip, ==, "192.0.2.5");
+	g_assert_cmpstr (r.real_hostname, ==, "client.example.com");
+
+	rspamd_mempool_delete (pool);
+}
@@ -54,6 +54,10 @@ main (int argc, char **argv)
 	g_test_add_func ("/rspamd/lua", rspamd_lua_test_func);
 	g_test_add_func ("/rspamd/crypto", rspamd_cryptobox_test_func);
 	g_test_add_func ("/rspamd/cryptobox", rspamd_cryptobox_test_func);
+	g_test_add_func ("/rspamd/re_cache", rspamd_re_cache_test_func);
+	g_test_add_func ("/rspamd/mime_parser", rspamd_mime_parser_test_func);
+	g_test_add_func ("/rspamd/url_set", rspamd_url_set_test_func);
+	g_test_add_func ("/rspamd/received", rspamd_received_test_func);
 
 	g_test_run ();
 
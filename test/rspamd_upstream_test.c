@@ -59,7 +59,7 @@ rspamd_upstream_test_func (void)
 	struct rspamd_config *cfg;
 	gint i, success = 0;
 	const gint assumptions = 100500;
-	gdouble p;
+	gdouble p, tokens[200];
 	struct event ev;
 	struct timeval tv;
 	rspamd_inet_addr_t *addr, *next_addr, *paddr;
@@ -157,6 +157,70 @@ rspamd_upstream_test_func (void)
 
 	rspamd_upstreams_destroy (nls);
 
+	/* Test latency based rotation */
+	nls = rspamd_upstreams_create (cfg->ups_ctx);
+	g_assert (rspamd_upstreams_parse_line (nls,
+			"latency:127.0.0.1,127.0.0.2,127.0.0.3", 443, NULL));
+	for (i = 0; i < 3; i ++) {
+		up = rspamd_upstream_get (nls, RSPAMD_UPSTREAM_RANDOM, NULL, 0);
+		rspamd_upstream_latency (up,
+				strcmp (rspamd_upstream_name (up), "127.0.0.1") == 0 ?
+				0.001 : 0.1);
+		rspamd_upstream_ok (up);
+	}
+
+	success = 0;
+	for (i = 0; i < 1000; i ++) {
+		up = rspamd_upstream_get (nls, RSPAMD_UPSTREAM_RANDOM, NULL, 0);
+
+		if (strcmp (rspamd_upstream_name (up), "127.0.0.1") == 0) {
+			success ++;
+			rspamd_upstream_latency (up, 0.001);
+		}
+		else {
+			rspamd_upstream_latency (up, 0.1);
+		}
+
+		rspamd_upstream_ok (up);
+	}
+	/* The fastest upstream wins every pair it appears in: p = 2/3 */
+	g_assert (success > 500);
+
+	/* Requests in flight make the fastest upstream less attractive */
+	do {
+		up = rspamd_upstream_get (nls, RSPAMD_UPSTREAM_RANDOM, NULL, 0);
+	} while (strcmp (rspamd_upstream_name (up), "127.0.0.1") != 0);
+
+	for (i = 0; i < G_N_ELEMENTS (tokens); i ++) {
+		tokens[i] = rspamd_upstream_start (up);
+		g_assert (tokens[i] != 0);
+	}
+
+	success = 0;
+	for (i = 0; i < 1000; i ++) {
+		if (strcmp (rspamd_upstream_name (rspamd_upstream_get (nls,
+				RSPAMD_UPSTREAM_RANDOM, NULL, 0)), "127.0.0.1") == 0) {
+			success ++;
+		}
+	}
+	g_assert (success < 500);
+
+	/* Each request is released only once */
+	for (i = 0; i < G_N_ELEMENTS (tokens); i ++) {
+		rspamd_upstream_finish (up, &tokens[i], TRUE);
+		g_assert (tokens[i] == 0);
+		rspamd_upstream_finish (up, &tokens[i], FALSE);
+	}
+
+	success = 0;
+	for (i = 0; i < 1000; i ++) {
+		if (strcmp (rspamd_upstream_name (rspamd_upstream_get (nls,
+				RSPAMD_UPSTREAM_RANDOM, NULL, 0)), "127.0.0.1") == 0) {
+			success ++;
+		}
+	}
+	g_assert (success > 500);
+	rspamd_upstreams_destroy (nls);
 
 	/* Upstream fail test */
 	evtimer_set (&ev, rspamd_upstream_timeout_handler, resolver);
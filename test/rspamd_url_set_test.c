@@ -0,0 +1,164 @@
+#include "config.h"
+#include "rspamd.h"
+#include "url.h"
+#include "tests.h"
+
+static struct rspamd_url *
+rspamd_url_set_test_url (rspamd_mempool_t *pool, const gchar *str,
+		enum rspamd_url_flags flags)
+{
+	struct rspamd_url *url;
+	const gchar *at;
+
+	url = rspamd_mempool_alloc0 (pool, sizeof (*url));
+	url->string = rspamd_mempool_strdup (pool, str);
+	url->urllen = strlen (str);
+	url->flags = flags;
+
+	at = strchr (url->string, '@');
+
+	if (at != NULL) {
+		url->user = url->string;
+		url->userlen = at - url->string;
+		url->host = (gchar *)at + 1;
+		url->hostlen = strlen (at + 1);
+	}
+	else {
+		url->host = url->string;
+		url->hostlen = url->urllen;
+	}
+
+	return url;
+}
+
+static void
+rspamd_url_set_test_dedup (rspamd_mempool_t *pool)
+{
+	struct rspamd_url_set *set;
+	struct rspamd_url *u1, *u2, *u3;
+
+	set = rspamd_url_set_new (pool, FALSE);
+	u1 = rspamd_url_set_test_url (pool, "http://example.com/", 0);
+	u2 = rspamd_url_set_test_url (pool, "http://example.com/", 0);
+	u3 = rspamd_url_set_test_url (pool, "http://example.org/", 0);
+
+	g_assert (rspamd_url_set_lookup (set, u1) == NULL);
+	g_assert (rspamd_url_set_add (set, u1));
+	g_assert (!rspamd_url_set_add (set, u2));
+	g_assert (rspamd_url_set_add (set, u3));
+	g_assert (rspamd_url_set_size (set) == 2);
+	g_assert (rspamd_url_set_lookup (set, u2) == u1);
+	g_assert (rspamd_url_set_index (set, 0) == u1);
+	g_assert (rspamd_url_set_index (set, 1) == u3);
+}
+
+static void
+rspamd_url_set_test_replace (rspamd_mempool_t *pool)
+{
+	struct rspamd_url_set *set;
+	struct rspamd_url *u1, *u2, *u3, *nu2, *u4;
+
+	set = rspamd_url_set_new (pool, FALSE);
+	u1 = rspamd_url_set_test_url (pool, "http://a.example.com/", 0);
+	u2 = rspamd_url_set_test_url (pool, "http://b.example.com/", 0);
+	u3 = rspamd_url_set_test_url (pool, "http://c.example.com/", 0);
+	nu2 = rspamd_url_set_test_url (pool, "http://b.example.com/", 0);
+	u4 = rspamd_url_set_test_url (pool, "http://d.example.com/", 0);
+
+	rspamd_url_set_add (set, u1);
+	rspamd_url_set_add (set, u2);
+	rspamd_url_set_add (set, u3);
+
+	/* Replaced url keeps its position */
+	rspamd_url_set_replace (set, nu2);
+	g_assert (rspamd_url_set_size (set) == 3);
+	g_assert (rspamd_url_set_index (set, 0) == u1);
+	g_assert (rspamd_url_set_index (set, 1) == nu2);
+	g_assert (rspamd_url_set_index (set, 2) == u3);
+	g_assert (rspamd_url_set_lookup (set, u2) == nu2);
+
+	/* New url is appended */
+	rspamd_url_set_replace (set, u4);
+	g_assert (rspamd_url_set_size (set) == 4);
+	g_assert (rspamd_url_set_index (set, 3) == u4);
+}
+
+static void
+rspamd_url_set_test_grow (rspamd_mempool_t *pool)
+{
+	struct rspamd_url_set *set;
+	struct rspamd_url *urls[100], *dup;
+	gchar buf[64];
+	guint i;
+
+	set = rspamd_url_set_new (pool, FALSE);
+
+	/* Initial array size is 16 and index has 32 buckets */
+	for (i = 0; i < G_N_ELEMENTS (urls); i ++) {
+		rspamd_snprintf (buf, sizeof (buf), "http://example.com/%ud", i);
+		urls[i] = rspamd_url_set_test_url (pool, buf, 0);
+		g_assert (rspamd_url_set_add (set, urls[i]));
+		g_assert (rspamd_url_set_size (set) == i + 1);
+		/* Load factor is kept below 1/2 */
+		g_assert (rspamd_url_set_size (set) * 2 <= set->nbuckets);
+	}
+
+	g_assert (set->nbuckets > 32);
+
+	for (i = 0; i < G_N_ELEMENTS (urls); i ++) {
+		rspamd_snprintf (buf, sizeof (buf), "http://example.com/%ud", i);
+		dup = rspamd_url_set_test_url (pool, buf, 0);
+		g_assert (rspamd_url_set_index (set, i) == urls[i]);
+		g_assert (rspamd_url_set_lookup (set, dup) == urls[i]);
+		g_assert (!rspamd_url_set_add (set, dup));
+	}
+
+	g_assert (rspamd_url_set_size (set) == G_N_ELEMENTS (urls));
+}
+
+static void
+rspamd_url_set_test_emails (rspamd_mempool_t *pool)
+{
+	struct rspamd_url_set *emails, *urls;
+	struct rspamd_url *e1, *e2, *h1, *h2, *p1, *p2;
+
+	emails = rspamd_url_set_new (pool, TRUE);
+	urls = rspamd_url_set_new (pool, FALSE);
+	e1 = rspamd_url_set_test_url (pool, "user@example.com", 0);
+	e2 = rspamd_url_set_test_url (pool, "user@example.com", 0);
+	/* No user part */
+	h1 = rspamd_url_set_test_url (pool, "example.com", 0);
+	h2 = rspamd_url_set_test_url (pool, "example.com", 0);
+	p1 = rspamd_url_set_test_url (pool, "http://example.com/", 0);
+	p2 = rspamd_url_set_test_url (pool, "http://example.com/",
+			RSPAMD_URL_FLAG_PHISHED);
+
+	/* Emails are equal if both user and host are equal */
+	g_assert (rspamd_url_set_add (emails, e1));
+	g_assert (!rspamd_url_set_add (emails, e2));
+	g_assert (rspamd_url_set_add (emails, h1));
+	g_assert (rspamd_url_set_add (emails, h2));
+	g_assert (rspamd_url_set_size (emails) == 3);
+
+	/* Urls are equal if both string and flags are equal */
+	g_assert (rspamd_url_set_add (urls, h1));
+	g_assert (!rspamd_url_set_add (urls, h2));
+	g_assert (rspamd_url_set_add (urls, p1));
+	g_assert (rspamd_url_set_add (urls, p2));
+	g_assert (rspamd_url_set_size (urls) == 3);
+}
+
+void
+rspamd_url_set_test_func (void)
+{
+	rspamd_mempool_t *pool;
+
+	pool = rspamd_mempool_new (rspamd_mempool_suggest_size (), NULL);
+
+	rspamd_url_set_test_dedup (pool);
+	rspamd_url_set_test_replace (pool);
+	rspamd_url_set_test_grow (pool);
+	rspamd_url_set_test_emails (pool);
+
+	rspamd_mempool_delete (pool);
+}
@@ -39,4 +39,12 @@ void rspamd_lua_test_func (void);
 
 void rspamd_cryptobox_test_func (void);
 
+void rspamd_re_cache_test_func (void);
+
+void rspamd_mime_parser_test_func (void);
+
+void rspamd_url_set_test_func (void);
+
+void rspamd_received_test_func (void);
+
 #endif